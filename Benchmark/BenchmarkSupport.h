@@ -0,0 +1,74 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __BenchmarkSupport_h
+#define __BenchmarkSupport_h
+
+// Pictures, clocks and statistics shared by the benchmarks
+
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#if !defined(_WIN32)
+  #include <sys/resource.h>
+#endif
+
+// A gradient that moves diagonally, with a bright square crossing it, so
+// that the encoder has motion to search
+inline void FillSyntheticPicture(unsigned char* picture, int width, int height, int index)
+{
+  unsigned char* y = picture;
+  for (int j = 0; j < height; j ++)
+    {
+    for (int i = 0; i < width; i ++)
+      {
+      y[j * width + i] = (unsigned char) ((i + j + 4 * index) & 0xff);
+      }
+    }
+  int size = std::min(width, height) / 8;
+  int x0 = (8 * index) % (width - size + 1);
+  int y0 = (4 * index) % (height - size + 1);
+  for (int j = y0; j < y0 + size; j ++)
+    {
+    memset(y + j * width + x0, 235, size);
+    }
+  unsigned char* u = picture + width * height;
+  unsigned char* v = u + width * height / 4;
+  memset(u, (128 + index) & 0xff, width * height / 4);
+  memset(v, (128 - index) & 0xff, width * height / 4);
+}
+
+inline double CPUTimeInSeconds()
+{
+#if defined(_WIN32)
+  return 0.0;
+#else
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+    + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#endif
+}
+
+// Value at percentile p (0..100) of sorted samples
+inline double Percentile(const std::vector<double>& sorted, double p)
+{
+  if (sorted.empty())
+    {
+    return 0.0;
+    }
+  size_t rank = (size_t) (p / 100.0 * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+#endif // __BenchmarkSupport_h
@@ -0,0 +1,251 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+// Encodes the same synthetic pictures with 1, 2, 4, ... threads up to
+// --threads for each picture size, and reports per size and thread count
+// the pictures per second, the EncodeFrame() latency percentiles and the
+// speed up over one thread as JSON. With the high-resolution profile the
+// slices follow the threads, so each run also shows what the extra
+// slices cost in bits.
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "api/svc/codec_api.h"
+#include "api/svc/codec_app_def.h"
+
+#include "BenchmarkSupport.h"
+#include "MonotonicClock.h"
+#include "EncoderProfiles.h"
+
+#define SCALING_DEFAULT_SIZES   "1280x720,1920x1080,3840x2160"
+#define SCALING_DEFAULT_FRAMES  60
+#define SCALING_WARM_UP_FRAMES  5
+#define SCALING_DEFAULT_PROFILE "high-resolution"
+
+// One size encoded with a number of threads
+typedef struct {
+  int                 threads;
+  int                 slices;
+  double              fps;
+  double              mbps;
+  std::vector<double> ms;   // EncodeFrame() of each measured picture
+} ScalingRun;
+
+// Encodes 'frames' pictures after a few unmeasured ones, which let the
+// rate control and the load balancing settle. Returns false when the
+// encoder can not be created or refuses the settings.
+static bool RunEncoder(const EncoderProfile* profile, int width, int height, int threads, int frames,
+                       std::vector<unsigned char>& picture, ScalingRun& run)
+{
+  ISVCEncoder* encoder_ = NULL;
+  if (WelsCreateSVCEncoder(&encoder_) != 0 || encoder_ == NULL)
+    {
+    return false;
+    }
+  SEncParamExt pEncParamExt;
+  if (!InitializeEncoder(encoder_, profile, width, height, pEncParamExt, threads))
+    {
+    WelsDestroySVCEncoder(encoder_);
+    return false;
+    }
+  run.threads = pEncParamExt.iMultipleThreadIdc;
+  run.slices = pEncParamExt.sSpatialLayers[pEncParamExt.iSpatialLayerNum - 1].sSliceArgument.uiSliceNum;
+
+  SFrameBSInfo info;
+  memset(&info, 0, sizeof(SFrameBSInfo));
+  SSourcePicture pic;
+  memset(&pic, 0, sizeof(SSourcePicture));
+  pic.iPicWidth    = width;
+  pic.iPicHeight   = height;
+  pic.iColorFormat = videoFormatI420;
+  pic.iStride[0]   = width;
+  pic.iStride[1]   = pic.iStride[2] = width >> 1;
+  pic.pData[0]     = &picture[0];
+  pic.pData[1]     = pic.pData[0] + width * height;
+  pic.pData[2]     = pic.pData[1] + (width * height >> 2);
+
+  run.ms.clear();
+  run.ms.reserve(frames);
+  long long bytes = 0;
+  for (int n = 0; n < SCALING_WARM_UP_FRAMES + frames; n ++)
+    {
+    // The same pictures for every run, so that they differ only in threads
+    FillSyntheticPicture(&picture[0], width, height, n);
+    pic.uiTimeStamp = (long long) (n * 1000 / profile->fFrameRate);
+    igtlUint64 encodeStart = MonotonicTimeNs();
+    int rv = encoder_->EncodeFrame(&pic, &info);
+    igtlUint64 encodeEnd = MonotonicTimeNs();
+    if (n < SCALING_WARM_UP_FRAMES || rv != cmResultSuccess)
+      {
+      continue;
+      }
+    run.ms.push_back((encodeEnd - encodeStart) / 1e6);
+    bytes += info.iFrameSizeInBytes;
+    }
+  // The pictures are filled in the loop too, so the rate comes from the
+  // encode times alone
+  double seconds = 0.0;
+  for (size_t i = 0; i < run.ms.size(); i ++)
+    {
+    seconds += run.ms[i] / 1000.0;
+    }
+  run.fps = seconds > 0.0 ? run.ms.size() / seconds : 0.0;
+  run.mbps = run.ms.empty() ? 0.0 : bytes * 8.0 * profile->fFrameRate / run.ms.size() / 1e6;
+
+  encoder_->Uninitialize();
+  WelsDestroySVCEncoder(encoder_);
+  return true;
+}
+
+static void PrintUsage(const char* name)
+{
+  std::cerr << "Usage: " << name << " [options]" << std::endl;
+  std::cerr << "    --sizes <w>x<h>,...  : Picture sizes (default " << SCALING_DEFAULT_SIZES << ")" << std::endl;
+  std::cerr << "    --threads <n>        : Most encoder threads; runs 1, 2, 4, ... up to it (default one per core)"
+            << std::endl;
+  std::cerr << "    --frames <n>         : Pictures measured per run (default " << SCALING_DEFAULT_FRAMES << ")"
+            << std::endl;
+  std::cerr << "    --profile <name>     : Encoder profile (default " << SCALING_DEFAULT_PROFILE << ")" << std::endl;
+  std::cerr << "    --json <file>        : Write the results there instead of to the standard output" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  std::string sizes = SCALING_DEFAULT_SIZES;
+  int maxThreads = 0;
+  int frames = SCALING_DEFAULT_FRAMES;
+  std::string profileName = SCALING_DEFAULT_PROFILE;
+  std::string jsonName;
+  for (int i = 1; i < argc; i ++)
+    {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--sizes" && hasValue)
+      {
+      sizes = argv[++ i];
+      }
+    else if (arg == "--threads" && hasValue)
+      {
+      maxThreads = atoi(argv[++ i]);
+      }
+    else if (arg == "--frames" && hasValue)
+      {
+      frames = atoi(argv[++ i]);
+      }
+    else if (arg == "--profile" && hasValue)
+      {
+      profileName = argv[++ i];
+      }
+    else if (arg == "--json" && hasValue)
+      {
+      jsonName = argv[++ i];
+      }
+    else
+      {
+      PrintUsage(argv[0]);
+      return 1;
+      }
+    }
+  const EncoderProfile* profile = FindEncoderProfile(profileName.c_str());
+  if (profile == NULL || frames <= 0)
+    {
+    PrintUsage(argv[0]);
+    return 1;
+    }
+  if (maxThreads <= 0)
+    {
+    maxThreads = GetEncoderThreads(profile, ENCODER_THREADS_PER_CORE);
+    }
+
+  std::vector<int> widths;
+  std::vector<int> heights;
+  size_t position = 0;
+  while (position < sizes.size())
+    {
+    size_t comma = sizes.find(',', position);
+    if (comma == std::string::npos)
+      {
+      comma = sizes.size();
+      }
+    int width = 0;
+    int height = 0;
+    if (sscanf(sizes.substr(position, comma - position).c_str(), "%dx%d", &width, &height) != 2
+        || width < 16 || height < 16 || (width & 1) || (height & 1))
+      {
+      PrintUsage(argv[0]);
+      return 1;
+      }
+    widths.push_back(width);
+    heights.push_back(height);
+    position = comma + 1;
+    }
+
+  FILE* fp = stdout;
+  if (!jsonName.empty())
+    {
+    fp = fopen(jsonName.c_str(), "w");
+    if (fp == NULL)
+      {
+      std::cerr << "Can not write " << jsonName << std::endl;
+      return 1;
+      }
+    }
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"profile\": \"%s\",\n", profile->pkcName);
+  fprintf(fp, "  \"frames\": %d,\n", frames);
+  fprintf(fp, "  \"results\": [\n");
+  bool ok = true;
+  for (size_t s = 0; s < widths.size() && ok; s ++)
+    {
+    int width = widths[s];
+    int height = heights[s];
+    std::vector<unsigned char> picture(width * height * 3 / 2);
+    fprintf(fp, "    {\n      \"width\": %d,\n      \"height\": %d,\n      \"runs\": [\n", width, height);
+    double single = 0.0;
+    for (int n = 1; n <= maxThreads && ok; n = (n * 2 <= maxThreads || n == maxThreads) ? n * 2 : maxThreads)
+      {
+      ScalingRun run;
+      if (!RunEncoder(profile, width, height, n, frames, picture, run))
+        {
+        std::cerr << "Create or initialize encoder failed!" << std::endl;
+        ok = false;
+        break;
+        }
+      if (n == 1)
+        {
+        single = run.fps;
+        }
+      std::vector<double> sorted(run.ms);
+      std::sort(sorted.begin(), sorted.end());
+      fprintf(fp, "        { \"threads\": %d, \"slices\": %d, \"fps\": %.2f, \"speedup\": %.2f, \"mbps\": %.3f,"
+              " \"latency_ms\": { \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f } }%s\n",
+              run.threads, run.slices, run.fps, single > 0.0 ? run.fps / single : 0.0, run.mbps,
+              Percentile(sorted, 50), Percentile(sorted, 90), Percentile(sorted, 99),
+              sorted.empty() ? 0.0 : sorted.back(), n == maxThreads ? "" : ",");
+      fflush(fp);
+      }
+    fprintf(fp, "      ]\n    }%s\n", s + 1 == widths.size() ? "" : ",");
+    }
+  fprintf(fp, "  ]\n}\n");
+  if (fp != stdout)
+    {
+    fclose(fp);
+    }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+// Converts random pictures of every pixel format to I420 with each
+// implementation, checks that the vector ones give the same bytes as the
+// scalar one, at the benchmark size and at widths that leave a tail for
+// the scalar loop, and that the scalar RGB conversion is within one step
+// of the BT.601 matrix, then reports the throughput of each. With --check
+// the converters are only checked, not timed.
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "PixelFormatConverter.h"
+
+static double NowInSeconds()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+typedef bool (*ConvertFunction)(EVideoFormatType, const unsigned char*, int, int, int, unsigned char*);
+
+static void MakePicture(std::vector<unsigned char>& picture, EVideoFormatType format, int width, int height)
+{
+  picture.resize(PixelFormatFrameSize(format, width, height));
+  srand(1);
+  for (size_t i = 0; i < picture.size(); i ++)
+    {
+    picture[i] = (unsigned char) (rand() & 0xff);
+    }
+}
+
+// Largest difference of the scalar Y, U and V from the floating point
+// full range BT.601 conversion, with chroma from the 2x2 block average
+static double ReferenceError(const std::vector<unsigned char>& picture, EVideoFormatType format, int width, int height,
+                             const std::vector<unsigned char>& i420)
+{
+  int bpp = format == videoFormatRGB ? 3 : 4;
+  int ri = format == videoFormatRGB ? 0 : 2;
+  int bi = 2 - ri;
+  const unsigned char* u = &i420[width * height];
+  const unsigned char* v = u + width * height / 4;
+  double error = 0.0;
+  for (int y = 0; y < height; y += 2)
+    {
+    for (int x = 0; x < width; x += 2)
+      {
+      double r = 0.0, g = 0.0, b = 0.0;
+      for (int k = 0; k < 4; k ++)
+        {
+        int px = (y + k / 2) * width + x + k % 2;
+        const unsigned char* p = &picture[px * bpp];
+        double luma = 0.299 * p[ri] + 0.587 * p[1] + 0.114 * p[bi];
+        error = std::max(error, std::fabs(luma - i420[px]));
+        r += p[ri] / 4.0;
+        g += p[1] / 4.0;
+        b += p[bi] / 4.0;
+        }
+      double cb = std::min(255.0, -0.168736 * r - 0.331264 * g + 0.5 * b + 128.0);
+      double cr = std::min(255.0, 0.5 * r - 0.418688 * g - 0.081312 * b + 128.0);
+      int c = (y / 2) * (width / 2) + x / 2;
+      error = std::max(error, std::max(std::fabs(cb - u[c]), std::fabs(cr - v[c])));
+      }
+    }
+  return error;
+}
+
+int main(int argc, char* argv[])
+{
+  int arg = 1;
+  bool timing = !(argc > arg && strcmp(argv[arg], "--check") == 0);
+  if (!timing)
+    {
+    arg ++;
+    }
+  int repeat = argc > arg ? atoi(argv[arg]) : 20;
+  int width = 1920;
+  int height = 1080;
+  if (argc > arg + 1 && (sscanf(argv[arg + 1], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0
+                         || (width & 1) || (height & 1)))
+    {
+    std::cerr << "Usage: " << argv[0] << " [--check] [repeat] [<width>x<height>]" << std::endl;
+    return 1;
+    }
+
+  struct { const char* name; ConvertFunction convert; } converters[] = {
+    { "scalar", ConvertToI420Scalar },
+#if defined(PIXEL_FORMAT_CONVERTER_SSE2)
+    { "sse2",   ConvertToI420SSE2 },
+#endif
+#if defined(PIXEL_FORMAT_CONVERTER_AVX2)
+    { "avx2",   ConvertToI420AVX2 },
+#endif
+  };
+  int nConverters = sizeof(converters) / sizeof(converters[0]);
+
+  // The benchmark size, then sizes that end in every vector tail
+  const int checkWidths[] = { width, 2, 14, 30, 46, 66 };
+  int failures = 0;
+  for (int f = 0; f < kNumberOfPixelFormats; f ++)
+    {
+    EVideoFormatType format = kPixelFormats[f].eFormat;
+    for (int c = 0; c < (int) (sizeof(checkWidths) / sizeof(checkWidths[0])); c ++)
+      {
+      int w = checkWidths[c];
+      int h = c == 0 ? height : 4;
+      std::vector<unsigned char> picture;
+      MakePicture(picture, format, w, h);
+      std::vector<unsigned char> reference(w * h * 3 / 2);
+      ConvertToI420Scalar(format, &picture[0], 0, w, h, &reference[0]);
+      if ((format == videoFormatRGB || format == videoFormatBGRA)
+          && ReferenceError(picture, format, w, h, reference) > 1.0)
+        {
+        printf("%-6s %5dx%-5d scalar  differs from BT.601\n", kPixelFormats[f].pkcName, w, h);
+        failures ++;
+        }
+      for (int s = 1; s < nConverters; s ++)
+        {
+#if defined(PIXEL_FORMAT_CONVERTER_AVX2)
+        if (converters[s].convert == ConvertToI420AVX2 && !CPUSupportsAVX2())
+          {
+          continue;
+          }
+#endif
+        std::vector<unsigned char> i420(w * h * 3 / 2);
+        converters[s].convert(format, &picture[0], 0, w, h, &i420[0]);
+        if (i420 != reference)
+          {
+          printf("%-6s %5dx%-5d %-7s MISMATCH\n", kPixelFormats[f].pkcName, w, h, converters[s].name);
+          failures ++;
+          }
+        }
+      }
+    }
+
+  if (!timing)
+    {
+    printf("%s\n", failures ? "MISMATCH" : "ok");
+    return failures ? 1 : 0;
+    }
+
+  printf("%dx%d, %d pictures\n", width, height, repeat);
+  for (int f = 0; f < kNumberOfPixelFormats; f ++)
+    {
+    EVideoFormatType format = kPixelFormats[f].eFormat;
+    std::vector<unsigned char> picture;
+    MakePicture(picture, format, width, height);
+    std::vector<unsigned char> i420(width * height * 3 / 2);
+    double scalar = 0.0;
+    for (int s = 0; s < nConverters; s ++)
+      {
+#if defined(PIXEL_FORMAT_CONVERTER_AVX2)
+      if (converters[s].convert == ConvertToI420AVX2 && !CPUSupportsAVX2())
+        {
+        continue;
+        }
+#endif
+      // Once to fault the output in
+      converters[s].convert(format, &picture[0], 0, width, height, &i420[0]);
+      double start = NowInSeconds();
+      for (int r = 0; r < repeat; r ++)
+        {
+        converters[s].convert(format, &picture[0], 0, width, height, &i420[0]);
+        }
+      double sec = (NowInSeconds() - start) / repeat;
+      if (s == 0)
+        {
+        scalar = sec;
+        }
+      printf("%-6s %-7s %9.1f us  %8.1f fps  %8.1f MB/s in  %7.1f Mpixel/s  speedup %5.2fx\n",
+             kPixelFormats[f].pkcName, converters[s].name, sec * 1e6, 1.0 / sec, picture.size() / sec / 1e6,
+             (double) width * height / sec / 1e6, scalar / sec);
+      }
+    }
+  return failures ? 1 : 0;
+}
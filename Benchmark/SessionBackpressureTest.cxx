@@ -0,0 +1,97 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+// Sends one frame far past the latency bound through a ClientSession and
+// checks that, once its queue has drained, the rate controller accepts
+// frames again instead of dropping every one before it is encoded.
+
+#include <cstdio>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "ClientSession.h"
+#include "MonotonicClock.h"
+#include "RateController.h"
+
+#define LATENCY_BOUND_NS 200000000ULL  // 200 ms
+
+static void IgnoreWakeup(ClientSession*, void*)
+{
+}
+
+// Queues an IDR without packets that became ready 'age' ago and writes
+// it out, as the event loop would
+static int SendFrame(ClientSession* session, int fd, igtlUint64 age)
+{
+  EncodedFrame::Pointer frame = EncodedFrame::New();
+  frame->SetFrameType(videoFrameTypeIDR);
+  frame->SetReadyTime(MonotonicTimeNs() - age);
+  session->Push(frame);
+  return session->SendQueued(fd);
+}
+
+static int Check(bool ok, const char* what)
+{
+  printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+
+int main(int, char*[])
+{
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    {
+    perror("socketpair");
+    return 1;
+    }
+  ClientSession::Pointer session = ClientSession::New();
+  session->SetWakeup(&IgnoreWakeup, NULL);
+  session->Start();
+
+  RateController rate;
+  rate.SetLatencyBoundNs(LATENCY_BOUND_NS);
+  rate.SetBitrateRange(100000, 1000000);
+  bool bitrateChanged = false;
+  int failures = 0;
+
+  // A frame that waited three times the bound is queued: drop
+  EncodedFrame::Pointer late = EncodedFrame::New();
+  late->SetFrameType(videoFrameTypeIDR);
+  late->SetReadyTime(MonotonicTimeNs() - 3 * LATENCY_BOUND_NS);
+  session->Push(late);
+  igtlUint64 now = MonotonicTimeNs();
+  failures += Check(!rate.Update(now, session->GetSendDelayNs(now), 0.0, bitrateChanged),
+                    "late frame queued, next frame dropped");
+
+  // It is sent and the queue is empty: frames are accepted again
+  failures += Check(session->SendQueued(fds[0]) == 1, "late frame sent");
+  now = MonotonicTimeNs();
+  failures += Check(session->GetSendDelayNs(now) == 0, "idle queue reports no delay");
+  failures += Check(rate.Update(now, session->GetSendDelayNs(now), 0.0, bitrateChanged),
+                    "idle queue, next frame accepted");
+
+  // And keep flowing
+  for (int i = 0; i < 5; i ++)
+    {
+    failures += Check(SendFrame(session, fds[0], 0) == 1, "on time frame sent");
+    now = MonotonicTimeNs();
+    failures += Check(rate.Update(now, session->GetSendDelayNs(now), 0.0, bitrateChanged),
+                      "on time frame accepted");
+    }
+  failures += Check(session->GetNumberOfSentFrames() == 6, "every frame sent");
+
+  session->Stop();
+  close(fds[0]);
+  close(fds[1]);
+  return failures ? 1 : 0;
+}
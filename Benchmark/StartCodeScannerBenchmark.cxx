@@ -0,0 +1,186 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+// Compares the Annex-B start code scanners with the byte-by-byte loop
+// the receiver used before, on synthetic access units shaped like
+// intra-only lossless frames (a few large slices) and like size-limited
+// slices (a NAL every ~1500 bytes). With --check the scanners are only
+// compared, not timed.
+
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "StartCodeScanner.h"
+
+static double NowInSeconds()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// The loop from the original H264DecodeInstance, bounded by the bytes
+// that remain. It reports the position where each slice ends; on a
+// 4-byte start code it first emits a 1-byte slice holding the leading
+// zero, which the caller then skipped as too small.
+static void FindStartCodesLegacy(const unsigned char* pBuf, int32_t iStreamSize, std::vector<int32_t>& offsets)
+{
+  int32_t iBufPos = 0;
+  while (iBufPos < iStreamSize)
+    {
+    int32_t i;
+    for (i = 0; iBufPos + i + 3 < iStreamSize; i++)
+      {
+      if ((pBuf[iBufPos + i] == 0 && pBuf[iBufPos + i + 1] == 0 && pBuf[iBufPos + i + 2] == 0 && pBuf[iBufPos + i + 3] == 1
+           && i > 0) || (pBuf[iBufPos + i] == 0 && pBuf[iBufPos + i + 1] == 0 && pBuf[iBufPos + i + 2] == 1 && i > 0))
+        {
+        break;
+        }
+      }
+    if (iBufPos + i + 3 >= iStreamSize)
+      {
+      // Last three bytes may still hold a 3-byte start code
+      if (iBufPos + i + 2 < iStreamSize && i > 0 && pBuf[iBufPos + i] == 0 && pBuf[iBufPos + i + 1] == 0
+          && pBuf[iBufPos + i + 2] == 1)
+        {
+        offsets.push_back(iBufPos + i);
+        }
+      break;
+      }
+    offsets.push_back(iBufPos + i);
+    iBufPos += i;
+    }
+}
+
+// Random payload without emulated start codes, with a 4-byte start code
+// and a NAL header every 'nalSize' bytes.
+static void MakeAccessUnit(std::vector<unsigned char>& au, int size, int nalSize)
+{
+  au.resize(size);
+  srand(1);
+  for (int i = 0; i < size; i ++)
+    {
+    unsigned char b = (unsigned char) (rand() & 0xff);
+    // Emulation prevention keeps 00 00 0x (x <= 3) out of real payloads
+    if (i >= 2 && au[i - 1] == 0 && au[i - 2] == 0 && b <= 3)
+      {
+      b = 4 + (b & 0x7f);
+      }
+    au[i] = b;
+    }
+  for (int pos = 0; pos + 5 < size; pos += nalSize)
+    {
+    au[pos] = 0; au[pos + 1] = 0; au[pos + 2] = 0; au[pos + 3] = 1; au[pos + 4] = 0x65;
+    }
+}
+
+// End offsets of the units a decoder is fed: the pieces between
+// consecutive boundaries that are at least 4 bytes long. Both ways of
+// splitting must hand the decoder the same NAL units.
+static std::vector<int32_t> DecodedUnits(const std::vector<int32_t>& offsets, int32_t size)
+{
+  std::vector<int32_t> ends;
+  int32_t start = 0;
+  for (size_t i = 0; i <= offsets.size(); i ++)
+    {
+    int32_t end = i < offsets.size() ? offsets[i] : size;
+    if (end - start >= 4)
+      {
+      ends.push_back(end);
+      }
+    start = end;
+    }
+  return ends;
+}
+
+typedef void (*ScanFunction)(const unsigned char*, int32_t, std::vector<int32_t>&);
+
+static void FindStartCodesPortable(const unsigned char* pBuf, int32_t iSize, std::vector<int32_t>& offsets)
+{
+  FindStartCodesScalar(pBuf, iSize, offsets);
+}
+
+static double Run(ScanFunction scan, const std::vector<unsigned char>& au, int repeat, std::vector<int32_t>& offsets)
+{
+  double start = NowInSeconds();
+  for (int r = 0; r < repeat; r ++)
+    {
+    offsets.clear();
+    scan(&au[0], au.size(), offsets);
+    }
+  return (NowInSeconds() - start) / repeat;
+}
+
+int main(int argc, char* argv[])
+{
+  int arg = 1;
+  bool timing = !(argc > arg && strcmp(argv[arg], "--check") == 0);
+  if (!timing)
+    {
+    arg ++;
+    }
+  int repeat = argc > arg ? atoi(argv[arg]) : 50;
+  if (!timing)
+    {
+    repeat = 1;
+    }
+  const int sizes[]    = { 4 << 20, 4 << 20, 256 << 10 };
+  const int nalSizes[] = { 1 << 20, 1500,    1500 };
+
+  struct { const char* name; ScanFunction scan; } scanners[] = {
+    { "legacy", FindStartCodesLegacy },
+    { "scalar", FindStartCodesPortable },
+#if defined(START_CODE_SCANNER_SSE2)
+    { "sse2",   FindStartCodesSSE2 },
+#endif
+#if defined(START_CODE_SCANNER_AVX2)
+    { "avx2",   FindStartCodesAVX2 },
+#endif
+  };
+  int nScanners = sizeof(scanners) / sizeof(scanners[0]);
+
+  int failures = 0;
+  for (int t = 0; t < 3; t ++)
+    {
+    std::vector<unsigned char> au;
+    MakeAccessUnit(au, sizes[t], nalSizes[t]);
+    std::vector<int32_t> reference;
+    double legacy = Run(FindStartCodesLegacy, au, repeat, reference);
+    for (int s = 0; s < nScanners; s ++)
+      {
+#if defined(START_CODE_SCANNER_AVX2)
+      if (scanners[s].scan == FindStartCodesAVX2 && !CPUSupportsAVX2())
+        {
+        continue;
+        }
+#endif
+      std::vector<int32_t> offsets;
+      double sec = s == 0 ? legacy : Run(scanners[s].scan, au, repeat, offsets);
+      bool ok = s == 0 || DecodedUnits(offsets, au.size()) == DecodedUnits(reference, au.size());
+      failures += ok ? 0 : 1;
+      if (!timing)
+        {
+        printf("%8d bytes  NAL %7d  %-7s %s\n", sizes[t], nalSizes[t], scanners[s].name, ok ? "ok" : "MISMATCH");
+        continue;
+        }
+      printf("%8d bytes  NAL %7d  %-7s %9.1f us  %8.1f MB/s  speedup %5.2fx  %s\n",
+             sizes[t], nalSizes[t], scanners[s].name, sec * 1e6, au.size() / sec / 1e6,
+             legacy / sec, ok ? "ok" : "MISMATCH");
+      }
+    }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,459 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+// Runs the server's encode path and the receiver's decode path in one
+// process, connected over loopback, and reports per stage latency
+// percentiles, throughput and CPU time per frame as JSON:
+//
+//   encode   EncodeFrame()
+//   pack     regrouping the NAL units and building the IGTL headers
+//   send     SendFragments() of the whole message
+//   receive  start of the send until the receiver has the whole body
+//   unpack   unpacking the IGTL header and locating the bit stream
+//   decode   DecodeAccessUnit() until the picture is out
+//   total    picture ready for the encoder until it is decoded
+//
+// Both ends use the same monotonic clock, so the cross-thread stages
+// need no clock synchronization. Pictures come from a raw I420 file
+// (--file) or from a synthetic moving pattern.
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "api/svc/codec_api.h"
+#include "api/svc/codec_app_def.h"
+
+#include "igtlOSUtil.h"
+#include "igtlMessageHeader.h"
+#include "igtlServerSocket.h"
+#include "igtlClientSocket.h"
+#include "igtlMultiThreader.h"
+
+#include "BenchmarkSupport.h"
+#include "MonotonicClock.h"
+#include "EncoderProfiles.h"
+#include "MappedYUVSource.h"
+#include "VectoredSend.h"
+#include "VideoDeviceNames.h"
+#include "VideoFramePacker.h"
+#include "H264Decoder.h"
+
+#define BENCHMARK_DEFAULT_FRAMES  300
+#define BENCHMARK_DEFAULT_WIDTH   1280
+#define BENCHMARK_DEFAULT_HEIGHT  720
+#define BENCHMARK_DEFAULT_PORT    18950
+#define BENCHMARK_DEFAULT_PROFILE "low-latency"
+
+// Time stamps of one access unit, in MonotonicTimeNs()
+typedef struct {
+  igtlUint64 capture;
+  igtlUint64 encodeStart;
+  igtlUint64 encodeEnd;
+  igtlUint64 packEnd;
+  igtlUint64 sendStart;
+  igtlUint64 sendEnd;
+  int        bytes;
+} SentFrame;
+
+typedef struct {
+  igtlUint64 bodyEnd;
+  igtlUint64 unpackNs;
+  igtlUint64 decodeStart;
+  igtlUint64 decodeEnd;
+  int        pictures;
+} ReceivedFrame;
+
+typedef struct {
+  int                        port;
+  std::vector<ReceivedFrame> frames;
+  bool                       connected;
+} ReceiverSide;
+
+// Receives and decodes until the sender closes the connection
+static void* ReceiverThread(void* ptr)
+{
+  igtl::MultiThreader::ThreadInfo* info =
+    static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+  ReceiverSide* side = static_cast<ReceiverSide*>(info->UserData);
+
+  igtl::ClientSocket::Pointer socket = igtl::ClientSocket::New();
+  if (socket->ConnectToServer("localhost", side->port) != 0)
+    {
+    return NULL;
+    }
+  side->connected = true;
+
+  H264DecoderSession decoder;
+  if (!decoder.Open(NULL))
+    {
+    socket->CloseSocket();
+    return NULL;
+    }
+  igtl::MessageHeader::Pointer headerMsg = igtl::MessageHeader::New();
+  std::vector<unsigned char> body;
+  while (1)
+    {
+    headerMsg->InitPack();
+    int rs = socket->Receive(headerMsg->GetPackPointer(), headerMsg->GetPackSize());
+    if (rs != headerMsg->GetPackSize())
+      {
+      break;
+      }
+    ReceivedFrame frame;
+    igtlUint64 start = MonotonicTimeNs();
+    headerMsg->Unpack();
+    int bodySize = headerMsg->GetBodySizeToRead();
+    bool video = strcmp(headerMsg->GetDeviceType(), "VIDEO") == 0 && bodySize > IGTL_VIDEO_HEADER_SIZE;
+    frame.unpackNs = MonotonicTimeNs() - start;
+    if (!video)
+      {
+      socket->Skip(bodySize, 0);
+      continue;
+      }
+    if (body.size() < (size_t) bodySize)
+      {
+      body.resize(bodySize);
+      }
+    if (socket->Receive(&body[0], bodySize) != bodySize)
+      {
+      break;
+      }
+    frame.bodyEnd = MonotonicTimeNs();
+    frame.decodeStart = frame.bodyEnd;
+    frame.pictures = decoder.DecodeAccessUnit(&body[IGTL_VIDEO_HEADER_SIZE], bodySize - IGTL_VIDEO_HEADER_SIZE);
+    frame.decodeEnd = MonotonicTimeNs();
+    side->frames.push_back(frame);
+    }
+  decoder.Close();
+  socket->CloseSocket();
+  return NULL;
+}
+
+// Latencies of one stage in milliseconds
+typedef struct {
+  const char*         name;
+  std::vector<double> ms;
+} StageSamples;
+
+static void WriteStage(FILE* fp, const StageSamples& stage, bool last)
+{
+  std::vector<double> sorted(stage.ms);
+  std::sort(sorted.begin(), sorted.end());
+  double sum = 0.0;
+  for (size_t i = 0; i < sorted.size(); i ++)
+    {
+    sum += sorted[i];
+    }
+  fprintf(fp, "    \"%s\": { \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f }%s\n",
+          stage.name, Percentile(sorted, 50), Percentile(sorted, 90), Percentile(sorted, 99),
+          sorted.empty() ? 0.0 : sorted.back(), sorted.empty() ? 0.0 : sum / sorted.size(), last ? "" : ",");
+}
+
+static double Ms(igtlUint64 from, igtlUint64 to)
+{
+  return to > from ? (to - from) / 1e6 : 0.0;
+}
+
+static void PrintUsage(const char* name)
+{
+  std::cerr << "Usage: " << name << " [options]" << std::endl;
+  std::cerr << "    --frames <n>      : Pictures to encode (default " << BENCHMARK_DEFAULT_FRAMES << ")" << std::endl;
+  std::cerr << "    --size <w>x<h>    : Picture size (default " << BENCHMARK_DEFAULT_WIDTH << "x"
+            << BENCHMARK_DEFAULT_HEIGHT << ")" << std::endl;
+  std::cerr << "    --file <yuv>      : Raw I420 pictures of that size instead of the synthetic pattern" << std::endl;
+  std::cerr << "    --profile <name>  : Encoder profile (default " << BENCHMARK_DEFAULT_PROFILE << ")" << std::endl;
+  std::cerr << "    --fps <rate>      : Capture rate; 0 (the default) encodes as fast as possible" << std::endl;
+  std::cerr << "    --port <port>     : Loopback port (default " << BENCHMARK_DEFAULT_PORT << ")" << std::endl;
+  std::cerr << "    --json <file>     : Write the results there instead of to the standard output" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  int frames = BENCHMARK_DEFAULT_FRAMES;
+  int width = BENCHMARK_DEFAULT_WIDTH;
+  int height = BENCHMARK_DEFAULT_HEIGHT;
+  std::string fileName;
+  std::string profileName = BENCHMARK_DEFAULT_PROFILE;
+  double fps = 0.0;
+  int port = BENCHMARK_DEFAULT_PORT;
+  std::string jsonName;
+  for (int i = 1; i < argc; i ++)
+    {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--frames" && hasValue)
+      {
+      frames = atoi(argv[++ i]);
+      }
+    else if (arg == "--size" && hasValue)
+      {
+      if (sscanf(argv[++ i], "%dx%d", &width, &height) != 2)
+        {
+        PrintUsage(argv[0]);
+        return 1;
+        }
+      }
+    else if (arg == "--file" && hasValue)
+      {
+      fileName = argv[++ i];
+      }
+    else if (arg == "--profile" && hasValue)
+      {
+      profileName = argv[++ i];
+      }
+    else if (arg == "--fps" && hasValue)
+      {
+      fps = atof(argv[++ i]);
+      }
+    else if (arg == "--port" && hasValue)
+      {
+      port = atoi(argv[++ i]);
+      }
+    else if (arg == "--json" && hasValue)
+      {
+      jsonName = argv[++ i];
+      }
+    else
+      {
+      PrintUsage(argv[0]);
+      return 1;
+      }
+    }
+  const EncoderProfile* profile = FindEncoderProfile(profileName.c_str());
+  if (profile == NULL || frames <= 0 || width < 16 || height < 16 || (width & 1) || (height & 1))
+    {
+    PrintUsage(argv[0]);
+    return 1;
+    }
+
+  //------------------------------------------------------------
+  // Picture source
+  MappedYUVSource::Pointer source;
+  std::vector<unsigned char> synthetic;
+  if (!fileName.empty())
+    {
+    source = MappedYUVSource::New();
+    if (!source->Open(fileName, width, height) || source->GetNumberOfFrames() == 0)
+      {
+      std::cerr << "Can not read pictures of " << width << "x" << height << " from " << fileName << std::endl;
+      return 1;
+      }
+    }
+  else
+    {
+    synthetic.resize(width * height * 3 / 2);
+    }
+
+  //------------------------------------------------------------
+  // Loopback connection
+  igtl::ServerSocket::Pointer serverSocket = igtl::ServerSocket::New();
+  if (serverSocket->CreateServer(port) < 0)
+    {
+    std::cerr << "Cannot create a server socket on port " << port << "." << std::endl;
+    return 1;
+    }
+  ReceiverSide receiver;
+  receiver.port = port;
+  receiver.connected = false;
+  receiver.frames.reserve(frames);
+  igtl::MultiThreader::Pointer threader = igtl::MultiThreader::New();
+  int receiverID = threader->SpawnThread((igtl::ThreadFunctionType) &ReceiverThread, &receiver);
+  igtl::ClientSocket::Pointer socket = serverSocket->WaitForConnection(5000);
+  if (socket.IsNull())
+    {
+    std::cerr << "The receiver did not connect." << std::endl;
+    threader->TerminateThread(receiverID);
+    return 1;
+    }
+
+  //------------------------------------------------------------
+  // Encoder
+  ISVCEncoder* encoder_ = NULL;
+  if (WelsCreateSVCEncoder(&encoder_) != 0 || encoder_ == NULL)
+    {
+    std::cerr << "Create encoder failed!" << std::endl;
+    socket->CloseSocket();
+    threader->TerminateThread(receiverID);
+    return 1;
+    }
+  SEncParamExt pEncParamExt;
+  if (!InitializeEncoder(encoder_, profile, width, height, pEncParamExt))
+    {
+    std::cerr << "The encoder refused profile " << profile->pkcName << "." << std::endl;
+    WelsDestroySVCEncoder(encoder_);
+    socket->CloseSocket();
+    threader->TerminateThread(receiverID);
+    return 1;
+    }
+  VideoFramePacker packer;
+  packer.Initialize(VIDEO_DEVICE_NAME, width, height);
+
+  SFrameBSInfo info;
+  memset(&info, 0, sizeof(SFrameBSInfo));
+  SSourcePicture pic;
+  memset(&pic, 0, sizeof(SSourcePicture));
+  pic.iPicWidth    = width;
+  pic.iPicHeight   = height;
+  pic.iColorFormat = videoFormatI420;
+  pic.iStride[0]   = width;
+  pic.iStride[1]   = pic.iStride[2] = width >> 1;
+
+  std::vector<SentFrame> sent;
+  sent.reserve(frames);
+  std::vector<unsigned char> bitStream(width * height * 3);
+  unsigned char header[VIDEO_FRAME_HEADER_SIZE];
+  igtlUint64 periodNs = fps > 0.0 ? (igtlUint64) (1e9 / fps) : 0;
+
+  double cpuStart = CPUTimeInSeconds();
+  igtlUint64 runStart = MonotonicTimeNs();
+  for (int n = 0; n < frames; n ++)
+    {
+    if (periodNs > 0)
+      {
+      SleepUntilNs(runStart + n * periodNs);
+      }
+    const unsigned char* picture;
+    if (source.IsNotNull())
+      {
+      picture = source->GetFrame(n % source->GetNumberOfFrames());
+      }
+    else
+      {
+      FillSyntheticPicture(&synthetic[0], width, height, n);
+      picture = &synthetic[0];
+      }
+    SentFrame frame;
+    frame.capture = MonotonicTimeNs();
+    pic.pData[0]    = const_cast<unsigned char*>(picture);
+    pic.pData[1]    = pic.pData[0] + width * height;
+    pic.pData[2]    = pic.pData[1] + (width * height >> 2);
+    pic.uiTimeStamp = (long long) (frame.capture / 1000000ULL);
+
+    frame.encodeStart = MonotonicTimeNs();
+    int rv = encoder_->EncodeFrame(&pic, &info);
+    frame.encodeEnd = MonotonicTimeNs();
+    if (rv != cmResultSuccess || info.eFrameType == videoFrameTypeSkip)
+      {
+      continue;
+      }
+
+    // The layers in order, as the server's encode thread copies them
+    // into the shared frame, then one message for the access unit
+    int frameSize = 0;
+    for (int i = 0; i < info.iLayerNum; ++i)
+      {
+      const SLayerBSInfo& layerInfo = info.sLayerInfo[i];
+      const unsigned char* pNal = layerInfo.pBsBuf;
+      for (int j = 0; j < layerInfo.iNalCount; ++j)
+        {
+        if (frameSize + layerInfo.pNalLengthInByte[j] > (int) bitStream.size())
+          {
+          bitStream.resize(2 * (frameSize + layerInfo.pNalLengthInByte[j]));
+          }
+        memcpy(&bitStream[frameSize], pNal, layerInfo.pNalLengthInByte[j]);
+        pNal += layerInfo.pNalLengthInByte[j];
+        frameSize += layerInfo.pNalLengthInByte[j];
+        }
+      }
+    packer.Begin();
+    packer.Update(&bitStream[0], frameSize);
+    packer.End(header);
+    frame.packEnd = MonotonicTimeNs();
+
+    SendFragment fragments[2];
+    fragments[0].ptr  = header;
+    fragments[0].size = VIDEO_FRAME_HEADER_SIZE;
+    fragments[1].ptr  = &bitStream[0];
+    fragments[1].size = frameSize;
+    frame.sendStart = MonotonicTimeNs();
+    if (!SendFragments(socket, fragments, 2))
+      {
+      std::cerr << "Sending failed." << std::endl;
+      break;
+      }
+    frame.sendEnd = MonotonicTimeNs();
+    frame.bytes = VIDEO_FRAME_HEADER_SIZE + frameSize;
+    sent.push_back(frame);
+    }
+  socket->CloseSocket();
+  threader->TerminateThread(receiverID);
+  igtlUint64 runEnd = MonotonicTimeNs();
+  double cpuSeconds = CPUTimeInSeconds() - cpuStart;
+  encoder_->Uninitialize();
+  WelsDestroySVCEncoder(encoder_);
+
+  //------------------------------------------------------------
+  // Results. Messages arrive in the order they were sent.
+  StageSamples stages[7] = {
+    { "encode", std::vector<double>() }, { "pack", std::vector<double>() },
+    { "send", std::vector<double>() }, { "receive", std::vector<double>() },
+    { "unpack", std::vector<double>() }, { "decode", std::vector<double>() },
+    { "total", std::vector<double>() },
+  };
+  size_t received = std::min(sent.size(), receiver.frames.size());
+  long long bytes = 0;
+  int pictures = 0;
+  for (size_t i = 0; i < received; i ++)
+    {
+    const SentFrame& s = sent[i];
+    const ReceivedFrame& r = receiver.frames[i];
+    stages[0].ms.push_back(Ms(s.encodeStart, s.encodeEnd));
+    stages[1].ms.push_back(Ms(s.encodeEnd, s.packEnd));
+    stages[2].ms.push_back(Ms(s.sendStart, s.sendEnd));
+    stages[3].ms.push_back(Ms(s.sendStart, r.bodyEnd));
+    stages[4].ms.push_back(r.unpackNs / 1e6);
+    stages[5].ms.push_back(Ms(r.decodeStart, r.decodeEnd));
+    stages[6].ms.push_back(Ms(s.capture, r.decodeEnd));
+    bytes += s.bytes;
+    pictures += r.pictures;
+    }
+  double seconds = (runEnd - runStart) / 1e9;
+
+  FILE* fp = stdout;
+  if (!jsonName.empty())
+    {
+    fp = fopen(jsonName.c_str(), "w");
+    if (fp == NULL)
+      {
+      std::cerr << "Can not write " << jsonName << std::endl;
+      return 1;
+      }
+    }
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"profile\": \"%s\",\n", profile->pkcName);
+  fprintf(fp, "  \"source\": \"%s\",\n", fileName.empty() ? "synthetic" : fileName.c_str());
+  fprintf(fp, "  \"width\": %d,\n  \"height\": %d,\n", width, height);
+  fprintf(fp, "  \"frames\": { \"captured\": %d, \"sent\": %d, \"received\": %d, \"decoded\": %d },\n",
+          frames, (int) sent.size(), (int) receiver.frames.size(), pictures);
+  fprintf(fp, "  \"latency_ms\": {\n");
+  for (int i = 0; i < 7; i ++)
+    {
+    WriteStage(fp, stages[i], i == 6);
+    }
+  fprintf(fp, "  },\n");
+  fprintf(fp, "  \"throughput\": { \"fps\": %.2f, \"mbps\": %.3f },\n",
+          seconds > 0 ? received / seconds : 0.0, seconds > 0 ? bytes * 8 / seconds / 1e6 : 0.0);
+  // Both ends together, since they share the process
+  fprintf(fp, "  \"cpu_ms_per_frame\": %.3f\n", received > 0 ? cpuSeconds * 1000.0 / received : 0.0);
+  fprintf(fp, "}\n");
+  if (fp != stdout)
+    {
+    fclose(fp);
+    }
+  return received > 0 && receiver.connected ? 0 : 1;
+}
@@ -0,0 +1,493 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __AccessUnitFile_h
+#define __AccessUnitFile_h
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#if defined(_WIN32)
+  #include <windows.h>
+#else
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+#include "igtlObject.h"
+#include "igtlTypes.h"
+
+// An encoded stream stored the way it goes on the wire, with an index.
+//
+//   header  "IGTLAUF1", number of frames (8 bytes), offset of the index
+//           (8 bytes), width and height of the largest layer (4 bytes
+//           each, 0 if not known)
+//   frames  for every access unit, its spatial layers lowest first; each
+//           layer is one or more complete VIDEO messages (IGTL header,
+//           video header, bit stream), exactly as a client is sent them
+//   index   one ACCESS_UNIT_FILE_ENTRY_SIZE entry per access unit
+//
+// Numbers are in network byte order. The messages keep the device name
+// and time stamps they were recorded with.
+#define ACCESS_UNIT_FILE_MAGIC        "IGTLAUF1"
+#define ACCESS_UNIT_FILE_HEADER_SIZE  32
+#define ACCESS_UNIT_FILE_ENTRY_SIZE   64
+#define ACCESS_UNIT_FILE_MAX_LAYERS   4
+#define ACCESS_UNIT_FILE_PAGE_SIZE    4096
+
+struct AccessUnitIndexEntry
+{
+  igtlUint64 m_Offset;                // first byte of the access unit in the file
+  igtlUint64 m_Time;                  // ns after the start of the recording
+  igtlUint32 m_FrameIndex;
+  igtlUint8  m_FrameType;             // EVideoFrameType of the encoder
+  igtlUint8  m_IDR;                   // 1 if decoding can start here
+  igtlUint8  m_TemporalId;
+  igtlUint8  m_NumberOfTemporalLayers;
+  igtlUint8  m_NumberOfLayers;        // spatial layers
+  igtlUint32 m_Interval;              // ms between frames of the stream
+  igtlUint32 m_LayerSize[ACCESS_UNIT_FILE_MAX_LAYERS];     // bytes, headers included
+  igtlUint32 m_LayerBitrate[ACCESS_UNIT_FILE_MAX_LAYERS];  // bits per second
+
+  igtlUint64 GetSize() const
+  {
+    igtlUint64 size = 0;
+    for (int i = 0; i < this->m_NumberOfLayers && i < ACCESS_UNIT_FILE_MAX_LAYERS; i ++)
+      {
+      size += this->m_LayerSize[i];
+      }
+    return size;
+  };
+};
+
+inline void AccessUnitFilePut(unsigned char* p, igtlUint64 value, int bytes)
+{
+  for (int b = 0; b < bytes; b ++)
+    {
+    p[b] = (unsigned char) (value >> (8 * (bytes - 1 - b)));
+    }
+}
+
+inline igtlUint64 AccessUnitFileGet(const unsigned char* p, int bytes)
+{
+  igtlUint64 value = 0;
+  for (int b = 0; b < bytes; b ++)
+    {
+    value = (value << 8) | p[b];
+    }
+  return value;
+}
+
+inline void PackAccessUnitIndexEntry(unsigned char* p, const AccessUnitIndexEntry& e)
+{
+  memset(p, 0, ACCESS_UNIT_FILE_ENTRY_SIZE);
+  AccessUnitFilePut(p,      e.m_Offset, 8);
+  AccessUnitFilePut(p + 8,  e.m_Time, 8);
+  AccessUnitFilePut(p + 16, e.m_FrameIndex, 4);
+  p[20] = e.m_FrameType;
+  p[21] = e.m_IDR;
+  p[22] = e.m_TemporalId;
+  p[23] = e.m_NumberOfTemporalLayers;
+  p[24] = e.m_NumberOfLayers;
+  AccessUnitFilePut(p + 28, e.m_Interval, 4);
+  for (int i = 0; i < ACCESS_UNIT_FILE_MAX_LAYERS; i ++)
+    {
+    AccessUnitFilePut(p + 32 + 4 * i, e.m_LayerSize[i], 4);
+    AccessUnitFilePut(p + 48 + 4 * i, e.m_LayerBitrate[i], 4);
+    }
+}
+
+inline void UnpackAccessUnitIndexEntry(const unsigned char* p, AccessUnitIndexEntry& e)
+{
+  e.m_Offset                 = AccessUnitFileGet(p, 8);
+  e.m_Time                   = AccessUnitFileGet(p + 8, 8);
+  e.m_FrameIndex             = (igtlUint32) AccessUnitFileGet(p + 16, 4);
+  e.m_FrameType              = p[20];
+  e.m_IDR                    = p[21];
+  e.m_TemporalId             = p[22];
+  e.m_NumberOfTemporalLayers = p[23];
+  e.m_NumberOfLayers         = p[24];
+  e.m_Interval               = (igtlUint32) AccessUnitFileGet(p + 28, 4);
+  for (int i = 0; i < ACCESS_UNIT_FILE_MAX_LAYERS; i ++)
+    {
+    e.m_LayerSize[i]    = (igtlUint32) AccessUnitFileGet(p + 32 + 4 * i, 4);
+    e.m_LayerBitrate[i] = (igtlUint32) AccessUnitFileGet(p + 48 + 4 * i, 4);
+    }
+}
+
+// Writes an access unit file front to back: BeginFrame() with the
+// index entry of an access unit, then Write() its messages layer by
+// layer. Close() appends the index; a file that was not closed has no
+// index and does not open.
+class AccessUnitFileWriter : public igtl::Object
+{
+public:
+  typedef AccessUnitFileWriter           Self;
+  typedef igtl::Object                   Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(AccessUnitFileWriter, igtl::Object);
+  igtlNewMacro(AccessUnitFileWriter);
+
+  bool Open(const std::string& fileName, unsigned int width, unsigned int height)
+  {
+    this->Close();
+    this->m_File = fopen(fileName.c_str(), "wb");
+    if (this->m_File == NULL)
+      {
+      std::cerr << "Cannot open " << fileName << std::endl;
+      return false;
+      }
+    this->m_Width = width;
+    this->m_Height = height;
+    this->m_Index.clear();
+    // Rewritten by Close() with the frame count and the index offset
+    unsigned char header[ACCESS_UNIT_FILE_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    this->m_Position = 0;
+    this->m_Failed = false;
+    this->Write(header, sizeof(header));
+    return !this->m_Failed;
+  };
+
+  bool IsOpen() const                       { return this->m_File != NULL; };
+  igtlUint64 GetNumberOfFrames() const      { return this->m_Index.size(); };
+  // Bytes written so far, header included
+  igtlUint64 GetSize() const                { return this->m_Position; };
+
+  // Starts an access unit; the entry's offset is filled in
+  void BeginFrame(const AccessUnitIndexEntry& entry)
+  {
+    this->m_Index.push_back(entry);
+    this->m_Index.back().m_Offset = this->m_Position;
+  };
+  // Entry of the access unit being written, e.g. to add to its layer
+  // sizes while its messages arrive
+  AccessUnitIndexEntry& GetLastEntry()      { return this->m_Index.back(); };
+
+  void Write(const void* data, igtlUint64 size)
+  {
+    if (this->m_File && !this->m_Failed && fwrite(data, 1, (size_t) size, this->m_File) != size)
+      {
+      this->m_Failed = true;
+      }
+    this->m_Position += size;
+  };
+
+  // Appends the index and completes the header. False if anything could
+  // not be written.
+  bool Close()
+  {
+    if (this->m_File == NULL)
+      {
+      return false;
+      }
+    igtlUint64 indexOffset = this->m_Position;
+    unsigned char entry[ACCESS_UNIT_FILE_ENTRY_SIZE];
+    for (size_t i = 0; i < this->m_Index.size(); i ++)
+      {
+      PackAccessUnitIndexEntry(entry, this->m_Index[i]);
+      this->Write(entry, sizeof(entry));
+      }
+    unsigned char header[ACCESS_UNIT_FILE_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, ACCESS_UNIT_FILE_MAGIC, 8);
+    AccessUnitFilePut(header + 8,  this->m_Index.size(), 8);
+    AccessUnitFilePut(header + 16, indexOffset, 8);
+    AccessUnitFilePut(header + 24, this->m_Width, 4);
+    AccessUnitFilePut(header + 28, this->m_Height, 4);
+    if (fseek(this->m_File, 0, SEEK_SET) != 0 ||
+        fwrite(header, 1, sizeof(header), this->m_File) != sizeof(header))
+      {
+      this->m_Failed = true;
+      }
+    if (fclose(this->m_File) != 0)
+      {
+      this->m_Failed = true;
+      }
+    this->m_File = NULL;
+    return !this->m_Failed;
+  };
+
+protected:
+  AccessUnitFileWriter()
+    : m_File(NULL), m_Position(0), m_Width(0), m_Height(0), m_Failed(false)
+  {
+  };
+  ~AccessUnitFileWriter()
+  {
+    this->Close();
+  };
+
+  FILE*                             m_File;
+  igtlUint64                        m_Position;
+  unsigned int                      m_Width;
+  unsigned int                      m_Height;
+  bool                              m_Failed;
+  std::vector<AccessUnitIndexEntry> m_Index;
+};
+
+// An access unit file mapped into memory. The messages are handed out as
+// pointers into the mapping, so a replay writes them to the sockets from
+// the page cache without reading them into buffers first.
+class AccessUnitFile : public igtl::Object
+{
+public:
+  typedef AccessUnitFile                 Self;
+  typedef igtl::Object                   Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(AccessUnitFile, igtl::Object);
+  igtlNewMacro(AccessUnitFile);
+
+  // Maps the file and reads its index. False if it is not a complete
+  // access unit file.
+  bool Open(const std::string& fileName)
+  {
+    this->Close();
+#if defined(_WIN32)
+    this->m_File = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (this->m_File == INVALID_HANDLE_VALUE)
+      {
+      std::cerr << "Cannot open " << fileName << std::endl;
+      return false;
+      }
+    LARGE_INTEGER size;
+    GetFileSizeEx(this->m_File, &size);
+    this->m_MappedSize = (igtlUint64) size.QuadPart;
+    if (this->m_MappedSize >= ACCESS_UNIT_FILE_HEADER_SIZE)
+      {
+      this->m_Mapping = CreateFileMappingA(this->m_File, NULL, PAGE_READONLY, 0, 0, NULL);
+      if (this->m_Mapping != NULL)
+        {
+        this->m_Data = (unsigned char*) MapViewOfFile(this->m_Mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+      }
+#else
+    this->m_File = open(fileName.c_str(), O_RDONLY);
+    if (this->m_File < 0)
+      {
+      std::cerr << "Cannot open " << fileName << std::endl;
+      return false;
+      }
+    struct stat st;
+    fstat(this->m_File, &st);
+    this->m_MappedSize = (igtlUint64) st.st_size;
+    if (this->m_MappedSize >= ACCESS_UNIT_FILE_HEADER_SIZE)
+      {
+      void* data = mmap(NULL, this->m_MappedSize, PROT_READ, MAP_SHARED, this->m_File, 0);
+      if (data != MAP_FAILED)
+        {
+        this->m_Data = (unsigned char*) data;
+        }
+      }
+#endif
+    if (this->m_Data == NULL || !this->ReadIndex())
+      {
+      std::cerr << fileName << " is not a complete access unit file" << std::endl;
+      this->Close();
+      return false;
+      }
+    return true;
+  };
+
+  void Close()
+  {
+#if defined(_WIN32)
+    if (this->m_Data)
+      {
+      UnmapViewOfFile(this->m_Data);
+      }
+    if (this->m_Mapping)
+      {
+      CloseHandle(this->m_Mapping);
+      this->m_Mapping = NULL;
+      }
+    if (this->m_File != INVALID_HANDLE_VALUE)
+      {
+      CloseHandle(this->m_File);
+      this->m_File = INVALID_HANDLE_VALUE;
+      }
+#else
+    if (this->m_Data)
+      {
+      munmap(this->m_Data, this->m_MappedSize);
+      }
+    if (this->m_File >= 0)
+      {
+      close(this->m_File);
+      this->m_File = -1;
+      }
+#endif
+    this->m_Data = NULL;
+    this->m_MappedSize = 0;
+    this->m_Index.clear();
+  };
+
+  bool IsOpen() const                         { return this->m_Data != NULL; };
+  igtlUint64 GetNumberOfFrames() const        { return this->m_Index.size(); };
+  unsigned int GetWidth() const               { return this->m_Width; };
+  unsigned int GetHeight() const              { return this->m_Height; };
+  const AccessUnitIndexEntry& GetEntry(igtlUint64 index) const { return this->m_Index[index]; };
+
+  // First message of access unit 'index'; its layers follow. Valid
+  // until Close().
+  const unsigned char* GetFrameData(igtlUint64 index) const
+  {
+    return this->m_Data + this->m_Index[index].m_Offset;
+  };
+
+  // The IDR at or before 'index' (the first one if there is none
+  // before), where decoding of a stream started at 'index' can begin
+  igtlUint64 FindKeyFrame(igtlUint64 index) const
+  {
+    if (this->m_Index.empty())
+      {
+      return 0;
+      }
+    if (index >= this->m_Index.size())
+      {
+      index = this->m_Index.size() - 1;
+      }
+    for (igtlUint64 i = index + 1; i > 0; i --)
+      {
+      if (this->m_Index[i - 1].m_IDR)
+        {
+        return i - 1;
+        }
+      }
+    for (igtlUint64 i = index + 1; i < this->m_Index.size(); i ++)
+      {
+      if (this->m_Index[i].m_IDR)
+        {
+        return i;
+        }
+      }
+    return 0;
+  };
+
+  // The first IDR from 'index' on, wrapping around at the end of the
+  // file; 'index' itself if the file has no other IDR
+  igtlUint64 FindNextKeyFrame(igtlUint64 index) const
+  {
+    igtlUint64 n = this->m_Index.size();
+    if (index >= n)
+      {
+      return 0;
+      }
+    for (igtlUint64 i = 0; i < n; i ++)
+      {
+      if (this->m_Index[(index + i) % n].m_IDR)
+        {
+        return (index + i) % n;
+        }
+      }
+    return index;
+  };
+
+  // Asks the kernel to read access unit 'index' ahead and faults its
+  // pages in on the calling thread
+  void Prefetch(igtlUint64 index) const
+  {
+    if (index >= this->m_Index.size())
+      {
+      return;
+      }
+    igtlUint64 offset = this->m_Index[index].m_Offset;
+    igtlUint64 size = this->m_Index[index].GetSize();
+    if (size == 0)
+      {
+      return;
+      }
+#if !defined(_WIN32)
+    igtlUint64 start = offset & ~((igtlUint64) ACCESS_UNIT_FILE_PAGE_SIZE - 1);
+    madvise(this->m_Data + start, (size_t) (offset + size - start), MADV_WILLNEED);
+#endif
+    volatile unsigned char sink = 0;
+    for (igtlUint64 i = 0; i < size; i += ACCESS_UNIT_FILE_PAGE_SIZE)
+      {
+      sink ^= this->m_Data[offset + i];
+      }
+    sink ^= this->m_Data[offset + size - 1];
+  };
+
+protected:
+  AccessUnitFile()
+    : m_Data(NULL), m_MappedSize(0), m_Width(0), m_Height(0)
+  {
+#if defined(_WIN32)
+    this->m_File = INVALID_HANDLE_VALUE;
+    this->m_Mapping = NULL;
+#else
+    this->m_File = -1;
+#endif
+  };
+  ~AccessUnitFile()
+  {
+    this->Close();
+  };
+
+  // Checks the header and that every access unit lies in front of the
+  // index
+  bool ReadIndex()
+  {
+    if (memcmp(this->m_Data, ACCESS_UNIT_FILE_MAGIC, 8) != 0)
+      {
+      return false;
+      }
+    igtlUint64 frames      = AccessUnitFileGet(this->m_Data + 8, 8);
+    igtlUint64 indexOffset = AccessUnitFileGet(this->m_Data + 16, 8);
+    this->m_Width  = (unsigned int) AccessUnitFileGet(this->m_Data + 24, 4);
+    this->m_Height = (unsigned int) AccessUnitFileGet(this->m_Data + 28, 4);
+    if (indexOffset < ACCESS_UNIT_FILE_HEADER_SIZE || indexOffset > this->m_MappedSize ||
+        frames > (this->m_MappedSize - indexOffset) / ACCESS_UNIT_FILE_ENTRY_SIZE)
+      {
+      return false;
+      }
+    this->m_Index.resize((size_t) frames);
+    for (igtlUint64 i = 0; i < frames; i ++)
+      {
+      AccessUnitIndexEntry& entry = this->m_Index[i];
+      UnpackAccessUnitIndexEntry(this->m_Data + indexOffset + i * ACCESS_UNIT_FILE_ENTRY_SIZE, entry);
+      if (entry.m_NumberOfLayers < 1 || entry.m_NumberOfLayers > ACCESS_UNIT_FILE_MAX_LAYERS ||
+          entry.m_Offset < ACCESS_UNIT_FILE_HEADER_SIZE || entry.m_Offset > indexOffset ||
+          entry.GetSize() > indexOffset - entry.m_Offset)
+        {
+        return false;
+        }
+      }
+    return !this->m_Index.empty();
+  };
+
+#if defined(_WIN32)
+  HANDLE                            m_File;
+  HANDLE                            m_Mapping;
+#else
+  int                               m_File;
+#endif
+  unsigned char*                    m_Data;
+  igtlUint64                        m_MappedSize;
+  unsigned int                      m_Width;
+  unsigned int                      m_Height;
+  std::vector<AccessUnitIndexEntry> m_Index;
+};
+
+#endif // __AccessUnitFile_h
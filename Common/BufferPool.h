@@ -0,0 +1,171 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __BufferPool_h
+#define __BufferPool_h
+
+#include <vector>
+
+#include "igtlObject.h"
+#include "igtlMutexLock.h"
+#include "igtlTypes.h"
+
+#define BUFFER_POOL_MIN_CLASS_BITS 12  // 4 KiB
+#define BUFFER_POOL_NUM_CLASSES    20  // up to 2 GiB
+
+// Size-classed free lists of byte buffers shared by the frames of a
+// stream. Every request is rounded up to a power of two, so bit streams
+// whose size varies from frame to frame keep hitting the same few classes
+// and, once each class has warmed up, no frame touches the heap.
+//
+// GetNumberOfAllocations() counts the buffers that actually came from the
+// heap; it stops growing in steady state.
+class BufferPool : public igtl::Object
+{
+public:
+  typedef BufferPool                     Self;
+  typedef igtl::Object                   Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(BufferPool, igtl::Object);
+  igtlNewMacro(BufferPool);
+
+  // Returns a buffer of at least 'size' bytes and stores its real size
+  // in 'capacity', which must be handed back to Release().
+  unsigned char* Acquire(igtlUint64 size, igtlUint64& capacity)
+  {
+    int c = SizeClass(size);
+    this->m_Lock->Lock();
+    ++ this->m_Acquisitions;
+    if (c >= 0)
+      {
+      capacity = ((igtlUint64) 1) << (c + BUFFER_POOL_MIN_CLASS_BITS);
+      if (!this->m_FreeLists[c].empty())
+        {
+        unsigned char* buffer = this->m_FreeLists[c].back();
+        this->m_FreeLists[c].pop_back();
+        this->m_Lock->Unlock();
+        return buffer;
+        }
+      }
+    else
+      {
+      capacity = size;
+      }
+    ++ this->m_Allocations;
+    this->m_BytesAllocated += capacity;
+    this->m_Lock->Unlock();
+    return new unsigned char[capacity];
+  };
+
+  void Release(unsigned char* buffer, igtlUint64 capacity)
+  {
+    if (buffer == NULL)
+      {
+      return;
+      }
+    int c = SizeClass(capacity);
+    if (c < 0 || (((igtlUint64) 1) << (c + BUFFER_POOL_MIN_CLASS_BITS)) != capacity)
+      {
+      // Oversized buffers are not kept
+      this->m_Lock->Lock();
+      this->m_BytesAllocated -= capacity;
+      this->m_Lock->Unlock();
+      delete [] buffer;
+      return;
+      }
+    this->m_Lock->Lock();
+    this->m_FreeLists[c].push_back(buffer);
+    this->m_Lock->Unlock();
+  };
+
+  // Heap allocations made by the pool since it was created
+  igtlUint64 GetNumberOfAllocations()
+  {
+    this->m_Lock->Lock();
+    igtlUint64 n = this->m_Allocations;
+    this->m_Lock->Unlock();
+    return n;
+  };
+
+  igtlUint64 GetNumberOfAcquisitions()
+  {
+    this->m_Lock->Lock();
+    igtlUint64 n = this->m_Acquisitions;
+    this->m_Lock->Unlock();
+    return n;
+  };
+
+  igtlUint64 GetBytesAllocated()
+  {
+    this->m_Lock->Lock();
+    igtlUint64 n = this->m_BytesAllocated;
+    this->m_Lock->Unlock();
+    return n;
+  };
+
+  // Lets objects built around the pool's buffers (frames, messages)
+  // report their own heap allocations in the same counter.
+  void CountAllocation()
+  {
+    this->m_Lock->Lock();
+    ++ this->m_Allocations;
+    this->m_Lock->Unlock();
+  };
+
+protected:
+  BufferPool() : m_Allocations(0), m_Acquisitions(0), m_BytesAllocated(0)
+  {
+    this->m_Lock = igtl::MutexLock::New();
+    for (int c = 0; c < BUFFER_POOL_NUM_CLASSES; c ++)
+      {
+      this->m_FreeLists[c].reserve(16);
+      }
+  };
+  ~BufferPool()
+  {
+    for (int c = 0; c < BUFFER_POOL_NUM_CLASSES; c ++)
+      {
+      for (unsigned int i = 0; i < this->m_FreeLists[c].size(); i ++)
+        {
+        delete [] this->m_FreeLists[c][i];
+        }
+      }
+  };
+
+  // Index of the smallest class that holds 'size' bytes, or -1 when the
+  // request is larger than the largest class.
+  static int SizeClass(igtlUint64 size)
+  {
+    int c = 0;
+    igtlUint64 s = ((igtlUint64) 1) << BUFFER_POOL_MIN_CLASS_BITS;
+    while (s < size)
+      {
+      s <<= 1;
+      if (++ c >= BUFFER_POOL_NUM_CLASSES)
+        {
+        return -1;
+        }
+      }
+    return c;
+  };
+
+  std::vector<unsigned char*> m_FreeLists[BUFFER_POOL_NUM_CLASSES];
+  igtl::MutexLock::Pointer    m_Lock;
+  igtlUint64                  m_Allocations;
+  igtlUint64                  m_Acquisitions;
+  igtlUint64                  m_BytesAllocated;
+};
+
+#endif // __BufferPool_h
@@ -0,0 +1,35 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __CPUFeatures_h
+#define __CPUFeatures_h
+
+// Run time checks for the instruction sets that the vectorized kernels
+// are compiled for without being enabled for the whole build
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+  #define CPU_FEATURES_X86
+#endif
+
+#if defined(CPU_FEATURES_X86)
+inline bool CPUSupportsAVX2() {
+  static int iSupported = -1;
+  if (iSupported < 0) {
+    __builtin_cpu_init();
+    iSupported = __builtin_cpu_supports ("avx2") ? 1 : 0;
+  }
+  return iSupported != 0;
+}
+#endif
+
+#endif // __CPUFeatures_h
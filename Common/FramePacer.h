@@ -0,0 +1,219 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __FramePacer_h
+#define __FramePacer_h
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include "MonotonicClock.h"
+
+#define FRAME_PACER_MAX_SAMPLES 8192
+
+// Releases frames on a fixed grid of absolute deadlines, so the time
+// spent producing a frame does not add up from frame to frame the way a
+// sleep of one interval after each frame does.
+//
+// When the producer falls behind, the policy decides what happens:
+//  CATCH_UP  late frames go out back to back until the grid is reached
+//            again; after more than MaxCatchUp periods the grid is
+//            moved to now instead of bursting.
+//  SKIP      the grid is kept and frames whose slot has fully passed
+//            are skipped, so the output stays in step with real time
+//            at a lower frame count.
+//
+// Report() prints the requested and achieved rate, percentiles of the
+// jitter (how far each gap between two releases is from the period) and
+// of the lateness of each release against its deadline. Frames dropped
+// with DropFrame() are counted apart and take no part in the rate and
+// jitter.
+class FramePacer
+{
+public:
+  enum Policy
+  {
+    CATCH_UP,
+    SKIP
+  };
+
+  FramePacer()
+    : m_Policy(CATCH_UP), m_PeriodNs(0), m_MaxCatchUp(3), m_Deadline(0),
+      m_Frames(0), m_Skipped(0), m_Dropped(0), m_FirstRelease(0), m_LastRelease(0)
+  {
+    this->m_LatenessNs.reserve(FRAME_PACER_MAX_SAMPLES);
+    this->m_JitterNs.reserve(FRAME_PACER_MAX_SAMPLES);
+  };
+
+  void SetPolicy(Policy policy)       { this->m_Policy = policy; };
+  Policy GetPolicy() const            { return this->m_Policy; };
+  void SetMaxCatchUp(int periods)     { this->m_MaxCatchUp = periods; };
+  // A change takes effect from the next deadline on
+  void SetPeriodNs(igtlUint64 period) { this->m_PeriodNs = period; };
+  igtlUint64 GetPeriodNs() const      { return this->m_PeriodNs; };
+
+  // Parses "catch-up" or "skip"; returns false for anything else
+  static bool ParsePolicy(const char* name, Policy& policy)
+  {
+    std::string s(name);
+    if (s == "catch-up")
+      {
+      policy = CATCH_UP;
+      return true;
+      }
+    if (s == "skip")
+      {
+      policy = SKIP;
+      return true;
+      }
+    return false;
+  };
+
+  // Call before producing a frame. Under SKIP, returns true when the
+  // frame's slot has already passed; the caller drops the frame and the
+  // deadline moves on by one period.
+  bool ShouldSkip()
+  {
+    if (this->m_Policy != SKIP || this->m_Deadline == 0)
+      {
+      return false;
+      }
+    if (MonotonicTimeNs() > this->m_Deadline + this->m_PeriodNs)
+      {
+      this->m_Deadline += this->m_PeriodNs;
+      ++ this->m_Skipped;
+      return true;
+      }
+    return false;
+  };
+
+  // Call when a frame is ready. Sleeps until its deadline, records how
+  // late the release was and schedules the next deadline.
+  void WaitForDeadline()
+  {
+    igtlUint64 now = MonotonicTimeNs();
+    if (this->m_Deadline == 0)
+      {
+      this->m_Deadline = now;
+      }
+    else if (now < this->m_Deadline)
+      {
+      SleepUntilNs(this->m_Deadline);
+      now = MonotonicTimeNs();
+      }
+    igtlUint64 lateness = now > this->m_Deadline ? now - this->m_Deadline : 0;
+    if (this->m_LatenessNs.size() < FRAME_PACER_MAX_SAMPLES)
+      {
+      this->m_LatenessNs.push_back(lateness);
+      }
+    // Too far behind to catch up without a burst: start a new grid from
+    // now. SKIP keeps the grid; ShouldSkip() drops the missed slots.
+    if (this->m_Policy == CATCH_UP && lateness > (igtlUint64) this->m_MaxCatchUp * this->m_PeriodNs)
+      {
+      this->m_Deadline = now;
+      }
+
+    if (this->m_Frames == 0)
+      {
+      this->m_FirstRelease = now;
+      }
+    else if (this->m_JitterNs.size() < FRAME_PACER_MAX_SAMPLES)
+      {
+      igtlUint64 gap = now - this->m_LastRelease;
+      this->m_JitterNs.push_back(gap > this->m_PeriodNs ? gap - this->m_PeriodNs : this->m_PeriodNs - gap);
+      }
+    this->m_LastRelease = now;
+    ++ this->m_Frames;
+    this->m_Deadline += this->m_PeriodNs;
+  };
+
+  // Call instead of WaitForDeadline() for a frame that is dropped once
+  // its slot has begun, e.g. to let congested queues drain. Sleeps until
+  // the deadline and schedules the next one, but records no release.
+  void DropFrame()
+  {
+    igtlUint64 now = MonotonicTimeNs();
+    if (this->m_Deadline == 0)
+      {
+      this->m_Deadline = now;
+      }
+    else if (now < this->m_Deadline)
+      {
+      SleepUntilNs(this->m_Deadline);
+      now = MonotonicTimeNs();
+      }
+    if (this->m_Policy == CATCH_UP && now > this->m_Deadline + (igtlUint64) this->m_MaxCatchUp * this->m_PeriodNs)
+      {
+      this->m_Deadline = now;
+      }
+    ++ this->m_Dropped;
+    this->m_Deadline += this->m_PeriodNs;
+  };
+
+  // Prints the statistics gathered since the last call and starts over
+  void Report(FILE* fp)
+  {
+    double requested = this->m_PeriodNs > 0 ? 1e9 / (double) this->m_PeriodNs : 0.0;
+    double achieved = 0.0;
+    if (this->m_Frames > 1 && this->m_LastRelease > this->m_FirstRelease)
+      {
+      achieved = (double) (this->m_Frames - 1) * 1e9 / (double) (this->m_LastRelease - this->m_FirstRelease);
+      }
+    fprintf(fp, "Pacing: requested %.2f fps, achieved %.2f fps, %llu frames, %llu skipped, %llu dropped\n",
+            requested, achieved, (unsigned long long) this->m_Frames, (unsigned long long) this->m_Skipped,
+            (unsigned long long) this->m_Dropped);
+    PrintPercentiles(fp, "  jitter:  ", this->m_JitterNs);
+    PrintPercentiles(fp, "  lateness:", this->m_LatenessNs);
+    this->m_JitterNs.clear();
+    this->m_LatenessNs.clear();
+    this->m_Frames = 0;
+    this->m_Skipped = 0;
+    this->m_Dropped = 0;
+  };
+
+protected:
+  static void PrintPercentiles(FILE* fp, const char* name, std::vector<igtlUint64>& samples)
+  {
+    std::sort(samples.begin(), samples.end());
+    fprintf(fp, "%s p50 %.3f ms  p90 %.3f ms  p99 %.3f ms  max %.3f ms\n", name,
+            Percentile(samples, 0.50) / 1e6, Percentile(samples, 0.90) / 1e6,
+            Percentile(samples, 0.99) / 1e6, Percentile(samples, 1.00) / 1e6);
+  };
+
+  // Expects 'sorted' in ascending order
+  static double Percentile(const std::vector<igtlUint64>& sorted, double p)
+  {
+    if (sorted.empty())
+      {
+      return 0.0;
+      }
+    size_t i = (size_t) (p * (sorted.size() - 1) + 0.5);
+    return (double) sorted[i];
+  };
+
+  Policy                  m_Policy;
+  igtlUint64              m_PeriodNs;
+  int                     m_MaxCatchUp;
+  igtlUint64              m_Deadline;
+  igtlUint64              m_Frames;
+  igtlUint64              m_Skipped;
+  igtlUint64              m_Dropped;
+  igtlUint64              m_FirstRelease;
+  igtlUint64              m_LastRelease;
+  std::vector<igtlUint64> m_LatenessNs;
+  std::vector<igtlUint64> m_JitterNs;
+};
+
+#endif // __FramePacer_h
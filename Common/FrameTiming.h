@@ -0,0 +1,98 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __FrameTiming_h
+#define __FrameTiming_h
+
+#include <cstring>
+
+#include "igtl_header.h"
+#include "igtl_util.h"
+#include "igtlTypes.h"
+
+// Device type of the message that carries the time stamps of an access
+// unit. With tracing on, the server sends one right before the VIDEO
+// message(s) of every access unit, under the same device name; receivers
+// that do not know it skip it like any other message.
+#define FRAME_TIMING_DEVICE_TYPE  "FRAME_TIME"
+#define FRAME_TIMING_BODY_SIZE    32
+#define FRAME_TIMING_MESSAGE_SIZE (IGTL_HEADER_SIZE + FRAME_TIMING_BODY_SIZE)
+
+// Life of one access unit, in MonotonicTimeNs() of the machine that took
+// each stamp. Across machines only the differences between stamps of the
+// same side are meaningful; on one machine (loopback) the clock is
+// shared and every stage can be measured. 0 means not taken.
+struct FrameTiming
+{
+  // Server side, sent on the wire
+  igtlUint64 m_FrameIndex;
+  igtlUint64 m_CaptureTime;   // the raw picture was taken for encoding
+  igtlUint64 m_EncodedTime;   // the encoder returned its bit stream
+  igtlUint64 m_SentTime;      // the client session began writing it
+  // Receiver side
+  igtlUint64 m_ReceivedTime;  // its last message was read from the socket
+  igtlUint64 m_DecodedTime;   // the decoder put the picture out
+  igtlUint64 m_WrittenTime;   // every sink has taken the picture
+};
+
+// Writes a FRAME_TIMING message (FRAME_TIMING_MESSAGE_SIZE bytes) to
+// 'message'. The IGTL header is taken from 'videoHeader', the header of
+// a VIDEO message of the same stream, for its version, device name and
+// time stamp.
+inline void PackFrameTiming(unsigned char* message, const unsigned char* videoHeader, const FrameTiming& timing)
+{
+  unsigned char* body = message + IGTL_HEADER_SIZE;
+  igtlUint64 fields[4] = { timing.m_FrameIndex, timing.m_CaptureTime, timing.m_EncodedTime, timing.m_SentTime };
+  for (int i = 0; i < 4; i ++)
+    {
+    // Network byte order, like every IGTL field
+    for (int b = 0; b < 8; b ++)
+      {
+      body[8 * i + b] = (unsigned char) (fields[i] >> (56 - 8 * b));
+      }
+    }
+
+  igtl_header h;
+  memcpy(&h, videoHeader, IGTL_HEADER_SIZE);
+  igtl_header_convert_byte_order(&h);
+  memset(h.name, 0, IGTL_HEADER_TYPE_SIZE);
+  strncpy(h.name, FRAME_TIMING_DEVICE_TYPE, IGTL_HEADER_TYPE_SIZE);
+  h.body_size = FRAME_TIMING_BODY_SIZE;
+  h.crc       = crc64(body, FRAME_TIMING_BODY_SIZE, crc64(0, 0, 0LL));
+  igtl_header_convert_byte_order(&h);
+  memcpy(message, &h, IGTL_HEADER_SIZE);
+}
+
+// Reads the server side stamps from the body of a FRAME_TIMING message
+// and clears the receiver side ones
+inline void UnpackFrameTiming(const unsigned char* body, FrameTiming& timing)
+{
+  igtlUint64 fields[4];
+  for (int i = 0; i < 4; i ++)
+    {
+    fields[i] = 0;
+    for (int b = 0; b < 8; b ++)
+      {
+      fields[i] = (fields[i] << 8) | body[8 * i + b];
+      }
+    }
+  timing.m_FrameIndex   = fields[0];
+  timing.m_CaptureTime  = fields[1];
+  timing.m_EncodedTime  = fields[2];
+  timing.m_SentTime     = fields[3];
+  timing.m_ReceivedTime = 0;
+  timing.m_DecodedTime  = 0;
+  timing.m_WrittenTime  = 0;
+}
+
+#endif // __FrameTiming_h
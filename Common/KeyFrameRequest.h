@@ -0,0 +1,42 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __KeyFrameRequest_h
+#define __KeyFrameRequest_h
+
+#include <cstring>
+
+#include "igtl_header.h"
+#include "igtl_util.h"
+#include "igtlSocket.h"
+
+// Message type a receiver sends to ask the server for an IDR, e.g. after
+// it lost a frame. The message has no body; the server limits how often
+// such requests reach the encoder.
+#define KEY_FRAME_REQUEST_TYPE "GET_IDR"
+
+// Sends a key frame request. Returns 0 if the socket failed.
+inline int SendKeyFrameRequest(igtl::Socket* socket, const char* deviceName)
+{
+  igtl_header h;
+  memset(&h, 0, sizeof(h));
+  h.version = IGTL_HEADER_VERSION_1;
+  strncpy(h.name, KEY_FRAME_REQUEST_TYPE, IGTL_HEADER_TYPE_SIZE);
+  strncpy(h.device_name, deviceName, IGTL_HEADER_NAME_SIZE);
+  h.body_size = 0;
+  h.crc = crc64(0, 0, 0LL);
+  igtl_header_convert_byte_order(&h);
+  return socket->Send(&h, IGTL_HEADER_SIZE);
+}
+
+#endif // __KeyFrameRequest_h
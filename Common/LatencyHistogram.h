@@ -0,0 +1,150 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __LatencyHistogram_h
+#define __LatencyHistogram_h
+
+#include <atomic>
+#include <cstdio>
+
+#include "igtlTypes.h"
+
+// Microseconds below this are counted one bucket each; above, every
+// power of two is split into LATENCY_HISTOGRAM_SUB_BUCKETS buckets, so a
+// bucket is at most 1/8 (12.5 %) wide relative to its value.
+#define LATENCY_HISTOGRAM_SUB_BUCKETS 8
+// Up to 2^40 us, about 12 days
+#define LATENCY_HISTOGRAM_MAX_EXPONENT 40
+#define LATENCY_HISTOGRAM_BUCKETS ((LATENCY_HISTOGRAM_MAX_EXPONENT - 2) * LATENCY_HISTOGRAM_SUB_BUCKETS)
+
+// Fixed size log-linear histogram of durations. Record() is lock free
+// and may be called from any thread; readers see a consistent enough
+// picture for reporting without stopping the writers. Nothing is
+// allocated, so it can stay on for the whole session.
+class LatencyHistogram
+{
+public:
+  LatencyHistogram()
+  {
+    this->Reset();
+  };
+
+  void Record(igtlUint64 ns)
+  {
+    igtlUint64 us = ns / 1000;
+    this->m_Buckets[BucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+    this->m_Count.fetch_add(1, std::memory_order_relaxed);
+    this->m_SumNs.fetch_add(ns, std::memory_order_relaxed);
+    igtlUint64 max = this->m_MaxNs.load(std::memory_order_relaxed);
+    while (ns > max && !this->m_MaxNs.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+      {
+      }
+  };
+
+  void Reset()
+  {
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i ++)
+      {
+      this->m_Buckets[i].store(0, std::memory_order_relaxed);
+      }
+    this->m_Count.store(0, std::memory_order_relaxed);
+    this->m_SumNs.store(0, std::memory_order_relaxed);
+    this->m_MaxNs.store(0, std::memory_order_relaxed);
+  };
+
+  igtlUint64 GetCount() const { return this->m_Count.load(std::memory_order_relaxed); };
+  igtlUint64 GetSumNs() const { return this->m_SumNs.load(std::memory_order_relaxed); };
+  igtlUint64 GetMaxNs() const { return this->m_MaxNs.load(std::memory_order_relaxed); };
+  igtlUint64 GetBucketCount(int bucket) const { return this->m_Buckets[bucket].load(std::memory_order_relaxed); };
+
+  // Upper bound of the bucket holding the p-th percentile (0..100), so
+  // the true value is never above it; capped at the largest sample
+  igtlUint64 GetPercentileNs(double p) const
+  {
+    igtlUint64 count = this->GetCount();
+    if (count == 0)
+      {
+      return 0;
+      }
+    igtlUint64 rank = (igtlUint64) (p / 100.0 * (double) count + 0.5);
+    if (rank < 1)
+      {
+      rank = 1;
+      }
+    igtlUint64 seen = 0;
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i ++)
+      {
+      seen += this->GetBucketCount(i);
+      if (seen >= rank)
+        {
+        igtlUint64 bound = GetBucketUpperBoundUs(i) * 1000;
+        return bound < this->GetMaxNs() ? bound : this->GetMaxNs();
+        }
+      }
+    return this->GetMaxNs();
+  };
+
+  // Durations in bucket 'bucket' are below this many microseconds
+  static igtlUint64 GetBucketUpperBoundUs(int bucket)
+  {
+    return GetBucketLowerBoundUs(bucket + 1);
+  };
+
+  static igtlUint64 GetBucketLowerBoundUs(int bucket)
+  {
+    if (bucket < LATENCY_HISTOGRAM_SUB_BUCKETS)
+      {
+      return (igtlUint64) bucket;
+      }
+    int exponent = bucket / LATENCY_HISTOGRAM_SUB_BUCKETS + 2;
+    igtlUint64 mantissa = LATENCY_HISTOGRAM_SUB_BUCKETS + bucket % LATENCY_HISTOGRAM_SUB_BUCKETS;
+    return mantissa << (exponent - 3);
+  };
+
+  // One line: count, mean, percentiles and maximum in milliseconds
+  void Print(FILE* fp, const char* name) const
+  {
+    igtlUint64 count = this->GetCount();
+    fprintf(fp, "%s %llu samples  mean %.3f ms  p50 %.3f ms  p90 %.3f ms  p99 %.3f ms  max %.3f ms\n", name,
+            (unsigned long long) count, count > 0 ? this->GetSumNs() / 1e6 / count : 0.0,
+            this->GetPercentileNs(50) / 1e6, this->GetPercentileNs(90) / 1e6,
+            this->GetPercentileNs(99) / 1e6, this->GetMaxNs() / 1e6);
+  };
+
+protected:
+  static int BucketOf(igtlUint64 us)
+  {
+    if (us < LATENCY_HISTOGRAM_SUB_BUCKETS)
+      {
+      return (int) us;
+      }
+    int exponent = 3;
+    while (exponent < LATENCY_HISTOGRAM_MAX_EXPONENT - 1 && (us >> (exponent + 1)) != 0)
+      {
+      ++ exponent;
+      }
+    if ((us >> (exponent + 1)) != 0)
+      {
+      return LATENCY_HISTOGRAM_BUCKETS - 1;
+      }
+    int sub = (int) ((us >> (exponent - 3)) & (LATENCY_HISTOGRAM_SUB_BUCKETS - 1));
+    return (exponent - 2) * LATENCY_HISTOGRAM_SUB_BUCKETS + sub;
+  };
+
+  std::atomic<igtlUint64> m_Buckets[LATENCY_HISTOGRAM_BUCKETS];
+  std::atomic<igtlUint64> m_Count;
+  std::atomic<igtlUint64> m_SumNs;
+  std::atomic<igtlUint64> m_MaxNs;
+};
+
+#endif // __LatencyHistogram_h
@@ -0,0 +1,334 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __MetricsRegistry_h
+#define __MetricsRegistry_h
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "igtlObject.h"
+#include "igtlMutexLock.h"
+#include "igtlMultiThreader.h"
+
+#include "LatencyHistogram.h"
+#include "MonotonicClock.h"
+
+#define METRICS_DEFAULT_INTERVAL_MS 1000
+
+// Monotonically increasing count, e.g. frames or bytes
+class MetricsCounter
+{
+public:
+  MetricsCounter() : m_Value(0) {};
+  void Add(igtlUint64 n = 1) { this->m_Value.fetch_add(n, std::memory_order_relaxed); };
+  igtlUint64 Get() const     { return this->m_Value.load(std::memory_order_relaxed); };
+
+protected:
+  std::atomic<igtlUint64> m_Value;
+};
+
+// Value that goes up and down, e.g. a queue depth or the bitrate
+class MetricsGauge
+{
+public:
+  MetricsGauge() : m_Value(0.0) {};
+  void Set(double value) { this->m_Value.store(value, std::memory_order_relaxed); };
+  void Add(double delta)
+  {
+    double value = this->m_Value.load(std::memory_order_relaxed);
+    while (!this->m_Value.compare_exchange_weak(value, value + delta, std::memory_order_relaxed))
+      {
+      }
+  };
+  double Get() const     { return this->m_Value.load(std::memory_order_relaxed); };
+
+protected:
+  std::atomic<double> m_Value;
+};
+
+// Named counters, gauges and duration summaries of a process, written in
+// the Prometheus text format. Metrics are created once at setup (under a
+// lock) and then updated from any thread without locking; the objects
+// never move, so callers keep the pointers. Adding the same name and
+// labels again returns the existing metric, so that e.g. every client
+// session can feed the same totals.
+//
+// With a file name set, Start() rewrites the file every interval (and
+// Stop() once more), replacing it atomically, so a node_exporter textfile
+// collector or a script can read it at any time.
+class MetricsRegistry : public igtl::Object
+{
+public:
+  typedef MetricsRegistry                Self;
+  typedef igtl::Object                   Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(MetricsRegistry, igtl::Object);
+  igtlNewMacro(MetricsRegistry);
+
+  // One label of a label list, name="value", with the value escaped as
+  // the text format requires; values may come from the network
+  static std::string Label(const std::string& name, const std::string& value)
+  {
+    std::string label = name + "=\"";
+    for (size_t i = 0; i < value.size(); i ++)
+      {
+      switch (value[i])
+        {
+        case '\\': label += "\\\\"; break;
+        case '"':  label += "\\\""; break;
+        case '\n': label += "\\n"; break;
+        default:   label += value[i]; break;
+        }
+      }
+    return label + "\"";
+  };
+
+  // 'labels' is empty or a Prometheus label list without the braces,
+  // made of Label()s, e.g. device="Video"
+  MetricsCounter* AddCounter(const std::string& name, const std::string& labels, const std::string& help)
+  {
+    return static_cast<MetricsCounter*>(this->Add(COUNTER, name, labels, help));
+  };
+  MetricsGauge* AddGauge(const std::string& name, const std::string& labels, const std::string& help)
+  {
+    return static_cast<MetricsGauge*>(this->Add(GAUGE, name, labels, help));
+  };
+  // Durations, exported in seconds as quantiles, sum and count
+  LatencyHistogram* AddSummary(const std::string& name, const std::string& labels, const std::string& help)
+  {
+    return static_cast<LatencyHistogram*>(this->Add(SUMMARY, name, labels, help));
+  };
+
+  // Every metric in the Prometheus text exposition format
+  std::string Format()
+  {
+    std::string text;
+    this->m_Lock.Lock();
+    std::vector<bool> written(this->m_Entries.size(), false);
+    for (size_t i = 0; i < this->m_Entries.size(); i ++)
+      {
+      if (written[i])
+        {
+        continue;
+        }
+      const Entry& first = this->m_Entries[i];
+      static const char* types[] = { "counter", "gauge", "summary" };
+      text += "# HELP " + first.m_Name + " " + first.m_Help + "\n";
+      text += "# TYPE " + first.m_Name + " " + types[first.m_Type] + "\n";
+      // Series of one name stay together
+      for (size_t j = i; j < this->m_Entries.size(); j ++)
+        {
+        if (!written[j] && this->m_Entries[j].m_Name == first.m_Name)
+          {
+          FormatEntry(this->m_Entries[j], text);
+          written[j] = true;
+          }
+        }
+      }
+    this->m_Lock.Unlock();
+    return text;
+  };
+
+  // Writes Format() to 'fileName' through a temporary file and a rename
+  bool WriteFile(const std::string& fileName)
+  {
+    std::string text = this->Format();
+    std::string temporary = fileName + ".tmp";
+    FILE* fp = fopen(temporary.c_str(), "w");
+    if (fp == NULL)
+      {
+      return false;
+      }
+    bool ok = fwrite(text.data(), 1, text.size(), fp) == text.size();
+    ok = fclose(fp) == 0 && ok;
+#if defined(_WIN32)
+    remove(fileName.c_str());
+#endif
+    return ok && rename(temporary.c_str(), fileName.c_str()) == 0;
+  };
+
+  void SetFileName(const std::string& name) { this->m_FileName = name; };
+  const std::string& GetFileName() const    { return this->m_FileName; };
+  void SetInterval(int ms)                  { this->m_Interval = ms > 0 ? ms : METRICS_DEFAULT_INTERVAL_MS; };
+  int GetInterval() const                   { return this->m_Interval; };
+
+  // Starts writing the file periodically; nothing to do without a name
+  void Start()
+  {
+    if (this->m_FileName.empty() || this->m_ThreadID >= 0)
+      {
+      return;
+      }
+    this->m_Stop = 0;
+    this->m_ThreadID = this->m_Threader->SpawnThread((igtl::ThreadFunctionType) &MetricsRegistry::WriteThread, this);
+  };
+
+  // Stops the writer after a last update of the file
+  void Stop()
+  {
+    if (this->m_ThreadID < 0)
+      {
+      return;
+      }
+    this->m_Stop = 1;
+    this->m_Threader->TerminateThread(this->m_ThreadID);
+    this->m_ThreadID = -1;
+    this->WriteFile(this->m_FileName);
+  };
+
+protected:
+  MetricsRegistry()
+    : m_Interval(METRICS_DEFAULT_INTERVAL_MS), m_ThreadID(-1), m_Stop(0)
+  {
+    this->m_Threader = igtl::MultiThreader::New();
+  };
+  ~MetricsRegistry()
+  {
+    this->Stop();
+    for (size_t i = 0; i < this->m_Entries.size(); i ++)
+      {
+      switch (this->m_Entries[i].m_Type)
+        {
+        case COUNTER: delete static_cast<MetricsCounter*>(this->m_Entries[i].m_Metric); break;
+        case GAUGE:   delete static_cast<MetricsGauge*>(this->m_Entries[i].m_Metric); break;
+        default:      delete static_cast<LatencyHistogram*>(this->m_Entries[i].m_Metric); break;
+        }
+      }
+  };
+
+  enum Type
+  {
+    COUNTER,
+    GAUGE,
+    SUMMARY
+  };
+
+  struct Entry
+  {
+    Type        m_Type;
+    std::string m_Name;
+    std::string m_Labels;
+    std::string m_Help;
+    void*       m_Metric;
+  };
+
+  void* Add(Type type, const std::string& name, const std::string& labels, const std::string& help)
+  {
+    this->m_Lock.Lock();
+    void* metric = NULL;
+    for (size_t i = 0; i < this->m_Entries.size() && metric == NULL; i ++)
+      {
+      const Entry& entry = this->m_Entries[i];
+      if (entry.m_Type == type && entry.m_Name == name && entry.m_Labels == labels)
+        {
+        metric = entry.m_Metric;
+        }
+      }
+    if (metric == NULL)
+      {
+      Entry entry;
+      entry.m_Type = type;
+      entry.m_Name = name;
+      entry.m_Labels = labels;
+      entry.m_Help = help;
+      switch (type)
+        {
+        case COUNTER: entry.m_Metric = new MetricsCounter(); break;
+        case GAUGE:   entry.m_Metric = new MetricsGauge(); break;
+        default:      entry.m_Metric = new LatencyHistogram(); break;
+        }
+      this->m_Entries.push_back(entry);
+      metric = entry.m_Metric;
+      }
+    this->m_Lock.Unlock();
+    return metric;
+  };
+
+  static void FormatSample(std::string& text, const std::string& name, const std::string& labels, double value)
+  {
+    char number[64];
+    snprintf(number, sizeof(number), "%.17g", value);
+    text += name;
+    if (!labels.empty())
+      {
+      text += "{" + labels + "}";
+      }
+    text += " ";
+    text += number;
+    text += "\n";
+  };
+
+  static void FormatEntry(const Entry& entry, std::string& text)
+  {
+    if (entry.m_Type == COUNTER)
+      {
+      FormatSample(text, entry.m_Name, entry.m_Labels, (double) static_cast<MetricsCounter*>(entry.m_Metric)->Get());
+      return;
+      }
+    if (entry.m_Type == GAUGE)
+      {
+      FormatSample(text, entry.m_Name, entry.m_Labels, static_cast<MetricsGauge*>(entry.m_Metric)->Get());
+      return;
+      }
+    const LatencyHistogram* histogram = static_cast<LatencyHistogram*>(entry.m_Metric);
+    static const char* quantiles[] = { "0.5", "0.9", "0.99" };
+    static const double percentiles[] = { 50.0, 90.0, 99.0 };
+    std::string separator = entry.m_Labels.empty() ? "" : ",";
+    for (int q = 0; q < 3; q ++)
+      {
+      FormatSample(text, entry.m_Name, entry.m_Labels + separator + "quantile=\"" + quantiles[q] + "\"",
+                   histogram->GetPercentileNs(percentiles[q]) / 1e9);
+      }
+    FormatSample(text, entry.m_Name + "_sum", entry.m_Labels, histogram->GetSumNs() / 1e9);
+    FormatSample(text, entry.m_Name + "_count", entry.m_Labels, (double) histogram->GetCount());
+  };
+
+  static void* WriteThread(void* ptr)
+  {
+    igtl::MultiThreader::ThreadInfo* info =
+      static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+    MetricsRegistry* registry = static_cast<MetricsRegistry*>(info->UserData);
+
+    igtlUint64 period = (igtlUint64) registry->m_Interval * 1000000ULL;
+    igtlUint64 next = MonotonicTimeNs() + period;
+    while (!registry->m_Stop.load())
+      {
+      // Short naps, so that Stop() does not wait for a whole interval
+      igtlUint64 now = MonotonicTimeNs();
+      if (now < next)
+        {
+        SleepUntilNs(std::min<igtlUint64>(next, now + 100000000ULL));
+        continue;
+        }
+      registry->WriteFile(registry->m_FileName);
+      next += period;
+      }
+    return NULL;
+  };
+
+  igtl::SimpleMutexLock         m_Lock;     // guards m_Entries
+  std::vector<Entry>            m_Entries;
+  std::string                   m_FileName;
+  int                           m_Interval;
+  igtl::MultiThreader::Pointer  m_Threader;
+  int                           m_ThreadID;
+  std::atomic<int>              m_Stop;
+};
+
+#endif // __MetricsRegistry_h
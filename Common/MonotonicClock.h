@@ -0,0 +1,76 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __MonotonicClock_h
+#define __MonotonicClock_h
+
+#include <errno.h>
+
+#if defined(_WIN32)
+  #include <windows.h>
+#else
+  #include <time.h>
+#endif
+
+#include "igtlTypes.h"
+
+// Monotonic time in nanoseconds, unaffected by wall clock adjustments
+inline igtlUint64 MonotonicTimeNs()
+{
+#if defined(_WIN32)
+  static LARGE_INTEGER frequency = {0};
+  if (frequency.QuadPart == 0)
+    {
+    QueryPerformanceFrequency(&frequency);
+    }
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return (igtlUint64) ((double) counter.QuadPart * 1e9 / (double) frequency.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (igtlUint64) ts.tv_sec * 1000000000ULL + (igtlUint64) ts.tv_nsec;
+#endif
+}
+
+// Sleeps until MonotonicTimeNs() reaches 'deadline'
+inline void SleepUntilNs(igtlUint64 deadline)
+{
+#if defined(__linux__)
+  struct timespec ts;
+  ts.tv_sec  = (time_t) (deadline / 1000000000ULL);
+  ts.tv_nsec = (long) (deadline % 1000000000ULL);
+  // Absolute deadline: an interrupted sleep resumes toward the same
+  // instant instead of restarting a relative delay
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    {
+    }
+#else
+  igtlUint64 now = MonotonicTimeNs();
+  while (now < deadline)
+    {
+  #if defined(_WIN32)
+    DWORD ms = (DWORD) ((deadline - now) / 1000000ULL);
+    Sleep(ms > 0 ? ms : 0);
+  #else
+    struct timespec ts;
+    ts.tv_sec  = (time_t) ((deadline - now) / 1000000000ULL);
+    ts.tv_nsec = (long) ((deadline - now) % 1000000000ULL);
+    nanosleep(&ts, NULL);
+  #endif
+    now = MonotonicTimeNs();
+    }
+#endif
+}
+
+#endif // __MonotonicClock_h
@@ -0,0 +1,518 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __PixelFormatConverter_h
+#define __PixelFormatConverter_h
+
+#include <cstring>
+#include <stdint.h>
+
+#include "api/svc/codec_app_def.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define PIXEL_FORMAT_CONVERTER_SSE2
+  #include <emmintrin.h>
+#endif
+#if defined(PIXEL_FORMAT_CONVERTER_SSE2) && (defined(__GNUC__) || defined(__clang__))
+  #define PIXEL_FORMAT_CONVERTER_AVX2
+  #include <immintrin.h>
+#endif
+
+#include "CPUFeatures.h"
+
+// The raw formats a video source may deliver. Pictures are converted
+// into the I420 the encoder takes; the encoder itself only reads I420.
+struct PixelFormat {
+  const char*      pkcName;
+  EVideoFormatType eFormat;
+  int              iBitsPerPixel;
+  const char*      pkcLayout;
+};
+
+static const PixelFormat kPixelFormats[] = {
+  { "i420",  videoFormatI420, 12, "Y plane, then U and V planes of half the width and height" },
+  { "nv12",  videoFormatNV12, 12, "Y plane, then one plane of interleaved U and V" },
+  { "yuyv",  videoFormatYUY2, 16, "Y0 U Y1 V for every two pixels" },
+  { "rgb24", videoFormatRGB,  24, "R G B for every pixel" },
+  { "bgra",  videoFormatBGRA, 32, "B G R A for every pixel" },
+};
+
+static const int kNumberOfPixelFormats = sizeof (kPixelFormats) / sizeof (kPixelFormats[0]);
+
+// Returns NULL when no format has that name
+inline const PixelFormat* FindPixelFormat (const char* pkcName) {
+  if (pkcName == NULL)
+    return NULL;
+  for (int i = 0; i < kNumberOfPixelFormats; i++) {
+    if (strcmp (kPixelFormats[i].pkcName, pkcName) == 0)
+      return &kPixelFormats[i];
+  }
+  return NULL;
+}
+
+inline const PixelFormat* GetPixelFormat (EVideoFormatType eFormat) {
+  for (int i = 0; i < kNumberOfPixelFormats; i++) {
+    if (kPixelFormats[i].eFormat == eFormat)
+      return &kPixelFormats[i];
+  }
+  return NULL;
+}
+
+// Bytes of a tightly packed picture, or 0 for an unknown format
+inline int64_t PixelFormatFrameSize (EVideoFormatType eFormat, int iWidth, int iHeight) {
+  const PixelFormat* pFormat = GetPixelFormat (eFormat);
+  return pFormat ? (int64_t) iWidth * iHeight * pFormat->iBitsPerPixel / 8 : 0;
+}
+
+// RGB to YUV with the full range BT.601 matrix, since the encoder
+// profiles mark the stream as full range. 15 bit fixed point; the rows
+// of U and V sum to 0 and that of Y to 1, so grey stays grey and white
+// stays 255. Chroma is taken from the sum of each 2x2 block, hence the
+// two extra bits of its shift.
+static const int kiYR = 9798;
+static const int kiYG = 19234;
+static const int kiYB = 3736;
+static const int kiUR = -5529;
+static const int kiUG = -10855;
+static const int kiUB = 16384;
+static const int kiVR = 16384;
+static const int kiVG = -13720;
+static const int kiVB = -2664;
+static const int kiLumaRound   = 1 << 14;
+static const int kiChromaRound = (128 << 17) + (1 << 16);
+
+inline unsigned char PixelClamp (int iValue) {
+  return (unsigned char) (iValue < 0 ? 0 : (iValue > 255 ? 255 : iValue));
+}
+
+inline unsigned char RgbToY (int iR, int iG, int iB) {
+  return (unsigned char) ((kiYR * iR + kiYG * iG + kiYB * iB + kiLumaRound) >> 15);
+}
+
+// iR, iG and iB are sums over a 2x2 block
+inline unsigned char RgbSumToU (int iR, int iG, int iB) {
+  return PixelClamp ((kiUR * iR + kiUG * iG + kiUB * iB + kiChromaRound) >> 17);
+}
+
+inline unsigned char RgbSumToV (int iR, int iG, int iB) {
+  return PixelClamp ((kiVR * iR + kiVG * iG + kiVB * iB + kiChromaRound) >> 17);
+}
+
+// Row kernels. Each converts two source rows into two rows of Y and one
+// row of U and V; the interleaved chroma of NV12 is split one row at a
+// time. Width and height are even. The vector kernels convert what fits
+// their width and leave the rest of the row to the scalar one.
+
+// Packed RGB of kiBpp bytes a pixel, green at byte 1 and red at byte 0
+// (kbRedFirst) or 2
+template <int kiBpp, bool kbRedFirst>
+inline void RgbRowsToI420Tail (const unsigned char* pRow0, const unsigned char* pRow1, int iWidth,
+                               unsigned char* pY0, unsigned char* pY1, unsigned char* pU, unsigned char* pV,
+                               int iFrom) {
+  const int iR = kbRedFirst ? 0 : 2;
+  const int iB = 2 - iR;
+  for (int x = iFrom; x < iWidth; x += 2) {
+    const unsigned char* a = pRow0 + x * kiBpp;
+    const unsigned char* b = a + kiBpp;
+    const unsigned char* c = pRow1 + x * kiBpp;
+    const unsigned char* d = c + kiBpp;
+    pY0[x]     = RgbToY (a[iR], a[1], a[iB]);
+    pY0[x + 1] = RgbToY (b[iR], b[1], b[iB]);
+    pY1[x]     = RgbToY (c[iR], c[1], c[iB]);
+    pY1[x + 1] = RgbToY (d[iR], d[1], d[iB]);
+    int r = a[iR] + b[iR] + c[iR] + d[iR];
+    int g = a[1] + b[1] + c[1] + d[1];
+    int bl = a[iB] + b[iB] + c[iB] + d[iB];
+    pU[x >> 1] = RgbSumToU (r, g, bl);
+    pV[x >> 1] = RgbSumToV (r, g, bl);
+  }
+}
+
+template <int kiBpp, bool kbRedFirst>
+inline void RgbRowsToI420Scalar (const unsigned char* pRow0, const unsigned char* pRow1, int iWidth,
+                                 unsigned char* pY0, unsigned char* pY1, unsigned char* pU, unsigned char* pV) {
+  RgbRowsToI420Tail<kiBpp, kbRedFirst> (pRow0, pRow1, iWidth, pY0, pY1, pU, pV, 0);
+}
+
+// Chroma is averaged over the two rows
+inline void YuyvRowsToI420Tail (const unsigned char* pRow0, const unsigned char* pRow1, int iWidth,
+                                unsigned char* pY0, unsigned char* pY1, unsigned char* pU, unsigned char* pV,
+                                int iFrom) {
+  for (int x = iFrom; x < iWidth; x += 2) {
+    const unsigned char* a = pRow0 + 2 * x;
+    const unsigned char* c = pRow1 + 2 * x;
+    pY0[x]     = a[0];
+    pY0[x + 1] = a[2];
+    pY1[x]     = c[0];
+    pY1[x + 1] = c[2];
+    pU[x >> 1] = (unsigned char) ((a[1] + c[1] + 1) >> 1);
+    pV[x >> 1] = (unsigned char) ((a[3] + c[3] + 1) >> 1);
+  }
+}
+
+inline void YuyvRowsToI420Scalar (const unsigned char* pRow0, const unsigned char* pRow1, int iWidth,
+                                  unsigned char* pY0, unsigned char* pY1, unsigned char* pU, unsigned char* pV) {
+  YuyvRowsToI420Tail (pRow0, pRow1, iWidth, pY0, pY1, pU, pV, 0);
+}
+
+// iWidth is the number of U (and V) samples
+inline void SplitUVRowTail (const unsigned char* pUV, int iWidth, unsigned char* pU, unsigned char* pV, int iFrom) {
+  for (int x = iFrom; x < iWidth; x++) {
+    pU[x] = pUV[2 * x];
+    pV[x] = pUV[2 * x + 1];
+  }
+}
+
+inline void SplitUVRowScalar (const unsigned char* pUV, int iWidth, unsigned char* pU, unsigned char* pV) {
+  SplitUVRowTail (pUV, iWidth, pU, pV, 0);
+}
+
+// Both halves of every 32 bit lane of a madd_epi16 coefficient vector
+inline int PackInt16Pair (int iLow, int iHigh) {
+  return (int) (((unsigned int) iHigh << 16) | ((unsigned int) iLow & 0xffff));
+}
+
+#if defined(PIXEL_FORMAT_CONVERTER_SSE2)
+// Four pixels, one in each 32 bit lane. A 3 byte pixel is loaded with
+// the first byte of the next one above it, which the kernels ignore, so
+// the load reads 4 bytes past the fourth pixel.
+template <int kiBpp>
+inline __m128i LoadPixelsSSE2 (const unsigned char* p) {
+  __m128i v = _mm_loadu_si128 ((const __m128i*) p);
+  if (kiBpp == 4)
+    return v;
+  __m128i a = _mm_unpacklo_epi32 (v, _mm_srli_si128 (v, 3));
+  __m128i b = _mm_unpacklo_epi32 (_mm_srli_si128 (v, 6), _mm_srli_si128 (v, 9));
+  return _mm_unpacklo_epi64 (a, b);
+}
+
+// The channels at bytes 0 and 2 of each lane go through one madd and
+// green, at byte 1, through another; byte 3 meets a zero coefficient.
+// 'even' and 'green' hold the masked channels, or sums of them.
+inline __m128i PixelDotSSE2 (__m128i even, __m128i green, __m128i kEven, __m128i kGreen) {
+  return _mm_add_epi32 (_mm_madd_epi16 (even, kEven), _mm_madd_epi16 (green, kGreen));
+}
+
+template <int kiBpp, bool kbRedFirst>
+inline void RgbRowsToI420SSE2 (const unsigned char* pRow0, const unsigned char* pRow1, int iWidth,
+                               unsigned char* pY0, unsigned char* pY1, unsigned char* pU, unsigned char* pV) {
+  const __m128i kMask   = _mm_set1_epi32 (0x00ff00ff);
+  const __m128i kYEven  = _mm_set1_epi32 (kbRedFirst ? PackInt16Pair (kiYR, kiYB) : PackInt16Pair (kiYB, kiYR));
+  const __m128i kUEven  = _mm_set1_epi32 (kbRedFirst ? PackInt16Pair (kiUR, kiUB) : PackInt16Pair (kiUB, kiUR));
+  const __m128i kVEven  = _mm_set1_epi32 (kbRedFirst ? PackInt16Pair (kiVR, kiVB) : PackInt16Pair (kiVB, kiVR));
+  const __m128i kYGreen = _mm_set1_epi32 (kiYG);
+  const __m128i kUGreen = _mm_set1_epi32 (PackInt16Pair (kiUG, 0));
+  const __m128i kVGreen = _mm_set1_epi32 (PackInt16Pair (kiVG, 0));
+  const __m128i kLumaRound   = _mm_set1_epi32 (kiLumaRound);
+  const __m128i kChromaRound = _mm_set1_epi32 (kiChromaRound);
+  // Pixels the last load may read past
+  const int iOverRead = kiBpp == 3 ? 2 : 0;
+  int x = 0;
+  for (; x + 8 + iOverRead <= iWidth; x += 8) {
+    __m128i px[4] = {
+      LoadPixelsSSE2<kiBpp> (pRow0 + x * kiBpp), LoadPixelsSSE2<kiBpp> (pRow0 + (x + 4) * kiBpp),
+      LoadPixelsSSE2<kiBpp> (pRow1 + x * kiBpp), LoadPixelsSSE2<kiBpp> (pRow1 + (x + 4) * kiBpp)
+    };
+    __m128i even[4], green[4], y[4];
+    for (int k = 0; k < 4; k++) {
+      even[k]  = _mm_and_si128 (px[k], kMask);
+      green[k] = _mm_and_si128 (_mm_srli_epi32 (px[k], 8), kMask);
+      y[k] = _mm_srai_epi32 (_mm_add_epi32 (PixelDotSSE2 (even[k], green[k], kYEven, kYGreen), kLumaRound), 15);
+    }
+    __m128i y0 = _mm_packs_epi32 (y[0], y[1]);
+    __m128i y1 = _mm_packs_epi32 (y[2], y[3]);
+    _mm_storel_epi64 ((__m128i*) (pY0 + x), _mm_packus_epi16 (y0, y0));
+    _mm_storel_epi64 ((__m128i*) (pY1 + x), _mm_packus_epi16 (y1, y1));
+
+    // Sums of the 2x2 blocks in lanes 0 and 2; the 16 bit halves of a
+    // lane do not carry into each other
+    __m128i u[2], v[2];
+    for (int k = 0; k < 2; k++) {
+      __m128i e = _mm_add_epi32 (even[k], even[k + 2]);
+      __m128i g = _mm_add_epi32 (green[k], green[k + 2]);
+      e = _mm_add_epi32 (e, _mm_srli_epi64 (e, 32));
+      g = _mm_add_epi32 (g, _mm_srli_epi64 (g, 32));
+      u[k] = _mm_srai_epi32 (_mm_add_epi32 (PixelDotSSE2 (e, g, kUEven, kUGreen), kChromaRound), 17);
+      v[k] = _mm_srai_epi32 (_mm_add_epi32 (PixelDotSSE2 (e, g, kVEven, kVGreen), kChromaRound), 17);
+      u[k] = _mm_shuffle_epi32 (u[k], _MM_SHUFFLE (3, 1, 2, 0));
+      v[k] = _mm_shuffle_epi32 (v[k], _MM_SHUFFLE (3, 1, 2, 0));
+    }
+    __m128i uu = _mm_unpacklo_epi64 (u[0], u[1]);
+    __m128i vv = _mm_unpacklo_epi64 (v[0], v[1]);
+    uu = _mm_packs_epi32 (uu, uu);
+    vv = _mm_packs_epi32 (vv, vv);
+    int32_t iU = _mm_cvtsi128_si32 (_mm_packus_epi16 (uu, uu));
+    int32_t iV = _mm_cvtsi128_si32 (_mm_packus_epi16 (vv, vv));
+    memcpy (pU + (x >> 1), &iU, 4);
+    memcpy (pV + (x >> 1), &iV, 4);
+  }
+  RgbRowsToI420Tail<kiBpp, kbRedFirst> (pRow0, pRow1, iWidth, pY0, pY1, pU, pV, x);
+}
+
+inline void YuyvRowsToI420SSE2 (const unsigned char* pRow0, const unsigned char* pRow1, int iWidth,
+                                unsigned char* pY0, unsigned char* pY1, unsigned char* pU, unsigned char* pV) {
+  const __m128i kMask = _mm_set1_epi16 (0x00ff);
+  const __m128i kZero = _mm_setzero_si128();
+  int x = 0;
+  for (; x + 16 <= iWidth; x += 16) {
+    __m128i a0 = _mm_loadu_si128 ((const __m128i*) (pRow0 + 2 * x));
+    __m128i a1 = _mm_loadu_si128 ((const __m128i*) (pRow0 + 2 * x + 16));
+    __m128i c0 = _mm_loadu_si128 ((const __m128i*) (pRow1 + 2 * x));
+    __m128i c1 = _mm_loadu_si128 ((const __m128i*) (pRow1 + 2 * x + 16));
+    _mm_storeu_si128 ((__m128i*) (pY0 + x), _mm_packus_epi16 (_mm_and_si128 (a0, kMask), _mm_and_si128 (a1, kMask)));
+    _mm_storeu_si128 ((__m128i*) (pY1 + x), _mm_packus_epi16 (_mm_and_si128 (c0, kMask), _mm_and_si128 (c1, kMask)));
+    // U V U V ... of the row average, then split like NV12
+    __m128i uv = _mm_packus_epi16 (_mm_srli_epi16 (_mm_avg_epu8 (a0, c0), 8),
+                                   _mm_srli_epi16 (_mm_avg_epu8 (a1, c1), 8));
+    _mm_storel_epi64 ((__m128i*) (pU + (x >> 1)), _mm_packus_epi16 (_mm_and_si128 (uv, kMask), kZero));
+    _mm_storel_epi64 ((__m128i*) (pV + (x >> 1)), _mm_packus_epi16 (_mm_srli_epi16 (uv, 8), kZero));
+  }
+  YuyvRowsToI420Tail (pRow0, pRow1, iWidth, pY0, pY1, pU, pV, x);
+}
+
+inline void SplitUVRowSSE2 (const unsigned char* pUV, int iWidth, unsigned char* pU, unsigned char* pV) {
+  const __m128i kMask = _mm_set1_epi16 (0x00ff);
+  int x = 0;
+  for (; x + 16 <= iWidth; x += 16) {
+    __m128i a = _mm_loadu_si128 ((const __m128i*) (pUV + 2 * x));
+    __m128i b = _mm_loadu_si128 ((const __m128i*) (pUV + 2 * x + 16));
+    _mm_storeu_si128 ((__m128i*) (pU + x), _mm_packus_epi16 (_mm_and_si128 (a, kMask), _mm_and_si128 (b, kMask)));
+    _mm_storeu_si128 ((__m128i*) (pV + x), _mm_packus_epi16 (_mm_srli_epi16 (a, 8), _mm_srli_epi16 (b, 8)));
+  }
+  SplitUVRowTail (pUV, iWidth, pU, pV, x);
+}
+#endif
+
+#if defined(PIXEL_FORMAT_CONVERTER_AVX2)
+// The AVX2 kernels follow the SSE2 ones; the packs work within 128 bit
+// lanes, so their results are put back in order with permute4x64.
+
+// Eight pixels: four from p in the low lane and four from 4 pixels on in
+// the high one
+template <int kiBpp>
+__attribute__ ((target ("avx2")))
+inline __m256i LoadPixelsAVX2 (const unsigned char* p) {
+  if (kiBpp == 4)
+    return _mm256_loadu_si256 ((const __m256i*) p);
+  __m256i v = _mm256_inserti128_si256 (_mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i*) p)),
+                                       _mm_loadu_si128 ((const __m128i*) (p + 4 * kiBpp)), 1);
+  __m256i a = _mm256_unpacklo_epi32 (v, _mm256_srli_si256 (v, 3));
+  __m256i b = _mm256_unpacklo_epi32 (_mm256_srli_si256 (v, 6), _mm256_srli_si256 (v, 9));
+  return _mm256_unpacklo_epi64 (a, b);
+}
+
+__attribute__ ((target ("avx2")))
+inline __m256i PixelDotAVX2 (__m256i even, __m256i green, __m256i kEven, __m256i kGreen) {
+  return _mm256_add_epi32 (_mm256_madd_epi16 (even, kEven), _mm256_madd_epi16 (green, kGreen));
+}
+
+template <int kiBpp, bool kbRedFirst>
+__attribute__ ((target ("avx2")))
+inline void RgbRowsToI420AVX2 (const unsigned char* pRow0, const unsigned char* pRow1, int iWidth,
+                               unsigned char* pY0, unsigned char* pY1, unsigned char* pU, unsigned char* pV) {
+  const __m256i kMask   = _mm256_set1_epi32 (0x00ff00ff);
+  const __m256i kYEven  = _mm256_set1_epi32 (kbRedFirst ? PackInt16Pair (kiYR, kiYB) : PackInt16Pair (kiYB, kiYR));
+  const __m256i kUEven  = _mm256_set1_epi32 (kbRedFirst ? PackInt16Pair (kiUR, kiUB) : PackInt16Pair (kiUB, kiUR));
+  const __m256i kVEven  = _mm256_set1_epi32 (kbRedFirst ? PackInt16Pair (kiVR, kiVB) : PackInt16Pair (kiVB, kiVR));
+  const __m256i kYGreen = _mm256_set1_epi32 (kiYG);
+  const __m256i kUGreen = _mm256_set1_epi32 (PackInt16Pair (kiUG, 0));
+  const __m256i kVGreen = _mm256_set1_epi32 (PackInt16Pair (kiVG, 0));
+  const __m256i kLumaRound   = _mm256_set1_epi32 (kiLumaRound);
+  const __m256i kChromaRound = _mm256_set1_epi32 (kiChromaRound);
+  const int iOverRead = kiBpp == 3 ? 2 : 0;
+  int x = 0;
+  for (; x + 16 + iOverRead <= iWidth; x += 16) {
+    __m256i px[4] = {
+      LoadPixelsAVX2<kiBpp> (pRow0 + x * kiBpp), LoadPixelsAVX2<kiBpp> (pRow0 + (x + 8) * kiBpp),
+      LoadPixelsAVX2<kiBpp> (pRow1 + x * kiBpp), LoadPixelsAVX2<kiBpp> (pRow1 + (x + 8) * kiBpp)
+    };
+    __m256i even[4], green[4], y[4];
+    for (int k = 0; k < 4; k++) {
+      even[k]  = _mm256_and_si256 (px[k], kMask);
+      green[k] = _mm256_and_si256 (_mm256_srli_epi32 (px[k], 8), kMask);
+      y[k] = _mm256_srai_epi32 (_mm256_add_epi32 (PixelDotAVX2 (even[k], green[k], kYEven, kYGreen), kLumaRound), 15);
+    }
+    for (int r = 0; r < 2; r++) {
+      __m256i yy = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (y[2 * r], y[2 * r + 1]), _MM_SHUFFLE (3, 1, 2, 0));
+      yy = _mm256_permute4x64_epi64 (_mm256_packus_epi16 (yy, yy), _MM_SHUFFLE (3, 1, 2, 0));
+      _mm_storeu_si128 ((__m128i*) ((r == 0 ? pY0 : pY1) + x), _mm256_castsi256_si128 (yy));
+    }
+
+    __m256i u[2], v[2];
+    for (int k = 0; k < 2; k++) {
+      __m256i e = _mm256_add_epi32 (even[k], even[k + 2]);
+      __m256i g = _mm256_add_epi32 (green[k], green[k + 2]);
+      e = _mm256_add_epi32 (e, _mm256_srli_epi64 (e, 32));
+      g = _mm256_add_epi32 (g, _mm256_srli_epi64 (g, 32));
+      u[k] = _mm256_srai_epi32 (_mm256_add_epi32 (PixelDotAVX2 (e, g, kUEven, kUGreen), kChromaRound), 17);
+      v[k] = _mm256_srai_epi32 (_mm256_add_epi32 (PixelDotAVX2 (e, g, kVEven, kVGreen), kChromaRound), 17);
+      u[k] = _mm256_shuffle_epi32 (u[k], _MM_SHUFFLE (3, 1, 2, 0));
+      v[k] = _mm256_shuffle_epi32 (v[k], _MM_SHUFFLE (3, 1, 2, 0));
+    }
+    __m256i uu = _mm256_permute4x64_epi64 (_mm256_unpacklo_epi64 (u[0], u[1]), _MM_SHUFFLE (3, 1, 2, 0));
+    __m256i vv = _mm256_permute4x64_epi64 (_mm256_unpacklo_epi64 (v[0], v[1]), _MM_SHUFFLE (3, 1, 2, 0));
+    uu = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (uu, uu), _MM_SHUFFLE (3, 1, 2, 0));
+    vv = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (vv, vv), _MM_SHUFFLE (3, 1, 2, 0));
+    _mm_storel_epi64 ((__m128i*) (pU + (x >> 1)), _mm256_castsi256_si128 (_mm256_packus_epi16 (uu, uu)));
+    _mm_storel_epi64 ((__m128i*) (pV + (x >> 1)), _mm256_castsi256_si128 (_mm256_packus_epi16 (vv, vv)));
+  }
+  RgbRowsToI420Tail<kiBpp, kbRedFirst> (pRow0, pRow1, iWidth, pY0, pY1, pU, pV, x);
+}
+
+__attribute__ ((target ("avx2")))
+inline void YuyvRowsToI420AVX2 (const unsigned char* pRow0, const unsigned char* pRow1, int iWidth,
+                                unsigned char* pY0, unsigned char* pY1, unsigned char* pU, unsigned char* pV) {
+  const __m256i kMask = _mm256_set1_epi16 (0x00ff);
+  const __m256i kZero = _mm256_setzero_si256();
+  int x = 0;
+  for (; x + 32 <= iWidth; x += 32) {
+    __m256i a0 = _mm256_loadu_si256 ((const __m256i*) (pRow0 + 2 * x));
+    __m256i a1 = _mm256_loadu_si256 ((const __m256i*) (pRow0 + 2 * x + 32));
+    __m256i c0 = _mm256_loadu_si256 ((const __m256i*) (pRow1 + 2 * x));
+    __m256i c1 = _mm256_loadu_si256 ((const __m256i*) (pRow1 + 2 * x + 32));
+    __m256i y0 = _mm256_packus_epi16 (_mm256_and_si256 (a0, kMask), _mm256_and_si256 (a1, kMask));
+    __m256i y1 = _mm256_packus_epi16 (_mm256_and_si256 (c0, kMask), _mm256_and_si256 (c1, kMask));
+    _mm256_storeu_si256 ((__m256i*) (pY0 + x), _mm256_permute4x64_epi64 (y0, _MM_SHUFFLE (3, 1, 2, 0)));
+    _mm256_storeu_si256 ((__m256i*) (pY1 + x), _mm256_permute4x64_epi64 (y1, _MM_SHUFFLE (3, 1, 2, 0)));
+    __m256i uv = _mm256_packus_epi16 (_mm256_srli_epi16 (_mm256_avg_epu8 (a0, c0), 8),
+                                      _mm256_srli_epi16 (_mm256_avg_epu8 (a1, c1), 8));
+    uv = _mm256_permute4x64_epi64 (uv, _MM_SHUFFLE (3, 1, 2, 0));
+    __m256i u = _mm256_packus_epi16 (_mm256_and_si256 (uv, kMask), kZero);
+    __m256i v = _mm256_packus_epi16 (_mm256_srli_epi16 (uv, 8), kZero);
+    u = _mm256_permute4x64_epi64 (u, _MM_SHUFFLE (3, 1, 2, 0));
+    v = _mm256_permute4x64_epi64 (v, _MM_SHUFFLE (3, 1, 2, 0));
+    _mm_storeu_si128 ((__m128i*) (pU + (x >> 1)), _mm256_castsi256_si128 (u));
+    _mm_storeu_si128 ((__m128i*) (pV + (x >> 1)), _mm256_castsi256_si128 (v));
+  }
+  YuyvRowsToI420Tail (pRow0, pRow1, iWidth, pY0, pY1, pU, pV, x);
+}
+
+__attribute__ ((target ("avx2")))
+inline void SplitUVRowAVX2 (const unsigned char* pUV, int iWidth, unsigned char* pU, unsigned char* pV) {
+  const __m256i kMask = _mm256_set1_epi16 (0x00ff);
+  int x = 0;
+  for (; x + 32 <= iWidth; x += 32) {
+    __m256i a = _mm256_loadu_si256 ((const __m256i*) (pUV + 2 * x));
+    __m256i b = _mm256_loadu_si256 ((const __m256i*) (pUV + 2 * x + 32));
+    __m256i u = _mm256_packus_epi16 (_mm256_and_si256 (a, kMask), _mm256_and_si256 (b, kMask));
+    __m256i v = _mm256_packus_epi16 (_mm256_srli_epi16 (a, 8), _mm256_srli_epi16 (b, 8));
+    _mm256_storeu_si256 ((__m256i*) (pU + x), _mm256_permute4x64_epi64 (u, _MM_SHUFFLE (3, 1, 2, 0)));
+    _mm256_storeu_si256 ((__m256i*) (pV + x), _mm256_permute4x64_epi64 (v, _MM_SHUFFLE (3, 1, 2, 0)));
+  }
+  SplitUVRowTail (pUV, iWidth, pU, pV, x);
+}
+#endif
+
+typedef void (*PackedRowsToI420Function) (const unsigned char* pRow0, const unsigned char* pRow1, int iWidth,
+                                          unsigned char* pY0, unsigned char* pY1, unsigned char* pU, unsigned char* pV);
+typedef void (*SplitUVRowFunction) (const unsigned char* pUV, int iWidth, unsigned char* pU, unsigned char* pV);
+
+// The row kernels of one instruction set
+struct PixelFormatKernels {
+  PackedRowsToI420Function pfRgb24;
+  PackedRowsToI420Function pfBgra;
+  PackedRowsToI420Function pfYuyv;
+  SplitUVRowFunction       pfSplitUV;
+};
+
+// Converts a picture into the planes of a tightly packed I420 picture at
+// pDst, in one pass over the source. iSrcStride is the distance between
+// source rows in bytes, 0 for tightly packed rows; the UV plane of NV12
+// has the stride of its Y plane. Returns false for an unknown format or
+// an odd size.
+inline bool ConvertToI420WithKernels (const PixelFormatKernels& sKernels, EVideoFormatType eFormat,
+                                      const unsigned char* pSrc, int iSrcStride, int iWidth, int iHeight,
+                                      unsigned char* pDst) {
+  const PixelFormat* pFormat = GetPixelFormat (eFormat);
+  if (pFormat == NULL || iWidth <= 0 || iHeight <= 0 || (iWidth & 1) || (iHeight & 1))
+    return false;
+  if (iSrcStride <= 0)
+    iSrcStride = eFormat == videoFormatI420 || eFormat == videoFormatNV12 ? iWidth : iWidth * pFormat->iBitsPerPixel / 8;
+  int iChromaWidth = iWidth >> 1;
+  unsigned char* pY = pDst;
+  unsigned char* pU = pY + iWidth * iHeight;
+  unsigned char* pV = pU + iChromaWidth * (iHeight >> 1);
+
+  if (eFormat == videoFormatI420 || eFormat == videoFormatNV12) {
+    for (int j = 0; j < iHeight; j++)
+      memcpy (pY + j * iWidth, pSrc + (int64_t) j * iSrcStride, iWidth);
+    const unsigned char* pChroma = pSrc + (int64_t) iSrcStride * iHeight;
+    for (int j = 0; j < (iHeight >> 1); j++) {
+      if (eFormat == videoFormatNV12) {
+        sKernels.pfSplitUV (pChroma + (int64_t) j * iSrcStride, iChromaWidth, pU + j * iChromaWidth, pV + j * iChromaWidth);
+      } else {
+        int iChromaStride = iSrcStride >> 1;
+        const unsigned char* pSrcV = pChroma + (int64_t) iChromaStride * (iHeight >> 1);
+        memcpy (pU + j * iChromaWidth, pChroma + (int64_t) j * iChromaStride, iChromaWidth);
+        memcpy (pV + j * iChromaWidth, pSrcV + (int64_t) j * iChromaStride, iChromaWidth);
+      }
+    }
+    return true;
+  }
+
+  PackedRowsToI420Function pfRows = eFormat == videoFormatRGB ? sKernels.pfRgb24
+                                    : eFormat == videoFormatBGRA ? sKernels.pfBgra : sKernels.pfYuyv;
+  for (int j = 0; j < iHeight; j += 2) {
+    const unsigned char* pRow0 = pSrc + (int64_t) j * iSrcStride;
+    pfRows (pRow0, pRow0 + iSrcStride, iWidth, pY + j * iWidth, pY + (j + 1) * iWidth,
+            pU + (j >> 1) * iChromaWidth, pV + (j >> 1) * iChromaWidth);
+  }
+  return true;
+}
+
+// Every function converts the same way and gives the same bytes.
+// ConvertToI420() picks the widest implementation the CPU supports, the
+// others are exposed for the benchmark.
+
+inline bool ConvertToI420Scalar (EVideoFormatType eFormat, const unsigned char* pSrc, int iSrcStride,
+                                 int iWidth, int iHeight, unsigned char* pDst) {
+  static const PixelFormatKernels sKernels = {
+    RgbRowsToI420Scalar<3, true>, RgbRowsToI420Scalar<4, false>, YuyvRowsToI420Scalar, SplitUVRowScalar
+  };
+  return ConvertToI420WithKernels (sKernels, eFormat, pSrc, iSrcStride, iWidth, iHeight, pDst);
+}
+
+#if defined(PIXEL_FORMAT_CONVERTER_SSE2)
+inline bool ConvertToI420SSE2 (EVideoFormatType eFormat, const unsigned char* pSrc, int iSrcStride,
+                               int iWidth, int iHeight, unsigned char* pDst) {
+  static const PixelFormatKernels sKernels = {
+    RgbRowsToI420SSE2<3, true>, RgbRowsToI420SSE2<4, false>, YuyvRowsToI420SSE2, SplitUVRowSSE2
+  };
+  return ConvertToI420WithKernels (sKernels, eFormat, pSrc, iSrcStride, iWidth, iHeight, pDst);
+}
+#endif
+
+#if defined(PIXEL_FORMAT_CONVERTER_AVX2)
+inline bool ConvertToI420AVX2 (EVideoFormatType eFormat, const unsigned char* pSrc, int iSrcStride,
+                               int iWidth, int iHeight, unsigned char* pDst) {
+  static const PixelFormatKernels sKernels = {
+    RgbRowsToI420AVX2<3, true>, RgbRowsToI420AVX2<4, false>, YuyvRowsToI420AVX2, SplitUVRowAVX2
+  };
+  return ConvertToI420WithKernels (sKernels, eFormat, pSrc, iSrcStride, iWidth, iHeight, pDst);
+}
+#endif
+
+inline bool ConvertToI420 (EVideoFormatType eFormat, const unsigned char* pSrc, int iSrcStride,
+                           int iWidth, int iHeight, unsigned char* pDst) {
+#if defined(PIXEL_FORMAT_CONVERTER_AVX2)
+  if (CPUSupportsAVX2())
+    return ConvertToI420AVX2 (eFormat, pSrc, iSrcStride, iWidth, iHeight, pDst);
+#endif
+#if defined(PIXEL_FORMAT_CONVERTER_SSE2)
+  return ConvertToI420SSE2 (eFormat, pSrc, iSrcStride, iWidth, iHeight, pDst);
+#else
+  return ConvertToI420Scalar (eFormat, pSrc, iSrcStride, iWidth, iHeight, pDst);
+#endif
+}
+
+#endif // __PixelFormatConverter_h
@@ -0,0 +1,149 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __SPSCRingBuffer_h
+#define __SPSCRingBuffer_h
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstddef>
+
+// Bounded lock-free queue of pointers between one producer thread and one
+// consumer thread.
+//
+// For live display the producer may evict the oldest entry when the queue
+// is full (PushEvictOldest) instead of waiting for the consumer. Eviction
+// and Pop() both advance the read index with a compare-and-swap and the
+// slots are atomic, so a consumer that loses the race simply retries and
+// never dereferences the evicted entry.
+template <class T>
+class SPSCRingBuffer
+{
+public:
+  explicit SPSCRingBuffer(size_t capacity)
+    : m_Capacity(capacity > 0 ? capacity : 1), m_Read(0), m_Write(0)
+  {
+    this->m_Slots = new std::atomic<T*>[this->m_Capacity];
+    for (size_t i = 0; i < this->m_Capacity; i ++)
+      {
+      this->m_Slots[i].store(NULL, std::memory_order_relaxed);
+      }
+  };
+  ~SPSCRingBuffer()
+  {
+    delete [] this->m_Slots;
+  };
+
+  size_t GetCapacity() const { return this->m_Capacity; };
+
+  // Approximate; exact only when called from the producer or consumer
+  // while the other side is idle.
+  size_t GetSize() const
+  {
+    return this->m_Write.load(std::memory_order_acquire) - this->m_Read.load(std::memory_order_acquire);
+  };
+
+  // Producer. Returns false when the queue is full.
+  bool Push(T* item)
+  {
+    size_t w = this->m_Write.load(std::memory_order_relaxed);
+    if (w - this->m_Read.load(std::memory_order_acquire) >= this->m_Capacity)
+      {
+      return false;
+      }
+    this->m_Slots[w % this->m_Capacity].store(item, std::memory_order_release);
+    this->m_Write.store(w + 1, std::memory_order_release);
+    return true;
+  };
+
+  // Producer. Always enqueues; when the queue is full the oldest entry is
+  // removed and returned so the producer can recycle it. Returns NULL
+  // when nothing was evicted.
+  T* PushEvictOldest(T* item)
+  {
+    T* evicted = NULL;
+    size_t w = this->m_Write.load(std::memory_order_relaxed);
+    size_t r = this->m_Read.load(std::memory_order_acquire);
+    while (w - r >= this->m_Capacity)
+      {
+      T* oldest = this->m_Slots[r % this->m_Capacity].load(std::memory_order_acquire);
+      if (this->m_Read.compare_exchange_weak(r, r + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+        evicted = oldest;
+        break;
+        }
+      // r now holds the current read index; the consumer made room
+      }
+    this->m_Slots[w % this->m_Capacity].store(item, std::memory_order_release);
+    this->m_Write.store(w + 1, std::memory_order_release);
+    return evicted;
+  };
+
+  // Consumer. Returns NULL when the queue is empty.
+  T* Pop()
+  {
+    size_t r = this->m_Read.load(std::memory_order_acquire);
+    for (;;)
+      {
+      if (r == this->m_Write.load(std::memory_order_acquire))
+        {
+        return NULL;
+        }
+      T* item = this->m_Slots[r % this->m_Capacity].load(std::memory_order_acquire);
+      if (this->m_Read.compare_exchange_weak(r, r + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+        return item;
+        }
+      }
+  };
+
+private:
+  SPSCRingBuffer(const SPSCRingBuffer&);
+  void operator=(const SPSCRingBuffer&);
+
+  const size_t         m_Capacity;
+  std::atomic<T*>*     m_Slots;
+  std::atomic<size_t>  m_Read;
+  std::atomic<size_t>  m_Write;
+};
+
+// Waiting strategy for pipeline stages polling a ring buffer: spin
+// briefly, then yield, then sleep in short steps so an idle stage costs
+// no CPU while a busy one reacts within microseconds.
+class RingBufferBackoff
+{
+public:
+  RingBufferBackoff() : m_Count(0) {};
+  void Reset() { this->m_Count = 0; };
+  void Wait()
+  {
+    if (this->m_Count < 64)
+      {
+      ++ this->m_Count;
+      }
+    else if (this->m_Count < 128)
+      {
+      ++ this->m_Count;
+      std::this_thread::yield();
+      }
+    else
+      {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+      }
+  };
+private:
+  int m_Count;
+};
+
+#endif // __SPSCRingBuffer_h
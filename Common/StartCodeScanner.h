@@ -0,0 +1,169 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __StartCodeScanner_h
+#define __StartCodeScanner_h
+
+#include <vector>
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define START_CODE_SCANNER_SSE2
+  #include <emmintrin.h>
+#endif
+#if defined(START_CODE_SCANNER_SSE2) && (defined(__GNUC__) || defined(__clang__))
+  #define START_CODE_SCANNER_AVX2
+  #include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+  #include <intrin.h>
+#endif
+
+#include "CPUFeatures.h"
+
+inline int StartCodeCtz (unsigned int x) {
+#if defined(_MSC_VER)
+  unsigned long r;
+  _BitScanForward (&r, x);
+  return (int) r;
+#else
+  return __builtin_ctz (x);
+#endif
+}
+
+// Annex-B start code search. Every function appends the offset of each
+// start code in pBuf[0, iSize) to 'offsets'; the offset is the first zero
+// of a 00 00 01 or 00 00 00 01 pattern. FindStartCodes() picks the
+// widest implementation the CPU supports, the others are exposed for
+// the benchmark.
+
+inline void FindStartCodesScalar (const unsigned char* pBuf, int32_t iSize, std::vector<int32_t>& offsets,
+                                  int32_t iFrom = 0) {
+  int32_t i = iFrom;
+  while (i + 2 < iSize) {
+    // A start code ends with 01, so any byte above 1 at i+2 rules out
+    // matches at i, i+1 and i+2.
+    if (pBuf[i + 2] > 1) {
+      i += 3;
+    } else if (pBuf[i + 2] == 1) {
+      if (pBuf[i + 1] == 0 && pBuf[i] == 0) {
+        offsets.push_back ((i > 0 && pBuf[i - 1] == 0) ? i - 1 : i);
+      }
+      i += 3;
+    } else {
+      ++ i;
+    }
+  }
+}
+
+#if defined(START_CODE_SCANNER_SSE2)
+inline void FindStartCodesSSE2 (const unsigned char* pBuf, int32_t iSize, std::vector<int32_t>& offsets) {
+  const __m128i kZero = _mm_setzero_si128();
+  const __m128i kOne  = _mm_set1_epi8 (1);
+  int32_t i = 0;
+  // Lane k of the mask is set when pBuf[i+k..i+k+2] is 00 00 01
+  for (; i + 18 <= iSize; i += 16) {
+    __m128i b0 = _mm_loadu_si128 ((const __m128i*) (pBuf + i));
+    __m128i b1 = _mm_loadu_si128 ((const __m128i*) (pBuf + i + 1));
+    __m128i b2 = _mm_loadu_si128 ((const __m128i*) (pBuf + i + 2));
+    __m128i m  = _mm_and_si128 (_mm_and_si128 (_mm_cmpeq_epi8 (b0, kZero), _mm_cmpeq_epi8 (b1, kZero)),
+                                _mm_cmpeq_epi8 (b2, kOne));
+    unsigned int mask = (unsigned int) _mm_movemask_epi8 (m);
+    while (mask) {
+      int32_t k = i + StartCodeCtz (mask);
+      offsets.push_back ((k > 0 && pBuf[k - 1] == 0) ? k - 1 : k);
+      mask &= mask - 1;
+    }
+  }
+  FindStartCodesScalar (pBuf, iSize, offsets, i);
+}
+#endif
+
+#if defined(START_CODE_SCANNER_AVX2)
+__attribute__ ((target ("avx2")))
+inline void FindStartCodesAVX2 (const unsigned char* pBuf, int32_t iSize, std::vector<int32_t>& offsets) {
+  const __m256i kZero = _mm256_setzero_si256();
+  const __m256i kOne  = _mm256_set1_epi8 (1);
+  int32_t i = 0;
+  for (; i + 34 <= iSize; i += 32) {
+    __m256i b0 = _mm256_loadu_si256 ((const __m256i*) (pBuf + i));
+    __m256i b1 = _mm256_loadu_si256 ((const __m256i*) (pBuf + i + 1));
+    __m256i b2 = _mm256_loadu_si256 ((const __m256i*) (pBuf + i + 2));
+    __m256i m  = _mm256_and_si256 (_mm256_and_si256 (_mm256_cmpeq_epi8 (b0, kZero), _mm256_cmpeq_epi8 (b1, kZero)),
+                                   _mm256_cmpeq_epi8 (b2, kOne));
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8 (m);
+    while (mask) {
+      int32_t k = i + StartCodeCtz (mask);
+      offsets.push_back ((k > 0 && pBuf[k - 1] == 0) ? k - 1 : k);
+      mask &= mask - 1;
+    }
+  }
+  FindStartCodesScalar (pBuf, iSize, offsets, i);
+}
+#endif
+
+inline void FindStartCodes (const unsigned char* pBuf, int32_t iSize, std::vector<int32_t>& offsets) {
+#if defined(START_CODE_SCANNER_AVX2)
+  if (CPUSupportsAVX2()) {
+    FindStartCodesAVX2 (pBuf, iSize, offsets);
+    return;
+  }
+#endif
+#if defined(START_CODE_SCANNER_SSE2)
+  FindStartCodesSSE2 (pBuf, iSize, offsets);
+#else
+  FindStartCodesScalar (pBuf, iSize, offsets);
+#endif
+}
+
+// Splits an access unit into NAL units in one pass. On return
+// nalOffsets holds the start of every NAL unit (start code included)
+// followed by iSize, so NAL k spans [nalOffsets[k], nalOffsets[k+1]).
+// Bytes before the first start code form a unit of their own, which the
+// decoder rejects like any other malformed NAL.
+inline void SplitNalUnits (const unsigned char* pBuf, int32_t iSize, std::vector<int32_t>& nalOffsets) {
+  nalOffsets.clear();
+  FindStartCodes (pBuf, iSize, nalOffsets);
+  if (nalOffsets.empty() || nalOffsets[0] != 0) {
+    nalOffsets.insert (nalOffsets.begin(), 0);
+  }
+  nalOffsets.push_back (iSize);
+}
+
+// nal_unit_type of the NAL unit at pNal (start code included), or -1
+inline int32_t NalUnitType (const unsigned char* pNal, int32_t iNalSize) {
+  int32_t i = 0;
+  while (i < iNalSize && pNal[i] == 0) {
+    ++ i;
+  }
+  if (i < 2 || i + 1 >= iNalSize || pNal[i] != 1) {
+    return -1;
+  }
+  return pNal[i + 1] & 0x1f;
+}
+
+// True when the first coded slice of the access unit is an IDR slice, i.e.
+// decoding can (re)start at this access unit. nalOffsets is scratch space.
+inline bool IsIDRAccessUnit (const unsigned char* pBuf, int32_t iSize, std::vector<int32_t>& nalOffsets) {
+  SplitNalUnits (pBuf, iSize, nalOffsets);
+  for (size_t k = 0; k + 1 < nalOffsets.size(); k++) {
+    int32_t iType = NalUnitType (pBuf + nalOffsets[k], nalOffsets[k + 1] - nalOffsets[k]);
+    if (iType >= 1 && iType <= 5) {
+      return iType == 5;
+    }
+  }
+  return false;
+}
+
+#endif // __StartCodeScanner_h
@@ -0,0 +1,42 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __StreamError_h
+#define __StreamError_h
+
+#include <cstring>
+
+#include "igtl_header.h"
+#include "igtl_util.h"
+
+// Message type the server sends a client whose request it could not
+// carry out, e.g. a switch to an encoder profile the encoder refused.
+// The message has no body; the device name is the refused request.
+#define STREAM_ERROR_TYPE "ERR_VIDEO"
+
+// Fills 'message', IGTL_HEADER_SIZE bytes, with a stream error about
+// 'deviceName'
+inline void PackStreamError(unsigned char* message, const char* deviceName)
+{
+  igtl_header h;
+  memset(&h, 0, sizeof(h));
+  h.version = IGTL_HEADER_VERSION_1;
+  strncpy(h.name, STREAM_ERROR_TYPE, IGTL_HEADER_TYPE_SIZE);
+  strncpy(h.device_name, deviceName, IGTL_HEADER_NAME_SIZE);
+  h.body_size = 0;
+  h.crc = crc64(0, 0, 0LL);
+  igtl_header_convert_byte_order(&h);
+  memcpy(message, &h, IGTL_HEADER_SIZE);
+}
+
+#endif // __StreamError_h
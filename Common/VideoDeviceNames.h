@@ -0,0 +1,63 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __VideoDeviceNames_h
+#define __VideoDeviceNames_h
+
+#include <cstring>
+#include <string>
+
+#include "igtl_header.h"
+
+// Device names of the VIDEO messages of a stream. An access unit is sent
+// either whole as the stream's device name or, when slices are streamed,
+// as a run of messages named with VIDEO_SLICE_SUFFIX appended, ended by
+// one with the plain name that carries its last slice. A server streams
+// VIDEO_DEVICE_NAME unless it is given another name, so that several
+// sources (e.g. both channels of a stereo endoscope) can be told apart.
+#define VIDEO_DEVICE_NAME       "Video"
+#define VIDEO_SLICE_SUFFIX      "Slice"
+#define VIDEO_SLICE_DEVICE_NAME VIDEO_DEVICE_NAME VIDEO_SLICE_SUFFIX
+
+// Sets 'stream' to the stream a VIDEO message belongs to. Returns false
+// for a slice message, which more of the same access unit follows.
+inline bool ParseVideoDeviceName(const char* deviceName, std::string& stream)
+{
+  size_t length = strlen(deviceName);
+  size_t suffix = sizeof(VIDEO_SLICE_SUFFIX) - 1;
+  if (length > suffix && strcmp(deviceName + length - suffix, VIDEO_SLICE_SUFFIX) == 0)
+    {
+    stream.assign(deviceName, length - suffix);
+    return false;
+    }
+  stream.assign(deviceName, length);
+  return true;
+}
+
+// True if 'name' can name a stream: not empty, not itself ending in
+// VIDEO_SLICE_SUFFIX, which would make it read as a slice of another
+// stream, and short enough for the message header once the suffix is
+// added for streamed slices
+inline bool IsValidVideoDeviceName(const char* name, bool slices)
+{
+  size_t length = strlen(name);
+  size_t suffix = sizeof(VIDEO_SLICE_SUFFIX) - 1;
+  if (length == 0 || length > IGTL_HEADER_NAME_SIZE - (slices ? suffix : 0))
+    {
+    return false;
+    }
+  std::string stream;
+  return ParseVideoDeviceName(name, stream);
+}
+
+#endif // __VideoDeviceNames_h
@@ -0,0 +1,207 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __BitStreamLog_h
+#define __BitStreamLog_h
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "api/svc/codec_app_def.h"
+
+#include "igtlObject.h"
+#include "igtl_header.h"
+#include "igtl_video.h"
+
+#include "AccessUnitFile.h"
+#include "StartCodeScanner.h"
+
+#define BIT_STREAM_LOG_DEFAULT_SEGMENT_SIZE (256ULL << 20)
+
+// Records the VIDEO messages of one stream as they were received, into a
+// series of access unit files (see AccessUnitFile.h) instead of decoded
+// pictures, so a long session takes a few percent of the disk space and
+// bandwidth of the YUV output and can be decoded later, in parallel, or
+// streamed again with the server's --replay.
+//
+// "log.au" is written as "log_000000.au", "log_000001.au", ... Every
+// segment starts with an IDR, so each one decodes on its own; a new one
+// is begun at the first IDR after a segment has grown to SegmentSize.
+// Files are only appended to; a segment gets its index when it is
+// closed, and then a line "<file>,<first frame>,<frames>,<first time ns>"
+// is appended to "log.au.segments", which locates any frame of the
+// recording. Messages before the first IDR are not recorded.
+//
+// Called from the connection thread that reads the stream.
+class BitStreamLog : public igtl::Object
+{
+public:
+  typedef BitStreamLog                   Self;
+  typedef igtl::Object                   Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(BitStreamLog, igtl::Object);
+  igtlNewMacro(BitStreamLog);
+
+  void SetFileName(const std::string& name)  { this->m_FileName = name; };
+  const std::string& GetFileName() const     { return this->m_FileName; };
+  void SetSegmentSize(igtlUint64 bytes)      { this->m_SegmentSize = bytes > 0 ? bytes : BIT_STREAM_LOG_DEFAULT_SEGMENT_SIZE; };
+  igtlUint64 GetSegmentSize() const          { return this->m_SegmentSize; };
+
+  // Appends one VIDEO message: 'header' is its IGTL header as received
+  // (IGTL_HEADER_SIZE bytes, network byte order), 'body' the video header
+  // and bit stream. 'time' is MonotonicTimeNs() of its arrival.
+  void Write(const unsigned char* header, const unsigned char* body, int bodySize,
+             bool endOfAccessUnit, igtlUint64 time)
+  {
+    if (this->m_StartOfAccessUnit)
+      {
+      const unsigned char* bitStream = body + IGTL_VIDEO_HEADER_SIZE;
+      int bitStreamSize = bodySize - IGTL_VIDEO_HEADER_SIZE;
+      bool idr = IsIDRAccessUnit(bitStream, bitStreamSize, this->m_NalOffsets);
+      if (idr && (!this->m_Segment->IsOpen() || this->m_Segment->GetSize() >= this->m_SegmentSize))
+        {
+        this->OpenSegment(time);
+        }
+      this->m_Recording = this->m_Segment->IsOpen();
+      if (this->m_Recording)
+        {
+        AccessUnitIndexEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.m_Time = time - this->m_StartTime;
+        entry.m_FrameIndex = (igtlUint32) this->m_Frames;
+        entry.m_FrameType = (igtlUint8) (idr ? videoFrameTypeIDR : videoFrameTypeP);
+        entry.m_IDR = idr ? 1 : 0;
+        entry.m_NumberOfTemporalLayers = 1;
+        entry.m_NumberOfLayers = 1;
+        this->m_Segment->BeginFrame(entry);
+        ++ this->m_Frames;
+        }
+      }
+    this->m_StartOfAccessUnit = endOfAccessUnit;
+    if (!this->m_Recording)
+      {
+      ++ this->m_SkippedMessages;
+      return;
+      }
+    this->m_Segment->Write(header, IGTL_HEADER_SIZE);
+    this->m_Segment->Write(body, bodySize);
+    this->m_Segment->GetLastEntry().m_LayerSize[0] += IGTL_HEADER_SIZE + bodySize;
+  };
+
+  // Completes the last segment
+  void Close()
+  {
+    this->CloseSegment();
+    if (this->m_Manifest)
+      {
+      fclose(this->m_Manifest);
+      this->m_Manifest = NULL;
+      }
+  };
+
+  igtlUint64 GetNumberOfFrames() const          { return this->m_Frames; };
+  int GetNumberOfSegments() const               { return this->m_Segments; };
+  igtlUint64 GetNumberOfSkippedMessages() const { return this->m_SkippedMessages; };
+
+  // "log.au" -> "log_000003.au"
+  static std::string SegmentFileName(const std::string& name, int segment)
+  {
+    char number[16];
+    snprintf(number, sizeof(number), "_%06d", segment);
+    size_t dot = name.find_last_of('.');
+    size_t slash = name.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+      {
+      return name + number;
+      }
+    return name.substr(0, dot) + number + name.substr(dot);
+  };
+
+protected:
+  BitStreamLog()
+    : m_SegmentSize(BIT_STREAM_LOG_DEFAULT_SEGMENT_SIZE), m_Manifest(NULL), m_Segments(0),
+      m_SegmentFirstFrame(0), m_SegmentFirstTime(0), m_StartTime(0), m_Frames(0), m_SkippedMessages(0),
+      m_StartOfAccessUnit(true), m_Recording(false)
+  {
+    this->m_Segment = AccessUnitFileWriter::New();
+  };
+  ~BitStreamLog()
+  {
+    this->Close();
+  };
+
+  void OpenSegment(igtlUint64 time)
+  {
+    this->CloseSegment();
+    if (this->m_Segments == 0)
+      {
+      this->m_StartTime = time;
+      }
+    this->m_SegmentName = SegmentFileName(this->m_FileName, this->m_Segments);
+    if (this->m_Segment->Open(this->m_SegmentName, 0, 0))
+      {
+      ++ this->m_Segments;
+      this->m_SegmentFirstFrame = this->m_Frames;
+      this->m_SegmentFirstTime = time - this->m_StartTime;
+      }
+  };
+
+  void CloseSegment()
+  {
+    if (!this->m_Segment->IsOpen())
+      {
+      return;
+      }
+    igtlUint64 frames = this->m_Segment->GetNumberOfFrames();
+    if (!this->m_Segment->Close())
+      {
+      fprintf(stderr, "Could not write %s completely\n", this->m_SegmentName.c_str());
+      }
+    if (this->m_Manifest == NULL)
+      {
+      this->m_Manifest = fopen((this->m_FileName + ".segments").c_str(), "w");
+      if (this->m_Manifest)
+        {
+        fprintf(this->m_Manifest, "file,first_frame,frames,first_time_ns\n");
+        }
+      }
+    if (this->m_Manifest)
+      {
+      fprintf(this->m_Manifest, "%s,%llu,%llu,%llu\n", this->m_SegmentName.c_str(),
+              (unsigned long long) this->m_SegmentFirstFrame, (unsigned long long) frames,
+              (unsigned long long) this->m_SegmentFirstTime);
+      fflush(this->m_Manifest);
+      }
+  };
+
+  std::string                   m_FileName;
+  igtlUint64                    m_SegmentSize;
+  AccessUnitFileWriter::Pointer m_Segment;
+  std::string                   m_SegmentName;
+  FILE*                         m_Manifest;
+  int                           m_Segments;
+  igtlUint64                    m_SegmentFirstFrame;
+  igtlUint64                    m_SegmentFirstTime;
+  igtlUint64                    m_StartTime;
+  igtlUint64                    m_Frames;
+  igtlUint64                    m_SkippedMessages;
+  bool                          m_StartOfAccessUnit;
+  bool                          m_Recording;   // the current access unit is written
+  std::vector<int32_t>          m_NalOffsets;
+};
+
+#endif // __BitStreamLog_h
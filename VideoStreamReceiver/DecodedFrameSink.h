@@ -0,0 +1,37 @@
+#ifndef __DecodedFrameSink_h
+#define __DecodedFrameSink_h
+
+// Destination of the pictures produced by H264DecoderSession. The planes
+// are I420; pData[1] and pData[2] share iStride[1]. They belong to
+// whoever calls WriteFrame() and are only valid for the duration of the
+// call, so a sink that keeps a picture must copy it.
+class DecodedFrameSink {
+ public:
+  virtual ~DecodedFrameSink() {}
+  virtual void WriteFrame (unsigned char* pData[3], int iStride[2], int iWidth, int iHeight,
+                           unsigned long long uiTimeStamp) = 0;
+};
+
+// Hands the decoder's planes straight to a function, e.g. of an
+// application that embeds the receiver. Nothing is copied; the callback
+// runs on the thread that decodes.
+typedef void (*DecodedFrameCallback) (void* pUserData, unsigned char* pData[3], int iStride[2], int iWidth,
+                                      int iHeight, unsigned long long uiTimeStamp);
+
+class CallbackFrameSink : public DecodedFrameSink {
+ public:
+  CallbackFrameSink (DecodedFrameCallback pCallback, void* pUserData)
+    : m_pCallback (pCallback), m_pUserData (pUserData) {
+  }
+  virtual void WriteFrame (unsigned char* pData[3], int iStride[2], int iWidth, int iHeight,
+                           unsigned long long uiTimeStamp) {
+    if (m_pCallback)
+      m_pCallback (m_pUserData, pData, iStride, iWidth, iHeight, uiTimeStamp);
+  }
+
+ protected:
+  DecodedFrameCallback m_pCallback;
+  void*                m_pUserData;
+};
+
+#endif // __DecodedFrameSink_h
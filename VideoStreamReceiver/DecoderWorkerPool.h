@@ -0,0 +1,198 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __DecoderWorkerPool_h
+#define __DecoderWorkerPool_h
+
+#include <atomic>
+#include <vector>
+
+#include "igtlObject.h"
+#include "igtlMutexLock.h"
+#include "igtlMultiThreader.h"
+
+#include "SPSCRingBuffer.h"
+#include "ReceiverPipeline.h"
+
+// Access units a worker decodes from one stream before it looks at the
+// others again
+#define DECODER_WORKER_POOL_BATCH 4
+
+// Decodes many streams on a fixed number of threads, one per core unless
+// told otherwise. Each stream is a ReceiverPipeline with SharedDecoding;
+// its decoder is not thread safe and its units must stay in order, so a
+// stream is claimed by one worker at a time, which decodes a few of its
+// units and hands it back. Different streams are decoded in parallel.
+class DecoderWorkerPool : public igtl::Object
+{
+public:
+  typedef DecoderWorkerPool              Self;
+  typedef igtl::Object                   Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(DecoderWorkerPool, igtl::Object);
+  igtlNewMacro(DecoderWorkerPool);
+
+  // 0 (the default) for one worker per core. Call before Start().
+  void SetNumberOfWorkers(int n) { this->m_NumberOfWorkers = n > 0 ? n : 0; };
+  int  GetNumberOfWorkers() const
+  {
+    return this->m_NumberOfWorkers > 0 ? this->m_NumberOfWorkers
+                                       : igtl::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  };
+
+  void Start()
+  {
+    if (!this->m_WorkerIDs.empty())
+      {
+      return;
+      }
+    this->m_Stop = 0;
+    int n = this->GetNumberOfWorkers();
+    for (int i = 0; i < n; i ++)
+      {
+      this->m_WorkerIDs.push_back(this->m_Threader->SpawnThread((igtl::ThreadFunctionType) &DecoderWorkerPool::WorkerThread, this));
+      }
+  };
+
+  // Joins the workers. Streams still added are left as they are.
+  void Stop()
+  {
+    this->m_Stop = 1;
+    for (unsigned int i = 0; i < this->m_WorkerIDs.size(); i ++)
+      {
+      this->m_Threader->TerminateThread(this->m_WorkerIDs[i]);
+      }
+    this->m_WorkerIDs.clear();
+  };
+
+  // The pipeline must have SharedDecoding set and be started.
+  void AddStream(ReceiverPipeline* pipeline)
+  {
+    Stream* stream = new Stream();
+    stream->m_Pipeline = pipeline;
+    stream->m_Busy = 0;
+    this->m_Lock->Lock();
+    this->m_Streams.push_back(stream);
+    this->m_Lock->Unlock();
+  };
+
+  // Waits until the workers have decoded what the stream has queued, then
+  // takes it out of the pool. Call before the pipeline's Stop(), after
+  // its last unit was pushed.
+  void RemoveStream(ReceiverPipeline* pipeline)
+  {
+    RingBufferBackoff backoff;
+    while (!this->m_WorkerIDs.empty() && pipeline->HasPendingUnits())
+      {
+      backoff.Wait();
+      }
+    Stream* stream = NULL;
+    this->m_Lock->Lock();
+    for (unsigned int i = 0; i < this->m_Streams.size(); i ++)
+      {
+      if (this->m_Streams[i]->m_Pipeline == pipeline)
+        {
+        stream = this->m_Streams[i];
+        this->m_Streams.erase(this->m_Streams.begin() + i);
+        break;
+        }
+      }
+    this->m_Lock->Unlock();
+    // A worker may still be in the middle of a batch
+    backoff.Reset();
+    while (stream && stream->m_Busy.load(std::memory_order_acquire))
+      {
+      backoff.Wait();
+      }
+    delete stream;
+  };
+
+protected:
+  DecoderWorkerPool()
+    : m_NumberOfWorkers(0), m_Next(0), m_Stop(0)
+  {
+    this->m_Threader = igtl::MultiThreader::New();
+    this->m_Lock = igtl::MutexLock::New();
+  };
+  ~DecoderWorkerPool()
+  {
+    this->Stop();
+    for (unsigned int i = 0; i < this->m_Streams.size(); i ++)
+      {
+      delete this->m_Streams[i];
+      }
+  };
+
+  struct Stream
+  {
+    ReceiverPipeline* m_Pipeline;
+    std::atomic<int>  m_Busy;   // claimed by a worker
+  };
+
+  // Picks the next stream with queued units that no other worker holds,
+  // round robin so that a busy stream cannot starve the others.
+  Stream* ClaimStream()
+  {
+    Stream* claimed = NULL;
+    this->m_Lock->Lock();
+    size_t n = this->m_Streams.size();
+    for (size_t i = 0; i < n; i ++)
+      {
+      Stream* stream = this->m_Streams[(this->m_Next + i) % n];
+      if (!stream->m_Busy.load(std::memory_order_acquire) && stream->m_Pipeline->HasPendingUnits())
+        {
+        stream->m_Busy.store(1, std::memory_order_relaxed);
+        this->m_Next = (this->m_Next + i + 1) % n;
+        claimed = stream;
+        break;
+        }
+      }
+    this->m_Lock->Unlock();
+    return claimed;
+  };
+
+  static void* WorkerThread(void* ptr)
+  {
+    igtl::MultiThreader::ThreadInfo* info =
+      static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+    DecoderWorkerPool* pool = static_cast<DecoderWorkerPool*>(info->UserData);
+
+    RingBufferBackoff backoff;
+    while (!pool->m_Stop.load())
+      {
+      Stream* stream = pool->ClaimStream();
+      if (stream == NULL)
+        {
+        backoff.Wait();
+        continue;
+        }
+      backoff.Reset();
+      stream->m_Pipeline->DecodeUnits(DECODER_WORKER_POOL_BATCH);
+      // Publishes the decoder state to whichever worker claims it next
+      stream->m_Busy.store(0, std::memory_order_release);
+      }
+    return NULL;
+  };
+
+  int                           m_NumberOfWorkers;
+  igtl::MultiThreader::Pointer  m_Threader;
+  igtl::MutexLock::Pointer      m_Lock;      // guards m_Streams and m_Next
+  std::vector<Stream*>          m_Streams;
+  size_t                        m_Next;
+  std::vector<int>              m_WorkerIDs;
+  std::atomic<int>              m_Stop;
+};
+
+#endif // __DecoderWorkerPool_h
@@ -0,0 +1,307 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __EncodedUnitSource_h
+#define __EncodedUnitSource_h
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "igtlObject.h"
+#include "igtlMutexLock.h"
+#include "igtl_header.h"
+#include "igtl_video.h"
+
+#include "AccessUnitFile.h"
+#include "StartCodeScanner.h"
+
+// Bytes of a raw stream scanned at a time for its access units
+#define ANNEX_B_FILE_SOURCE_BLOCK_SIZE (16 << 20)
+
+// A recorded H.264 stream as a sequence of access units, some of which
+// are key units (IDR) that decoding can start at. ReadUnits() may be
+// called from several threads at once.
+class EncodedUnitSource : public igtl::Object
+{
+public:
+  typedef EncodedUnitSource              Self;
+  typedef igtl::Object                   Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(EncodedUnitSource, igtl::Object);
+
+  virtual igtlUint64 GetNumberOfUnits() const = 0;
+  virtual bool IsKeyUnit(igtlUint64 unit) const = 0;
+
+  // Appends the Annex-B bit stream of units [first, first + count) to
+  // 'data' and the end of each of them in 'data' to 'ends'
+  virtual bool ReadUnits(igtlUint64 first, igtlUint64 count,
+                         std::vector<unsigned char>& data, std::vector<igtlUint64>& ends) = 0;
+
+protected:
+  EncodedUnitSource() {};
+  ~EncodedUnitSource() {};
+};
+
+// One spatial layer of an access unit file (see AccessUnitFile.h), e.g.
+// a recording of the server or a segment of the receiver's recording.
+// The IGTL and video headers of its messages are dropped.
+class AccessUnitFileSource : public EncodedUnitSource
+{
+public:
+  typedef AccessUnitFileSource           Self;
+  typedef EncodedUnitSource              Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(AccessUnitFileSource, EncodedUnitSource);
+  igtlNewMacro(AccessUnitFileSource);
+
+  // 'layer' is clamped to the layers of each access unit; -1 for the
+  // largest
+  bool Open(const std::string& fileName, int layer)
+  {
+    this->m_Layer = layer;
+    return this->m_File->Open(fileName);
+  };
+
+  virtual igtlUint64 GetNumberOfUnits() const   { return this->m_File->GetNumberOfFrames(); };
+  virtual bool IsKeyUnit(igtlUint64 unit) const { return this->m_File->GetEntry(unit).m_IDR != 0; };
+
+  virtual bool ReadUnits(igtlUint64 first, igtlUint64 count,
+                         std::vector<unsigned char>& data, std::vector<igtlUint64>& ends)
+  {
+    for (igtlUint64 i = first; i < first + count; i ++)
+      {
+      const AccessUnitIndexEntry& entry = this->m_File->GetEntry(i);
+      const unsigned char* frame = this->m_File->GetFrameData(i);
+      int layer = this->m_Layer;
+      if (layer < 0 || layer >= entry.m_NumberOfLayers)
+        {
+        layer = entry.m_NumberOfLayers - 1;
+        }
+      igtlUint64 offset = 0;
+      for (int s = 0; s < layer; s ++)
+        {
+        offset += entry.m_LayerSize[s];
+        }
+      igtlUint64 end = offset + entry.m_LayerSize[layer];
+      while (offset + IGTL_HEADER_SIZE + IGTL_VIDEO_HEADER_SIZE <= end)
+        {
+        igtl_header h;
+        memcpy(&h, frame + offset, IGTL_HEADER_SIZE);
+        igtl_header_convert_byte_order(&h);
+        if (h.body_size < IGTL_VIDEO_HEADER_SIZE || offset + IGTL_HEADER_SIZE + h.body_size > end)
+          {
+          return false;
+          }
+        const unsigned char* bitStream = frame + offset + IGTL_HEADER_SIZE + IGTL_VIDEO_HEADER_SIZE;
+        data.insert(data.end(), bitStream, bitStream + (h.body_size - IGTL_VIDEO_HEADER_SIZE));
+        offset += IGTL_HEADER_SIZE + h.body_size;
+        }
+      ends.push_back(data.size());
+      }
+    return true;
+  };
+
+protected:
+  AccessUnitFileSource() : m_Layer(-1)
+  {
+    this->m_File = AccessUnitFile::New();
+  };
+  ~AccessUnitFileSource() {};
+
+  AccessUnitFile::Pointer m_File;
+  int                     m_Layer;
+};
+
+// A raw Annex-B H.264 file, e.g. from the encoder console or another
+// recorder. Open() scans it once for the access unit boundaries: an
+// access unit begins with the SEI, parameter sets or delimiter in front
+// of its first slice, or with a slice whose first_mb_in_slice is 0.
+class AnnexBFileSource : public EncodedUnitSource
+{
+public:
+  typedef AnnexBFileSource               Self;
+  typedef EncodedUnitSource              Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(AnnexBFileSource, EncodedUnitSource);
+  igtlNewMacro(AnnexBFileSource);
+
+  bool Open(const std::string& fileName)
+  {
+    this->Close();
+    this->m_File = fopen(fileName.c_str(), "rb");
+    if (this->m_File == NULL)
+      {
+      std::cerr << "Cannot open " << fileName << std::endl;
+      return false;
+      }
+    this->Scan();
+    return !this->m_Units.empty();
+  };
+
+  void Close()
+  {
+    if (this->m_File)
+      {
+      fclose(this->m_File);
+      this->m_File = NULL;
+      }
+    this->m_Units.clear();
+  };
+
+  virtual igtlUint64 GetNumberOfUnits() const   { return this->m_Units.size(); };
+  virtual bool IsKeyUnit(igtlUint64 unit) const { return this->m_Units[unit].m_Key; };
+
+  virtual bool ReadUnits(igtlUint64 first, igtlUint64 count,
+                         std::vector<unsigned char>& data, std::vector<igtlUint64>& ends)
+  {
+    if (count == 0)
+      {
+      return true;
+      }
+    igtlUint64 begin = this->m_Units[first].m_Offset;
+    igtlUint64 end = this->m_Units[first + count - 1].m_End;
+    size_t base = data.size();
+    data.resize(base + (size_t) (end - begin));
+    // One read per call; the workers spend their time in the decoder
+    this->m_Lock.Lock();
+    bool ok = Seek(this->m_File, begin) && fread(&data[base], 1, (size_t) (end - begin), this->m_File) == end - begin;
+    this->m_Lock.Unlock();
+    for (igtlUint64 i = first; i < first + count; i ++)
+      {
+      ends.push_back(base + (this->m_Units[i].m_End - begin));
+      }
+    return ok;
+  };
+
+protected:
+  AnnexBFileSource() : m_File(NULL) {};
+  ~AnnexBFileSource()
+  {
+    this->Close();
+  };
+
+  struct Unit
+  {
+    igtlUint64 m_Offset;
+    igtlUint64 m_End;
+    bool       m_Key;
+  };
+
+  static bool Seek(FILE* fp, igtlUint64 offset)
+  {
+#if defined(_WIN32)
+    return _fseeki64(fp, (__int64) offset, SEEK_SET) == 0;
+#else
+    return fseeko(fp, (off_t) offset, SEEK_SET) == 0;
+#endif
+  };
+
+  // Reads the file in blocks that overlap by a few bytes, so that a
+  // start code and the two bytes after it are seen whole in the block
+  // that holds its 01
+  void Scan()
+  {
+    std::vector<unsigned char> block(ANNEX_B_FILE_SOURCE_BLOCK_SIZE + 8);
+    std::vector<int32_t> offsets;
+    igtlUint64 position = 0;
+    igtlUint64 pending = 0;     // first NAL in front of the next slice
+    bool havePending = false;
+    bool inUnit = false;
+    Seek(this->m_File, 0);
+    while (1)
+      {
+      igtlUint64 start = position > 4 ? position - 4 : 0;
+      Seek(this->m_File, start);
+      size_t size = fread(&block[0], 1, block.size(), this->m_File);
+      if (size == 0 || start + size <= position)
+        {
+        break;
+        }
+      igtlUint64 limit = position + ANNEX_B_FILE_SOURCE_BLOCK_SIZE;
+      offsets.clear();
+      FindStartCodes(&block[0], (int32_t) size, offsets);
+      for (size_t k = 0; k < offsets.size(); k ++)
+        {
+        size_t o = offsets[k];
+        size_t one = block[o + 2] == 1 ? o + 2 : o + 3;
+        igtlUint64 nal = start + o;
+        if (start + one < position || start + one >= limit)
+          {
+          continue;
+          }
+        if (one + 1 >= size)
+          {
+          break;
+          }
+        int type = block[one + 1] & 0x1f;
+        // A first_mb_in_slice of 0 is coded as a single 1 bit
+        bool firstSlice = one + 2 < size && (block[one + 2] & 0x80);
+        if (type == 6 || type == 7 || type == 8 || type == 9 || type == 14 || type == 15)
+          {
+          if (inUnit && !havePending)
+            {
+            pending = nal;
+            havePending = true;
+            }
+          }
+        else if (type >= 1 && type <= 5)
+          {
+          if (!inUnit || havePending || firstSlice)
+            {
+            igtlUint64 begin = !inUnit ? 0 : havePending ? pending : nal;
+            if (!this->m_Units.empty())
+              {
+              this->m_Units.back().m_End = begin;
+              }
+            Unit unit;
+            unit.m_Offset = begin;
+            unit.m_End = begin;
+            unit.m_Key = type == 5;
+            this->m_Units.push_back(unit);
+            }
+          inUnit = true;
+          havePending = false;
+          }
+        }
+      position = limit;
+      if (start + size < position)
+        {
+        break;
+        }
+      }
+    if (!this->m_Units.empty())
+      {
+      fseek(this->m_File, 0, SEEK_END);
+#if defined(_WIN32)
+      this->m_Units.back().m_End = (igtlUint64) _ftelli64(this->m_File);
+#else
+      this->m_Units.back().m_End = (igtlUint64) ftello(this->m_File);
+#endif
+      }
+  };
+
+  FILE*                 m_File;
+  igtl::SimpleMutexLock m_Lock;    // guards the file position
+  std::vector<Unit>     m_Units;
+};
+
+#endif // __EncodedUnitSource_h
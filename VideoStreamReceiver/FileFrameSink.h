@@ -0,0 +1,167 @@
+#ifndef __FileFrameSink_h
+#define __FileFrameSink_h
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#if defined(_WIN32)
+  #include <malloc.h>
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+#include "DecodedFrameSink.h"
+
+#define FILE_FRAME_SINK_ALIGNMENT   4096
+#define FILE_FRAME_SINK_BUFFER_SIZE (4 << 20)
+
+// Writes pictures to a raw I420 file. Rows are gathered in a large
+// aligned buffer that goes to the file in one write once it is full, so
+// a picture costs a few system calls instead of one fwrite per row.
+// With bDirect the file is opened with O_DIRECT (F_NOCACHE on Mac OS X)
+// and the writes bypass the page cache; file systems that refuse it get
+// the buffered writes instead.
+class FileFrameSink : public DecodedFrameSink {
+ public:
+  FileFrameSink()
+    : m_pFile (NULL), m_iFd (-1), m_bDirect (false), m_pBuffer (NULL), m_uiFill (0), m_uiBytesWritten (0) {
+  }
+  virtual ~FileFrameSink() {
+    Close();
+  }
+
+  bool Open (const char* kpFileName, bool bDirect) {
+    Close();
+    m_bDirect = false;
+#if defined(_WIN32)
+    m_pBuffer = (unsigned char*) _aligned_malloc (FILE_FRAME_SINK_BUFFER_SIZE, FILE_FRAME_SINK_ALIGNMENT);
+    m_pFile = fopen (kpFileName, "wb");
+    if (m_pFile == NULL) {
+#else
+    if (posix_memalign ((void**) &m_pBuffer, FILE_FRAME_SINK_ALIGNMENT, FILE_FRAME_SINK_BUFFER_SIZE) != 0)
+      m_pBuffer = NULL;
+    if (bDirect) {
+#if defined(O_DIRECT)
+      m_iFd = open (kpFileName, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+#elif defined(F_NOCACHE)
+      m_iFd = open (kpFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (m_iFd >= 0 && fcntl (m_iFd, F_NOCACHE, 1) != 0) {
+        close (m_iFd);
+        m_iFd = -1;
+      }
+#endif
+      m_bDirect = m_iFd >= 0;
+      if (!m_bDirect)
+        fprintf (stderr, "Direct I/O is not available for %s, writing through the page cache.\n", kpFileName);
+    }
+    if (m_iFd < 0)
+      m_iFd = open (kpFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (m_iFd < 0) {
+#endif
+      fprintf (stderr, "Can not open yuv file to output result of decoding..\n");
+      Close();
+      return false;
+    }
+    if (m_pBuffer == NULL) {
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  bool IsOpen() const { return m_pBuffer != NULL && (m_pFile != NULL || m_iFd >= 0); }
+  bool IsDirect() const { return m_bDirect; }
+  unsigned long long GetBytesWritten() const { return m_uiBytesWritten; }
+
+  // The raw file holds the planes only, so the time stamp is not kept
+  virtual void WriteFrame (unsigned char* pData[3], int iStride[2], int iWidth, int iHeight,
+                           unsigned long long /*uiTimeStamp*/) {
+    if (!IsOpen())
+      return;
+    for (int i = 0; i < iHeight; i++)
+      Append (pData[0] + i * iStride[0], iWidth);
+    for (int p = 1; p < 3; p++) {
+      for (int i = 0; i < iHeight / 2; i++)
+        Append (pData[p] + i * iStride[1], iWidth / 2);
+    }
+  }
+
+  // Writes out what is left in the buffer and closes the file
+  void Close() {
+    if (m_uiFill > 0 && IsOpen()) {
+#if !defined(_WIN32)
+      if (m_bDirect) {
+        // O_DIRECT only takes whole blocks; the tail goes through the
+        // page cache
+        size_t uiAligned = m_uiFill & ~((size_t) FILE_FRAME_SINK_ALIGNMENT - 1);
+        Flush (m_pBuffer, uiAligned);
+        int iFlags = fcntl (m_iFd, F_GETFL);
+#if defined(O_DIRECT)
+        fcntl (m_iFd, F_SETFL, iFlags & ~O_DIRECT);
+#endif
+        Flush (m_pBuffer + uiAligned, m_uiFill - uiAligned);
+      } else
+#endif
+        Flush (m_pBuffer, m_uiFill);
+    }
+    m_uiFill = 0;
+    if (m_pFile) {
+      fclose (m_pFile);
+      m_pFile = NULL;
+    }
+#if !defined(_WIN32)
+    if (m_iFd >= 0) {
+      close (m_iFd);
+      m_iFd = -1;
+    }
+    free (m_pBuffer);
+#else
+    _aligned_free (m_pBuffer);
+#endif
+    m_pBuffer = NULL;
+  }
+
+ protected:
+  void Append (const unsigned char* pSrc, size_t uiSize) {
+    while (uiSize > 0) {
+      size_t uiCopy = FILE_FRAME_SINK_BUFFER_SIZE - m_uiFill;
+      if (uiCopy > uiSize)
+        uiCopy = uiSize;
+      memcpy (m_pBuffer + m_uiFill, pSrc, uiCopy);
+      m_uiFill += uiCopy;
+      pSrc += uiCopy;
+      uiSize -= uiCopy;
+      if (m_uiFill == FILE_FRAME_SINK_BUFFER_SIZE) {
+        Flush (m_pBuffer, m_uiFill);
+        m_uiFill = 0;
+      }
+    }
+  }
+
+  void Flush (const unsigned char* pSrc, size_t uiSize) {
+#if defined(_WIN32)
+    m_uiBytesWritten += fwrite (pSrc, 1, uiSize, m_pFile);
+#else
+    while (uiSize > 0) {
+      ssize_t iWritten = write (m_iFd, pSrc, uiSize);
+      if (iWritten <= 0) {
+        fprintf (stderr, "Writing the decoded video failed.\n");
+        return;
+      }
+      pSrc += iWritten;
+      uiSize -= iWritten;
+      m_uiBytesWritten += iWritten;
+    }
+#endif
+  }
+
+  FILE*              m_pFile;
+  int                m_iFd;
+  bool               m_bDirect;
+  unsigned char*     m_pBuffer;
+  size_t             m_uiFill;
+  unsigned long long m_uiBytesWritten;
+};
+
+#endif // __FileFrameSink_h
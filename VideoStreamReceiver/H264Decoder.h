@@ -1,3 +1,6 @@
+#ifndef __H264Decoder_h
+#define __H264Decoder_h
+
 #include <time.h>
 #if defined(_WIN32) /*&& defined(_DEBUG)*/
   #include <windows.h>
@@ -7,8 +10,15 @@
 #else
   #include <sys/time.h>
 #endif
+#include <climits>
 #include <vector>
-#define NO_DELAY_DECODING
+#include <cstring>
+#include <cstdio>
+#include "api/svc/codec_api.h"
+#include "api/svc/codec_app_def.h"
+
+#include "StartCodeScanner.h"
+#include "DecodedFrameSink.h"
 
 void Write2File (FILE* pFp, unsigned char* pData[3], int iStride[2], int iWidth, int iHeight) {
   int   i;
@@ -67,216 +77,207 @@ int64_t getCurrentTime()
   
 }
 
-int32_t iFrameCountTotal = 0;
-
-void H264DecodeInstance (ISVCDecoder* pDecoder, unsigned char* kpH264BitStream, const char* kpOuputFileName,
-                         int32_t& iWidth, int32_t& iHeight, int32_t& iStreamSize, const char* pOptionFileName) {
-  
-  
-  unsigned long long uiTimeStamp = 0;
-  int64_t iStart = 0, iEnd = 0, iTotal = 0;
-  int32_t iSliceSize;
-  int32_t iSliceIndex = 0;
-  unsigned char* pBuf = NULL;
-  unsigned char uiStartCode[4] = {0, 0, 0, 1};
-  
-  unsigned char* pData[3] = {NULL};
-  unsigned char* pDst[3] = {NULL};
-  SBufferInfo sDstBufInfo;
-  
-  int32_t iBufPos = 0;
-  int32_t i = 0;
-  int32_t iLastWidth = 0, iLastHeight = 0;
-  int32_t iFrameCount = 0;
-  int32_t iEndOfStreamFlag = 0;
-  //for coverage test purpose
-  int32_t iErrorConMethod = (int32_t) ERROR_CON_SLICE_MV_COPY_CROSS_IDR_FREEZE_RES_CHANGE;
-  pDecoder->SetOption (DECODER_OPTION_ERROR_CON_IDC, &iErrorConMethod);
-  //~end for
-  double dElapsed = 0;
-  
-  if (pDecoder == NULL) return;
-  
-  
-  FILE* pYuvFile    = NULL;
-  FILE* pOptionFile = NULL;
-  // Lenght input mode support
-  if (kpOuputFileName) {
-    pYuvFile = fopen (kpOuputFileName, "ab");
-    if (pYuvFile == NULL) {
-      fprintf (stderr, "Can not open yuv file to output result of decoding..\n");
-      // any options
-      //return; // can let decoder work in quiet mode, no writing any output
-    } //else
-    //fprintf (stderr, "Sequence output file name: %s..\n", kpOuputFileName);
-  } else {
-    fprintf (stderr, "Can not find any output file to write..\n");
-    // any options
+// Decoder state that lives as long as the stream: the decoder instance,
+// the output files and the timing counters. Access units are fed one at a
+// time and each decoded picture is written as soon as the decoder emits
+// it; the decoder is only told that the stream ended in Close(), so its
+// reference pictures carry over from one access unit to the next.
+// Pictures go to the output file and, when one is set, to a
+// DecodedFrameSink.
+class H264DecoderSession {
+ public:
+  H264DecoderSession()
+    : m_pDecoder (NULL), m_pYuvFile (NULL), m_pOptionFile (NULL), m_pSink (NULL), m_uiTimeStamp (0),
+      m_iWidth (0), m_iHeight (0), m_iLastWidth (0), m_iLastHeight (0),
+      m_iFrameCount (0), m_iDecodeTime (0), m_bInAccessUnit (false), m_bReport (true) {
+    m_NalOffsets.reserve (256);
   }
-  
-  if (pOptionFileName) {
-    pOptionFile = fopen (pOptionFileName, "wb");
-    if (pOptionFile == NULL) {
-      fprintf (stderr, "Can not open optional file for write..\n");
-    } else
-      fprintf (stderr, "Extra optional file: %s..\n", pOptionFileName);
+  ~H264DecoderSession() {
+    Close();
   }
-  
-  printf ("------------------------------------------------------\n");
-  
-  if (iStreamSize <= 0) {
-    fprintf (stderr, "Current Bit Stream File is too small, read error!!!!\n");
-    goto label_exit;
+
+  // Creates and initializes the decoder and opens the output files once.
+  // kpOuputFileName may be NULL to decode without writing any output.
+  bool Open (const char* kpOuputFileName, const char* pOptionFileName = NULL) {
+    if (WelsCreateDecoder (&m_pDecoder) != 0 || m_pDecoder == NULL) {
+      fprintf (stderr, "Create decoder failed!\n");
+      m_pDecoder = NULL;
+      return false;
+    }
+    SDecodingParam decParam;
+    memset (&decParam, 0, sizeof (SDecodingParam));
+    decParam.uiTargetDqLayer = UCHAR_MAX;
+    decParam.eEcActiveIdc = ERROR_CON_SLICE_COPY;
+    decParam.sVideoProperty.eVideoBsType = VIDEO_BITSTREAM_DEFAULT;
+    m_pDecoder->Initialize (&decParam);
+    int32_t iErrorConMethod = (int32_t) ERROR_CON_SLICE_MV_COPY_CROSS_IDR_FREEZE_RES_CHANGE;
+    m_pDecoder->SetOption (DECODER_OPTION_ERROR_CON_IDC, &iErrorConMethod);
+
+    if (kpOuputFileName) {
+      m_pYuvFile = fopen (kpOuputFileName, "wb");
+      if (m_pYuvFile == NULL) {
+        fprintf (stderr, "Can not open yuv file to output result of decoding..\n");
+        // can let decoder work in quiet mode, no writing any output
+      }
+    }
+    if (pOptionFileName) {
+      m_pOptionFile = fopen (pOptionFileName, "wb");
+      if (m_pOptionFile == NULL) {
+        fprintf (stderr, "Can not open optional file for write..\n");
+      } else
+        fprintf (stderr, "Extra optional file: %s..\n", pOptionFileName);
+    }
+    return true;
   }
-  pBuf = new unsigned char[iStreamSize + 4];
-  if (pBuf == NULL) {
-    fprintf (stderr, "new buffer failed!\n");
-    goto label_exit;
+
+  // Decodes one access unit. Returns the number of pictures written.
+  int32_t DecodeAccessUnit (unsigned char* pBuf, int32_t iStreamSize, unsigned long long uiTimeStamp = 0) {
+    return DecodeSlices (pBuf, iStreamSize, true, uiTimeStamp);
   }
-  memcpy (pBuf, kpH264BitStream, iStreamSize);
-  memcpy (pBuf + iStreamSize, &uiStartCode[0], 4); //confirmed_safe_unsafe_usage
-  
-  while (true) {
-    if (iBufPos >= iStreamSize) {
-      iEndOfStreamFlag = true;
-      if (iEndOfStreamFlag)
-        pDecoder->SetOption (DECODER_OPTION_END_OF_STREAM, (void*)&iEndOfStreamFlag);
-      break;
+
+  // Decodes the next whole NAL units of an access unit as soon as they
+  // arrive. With bLast the access unit is complete: its last NAL goes
+  // through DecodeFrameNoDelay, which puts the picture out right away
+  // instead of when the first NAL of the next access unit arrives.
+  // uiTimeStamp, taken at the first slice, is handed to the sink with the
+  // picture; 0 numbers the access units instead.
+  // Returns the number of pictures written.
+  int32_t DecodeSlices (unsigned char* pBuf, int32_t iStreamSize, bool bLast, unsigned long long uiTimeStamp = 0) {
+    int32_t iFrameCount = m_iFrameCount;
+
+    if (m_pDecoder == NULL || iStreamSize <= 0)
+      return 0;
+
+    if (!m_bInAccessUnit)
+      m_uiTimeStamp = uiTimeStamp ? uiTimeStamp : m_uiTimeStamp + 1;
+    m_bInAccessUnit = !bLast;
+    SplitNalUnits (pBuf, iStreamSize, m_NalOffsets);
+    int32_t iLastNal = -1;
+    for (size_t k = 0; k + 1 < m_NalOffsets.size(); k++) {
+      if (m_NalOffsets[k + 1] - m_NalOffsets[k] >= 4)
+        iLastNal = (int32_t) k;
     }
-    for (i = 0; i < iStreamSize; i++) {
-      if ((pBuf[iBufPos + i] == 0 && pBuf[iBufPos + i + 1] == 0 && pBuf[iBufPos + i + 2] == 0 && pBuf[iBufPos + i + 3] == 1
-           && i > 0) || (pBuf[iBufPos + i] == 0 && pBuf[iBufPos + i + 1] == 0 && pBuf[iBufPos + i + 2] == 1 && i > 0)) {
-        break;
+    for (int32_t k = 0; k <= iLastNal; k++) {
+      int32_t iSliceSize = m_NalOffsets[k + 1] - m_NalOffsets[k];
+      if (iSliceSize >= 4) { //too small size, no effective data, ignore
+        DecodeNal (pBuf + m_NalOffsets[k], iSliceSize, bLast && k == iLastNal);
       }
     }
-    iSliceSize = i;
-    if (iSliceSize < 4) { //too small size, no effective data, ignore
-      iBufPos += iSliceSize;
-      continue;
+    if (bLast && iLastNal < 0)
+      DecodeNal (NULL, 0);
+    return m_iFrameCount - iFrameCount;
+  }
+
+  // Gives up on a partly decoded access unit, e.g. after losing one of
+  // its slices. Whatever the decoder has of it is put out concealed.
+  void EndAccessUnit() {
+    if (m_pDecoder != NULL && m_bInAccessUnit)
+      DecodeNal (NULL, 0);
+    m_bInAccessUnit = false;
+  }
+
+  // Writes any picture still held by the decoder, e.g. at the end of a
+  // chunk of a stream that is cut at IDRs. Decoding can go on with the
+  // next IDR.
+  void Flush() {
+    if (m_pDecoder == NULL)
+      return;
+    EndAccessUnit();
+    int32_t iEndOfStreamFlag = 1;
+    m_pDecoder->SetOption (DECODER_OPTION_END_OF_STREAM, (void*)&iEndOfStreamFlag);
+    DecodeNal (NULL, 0);
+    iEndOfStreamFlag = 0;
+    m_pDecoder->SetOption (DECODER_OPTION_END_OF_STREAM, (void*)&iEndOfStreamFlag);
+  }
+
+  // Signals the end of the stream, writes any picture still held by the
+  // decoder and releases everything.
+  void Close() {
+    if (m_pDecoder) {
+      int32_t iEndOfStreamFlag = 1;
+      m_pDecoder->SetOption (DECODER_OPTION_END_OF_STREAM, (void*)&iEndOfStreamFlag);
+      DecodeNal (NULL, 0);
+      m_pDecoder->Uninitialize();
+      WelsDestroyDecoder (m_pDecoder);
+      m_pDecoder = NULL;
+      if (m_bReport && m_iFrameCount > 0 && m_iDecodeTime > 0) {
+        double dElapsed = m_iDecodeTime / 1e6;
+        fprintf (stderr, "-------------------------------------------------------\n");
+        fprintf (stderr, "iWidth:\t\t%d\nheight:\t\t%d\nFrames:\t\t%d\ndecode time:\t%f sec\nFPS:\t\t%f fps\n",
+                 m_iWidth, m_iHeight, m_iFrameCount, dElapsed, (m_iFrameCount * 1.0) / dElapsed);
+        fprintf (stderr, "-------------------------------------------------------\n");
+      }
     }
-    
-    //for coverage test purpose
-    int32_t iEndOfStreamFlag;
-    pDecoder->GetOption (DECODER_OPTION_END_OF_STREAM, &iEndOfStreamFlag);
-    int32_t iCurIdrPicId;
-    pDecoder->GetOption (DECODER_OPTION_IDR_PIC_ID, &iCurIdrPicId);
-    int32_t iFrameNum;
-    pDecoder->GetOption (DECODER_OPTION_FRAME_NUM, &iFrameNum);
-    int32_t bCurAuContainLtrMarkSeFlag;
-    pDecoder->GetOption (DECODER_OPTION_LTR_MARKING_FLAG, &bCurAuContainLtrMarkSeFlag);
-    int32_t iFrameNumOfAuMarkedLtr;
-    pDecoder->GetOption (DECODER_OPTION_LTR_MARKED_FRAME_NUM, &iFrameNumOfAuMarkedLtr);
-    int32_t iFeedbackVclNalInAu;
-    pDecoder->GetOption (DECODER_OPTION_VCL_NAL, &iFeedbackVclNalInAu);
-    int32_t iFeedbackTidInAu;
-    pDecoder->GetOption (DECODER_OPTION_TEMPORAL_ID, &iFeedbackTidInAu);
-    //~end for
-    
-    iStart = getCurrentTime();
-    pData[0] = NULL;
-    pData[1] = NULL;
-    pData[2] = NULL;
-    uiTimeStamp ++;
-    memset (&sDstBufInfo, 0, sizeof (SBufferInfo));
-    sDstBufInfo.uiInBsTimeStamp = uiTimeStamp;
-    sDstBufInfo.UsrData.sSystemBuffer.iWidth =
-#ifndef NO_DELAY_DECODING
-    pDecoder->DecodeFrameNoDelay (pBuf + iBufPos, iSliceSize, pData, &sDstBufInfo);
-#else
-    pDecoder->DecodeFrame2 (pBuf + iBufPos, iSliceSize, pData, &sDstBufInfo);
-#endif
-    
-    if (sDstBufInfo.iBufferStatus == 1) {
-      pDst[0] = pData[0];
-      pDst[1] = pData[1];
-      pDst[2] = pData[2];
+    if (m_pYuvFile) {
+      fclose (m_pYuvFile);
+      m_pYuvFile = NULL;
     }
-    iEnd    = getCurrentTime();
-    iTotal  = iEnd - iStart;
-    if (sDstBufInfo.iBufferStatus == 1) {
-      Process((void**)pDst, &sDstBufInfo, pYuvFile);
-      iWidth  = sDstBufInfo.UsrData.sSystemBuffer.iWidth;
-      iHeight = sDstBufInfo.UsrData.sSystemBuffer.iHeight;
-      
-      if (pOptionFile != NULL) {
-        if (iWidth != iLastWidth && iHeight != iLastHeight) {
-          fwrite (&iFrameCount, sizeof (iFrameCount), 1, pOptionFile);
-          fwrite (&iWidth , sizeof (iWidth) , 1, pOptionFile);
-          fwrite (&iHeight, sizeof (iHeight), 1, pOptionFile);
-          iLastWidth  = iWidth;
-          iLastHeight = iHeight;
-        }
-      }
-      ++ iFrameCount;
+    if (m_pOptionFile) {
+      fclose (m_pOptionFile);
+      m_pOptionFile = NULL;
     }
-    
-#ifdef NO_DELAY_DECODING
-    iStart = getCurrentTime();
-    pData[0] = NULL;
-    pData[1] = NULL;
-    pData[2] = NULL;
+  }
+
+  void SetFrameSink (DecodedFrameSink* pSink) { m_pSink = pSink; }
+  // Whether Close() prints the size, frames and decoding speed
+  void SetReport (bool bReport)                 { m_bReport = bReport; }
+
+  ISVCDecoder* GetDecoder() const { return m_pDecoder; }
+  int32_t GetWidth() const        { return m_iWidth; }
+  int32_t GetHeight() const       { return m_iHeight; }
+  int32_t GetFrameCount() const   { return m_iFrameCount; }
+  // Accumulated time spent inside the decoder, in microseconds
+  int64_t GetDecodeTime() const   { return m_iDecodeTime; }
+
+ protected:
+  void DecodeNal (unsigned char* pNal, int32_t iNalSize, bool bNoDelay = false) {
+    unsigned char* pData[3] = {NULL};
+    SBufferInfo sDstBufInfo;
     memset (&sDstBufInfo, 0, sizeof (SBufferInfo));
-    sDstBufInfo.uiInBsTimeStamp = uiTimeStamp;
-    pDecoder->DecodeFrame2 (NULL, 0, pData, &sDstBufInfo);
-    if (sDstBufInfo.iBufferStatus == 1) {
-      pDst[0] = pData[0];
-      pDst[1] = pData[1];
-      pDst[2] = pData[2];
-    }
-    iEnd    = getCurrentTime();
-    iTotal = iEnd - iStart;
+    sDstBufInfo.uiInBsTimeStamp = m_uiTimeStamp;
+
+    int64_t iStart = getCurrentTime();
+    if (bNoDelay)
+      m_pDecoder->DecodeFrameNoDelay (pNal, iNalSize, pData, &sDstBufInfo);
+    else
+      m_pDecoder->DecodeFrame2 (pNal, iNalSize, pData, &sDstBufInfo);
+    m_iDecodeTime += getCurrentTime() - iStart;
+
     if (sDstBufInfo.iBufferStatus == 1) {
-      Process ((void**)pDst, &sDstBufInfo, pYuvFile);
-      iWidth  = sDstBufInfo.UsrData.sSystemBuffer.iWidth;
-      iHeight = sDstBufInfo.UsrData.sSystemBuffer.iHeight;
-      std::vector<unsigned char> test(iWidth*iHeight*3/2,0);
-      for (int i =0; i< test.size()*2/3; i++)
-      {
-        test[i] = pDst[0][i];
-      }
-      for (int i =0; i< test.size()/6; i++)
-      {
-        test[i+test.size()*2/3] = pDst[1][i];
+      Process ((void**)pData, &sDstBufInfo, m_pYuvFile);
+      m_iWidth  = sDstBufInfo.UsrData.sSystemBuffer.iWidth;
+      m_iHeight = sDstBufInfo.UsrData.sSystemBuffer.iHeight;
+      if (m_pSink != NULL && pData[0] && pData[1] && pData[2]) {
+        m_pSink->WriteFrame (pData, sDstBufInfo.UsrData.sSystemBuffer.iStride, m_iWidth, m_iHeight,
+                             sDstBufInfo.uiOutYuvTimeStamp);
       }
-      for (int i =0; i< test.size()/6; i++)
-      {
-        test[i+test.size()*5/6] = pDst[2][i];
-      }
-      if (pOptionFile != NULL) {
-        if (iWidth != iLastWidth && iHeight != iLastHeight) {
-          fwrite (&iFrameCount, sizeof (iFrameCount), 1, pOptionFile);
-          fwrite (&iWidth , sizeof (iWidth) , 1, pOptionFile);
-          fwrite (&iHeight, sizeof (iHeight), 1, pOptionFile);
-          iLastWidth  = iWidth;
-          iLastHeight = iHeight;
+      if (m_pOptionFile != NULL) {
+        if (m_iWidth != m_iLastWidth && m_iHeight != m_iLastHeight) {
+          fwrite (&m_iFrameCount, sizeof (m_iFrameCount), 1, m_pOptionFile);
+          fwrite (&m_iWidth , sizeof (m_iWidth) , 1, m_pOptionFile);
+          fwrite (&m_iHeight, sizeof (m_iHeight), 1, m_pOptionFile);
+          m_iLastWidth  = m_iWidth;
+          m_iLastHeight = m_iHeight;
         }
       }
-      ++ iFrameCount;
+      ++ m_iFrameCount;
     }
-#endif
-    if (iFrameCount)
-    {
-      dElapsed = iTotal / 1e6;
-      fprintf (stderr, "-------------------------------------------------------\n");
-       fprintf (stderr, "iWidth:\t\t%d\nheight:\t\t%d\nFrames:\t\t%d\ndecode time:\t%f sec\nFPS:\t\t%f fps\n",
-       iWidth, iHeight, ++iFrameCountTotal, dElapsed, (iFrameCount * 1.0) / dElapsed);
-       fprintf (stderr, "-------------------------------------------------------\n");
-    }
-    iBufPos += iSliceSize;
-    ++ iSliceIndex;
-  }
-  // coverity scan uninitial
-label_exit:
-  if (pBuf) {
-    delete[] pBuf;
-    pBuf = NULL;
-  }
-  if (pYuvFile) {
-    fclose (pYuvFile);
-    pYuvFile = NULL;
-  }
-  if (pOptionFile) {
-    fclose (pOptionFile);
-    pOptionFile = NULL;
   }
-}
+
+  ISVCDecoder*       m_pDecoder;
+  FILE*              m_pYuvFile;
+  FILE*              m_pOptionFile;
+  DecodedFrameSink*  m_pSink;
+  unsigned long long m_uiTimeStamp;
+  int32_t            m_iWidth;
+  int32_t            m_iHeight;
+  int32_t            m_iLastWidth;
+  int32_t            m_iLastHeight;
+  int32_t            m_iFrameCount;
+  int64_t            m_iDecodeTime;
+  bool               m_bInAccessUnit;
+  bool               m_bReport;
+  std::vector<int32_t> m_NalOffsets;
+};
+
+#endif // __H264Decoder_h
@@ -0,0 +1,131 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __LatencyTrace_h
+#define __LatencyTrace_h
+
+#include <cstdio>
+#include <string>
+
+#include "FrameTiming.h"
+#include "LatencyHistogram.h"
+
+// Stages of an access unit between two stamps of its FrameTiming
+enum LatencyStage
+{
+  LATENCY_ENCODE,   // capture -> encoded
+  LATENCY_SERVER,   // encoded -> sent: pacing and the client's send queue
+  LATENCY_NETWORK,  // sent -> received
+  LATENCY_DECODE,   // received -> decoded, including the wait for the decoder
+  LATENCY_SINK,     // decoded -> written to every output
+  LATENCY_TOTAL,    // capture -> written
+  LATENCY_NUMBER_OF_STAGES
+};
+
+// Per stage latency histograms of one stream, fed with the complete
+// FrameTiming of every traced picture, and optionally a log with one
+// line per picture for offline analysis. Record() may be called from the
+// decoder or the writer thread.
+class LatencyTrace
+{
+public:
+  LatencyTrace()
+    : m_Log(NULL)
+  {
+  };
+
+  // Each picture adds a line "<stream>,<frame>,<capture>,<encoded>,<sent>,
+  // <received>,<decoded>,<written>" (ns) to 'log', which may be shared by
+  // several streams. NULL for none.
+  void SetLog(FILE* log, const std::string& stream)
+  {
+    this->m_Log = log;
+    this->m_Stream = stream;
+  };
+
+  static const char* GetStageName(int stage)
+  {
+    static const char* names[LATENCY_NUMBER_OF_STAGES] =
+      { "encode", "server", "network", "decode", "sink", "total" };
+    return names[stage];
+  };
+
+  void Record(const FrameTiming& t)
+  {
+    this->RecordStage(LATENCY_ENCODE, t.m_CaptureTime, t.m_EncodedTime);
+    this->RecordStage(LATENCY_SERVER, t.m_EncodedTime, t.m_SentTime);
+    this->RecordStage(LATENCY_NETWORK, t.m_SentTime, t.m_ReceivedTime);
+    this->RecordStage(LATENCY_DECODE, t.m_ReceivedTime, t.m_DecodedTime);
+    this->RecordStage(LATENCY_SINK, t.m_DecodedTime, t.m_WrittenTime);
+    this->RecordStage(LATENCY_TOTAL, t.m_CaptureTime, t.m_WrittenTime);
+    if (this->m_Log)
+      {
+      // One call per line, so lines of several streams do not interleave
+      fprintf(this->m_Log, "%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", this->m_Stream.c_str(),
+              (unsigned long long) t.m_FrameIndex, (unsigned long long) t.m_CaptureTime,
+              (unsigned long long) t.m_EncodedTime, (unsigned long long) t.m_SentTime,
+              (unsigned long long) t.m_ReceivedTime, (unsigned long long) t.m_DecodedTime,
+              (unsigned long long) t.m_WrittenTime);
+      }
+  };
+
+  const LatencyHistogram& GetHistogram(int stage) const { return this->m_Histograms[stage]; };
+  igtlUint64 GetNumberOfFrames() const { return this->m_Histograms[LATENCY_TOTAL].GetCount(); };
+
+  // Percentiles of every stage
+  void Print(FILE* fp) const
+  {
+    for (int i = 0; i < LATENCY_NUMBER_OF_STAGES; i ++)
+      {
+      std::string name = std::string("  ") + GetStageName(i) + ":";
+      name.resize(11, ' ');
+      this->m_Histograms[i].Print(fp, name.c_str());
+      }
+  };
+
+  // The non-empty buckets as "<stream>,<stage>,<lower us>,<upper us>,<count>"
+  void WriteHistograms(FILE* fp) const
+  {
+    for (int i = 0; i < LATENCY_NUMBER_OF_STAGES; i ++)
+      {
+      for (int b = 0; b < LATENCY_HISTOGRAM_BUCKETS; b ++)
+        {
+        igtlUint64 count = this->m_Histograms[i].GetBucketCount(b);
+        if (count > 0)
+          {
+          fprintf(fp, "%s,%s,%llu,%llu,%llu\n", this->m_Stream.c_str(), GetStageName(i),
+                  (unsigned long long) LatencyHistogram::GetBucketLowerBoundUs(b),
+                  (unsigned long long) LatencyHistogram::GetBucketUpperBoundUs(b),
+                  (unsigned long long) count);
+          }
+        }
+      }
+  };
+
+protected:
+  // Stamps from different clocks can be out of order; such a stage is
+  // not recorded rather than wrapped around
+  void RecordStage(int stage, igtlUint64 from, igtlUint64 to)
+  {
+    if (from > 0 && to >= from)
+      {
+      this->m_Histograms[stage].Record(to - from);
+      }
+  };
+
+  FILE*            m_Log;
+  std::string      m_Stream;
+  LatencyHistogram m_Histograms[LATENCY_NUMBER_OF_STAGES];
+};
+
+#endif // __LatencyTrace_h
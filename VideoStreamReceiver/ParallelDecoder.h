@@ -0,0 +1,364 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __ParallelDecoder_h
+#define __ParallelDecoder_h
+
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#include "igtlObject.h"
+#include "igtlMutexLock.h"
+#include "igtlMultiThreader.h"
+
+#include "BufferPool.h"
+#include "DecodedFrameSink.h"
+#include "EncodedUnitSource.h"
+#include "H264Decoder.h"
+#include "SPSCRingBuffer.h"
+
+// Smallest number of access units in a chunk; shorter GOPs are merged
+#define PARALLEL_DECODER_DEFAULT_CHUNK_UNITS 30
+
+// Decodes recorded streams offline on all cores. The streams are cut
+// into chunks that start at an IDR, each decoded from start to end by
+// one worker with a decoder of its own, so no two workers ever share
+// decoder state. The pictures are handed to the output in stream order:
+// those of the oldest unfinished chunk as soon as they are decoded, the
+// later ones once their turn comes. At most Window chunks past the one
+// being written are decoded ahead, which bounds the memory to about
+// Window GOPs of pictures.
+//
+// A stream with a single IDR is a single chunk and is decoded by one
+// worker.
+class ParallelDecoder : public igtl::Object
+{
+public:
+  typedef ParallelDecoder                Self;
+  typedef igtl::Object                   Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(ParallelDecoder, igtl::Object);
+  igtlNewMacro(ParallelDecoder);
+
+  // Streams are decoded one after the other, in the order added
+  void AddSource(EncodedUnitSource* source) { this->m_Sources.push_back(source); };
+
+  // 0 (the default) for one worker per core
+  void SetNumberOfWorkers(int n) { this->m_NumberOfWorkers = n > 0 ? n : 0; };
+  int  GetNumberOfWorkers() const
+  {
+    return this->m_NumberOfWorkers > 0 ? this->m_NumberOfWorkers
+                                       : igtl::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  };
+  void SetMinimumChunkUnits(int n) { this->m_MinimumChunkUnits = n > 0 ? n : 1; };
+  // 0 (the default) for twice the number of workers
+  void SetWindow(int chunks)       { this->m_Window = chunks > 0 ? chunks : 0; };
+  // Receives the pictures in order on the thread that calls Run(); NULL
+  // to only decode
+  void SetOutput(DecodedFrameSink* sink) { this->m_Output = sink; };
+
+  // Decodes every source. Returns false if a source could not be read;
+  // the pictures of the chunks before it are written.
+  bool Run()
+  {
+    this->Split();
+    int workers = this->GetNumberOfWorkers();
+    int window = this->m_Window > 0 ? this->m_Window : 2 * workers;
+    this->m_ActiveWindow = window > workers ? window : workers;
+    this->m_NextChunk = 0;
+    this->m_WrittenChunks = 0;
+    this->m_Pictures = 0;
+    this->m_DecodeTime = 0;
+    this->m_Failed = 0;
+
+    std::vector<int> threadIDs;
+    for (int i = 0; i < workers; i ++)
+      {
+      threadIDs.push_back(this->m_Threader->SpawnThread((igtl::ThreadFunctionType) &ParallelDecoder::WorkerThread, this));
+      }
+    for (size_t c = 0; c < this->m_Chunks.size(); c ++)
+      {
+      this->WriteChunk(this->m_Chunks[c]);
+      if (this->m_Chunks[c]->m_Failed)
+        {
+        this->m_Failed = 1;
+        }
+      this->m_WrittenChunks.store(c + 1, std::memory_order_release);
+      if (this->m_Failed)
+        {
+        break;
+        }
+      }
+    for (unsigned int i = 0; i < threadIDs.size(); i ++)
+      {
+      this->m_Threader->TerminateThread(threadIDs[i]);
+      }
+    this->ClearChunks();
+    return !this->m_Failed;
+  };
+
+  size_t GetNumberOfChunks() const      { return this->m_NumberOfChunks; };
+  igtlUint64 GetNumberOfPictures() const { return this->m_Pictures.load(); };
+  // Time the workers spent in the decoder, summed, in microseconds
+  igtlUint64 GetDecodeTime() const       { return this->m_DecodeTime.load(); };
+
+protected:
+  ParallelDecoder()
+    : m_NumberOfWorkers(0), m_MinimumChunkUnits(PARALLEL_DECODER_DEFAULT_CHUNK_UNITS), m_Window(0),
+      m_ActiveWindow(0), m_Output(NULL), m_NumberOfChunks(0), m_NextChunk(0), m_WrittenChunks(0),
+      m_Pictures(0), m_DecodeTime(0), m_Failed(0)
+  {
+    this->m_Threader = igtl::MultiThreader::New();
+    this->m_BufferPool = BufferPool::New();
+  };
+  ~ParallelDecoder()
+  {
+    this->ClearChunks();
+  };
+
+  struct Picture
+  {
+    unsigned char* m_Data;
+    igtlUint64     m_Capacity;
+    int            m_Width;
+    int            m_Height;
+  };
+
+  struct Chunk
+  {
+    EncodedUnitSource*    m_Source;
+    igtlUint64            m_First;
+    igtlUint64            m_Count;
+    igtl::SimpleMutexLock m_Lock;       // guards m_Pictures
+    std::vector<Picture>  m_Pictures;
+    std::atomic<int>      m_Done;
+    bool                  m_Failed;     // set before m_Done
+  };
+
+  // Copies the decoder's pictures into the chunk being decoded
+  class ChunkSink : public DecodedFrameSink
+  {
+  public:
+    ChunkSink(BufferPool* pool) : m_Pool(pool), m_Chunk(NULL) {};
+    void SetChunk(Chunk* chunk) { this->m_Chunk = chunk; };
+    virtual void WriteFrame(unsigned char* pData[3], int iStride[2], int iWidth, int iHeight,
+                            unsigned long long /*uiTimeStamp*/)
+    {
+      Picture picture;
+      picture.m_Width = iWidth;
+      picture.m_Height = iHeight;
+      picture.m_Data = this->m_Pool->Acquire((igtlUint64) iWidth * iHeight * 3 / 2, picture.m_Capacity);
+      unsigned char* dst = picture.m_Data;
+      for (int y = 0; y < iHeight; y ++)
+        {
+        memcpy(dst, pData[0] + y * iStride[0], iWidth);
+        dst += iWidth;
+        }
+      for (int p = 1; p < 3; p ++)
+        {
+        for (int y = 0; y < iHeight / 2; y ++)
+          {
+          memcpy(dst, pData[p] + y * iStride[1], iWidth / 2);
+          dst += iWidth / 2;
+          }
+        }
+      this->m_Chunk->m_Lock.Lock();
+      this->m_Chunk->m_Pictures.push_back(picture);
+      this->m_Chunk->m_Lock.Unlock();
+    };
+
+  protected:
+    BufferPool* m_Pool;
+    Chunk*      m_Chunk;
+  };
+
+  // A new chunk begins with every source, and at an IDR once the chunk
+  // has MinimumChunkUnits units
+  void Split()
+  {
+    this->ClearChunks();
+    for (size_t s = 0; s < this->m_Sources.size(); s ++)
+      {
+      EncodedUnitSource* source = this->m_Sources[s];
+      igtlUint64 units = source->GetNumberOfUnits();
+      Chunk* chunk = NULL;
+      for (igtlUint64 i = 0; i < units; i ++)
+        {
+        if (chunk == NULL || (chunk->m_Count >= (igtlUint64) this->m_MinimumChunkUnits && source->IsKeyUnit(i)))
+          {
+          chunk = new Chunk();
+          chunk->m_Source = source;
+          chunk->m_First = i;
+          chunk->m_Count = 0;
+          chunk->m_Done = 0;
+          chunk->m_Failed = false;
+          this->m_Chunks.push_back(chunk);
+          }
+        ++ chunk->m_Count;
+        }
+      }
+    this->m_NumberOfChunks = this->m_Chunks.size();
+  };
+
+  void ClearChunks()
+  {
+    for (size_t c = 0; c < this->m_Chunks.size(); c ++)
+      {
+      Chunk* chunk = this->m_Chunks[c];
+      for (size_t i = 0; i < chunk->m_Pictures.size(); i ++)
+        {
+        this->m_BufferPool->Release(chunk->m_Pictures[i].m_Data, chunk->m_Pictures[i].m_Capacity);
+        }
+      delete chunk;
+      }
+    this->m_Chunks.clear();
+  };
+
+  // Hands the pictures of 'chunk' to the output while it is decoded, and
+  // returns when it is done
+  void WriteChunk(Chunk* chunk)
+  {
+    size_t written = 0;
+    std::vector<Picture> pictures;
+    RingBufferBackoff backoff;
+    while (1)
+      {
+      // Every picture is in the chunk before m_Done is set
+      bool done = chunk->m_Done.load(std::memory_order_acquire) != 0;
+      pictures.clear();
+      chunk->m_Lock.Lock();
+      pictures.insert(pictures.end(), chunk->m_Pictures.begin() + written, chunk->m_Pictures.end());
+      chunk->m_Lock.Unlock();
+      for (size_t i = 0; i < pictures.size(); i ++)
+        {
+        this->WritePicture(pictures[i]);
+        }
+      written += pictures.size();
+      if (done)
+        {
+        break;
+        }
+      if (pictures.empty())
+        {
+        backoff.Wait();
+        }
+      else
+        {
+        backoff.Reset();
+        }
+      }
+    chunk->m_Lock.Lock();
+    for (size_t i = 0; i < chunk->m_Pictures.size(); i ++)
+      {
+      this->m_BufferPool->Release(chunk->m_Pictures[i].m_Data, chunk->m_Pictures[i].m_Capacity);
+      }
+    chunk->m_Pictures.clear();
+    chunk->m_Lock.Unlock();
+  };
+
+  void WritePicture(const Picture& picture)
+  {
+    if (this->m_Output == NULL)
+      {
+      return;
+      }
+    int w = picture.m_Width;
+    int h = picture.m_Height;
+    unsigned char* planes[3] = { picture.m_Data, picture.m_Data + w * h, picture.m_Data + w * h + (w / 2) * (h / 2) };
+    int strides[2] = { w, w / 2 };
+    this->m_Output->WriteFrame(planes, strides, w, h, 0);
+  };
+
+  static void* WorkerThread(void* ptr)
+  {
+    igtl::MultiThreader::ThreadInfo* info =
+      static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+    ParallelDecoder* decoder = static_cast<ParallelDecoder*>(info->UserData);
+
+    // The sink outlives the session, which may still put out pictures
+    // when it is destroyed
+    ChunkSink sink(decoder->m_BufferPool);
+    H264DecoderSession session;
+    session.SetReport(false);
+    session.SetFrameSink(&sink);
+    bool open = session.Open(NULL);
+    std::vector<unsigned char> data;
+    std::vector<igtlUint64> ends;
+    RingBufferBackoff backoff;
+    while (1)
+      {
+      size_t c = decoder->m_NextChunk.fetch_add(1);
+      if (c >= decoder->m_Chunks.size())
+        {
+        break;
+        }
+      // Keeps the decoded pictures that wait for the output bounded
+      while (c >= decoder->m_WrittenChunks.load(std::memory_order_acquire) + decoder->m_ActiveWindow &&
+             !decoder->m_Failed.load())
+        {
+        backoff.Wait();
+        }
+      backoff.Reset();
+      Chunk* chunk = decoder->m_Chunks[c];
+      if (decoder->m_Failed.load())
+        {
+        chunk->m_Done.store(1, std::memory_order_release);
+        continue;
+        }
+      data.clear();
+      ends.clear();
+      chunk->m_Failed = !open || !chunk->m_Source->ReadUnits(chunk->m_First, chunk->m_Count, data, ends);
+      if (!chunk->m_Failed)
+        {
+        sink.SetChunk(chunk);
+        igtlUint64 pictures = session.GetFrameCount();
+        igtlUint64 time = session.GetDecodeTime();
+        igtlUint64 begin = 0;
+        for (size_t i = 0; i < ends.size(); i ++)
+          {
+          if (ends[i] > begin)
+            {
+            session.DecodeAccessUnit(&data[begin], (int32_t) (ends[i] - begin));
+            }
+          begin = ends[i];
+          }
+        session.Flush();
+        decoder->m_Pictures += session.GetFrameCount() - pictures;
+        decoder->m_DecodeTime += session.GetDecodeTime() - time;
+        }
+      chunk->m_Done.store(1, std::memory_order_release);
+      }
+    return NULL;
+  };
+
+  std::vector<EncodedUnitSource::Pointer> m_Sources;
+  int                                     m_NumberOfWorkers;
+  int                                     m_MinimumChunkUnits;
+  int                                     m_Window;
+  size_t                                  m_ActiveWindow;
+  DecodedFrameSink*                       m_Output;
+  igtl::MultiThreader::Pointer            m_Threader;
+  BufferPool::Pointer                     m_BufferPool;
+  std::vector<Chunk*>                     m_Chunks;
+  size_t                                  m_NumberOfChunks;
+  std::atomic<size_t>                     m_NextChunk;
+  std::atomic<size_t>                     m_WrittenChunks;
+  std::atomic<igtlUint64>                 m_Pictures;
+  std::atomic<igtlUint64>                 m_DecodeTime;
+  std::atomic<int>                        m_Failed;
+};
+
+#endif // __ParallelDecoder_h
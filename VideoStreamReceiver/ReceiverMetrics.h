@@ -0,0 +1,49 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __ReceiverMetrics_h
+#define __ReceiverMetrics_h
+
+#include <string>
+
+#include "MetricsRegistry.h"
+
+// Live counters of one received stream and its pipeline
+struct ReceiverMetrics
+{
+  MetricsCounter*   m_MessagesReceived;  // access units or slices
+  MetricsCounter*   m_ReceivedBytes;
+  MetricsCounter*   m_UnitsDropped;
+  MetricsCounter*   m_PicturesDecoded;
+  MetricsCounter*   m_PicturesDropped;
+  LatencyHistogram* m_DecodeTime;
+  LatencyHistogram* m_Latency;           // capture -> written, traced pictures only
+  MetricsGauge*     m_UnitQueueDepth;
+  MetricsGauge*     m_PictureQueueDepth;
+};
+
+inline void RegisterReceiverMetrics(MetricsRegistry* registry, const std::string& stream, ReceiverMetrics& m)
+{
+  std::string labels = MetricsRegistry::Label("device", stream);
+  m.m_MessagesReceived  = registry->AddCounter("igtl_video_messages_received_total", labels, "VIDEO messages read from the socket.");
+  m.m_ReceivedBytes     = registry->AddCounter("igtl_video_received_bytes_total", labels, "Bytes of VIDEO message bodies read from the socket.");
+  m.m_UnitsDropped      = registry->AddCounter("igtl_video_units_dropped_total", labels, "Received messages dropped before decoding.");
+  m.m_PicturesDecoded   = registry->AddCounter("igtl_video_pictures_decoded_total", labels, "Pictures put out by the decoder.");
+  m.m_PicturesDropped   = registry->AddCounter("igtl_video_pictures_dropped_total", labels, "Decoded pictures dropped before the outputs.");
+  m.m_DecodeTime        = registry->AddSummary("igtl_video_decode_seconds", labels, "Time spent in the decoder per message.");
+  m.m_Latency           = registry->AddSummary("igtl_video_latency_seconds", labels, "Time from capture to written for traced pictures.");
+  m.m_UnitQueueDepth    = registry->AddGauge("igtl_video_unit_queue_depth", labels, "Received messages waiting for the decoder.");
+  m.m_PictureQueueDepth = registry->AddGauge("igtl_video_picture_queue_depth", labels, "Decoded pictures waiting for the outputs.");
+}
+
+#endif // __ReceiverMetrics_h
@@ -0,0 +1,659 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __ReceiverPipeline_h
+#define __ReceiverPipeline_h
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "igtlObject.h"
+#include "igtlMultiThreader.h"
+#include "igtlTypes.h"
+#include "igtl_video.h"
+
+#include "BufferPool.h"
+#include "MonotonicClock.h"
+#include "SPSCRingBuffer.h"
+#include "DecodedFrameSink.h"
+#include "FileFrameSink.h"
+#include "FrameTiming.h"
+#include "H264Decoder.h"
+#include "LatencyTrace.h"
+#include "ReceiverMetrics.h"
+
+#define RECEIVER_PIPELINE_DEFAULT_UNIT_QUEUE_DEPTH    8
+#define RECEIVER_PIPELINE_DEFAULT_PICTURE_QUEUE_DEPTH 4
+// Traced access units the decoder may hold before their pictures come out
+#define RECEIVER_PIPELINE_MAX_PENDING_TIMINGS         64
+
+// Body of one video message (video header followed by the bit stream)
+// as received from the socket: a whole access unit, or some of its
+// slices when the server streams slices.
+struct ReceivedAccessUnit
+{
+  unsigned char* m_Body;
+  igtlUint64     m_Capacity;
+  int            m_BodySize;
+  igtlUint64     m_Sequence;
+  bool           m_EndOfAccessUnit;  // false if more slices of the access unit follow
+  FrameTiming    m_Timing;           // m_CaptureTime is 0 if the server sent none
+};
+
+// One decoded I420 picture, planes stored back to back without padding.
+struct DecodedPicture
+{
+  unsigned char*     m_Data;
+  igtlUint64         m_Capacity;
+  int                m_Width;
+  int                m_Height;
+  unsigned long long m_TimeStamp;
+  FrameTiming        m_Timing;
+};
+
+// Receive -> decode -> write pipeline. The caller's thread is the socket
+// reader; decoding and writing the decoded pictures run on two threads of
+// their own, so a slow disk no longer stalls the decoder and a slow
+// decode no longer stalls the socket.
+//
+// Stages hand work over through bounded lock-free rings; the objects
+// travel back to the producing stage through a second ring, so nothing is
+// allocated once the pipeline is warm. When a queue is full the producer
+// either waits (every frame is kept, for recording) or, with DropOldest,
+// evicts the oldest entry so that the output stays close to live. After a
+// dropped access unit the decoder skips ahead to the next IDR instead of
+// decoding pictures that reference a missing frame, and asks for one
+// through TakeKeyFrameRequest().
+//
+// Access units that arrive with a FrameTiming are traced: the capture
+// time becomes the picture's time stamp, and the times the picture is
+// decoded and has been written to every sink complete the timing, which
+// goes to the LatencyTrace.
+//
+// With SharedDecoding the pipeline has no decode thread; the workers of a
+// DecoderWorkerPool call DecodeUnits() instead, one at a time, so that
+// many streams share as many threads as there are cores.
+class ReceiverPipeline : public igtl::Object, public DecodedFrameSink
+{
+public:
+  typedef ReceiverPipeline               Self;
+  typedef igtl::Object                   Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(ReceiverPipeline, igtl::Object);
+  igtlNewMacro(ReceiverPipeline);
+
+  // Configuration; takes effect in Start()
+  void SetOutputFileName(const std::string& name) { this->m_OutputFileName = name; };
+  // Writes the output file with O_DIRECT, bypassing the page cache
+  void SetDirectIO(bool direct)                   { this->m_DirectIO = direct; };
+  bool GetDirectIO() const                        { return this->m_DirectIO; };
+  void SetUnitQueueDepth(int depth)               { this->m_UnitQueueDepth = depth > 0 ? depth : 1; };
+  int  GetUnitQueueDepth() const                  { return this->m_UnitQueueDepth; };
+  void SetPictureQueueDepth(int depth)            { this->m_PictureQueueDepth = depth > 0 ? depth : 1; };
+  int  GetPictureQueueDepth() const               { return this->m_PictureQueueDepth; };
+  void SetDropOldest(bool drop)                   { this->m_DropOldest = drop; };
+  bool GetDropOldest() const                      { return this->m_DropOldest; };
+  void SetSharedDecoding(bool shared)             { this->m_SharedDecoding = shared; };
+  bool GetSharedDecoding() const                  { return this->m_SharedDecoding; };
+  // Live counters of the stream, or NULL; the caller keeps ownership
+  void SetMetrics(ReceiverMetrics* metrics)       { this->m_Metrics = metrics; };
+
+  BufferPool* GetBufferPool() const { return this->m_BufferPool; };
+  LatencyTrace* GetLatencyTrace()   { return &this->m_LatencyTrace; };
+
+  // Adds a consumer of the decoded pictures; the caller keeps ownership.
+  // A direct sink is called on the decoder thread with the decoder's own
+  // planes, so it must be quick (a callback, the shared memory ring).
+  // Other sinks get a copy on the writer thread and may block, like the
+  // output file. Call before Start().
+  void AddSink(DecodedFrameSink* sink, bool direct)
+  {
+    if (direct)
+      {
+      this->m_DirectSinks.push_back(sink);
+      }
+    else
+      {
+      this->m_QueuedSinks.push_back(sink);
+      }
+  };
+
+  // Opens the decoder and the output file and starts the decode and
+  // write threads.
+  bool Start()
+  {
+    if (this->m_WriteThreadID >= 0)
+      {
+      return true;
+      }
+    if (!this->m_Decoder.Open(NULL))
+      {
+      return false;
+      }
+    this->m_Decoder.SetFrameSink(this);
+    if (!this->m_OutputFileName.empty() &&
+        this->m_FileSink.Open(this->m_OutputFileName.c_str(), this->m_DirectIO))
+      {
+      this->m_QueuedSinks.push_back(&this->m_FileSink);
+      }
+
+    // Each stage holds at most one object besides the queue, so depth + 2
+    // objects per stage never run out.
+    this->m_Units        = new SPSCRingBuffer<ReceivedAccessUnit>(this->m_UnitQueueDepth);
+    this->m_FreeUnits    = new SPSCRingBuffer<ReceivedAccessUnit>(this->m_UnitQueueDepth + 2);
+    this->m_Pictures     = new SPSCRingBuffer<DecodedPicture>(this->m_PictureQueueDepth);
+    this->m_FreePictures = new SPSCRingBuffer<DecodedPicture>(this->m_PictureQueueDepth + 2);
+    for (int i = 0; i < this->m_UnitQueueDepth + 2; i ++)
+      {
+      ReceivedAccessUnit* unit = new ReceivedAccessUnit();
+      memset(unit, 0, sizeof(ReceivedAccessUnit));
+      this->m_AllUnits.push_back(unit);
+      this->m_FreeUnits->Push(unit);
+      }
+    for (int i = 0; i < this->m_PictureQueueDepth + 2; i ++)
+      {
+      DecodedPicture* picture = new DecodedPicture();
+      memset(picture, 0, sizeof(DecodedPicture));
+      this->m_AllPictures.push_back(picture);
+      this->m_FreePictures->Push(picture);
+      }
+
+    this->m_InputDone = 0;
+    this->m_DecodeDone = 0;
+    this->m_Expected = 0;
+    this->m_WaitForIDR = false;
+    this->m_StartOfAccessUnit = true;
+    if (!this->m_SharedDecoding)
+      {
+      this->m_DecodeThreadID = this->m_Threader->SpawnThread((igtl::ThreadFunctionType) &ReceiverPipeline::DecodeThread, this);
+      }
+    this->m_WriteThreadID  = this->m_Threader->SpawnThread((igtl::ThreadFunctionType) &ReceiverPipeline::WriteThread, this);
+    return true;
+  };
+
+  // Decoder stage: true if received units wait for DecodeUnits()
+  bool HasPendingUnits() const
+  {
+    return this->m_Units != NULL && this->m_Units->GetSize() > 0;
+  };
+
+  // Decoder stage: decodes up to 'maxUnits' queued units in order and
+  // returns how many there were. Must not be called by two threads at
+  // once; the decode thread or the pool serializes the calls.
+  int DecodeUnits(int maxUnits)
+  {
+    int n = 0;
+    while (n < maxUnits)
+      {
+      ReceivedAccessUnit* unit = this->m_Units->Pop();
+      if (unit == NULL)
+        {
+        break;
+        }
+      this->DecodeUnit(unit);
+      ++ n;
+      }
+    return n;
+  };
+
+  // Reader stage: returns an access unit with room for 'bodySize' bytes.
+  ReceivedAccessUnit* AcquireAccessUnit(int bodySize)
+  {
+    ReceivedAccessUnit* unit = this->m_SpareUnit;
+    this->m_SpareUnit = NULL;
+    RingBufferBackoff backoff;
+    while (unit == NULL)
+      {
+      unit = this->m_FreeUnits->Pop();
+      if (unit == NULL)
+        {
+        backoff.Wait();
+        }
+      }
+    if (unit->m_Capacity < (igtlUint64) bodySize)
+      {
+      this->m_BufferPool->Release(unit->m_Body, unit->m_Capacity);
+      unit->m_Body = this->m_BufferPool->Acquire(bodySize, unit->m_Capacity);
+      }
+    unit->m_BodySize = bodySize;
+    unit->m_EndOfAccessUnit = true;
+    unit->m_Timing.m_CaptureTime = 0;
+    return unit;
+  };
+
+  // Reader stage: gives back a unit that was not pushed (receive failed)
+  void ReleaseAccessUnit(ReceivedAccessUnit* unit)
+  {
+    this->m_SpareUnit = unit;
+  };
+
+  // Reader stage: queues a received unit for decoding.
+  void PushAccessUnit(ReceivedAccessUnit* unit)
+  {
+    unit->m_Sequence = this->m_NextSequence ++;
+    if (this->m_Metrics)
+      {
+      this->m_Metrics->m_MessagesReceived->Add();
+      this->m_Metrics->m_ReceivedBytes->Add(unit->m_BodySize);
+      }
+    if (this->m_DropOldest)
+      {
+      ReceivedAccessUnit* evicted = this->m_Units->PushEvictOldest(unit);
+      if (evicted)
+        {
+        this->m_SpareUnit = evicted;
+        this->CountDroppedUnit();
+        }
+      }
+    else
+      {
+      RingBufferBackoff backoff;
+      while (!this->m_Units->Push(unit))
+        {
+        backoff.Wait();
+        }
+      }
+    if (this->m_Metrics)
+      {
+      this->m_Metrics->m_UnitQueueDepth->Set(this->m_Units->GetSize());
+      }
+  };
+
+  // Reader stage: true once after the decoder lost a unit and now waits
+  // for an IDR; the reader then asks the server for one.
+  bool TakeKeyFrameRequest()
+  {
+    return this->m_KeyFrameWanted.exchange(0) != 0;
+  };
+
+  // Ends the input, lets the decoder and writer drain and joins them.
+  // With SharedDecoding the stream must have been removed from its pool
+  // first; what is left in the queue is decoded on the calling thread.
+  void Stop()
+  {
+    if (this->m_WriteThreadID < 0)
+      {
+      return;
+      }
+    this->m_InputDone = 1;
+    if (this->m_SharedDecoding)
+      {
+      while (this->DecodeUnits(this->m_UnitQueueDepth) > 0)
+        {
+        }
+      this->FinishDecoding();
+      }
+    else
+      {
+      this->m_Threader->TerminateThread(this->m_DecodeThreadID);
+      }
+    this->m_Threader->TerminateThread(this->m_WriteThreadID);
+    this->m_DecodeThreadID = -1;
+    this->m_WriteThreadID = -1;
+    if (this->m_FileSink.IsOpen())
+      {
+      this->m_FileSink.Close();
+      this->m_QueuedSinks.erase(std::remove(this->m_QueuedSinks.begin(), this->m_QueuedSinks.end(),
+                                            (DecodedFrameSink*) &this->m_FileSink),
+                                this->m_QueuedSinks.end());
+      }
+    fprintf(stderr, "Pipeline: %d pictures written, %llu access units and %llu pictures dropped\n",
+            this->m_PicturesWritten.load(), (unsigned long long) this->m_DroppedUnits.load(),
+            (unsigned long long) this->m_DroppedPictures.load());
+    if (this->m_LatencyTrace.GetNumberOfFrames() > 0)
+      {
+      fprintf(stderr, "Latency of %llu traced pictures:\n", (unsigned long long) this->m_LatencyTrace.GetNumberOfFrames());
+      this->m_LatencyTrace.Print(stderr);
+      }
+  };
+
+  // Decoder thread: passes each decoded picture to the direct sinks and
+  // copies it into a queue entry for the writer if there are other
+  // sinks. The decoder's planes are reused by the next decode call.
+  virtual void WriteFrame(unsigned char* pData[3], int iStride[2], int iWidth, int iHeight,
+                          unsigned long long uiTimeStamp)
+  {
+    FrameTiming timing;
+    timing.m_CaptureTime = 0;
+    this->TakePendingTiming(uiTimeStamp, timing);
+    if (this->m_Metrics)
+      {
+      this->m_Metrics->m_PicturesDecoded->Add();
+      }
+    for (unsigned int i = 0; i < this->m_DirectSinks.size(); i ++)
+      {
+      this->m_DirectSinks[i]->WriteFrame(pData, iStride, iWidth, iHeight, uiTimeStamp);
+      }
+    if (this->m_QueuedSinks.empty())
+      {
+      if (timing.m_CaptureTime)
+        {
+        timing.m_WrittenTime = MonotonicTimeNs();
+        this->RecordTiming(timing);
+        }
+      ++ this->m_PicturesWritten;
+      return;
+      }
+
+    DecodedPicture* picture = this->m_SparePicture;
+    this->m_SparePicture = NULL;
+    RingBufferBackoff backoff;
+    while (picture == NULL)
+      {
+      picture = this->m_FreePictures->Pop();
+      if (picture == NULL)
+        {
+        backoff.Wait();
+        }
+      }
+    igtlUint64 size = (igtlUint64) iWidth * iHeight * 3 / 2;
+    if (picture->m_Capacity < size)
+      {
+      this->m_BufferPool->Release(picture->m_Data, picture->m_Capacity);
+      picture->m_Data = this->m_BufferPool->Acquire(size, picture->m_Capacity);
+      }
+    picture->m_Width = iWidth;
+    picture->m_Height = iHeight;
+    picture->m_TimeStamp = uiTimeStamp;
+    picture->m_Timing = timing;
+    unsigned char* dst = picture->m_Data;
+    for (int y = 0; y < iHeight; y ++)
+      {
+      memcpy(dst, pData[0] + y * iStride[0], iWidth);
+      dst += iWidth;
+      }
+    for (int p = 1; p < 3; p ++)
+      {
+      for (int y = 0; y < iHeight / 2; y ++)
+        {
+        memcpy(dst, pData[p] + y * iStride[1], iWidth / 2);
+        dst += iWidth / 2;
+        }
+      }
+
+    if (this->m_DropOldest)
+      {
+      DecodedPicture* evicted = this->m_Pictures->PushEvictOldest(picture);
+      if (evicted)
+        {
+        this->m_SparePicture = evicted;
+        ++ this->m_DroppedPictures;
+        if (this->m_Metrics)
+          {
+          this->m_Metrics->m_PicturesDropped->Add();
+          }
+        }
+      }
+    else
+      {
+      backoff.Reset();
+      while (!this->m_Pictures->Push(picture))
+        {
+        backoff.Wait();
+        }
+      }
+    if (this->m_Metrics)
+      {
+      this->m_Metrics->m_PictureQueueDepth->Set(this->m_Pictures->GetSize());
+      }
+  };
+
+protected:
+  ReceiverPipeline()
+    : m_DirectIO(false),
+      m_UnitQueueDepth(RECEIVER_PIPELINE_DEFAULT_UNIT_QUEUE_DEPTH),
+      m_PictureQueueDepth(RECEIVER_PIPELINE_DEFAULT_PICTURE_QUEUE_DEPTH),
+      m_DropOldest(false), m_SharedDecoding(false), m_Metrics(NULL), m_Units(NULL), m_FreeUnits(NULL), m_Pictures(NULL), m_FreePictures(NULL),
+      m_SpareUnit(NULL), m_SparePicture(NULL), m_NextSequence(0),
+      m_Expected(0), m_WaitForIDR(false), m_StartOfAccessUnit(true),
+      m_DecodeThreadID(-1), m_WriteThreadID(-1),
+      m_InputDone(0), m_DecodeDone(0), m_KeyFrameWanted(0), m_DroppedUnits(0), m_DroppedPictures(0), m_PicturesWritten(0)
+  {
+    this->m_Threader = igtl::MultiThreader::New();
+    this->m_BufferPool = BufferPool::New();
+  };
+  ~ReceiverPipeline()
+  {
+    this->Stop();
+    for (unsigned int i = 0; i < this->m_AllUnits.size(); i ++)
+      {
+      this->m_BufferPool->Release(this->m_AllUnits[i]->m_Body, this->m_AllUnits[i]->m_Capacity);
+      delete this->m_AllUnits[i];
+      }
+    for (unsigned int i = 0; i < this->m_AllPictures.size(); i ++)
+      {
+      this->m_BufferPool->Release(this->m_AllPictures[i]->m_Data, this->m_AllPictures[i]->m_Capacity);
+      delete this->m_AllPictures[i];
+      }
+    delete this->m_Units;
+    delete this->m_FreeUnits;
+    delete this->m_Pictures;
+    delete this->m_FreePictures;
+  };
+
+  static void* DecodeThread(void* ptr)
+  {
+    igtl::MultiThreader::ThreadInfo* info =
+      static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+    ReceiverPipeline* pipeline = static_cast<ReceiverPipeline*>(info->UserData);
+
+    RingBufferBackoff backoff;
+    for (;;)
+      {
+      // Read the flag before polling so the last units are not missed
+      int done = pipeline->m_InputDone.load();
+      if (pipeline->DecodeUnits(1) == 0)
+        {
+        if (done)
+          {
+          break;
+          }
+        backoff.Wait();
+        continue;
+        }
+      backoff.Reset();
+      }
+    pipeline->FinishDecoding();
+    return NULL;
+  };
+
+  void DecodeUnit(ReceivedAccessUnit* unit)
+  {
+    // A gap in the sequence means the reader evicted a unit
+    if (unit->m_Sequence != this->m_Expected)
+      {
+      this->m_WaitForIDR = true;
+      this->m_KeyFrameWanted = 1;
+      this->m_Decoder.EndAccessUnit();
+      }
+    this->m_Expected = unit->m_Sequence + 1;
+
+    unsigned char* bitStream = unit->m_Body + IGTL_VIDEO_HEADER_SIZE;
+    int32_t bitStreamSize = unit->m_BodySize - IGTL_VIDEO_HEADER_SIZE;
+    // Decoding resumes only at the first slice of an IDR
+    if (this->m_WaitForIDR &&
+        !(this->m_StartOfAccessUnit && IsIDRAccessUnit(bitStream, bitStreamSize, this->m_NalOffsets)))
+      {
+      this->CountDroppedUnit();
+      }
+    else
+      {
+      this->m_WaitForIDR = false;
+      // The picture may come out during this call; its timing waits for
+      // it, keyed by the capture time the decoder passes through
+      if (unit->m_EndOfAccessUnit && unit->m_Timing.m_CaptureTime)
+        {
+        if (this->m_PendingTimings.size() >= RECEIVER_PIPELINE_MAX_PENDING_TIMINGS)
+          {
+          this->m_PendingTimings.pop_front();
+          }
+        this->m_PendingTimings.push_back(unit->m_Timing);
+        }
+      igtlUint64 start = this->m_Metrics ? MonotonicTimeNs() : 0;
+      this->m_Decoder.DecodeSlices(bitStream, bitStreamSize, unit->m_EndOfAccessUnit, unit->m_Timing.m_CaptureTime);
+      if (this->m_Metrics)
+        {
+        this->m_Metrics->m_DecodeTime->Record(MonotonicTimeNs() - start);
+        this->m_Metrics->m_UnitQueueDepth->Set(this->m_Units->GetSize());
+        }
+      }
+    this->m_StartOfAccessUnit = unit->m_EndOfAccessUnit;
+    this->m_FreeUnits->Push(unit);
+  };
+
+  // Decoder stage: the timing of the access unit whose picture has time
+  // stamp 'timeStamp', with the decode time set. Timings of access units
+  // that gave no picture are discarded on the way. False if the picture
+  // is not traced.
+  bool TakePendingTiming(unsigned long long timeStamp, FrameTiming& timing)
+  {
+    while (!this->m_PendingTimings.empty() && this->m_PendingTimings.front().m_CaptureTime <= timeStamp)
+      {
+      bool found = this->m_PendingTimings.front().m_CaptureTime == timeStamp;
+      if (found)
+        {
+        timing = this->m_PendingTimings.front();
+        timing.m_DecodedTime = MonotonicTimeNs();
+        }
+      this->m_PendingTimings.pop_front();
+      if (found)
+        {
+        return true;
+        }
+      }
+    return false;
+  };
+
+  void CountDroppedUnit()
+  {
+    ++ this->m_DroppedUnits;
+    if (this->m_Metrics)
+      {
+      this->m_Metrics->m_UnitsDropped->Add();
+      }
+  };
+
+  // Decoder or writer stage: a traced picture is complete
+  void RecordTiming(const FrameTiming& timing)
+  {
+    this->m_LatencyTrace.Record(timing);
+    if (this->m_Metrics && timing.m_WrittenTime >= timing.m_CaptureTime)
+      {
+      this->m_Metrics->m_Latency->Record(timing.m_WrittenTime - timing.m_CaptureTime);
+      }
+  };
+
+  // Flushes the pictures still held by the decoder through WriteFrame()
+  // and lets the writer finish
+  void FinishDecoding()
+  {
+    this->m_Decoder.Close();
+    this->m_DecodeDone = 1;
+  };
+
+  static void* WriteThread(void* ptr)
+  {
+    igtl::MultiThreader::ThreadInfo* info =
+      static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+    ReceiverPipeline* pipeline = static_cast<ReceiverPipeline*>(info->UserData);
+
+    RingBufferBackoff backoff;
+    for (;;)
+      {
+      int done = pipeline->m_DecodeDone.load();
+      DecodedPicture* picture = pipeline->m_Pictures->Pop();
+      if (picture == NULL)
+        {
+        if (done)
+          {
+          break;
+          }
+        backoff.Wait();
+        continue;
+        }
+      backoff.Reset();
+      unsigned char* planes[3];
+      int strides[2] = { picture->m_Width, picture->m_Width / 2 };
+      planes[0] = picture->m_Data;
+      planes[1] = planes[0] + picture->m_Width * picture->m_Height;
+      planes[2] = planes[1] + (picture->m_Width / 2) * (picture->m_Height / 2);
+      for (unsigned int i = 0; i < pipeline->m_QueuedSinks.size(); i ++)
+        {
+        pipeline->m_QueuedSinks[i]->WriteFrame(planes, strides, picture->m_Width, picture->m_Height,
+                                               picture->m_TimeStamp);
+        }
+      if (picture->m_Timing.m_CaptureTime)
+        {
+        picture->m_Timing.m_WrittenTime = MonotonicTimeNs();
+        pipeline->RecordTiming(picture->m_Timing);
+        }
+      ++ pipeline->m_PicturesWritten;
+      pipeline->m_FreePictures->Push(picture);
+      if (pipeline->m_Metrics)
+        {
+        pipeline->m_Metrics->m_PictureQueueDepth->Set(pipeline->m_Pictures->GetSize());
+        }
+      }
+    return NULL;
+  };
+
+  std::string                          m_OutputFileName;
+  bool                                 m_DirectIO;
+  FileFrameSink                        m_FileSink;
+  std::vector<DecodedFrameSink*>       m_DirectSinks;
+  std::vector<DecodedFrameSink*>       m_QueuedSinks;  // fed by the writer thread
+  int                                  m_UnitQueueDepth;
+  int                                  m_PictureQueueDepth;
+  bool                                 m_DropOldest;
+  bool                                 m_SharedDecoding;
+  ReceiverMetrics*                     m_Metrics;
+  H264DecoderSession                   m_Decoder;
+  BufferPool::Pointer                  m_BufferPool;
+  igtl::MultiThreader::Pointer         m_Threader;
+
+  SPSCRingBuffer<ReceivedAccessUnit>*  m_Units;         // reader -> decoder
+  SPSCRingBuffer<ReceivedAccessUnit>*  m_FreeUnits;     // decoder -> reader
+  SPSCRingBuffer<DecodedPicture>*      m_Pictures;      // decoder -> writer
+  SPSCRingBuffer<DecodedPicture>*      m_FreePictures;  // writer -> decoder
+  std::vector<ReceivedAccessUnit*>     m_AllUnits;
+  std::vector<DecodedPicture*>         m_AllPictures;
+  ReceivedAccessUnit*                  m_SpareUnit;     // owned by the reader
+  DecodedPicture*                      m_SparePicture;  // owned by the decoder
+  igtlUint64                           m_NextSequence;
+
+  // Decoder stage state, kept here so that any pool worker can continue
+  std::vector<int32_t>                 m_NalOffsets;
+  igtlUint64                           m_Expected;
+  bool                                 m_WaitForIDR;
+  bool                                 m_StartOfAccessUnit;
+  std::deque<FrameTiming>              m_PendingTimings;  // in decoding order
+  LatencyTrace                         m_LatencyTrace;
+
+  int                                  m_DecodeThreadID;
+  int                                  m_WriteThreadID;
+  std::atomic<int>                     m_InputDone;
+  std::atomic<int>                     m_DecodeDone;
+  std::atomic<int>                     m_KeyFrameWanted;
+  std::atomic<igtlUint64>              m_DroppedUnits;
+  std::atomic<igtlUint64>              m_DroppedPictures;
+  std::atomic<int>                     m_PicturesWritten;
+};
+
+#endif // __ReceiverPipeline_h
@@ -0,0 +1,282 @@
+#ifndef __SharedMemoryFrameSink_h
+#define __SharedMemoryFrameSink_h
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <stdint.h>
+#if !defined(_WIN32)
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+#include "DecodedFrameSink.h"
+
+#define SHARED_FRAME_RING_MAGIC   0x49475446  // "IGTF"
+#define SHARED_FRAME_RING_VERSION 1
+
+// Layout of the shared memory object, for the processes that read it:
+//
+//   SSharedFrameRingHeader, padded to SHARED_FRAME_RING_HEADER_SIZE
+//   uiSlotCount x { SSharedFrameSlotHeader padded to SHARED_FRAME_SLOT_DATA_OFFSET,
+//                   uiSlotSize bytes of I420, padding to uiSlotStride }
+//
+// Slots are written round robin and never waited for; a reader that
+// falls behind loses frames rather than slowing the decoder. Each slot is
+// guarded by a sequence counter that is odd while the slot is written,
+// so a reader can use the planes in place and check afterwards that they
+// were not overwritten meanwhile (see SharedMemoryFrameReader).
+struct SSharedFrameRingHeader {
+  uint32_t              uiMagic;
+  uint32_t              uiVersion;
+  uint32_t              uiSlotCount;
+  uint32_t              uiSlotSize;     // bytes of picture data per slot
+  uint32_t              uiSlotStride;   // bytes from one slot header to the next
+  uint32_t              uiReserved;
+  std::atomic<uint64_t> uiFramesWritten;
+};
+
+struct SSharedFrameSlotHeader {
+  std::atomic<uint64_t> uiSequence;     // 2n+1 while frame n is written, 2n+2 once it is complete
+  uint64_t              uiTimeStamp;
+  int32_t               iWidth;
+  int32_t               iHeight;
+  int32_t               iStride[2];     // Y, then U and V; planes follow the slot header back to back
+};
+
+#define SHARED_FRAME_RING_HEADER_SIZE ((sizeof (SSharedFrameRingHeader) + 63) & ~(size_t) 63)
+#define SHARED_FRAME_SLOT_DATA_OFFSET ((sizeof (SSharedFrameSlotHeader) + 63) & ~(size_t) 63)
+
+// Bytes of a ring of uiSlotCount slots of uiSlotSize bytes of picture
+// data. False when the slot size does not fit the header or the ring
+// does not fit the address space.
+inline bool GetRingSize (uint64_t uiSlotCount, uint64_t uiSlotSize, uint64_t& uiRingSize) {
+  uint64_t uiSlotStride = (SHARED_FRAME_SLOT_DATA_OFFSET + uiSlotSize + 63) & ~(uint64_t) 63;
+  if (uiSlotCount == 0 || uiSlotSize == 0 || uiSlotStride > 0xffffffffULL)
+    return false;
+  uint64_t uiLimit = (uint64_t) (SIZE_MAX >> 1);
+  if (uiSlotCount > (uiLimit - SHARED_FRAME_RING_HEADER_SIZE) / uiSlotStride)
+    return false;
+  uiRingSize = SHARED_FRAME_RING_HEADER_SIZE + uiSlotCount * uiSlotStride;
+  return true;
+}
+
+// Publishes decoded pictures in a POSIX shared memory object that other
+// processes (navigation, inference) map read-only. The decoder's planes
+// are copied once, into the slot; readers use them where they are.
+class SharedMemoryFrameSink : public DecodedFrameSink {
+ public:
+  SharedMemoryFrameSink()
+    : m_pHeader (NULL), m_uiMappedSize (0), m_uiDropped (0) {
+  }
+  virtual ~SharedMemoryFrameSink() {
+    Close();
+  }
+
+  // Creates (or replaces) the object kpName, e.g. "/igtl-video", with
+  // iSlotCount slots for pictures of up to iMaxWidth x iMaxHeight. Fails
+  // for no slots, a size that is not positive or a ring too large to map.
+  bool Open (const char* kpName, int iSlotCount, int iMaxWidth, int iMaxHeight) {
+    Close();
+#if defined(_WIN32)
+    fprintf (stderr, "Shared memory output is not supported on this platform.\n");
+    return false;
+#else
+    uint64_t uiMappedSize = 0;
+    if (iSlotCount <= 0 || iMaxWidth <= 0 || iMaxHeight <= 0
+        || !GetRingSize ((uint64_t) iSlotCount, (uint64_t) iMaxWidth * iMaxHeight * 3 / 2, uiMappedSize)) {
+      fprintf (stderr, "Can not make a shared memory ring of %d slots of %dx%d.\n", iSlotCount, iMaxWidth, iMaxHeight);
+      return false;
+    }
+    uint32_t uiSlotSize = (uint32_t) ((uint64_t) iMaxWidth * iMaxHeight * 3 / 2);
+    uint32_t uiSlotStride = (uint32_t) ((SHARED_FRAME_SLOT_DATA_OFFSET + uiSlotSize + 63) & ~(uint64_t) 63);
+    m_uiMappedSize = (size_t) uiMappedSize;
+    m_strName = kpName;
+    int iFd = shm_open (kpName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (iFd < 0 || ftruncate (iFd, m_uiMappedSize) != 0) {
+      fprintf (stderr, "Can not create shared memory %s.\n", kpName);
+      if (iFd >= 0)
+        close (iFd);
+      return false;
+    }
+    void* pMap = mmap (NULL, m_uiMappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, iFd, 0);
+    close (iFd);
+    if (pMap == MAP_FAILED) {
+      shm_unlink (kpName);
+      return false;
+    }
+    m_pHeader = (SSharedFrameRingHeader*) pMap;
+    m_pHeader->uiSlotCount = iSlotCount;
+    m_pHeader->uiSlotSize = uiSlotSize;
+    m_pHeader->uiSlotStride = uiSlotStride;
+    m_pHeader->uiFramesWritten.store (0);
+    for (int i = 0; i < iSlotCount; i++)
+      GetSlot (i)->uiSequence.store (0);
+    m_pHeader->uiVersion = SHARED_FRAME_RING_VERSION;
+    // Readers check the magic last
+    std::atomic_thread_fence (std::memory_order_release);
+    m_pHeader->uiMagic = SHARED_FRAME_RING_MAGIC;
+    return true;
+#endif
+  }
+
+  virtual void WriteFrame (unsigned char* pData[3], int iStride[2], int iWidth, int iHeight,
+                           unsigned long long uiTimeStamp) {
+    if (m_pHeader == NULL)
+      return;
+    if ((uint64_t) iWidth * iHeight * 3 / 2 > m_pHeader->uiSlotSize) {
+      ++ m_uiDropped;
+      return;
+    }
+    uint64_t uiFrame = m_pHeader->uiFramesWritten.load (std::memory_order_relaxed);
+    SSharedFrameSlotHeader* pSlot = GetSlot ((uint32_t) (uiFrame % m_pHeader->uiSlotCount));
+    pSlot->uiSequence.store (2 * uiFrame + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+
+    pSlot->uiTimeStamp = uiTimeStamp;
+    pSlot->iWidth = iWidth;
+    pSlot->iHeight = iHeight;
+    pSlot->iStride[0] = iWidth;
+    pSlot->iStride[1] = iWidth / 2;
+    unsigned char* pDst = (unsigned char*) pSlot + SHARED_FRAME_SLOT_DATA_OFFSET;
+    for (int i = 0; i < iHeight; i++, pDst += iWidth)
+      memcpy (pDst, pData[0] + i * iStride[0], iWidth);
+    for (int p = 1; p < 3; p++) {
+      for (int i = 0; i < iHeight / 2; i++, pDst += iWidth / 2)
+        memcpy (pDst, pData[p] + i * iStride[1], iWidth / 2);
+    }
+
+    pSlot->uiSequence.store (2 * uiFrame + 2, std::memory_order_release);
+    m_pHeader->uiFramesWritten.store (uiFrame + 1, std::memory_order_release);
+  }
+
+  // Pictures larger than a slot, which were not published
+  unsigned long long GetNumberOfDroppedFrames() const { return m_uiDropped; }
+
+  void Close() {
+#if !defined(_WIN32)
+    if (m_pHeader) {
+      munmap (m_pHeader, m_uiMappedSize);
+      shm_unlink (m_strName.c_str());
+    }
+#endif
+    m_pHeader = NULL;
+  }
+
+ protected:
+  SSharedFrameSlotHeader* GetSlot (uint32_t uiSlot) {
+    return (SSharedFrameSlotHeader*) ((unsigned char*) m_pHeader + SHARED_FRAME_RING_HEADER_SIZE
+                                      + (size_t) uiSlot * m_pHeader->uiSlotStride);
+  }
+
+  SSharedFrameRingHeader* m_pHeader;
+  size_t                  m_uiMappedSize;
+  std::string             m_strName;
+  unsigned long long      m_uiDropped;
+};
+
+// Reader side, for the consuming processes. Maps the object read-only
+// and hands out the latest complete picture in place.
+class SharedMemoryFrameReader {
+ public:
+  SharedMemoryFrameReader()
+    : m_pHeader (NULL), m_uiMappedSize (0) {
+  }
+  ~SharedMemoryFrameReader() {
+    Close();
+  }
+
+  bool Open (const char* kpName) {
+    Close();
+#if defined(_WIN32)
+    return false;
+#else
+    int iFd = shm_open (kpName, O_RDONLY, 0);
+    if (iFd < 0)
+      return false;
+    struct stat sStat;
+    if (fstat (iFd, &sStat) != 0 || (size_t) sStat.st_size < sizeof (SSharedFrameRingHeader)) {
+      close (iFd);
+      return false;
+    }
+    void* pMap = mmap (NULL, sStat.st_size, PROT_READ, MAP_SHARED, iFd, 0);
+    close (iFd);
+    if (pMap == MAP_FAILED)
+      return false;
+    m_pHeader = (const SSharedFrameRingHeader*) pMap;
+    m_uiMappedSize = sStat.st_size;
+    if (m_pHeader->uiMagic != SHARED_FRAME_RING_MAGIC || m_pHeader->uiVersion != SHARED_FRAME_RING_VERSION) {
+      Close();
+      return false;
+    }
+    std::atomic_thread_fence (std::memory_order_acquire);
+    // Every slot the header describes must lie inside the mapping
+    uint64_t uiRingSize = 0;
+    if (!GetRingSize (m_pHeader->uiSlotCount, m_pHeader->uiSlotSize, uiRingSize)
+        || m_pHeader->uiSlotStride != ((SHARED_FRAME_SLOT_DATA_OFFSET + (uint64_t) m_pHeader->uiSlotSize + 63) & ~(uint64_t) 63)
+        || uiRingSize > (uint64_t) m_uiMappedSize) {
+      Close();
+      return false;
+    }
+    return true;
+#endif
+  }
+
+  // Number of the newest complete picture plus one; 0 before the first
+  uint64_t GetFramesWritten() const {
+    return m_pHeader ? m_pHeader->uiFramesWritten.load (std::memory_order_acquire) : 0;
+  }
+
+  // Points pData at the planes of picture uiFrame, which must be one of
+  // the last SlotCount pictures. Returns the slot's sequence value to
+  // pass to IsStillValid() once the planes have been used, or 0 if the
+  // picture is no longer (or not yet) there.
+  uint64_t Acquire (uint64_t uiFrame, const unsigned char* pData[3], int iStride[2], int& iWidth, int& iHeight,
+                    unsigned long long& uiTimeStamp) const {
+    if (m_pHeader == NULL)
+      return 0;
+    const SSharedFrameSlotHeader* pSlot = GetSlot ((uint32_t) (uiFrame % m_pHeader->uiSlotCount));
+    uint64_t uiSequence = pSlot->uiSequence.load (std::memory_order_acquire);
+    if (uiSequence != 2 * uiFrame + 2)
+      return 0;
+    iWidth = pSlot->iWidth;
+    iHeight = pSlot->iHeight;
+    iStride[0] = pSlot->iStride[0];
+    iStride[1] = pSlot->iStride[1];
+    uiTimeStamp = pSlot->uiTimeStamp;
+    pData[0] = (const unsigned char*) pSlot + SHARED_FRAME_SLOT_DATA_OFFSET;
+    pData[1] = pData[0] + iStride[0] * iHeight;
+    pData[2] = pData[1] + iStride[1] * (iHeight / 2);
+    return uiSequence;
+  }
+
+  // False if the writer has started to overwrite the picture since
+  // Acquire(); whatever was read from it must then be discarded.
+  bool IsStillValid (uint64_t uiFrame, uint64_t uiSequence) const {
+    std::atomic_thread_fence (std::memory_order_acquire);
+    const SSharedFrameSlotHeader* pSlot = GetSlot ((uint32_t) (uiFrame % m_pHeader->uiSlotCount));
+    return pSlot->uiSequence.load (std::memory_order_relaxed) == uiSequence;
+  }
+
+  void Close() {
+#if !defined(_WIN32)
+    if (m_pHeader)
+      munmap ((void*) m_pHeader, m_uiMappedSize);
+#endif
+    m_pHeader = NULL;
+  }
+
+ protected:
+  const SSharedFrameSlotHeader* GetSlot (uint32_t uiSlot) const {
+    return (const SSharedFrameSlotHeader*) ((const unsigned char*) m_pHeader + SHARED_FRAME_RING_HEADER_SIZE
+                                            + (size_t) uiSlot * m_pHeader->uiSlotStride);
+  }
+
+  const SSharedFrameRingHeader* m_pHeader;
+  size_t                        m_uiMappedSize;
+};
+
+#endif // __SharedMemoryFrameSink_h
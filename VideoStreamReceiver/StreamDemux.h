@@ -0,0 +1,302 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __StreamDemux_h
+#define __StreamDemux_h
+
+#include <cstdio>
+#include <map>
+#include <string>
+
+#include "igtlObject.h"
+#include "igtlMutexLock.h"
+
+#include "BitStreamLog.h"
+#include "DecoderWorkerPool.h"
+#include "FrameTiming.h"
+#include "MetricsRegistry.h"
+#include "ReceiverPipeline.h"
+#include "SharedMemoryFrameSink.h"
+#include "VideoDeviceNames.h"
+
+// One video source, named by the device name of its messages
+struct ReceiverStream
+{
+  std::string               m_Name;
+  ReceiverPipeline::Pointer m_Pipeline;
+  SharedMemoryFrameSink*    m_SharedMemory;
+  int                       m_Connection;  // the only connection that may feed it
+  int                       m_Frames;      // complete access units received
+  FrameTiming               m_Timing;      // of the access unit being received; m_CaptureTime 0 if none
+  ReceiverMetrics           m_Metrics;     // if the demux has a registry
+  BitStreamLog::Pointer     m_Log;         // NULL if the bit stream is not recorded
+};
+
+// Sorts the VIDEO messages of one or more connections into streams by
+// device name. The first message of a device creates its stream: a
+// ReceiverPipeline with a decoder of its own, decoded on the shared
+// DecoderWorkerPool, with outputs named after the device. The pipeline's
+// reader stage is single-threaded, so a device name belongs to the
+// connection it was first seen on; the same name on another connection
+// is refused, and that connection is expected to close.
+class StreamDemux : public igtl::Object
+{
+public:
+  typedef StreamDemux                    Self;
+  typedef igtl::Object                   Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(StreamDemux, igtl::Object);
+  igtlNewMacro(StreamDemux);
+
+  // Configuration of the streams created from now on. The output file
+  // and shared memory names are used as they are for VIDEO_DEVICE_NAME;
+  // other streams get the device name added.
+  void SetOutputFileName(const std::string& name)  { this->m_OutputFileName = name; };
+  void SetDirectIO(bool direct)                    { this->m_DirectIO = direct; };
+  void SetUnitQueueDepth(int depth)                { this->m_UnitQueueDepth = depth; };
+  void SetPictureQueueDepth(int depth)             { this->m_PictureQueueDepth = depth; };
+  void SetDropOldest(bool drop)                    { this->m_DropOldest = drop; };
+  // Per picture latency log of every stream (see LatencyTrace)
+  void SetTraceLog(FILE* log)                      { this->m_TraceLog = log; };
+  // Registry the counters of every stream are added to, labeled with
+  // its device name; NULL for none
+  void SetMetrics(MetricsRegistry* registry)       { this->m_Metrics = registry; };
+  // Records the received bit stream of every stream in segments of
+  // about 'segmentSize' bytes (see BitStreamLog); empty for none
+  void SetBitStreamLog(const std::string& name, igtlUint64 segmentSize)
+  {
+    this->m_LogFileName = name;
+    this->m_LogSegmentSize = segmentSize;
+  };
+  void SetSharedMemory(const std::string& name, int slots, int maxWidth, int maxHeight)
+  {
+    this->m_SharedMemoryName = name;
+    this->m_SharedMemorySlots = slots;
+    this->m_SharedMemoryWidth = maxWidth;
+    this->m_SharedMemoryHeight = maxHeight;
+  };
+
+  DecoderWorkerPool* GetWorkerPool() const { return this->m_Pool; };
+
+  void Start()
+  {
+    this->m_Pool->Start();
+    this->m_Running = true;
+  };
+
+  // Returns the stream of a VIDEO message received on 'connection' and
+  // sets 'endOfAccessUnit' to false for a slice that more of the access
+  // unit follows. NULL if the stream could not be started or belongs to
+  // another connection; 'otherConnection' tells the two apart.
+  ReceiverStream* GetStream(const char* deviceName, int connection, bool& endOfAccessUnit, bool& otherConnection)
+  {
+    std::string name;
+    endOfAccessUnit = ParseVideoDeviceName(deviceName, name);
+    otherConnection = false;
+
+    this->m_Lock->Lock();
+    ReceiverStream* stream = NULL;
+    std::map<std::string, ReceiverStream*>::iterator it = this->m_Streams.find(name);
+    if (it != this->m_Streams.end())
+      {
+      stream = it->second;
+      }
+    else
+      {
+      stream = this->CreateStream(name, connection);
+      this->m_Streams[name] = stream;
+      }
+    this->m_Lock->Unlock();
+
+    if (stream != NULL && stream->m_Connection != connection)
+      {
+      otherConnection = true;
+      return NULL;
+      }
+    return stream;
+  };
+
+  // Drains and stops every stream, then the workers
+  void Stop()
+  {
+    if (!this->m_Running)
+      {
+      return;
+      }
+    this->m_Running = false;
+    this->m_Lock->Lock();
+    std::map<std::string, ReceiverStream*>::iterator it;
+    for (it = this->m_Streams.begin(); it != this->m_Streams.end(); ++ it)
+      {
+      ReceiverStream* stream = it->second;
+      if (stream == NULL)
+        {
+        continue;
+        }
+      this->m_Pool->RemoveStream(stream->m_Pipeline);
+      fprintf(stderr, "Stream %s: ", stream->m_Name.c_str());
+      stream->m_Pipeline->Stop();
+      if (stream->m_SharedMemory && stream->m_SharedMemory->GetNumberOfDroppedFrames() > 0)
+        {
+        fprintf(stderr, "Stream %s: %llu pictures too large for the shared memory ring\n", stream->m_Name.c_str(),
+                stream->m_SharedMemory->GetNumberOfDroppedFrames());
+        }
+      if (stream->m_Log)
+        {
+        stream->m_Log->Close();
+        fprintf(stderr, "Stream %s: %llu frames recorded in %d segments, %llu messages before the first IDR not recorded\n",
+                stream->m_Name.c_str(), (unsigned long long) stream->m_Log->GetNumberOfFrames(),
+                stream->m_Log->GetNumberOfSegments(), (unsigned long long) stream->m_Log->GetNumberOfSkippedMessages());
+        }
+      }
+    this->m_Lock->Unlock();
+    this->m_Pool->Stop();
+  };
+
+  // The latency histograms of every stream, after Stop()
+  void WriteLatencyHistograms(FILE* fp)
+  {
+    this->m_Lock->Lock();
+    std::map<std::string, ReceiverStream*>::iterator it;
+    for (it = this->m_Streams.begin(); it != this->m_Streams.end(); ++ it)
+      {
+      if (it->second)
+        {
+        it->second->m_Pipeline->GetLatencyTrace()->WriteHistograms(fp);
+        }
+      }
+    this->m_Lock->Unlock();
+  };
+
+protected:
+  StreamDemux()
+    : m_DirectIO(false), m_UnitQueueDepth(RECEIVER_PIPELINE_DEFAULT_UNIT_QUEUE_DEPTH),
+      m_PictureQueueDepth(RECEIVER_PIPELINE_DEFAULT_PICTURE_QUEUE_DEPTH), m_DropOldest(false),
+      m_SharedMemorySlots(0), m_SharedMemoryWidth(0), m_SharedMemoryHeight(0), m_TraceLog(NULL), m_Metrics(NULL),
+      m_LogSegmentSize(BIT_STREAM_LOG_DEFAULT_SEGMENT_SIZE), m_Running(false)
+  {
+    this->m_Pool = DecoderWorkerPool::New();
+    this->m_Lock = igtl::MutexLock::New();
+  };
+  ~StreamDemux()
+  {
+    this->Stop();
+    std::map<std::string, ReceiverStream*>::iterator it;
+    for (it = this->m_Streams.begin(); it != this->m_Streams.end(); ++ it)
+      {
+      if (it->second)
+        {
+        // The pipeline goes first; it may still hold the sink
+        it->second->m_Pipeline = NULL;
+        delete it->second->m_SharedMemory;
+        delete it->second;
+        }
+      }
+  };
+
+  // "outputDecodedVideo.yuv" becomes "outputDecodedVideo_<stream>.yuv"
+  static std::string StreamFileName(const std::string& name, const std::string& stream)
+  {
+    if (name.empty() || stream == VIDEO_DEVICE_NAME)
+      {
+      return name;
+      }
+    size_t dot = name.find_last_of('.');
+    size_t slash = name.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+      {
+      return name + "_" + stream;
+      }
+    return name.substr(0, dot) + "_" + stream + name.substr(dot);
+  };
+
+  // Called with m_Lock held. Returns NULL, which is remembered, if the
+  // stream can not be started.
+  ReceiverStream* CreateStream(const std::string& name, int connection)
+  {
+    ReceiverStream* stream = new ReceiverStream();
+    stream->m_Name = name;
+    stream->m_Connection = connection;
+    stream->m_Frames = 0;
+    stream->m_SharedMemory = NULL;
+    stream->m_Timing.m_CaptureTime = 0;
+    stream->m_Pipeline = ReceiverPipeline::New();
+    stream->m_Pipeline->SetOutputFileName(StreamFileName(this->m_OutputFileName, name));
+    stream->m_Pipeline->SetDirectIO(this->m_DirectIO);
+    stream->m_Pipeline->SetUnitQueueDepth(this->m_UnitQueueDepth);
+    stream->m_Pipeline->SetPictureQueueDepth(this->m_PictureQueueDepth);
+    stream->m_Pipeline->SetDropOldest(this->m_DropOldest);
+    stream->m_Pipeline->SetSharedDecoding(true);
+    stream->m_Pipeline->GetLatencyTrace()->SetLog(this->m_TraceLog, name);
+    if (this->m_Metrics)
+      {
+      RegisterReceiverMetrics(this->m_Metrics, name, stream->m_Metrics);
+      stream->m_Pipeline->SetMetrics(&stream->m_Metrics);
+      }
+    if (!this->m_LogFileName.empty())
+      {
+      stream->m_Log = BitStreamLog::New();
+      stream->m_Log->SetFileName(StreamFileName(this->m_LogFileName, name));
+      stream->m_Log->SetSegmentSize(this->m_LogSegmentSize);
+      }
+    if (!this->m_SharedMemoryName.empty())
+      {
+      std::string shmName = this->m_SharedMemoryName;
+      if (name != VIDEO_DEVICE_NAME)
+        {
+        shmName += "-" + name;
+        }
+      stream->m_SharedMemory = new SharedMemoryFrameSink();
+      if (stream->m_SharedMemory->Open(shmName.c_str(), this->m_SharedMemorySlots,
+                                       this->m_SharedMemoryWidth, this->m_SharedMemoryHeight))
+        {
+        // Published straight from the decoder, without the copy into the
+        // picture queue
+        stream->m_Pipeline->AddSink(stream->m_SharedMemory, true);
+        }
+      }
+    if (!stream->m_Pipeline->Start())
+      {
+      fprintf(stderr, "Can not start a decoder for %s.\n", name.c_str());
+      delete stream->m_SharedMemory;
+      delete stream;
+      return NULL;
+      }
+    fprintf(stderr, "New stream: %s\n", name.c_str());
+    this->m_Pool->AddStream(stream->m_Pipeline);
+    return stream;
+  };
+
+  std::string                             m_OutputFileName;
+  bool                                    m_DirectIO;
+  int                                     m_UnitQueueDepth;
+  int                                     m_PictureQueueDepth;
+  bool                                    m_DropOldest;
+  std::string                             m_SharedMemoryName;
+  int                                     m_SharedMemorySlots;
+  int                                     m_SharedMemoryWidth;
+  int                                     m_SharedMemoryHeight;
+  FILE*                                   m_TraceLog;
+  MetricsRegistry*                        m_Metrics;
+  std::string                             m_LogFileName;
+  igtlUint64                              m_LogSegmentSize;
+  bool                                    m_Running;
+
+  DecoderWorkerPool::Pointer              m_Pool;
+  igtl::MutexLock::Pointer                m_Lock;     // guards m_Streams
+  std::map<std::string, ReceiverStream*>  m_Streams;  // NULL for streams that failed to start
+};
+
+#endif // __StreamDemux_h
@@ -0,0 +1,236 @@
+/*=========================================================================
+
+ Program:   OpenIGTLink
+ Language:  C++
+
+ Copyright (c) Insight Software Consortium. All rights reserved.
+
+ This software is distributed WITHOUT ANY WARRANTY; without even
+ the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ PURPOSE.  See the above copyright notices for more information.
+
+ =========================================================================*/
+
+// Decodes recorded H.264 streams offline, in parallel, into one I420
+// file: access unit files of the server's --record, the segments of the
+// receiver's --record (or their .segments list) and raw Annex-B files.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "igtlMultiThreader.h"
+
+#include "AccessUnitFile.h"
+#include "EncodedUnitSource.h"
+#include "FileFrameSink.h"
+#include "MonotonicClock.h"
+#include "ParallelDecoder.h"
+
+// Opens one input as a source; a .segments list adds all its segments
+bool AddInput(const std::string& name, int layer, std::vector<EncodedUnitSource::Pointer>& sources);
+// Decodes every source with 'workers' threads; prints and returns the
+// pictures per second
+double Decode(std::vector<EncodedUnitSource::Pointer>& sources, int workers, int chunkUnits, int window,
+              DecodedFrameSink* output);
+
+int main(int argc, char* argv[])
+{
+  //------------------------------------------------------------
+  // Parse Arguments
+
+  if (argc < 2) // check number of arguments
+  {
+    // If not correct, print usage
+    std::cerr << "Usage: " << argv[0] << " <input> [<input> ...] [options]" << std::endl;
+    std::cerr << "    <input>    : Access unit file (--record of the server or the receiver), a .segments list"
+              << " of the receiver's recording or a raw H.264 (Annex-B) file; inputs are decoded one after the other"
+              << std::endl;
+    std::cerr << "    --output <file>     : Decoded I420 output, in stream order (none in default)" << std::endl;
+    std::cerr << "    --direct-io         : Write the output file with O_DIRECT, bypassing the page cache" << std::endl;
+    std::cerr << "    --threads <n>       : Decoder threads (one per core in default)" << std::endl;
+    std::cerr << "    --chunk-frames <n>  : Frames a chunk has at least before the next IDR begins a new one ("
+              << PARALLEL_DECODER_DEFAULT_CHUNK_UNITS << " in default)" << std::endl;
+    std::cerr << "    --window <n>        : Chunks decoded ahead of the one being written (twice the threads in default)"
+              << std::endl;
+    std::cerr << "    --layer <n>         : Spatial layer of a layered recording (the largest in default)" << std::endl;
+    std::cerr << "    --scaling           : Decode without output with 1, 2, 4, ... threads up to --threads and"
+              << " print the speed up" << std::endl;
+    exit(0);
+  }
+
+  std::vector<std::string> inputs;
+  std::string outputName;
+  bool directIO = false;
+  int threads = 0;
+  int chunkUnits = PARALLEL_DECODER_DEFAULT_CHUNK_UNITS;
+  int window = 0;
+  int layer = -1;
+  bool scaling = false;
+  for (int i = 1; i < argc; i ++)
+  {
+    if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+    {
+      outputName = argv[++i];
+    }
+    else if (strcmp(argv[i], "--direct-io") == 0)
+    {
+      directIO = true;
+    }
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+    {
+      threads = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--chunk-frames") == 0 && i + 1 < argc)
+    {
+      chunkUnits = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc)
+    {
+      window = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--layer") == 0 && i + 1 < argc)
+    {
+      layer = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--scaling") == 0)
+    {
+      scaling = true;
+    }
+    else if (strncmp(argv[i], "--", 2) == 0)
+    {
+      std::cerr << "Unknown option: " << argv[i] << std::endl;
+      exit(0);
+    }
+    else
+    {
+      inputs.push_back(argv[i]);
+    }
+  }
+  if (threads <= 0)
+  {
+    threads = igtl::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  }
+
+  std::vector<EncodedUnitSource::Pointer> sources;
+  for (unsigned int i = 0; i < inputs.size(); i ++)
+  {
+    if (!AddInput(inputs[i], layer, sources))
+    {
+      std::cerr << "Can not read " << inputs[i] << std::endl;
+      exit(1);
+    }
+  }
+  if (sources.empty())
+  {
+    std::cerr << "No input." << std::endl;
+    exit(1);
+  }
+
+  if (scaling)
+  {
+    // Every run decodes the same chunks; the first one also warms the
+    // page cache for the others
+    Decode(sources, 1, chunkUnits, window, NULL);
+    std::cout << "threads,fps,speedup" << std::endl;
+    double single = 0.0;
+    for (int n = 1; n <= threads; n = (n * 2 <= threads || n == threads) ? n * 2 : threads)
+    {
+      double fps = Decode(sources, n, chunkUnits, window, NULL);
+      if (n == 1)
+      {
+        single = fps;
+      }
+      std::cout << n << "," << fps << "," << (single > 0.0 ? fps / single : 0.0) << std::endl;
+    }
+    return 0;
+  }
+
+  FileFrameSink output;
+  if (!outputName.empty() && !output.Open(outputName.c_str(), directIO))
+  {
+    std::cerr << "Can not open " << outputName << std::endl;
+    exit(1);
+  }
+  double fps = Decode(sources, threads, chunkUnits, window, outputName.empty() ? NULL : &output);
+  output.Close();
+  return fps > 0.0 ? 0 : 1;
+}
+
+bool AddInput(const std::string& name, int layer, std::vector<EncodedUnitSource::Pointer>& sources)
+{
+  std::string suffix = ".segments";
+  if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+  {
+    // file,first_frame,frames,first_time_ns
+    std::ifstream list(name.c_str());
+    std::string line;
+    std::getline(list, line);
+    bool ok = list.good();
+    while (ok && std::getline(list, line))
+    {
+      if (!line.empty())
+      {
+        ok = AddInput(line.substr(0, line.find(',')), layer, sources);
+      }
+    }
+    return ok;
+  }
+
+  char magic[8] = { 0 };
+  FILE* fp = fopen(name.c_str(), "rb");
+  if (fp == NULL)
+  {
+    return false;
+  }
+  size_t r = fread(magic, 1, sizeof(magic), fp);
+  fclose(fp);
+  if (r == sizeof(magic) && memcmp(magic, ACCESS_UNIT_FILE_MAGIC, sizeof(magic)) == 0)
+  {
+    AccessUnitFileSource::Pointer source = AccessUnitFileSource::New();
+    if (!source->Open(name, layer))
+    {
+      return false;
+    }
+    sources.push_back(source.GetPointer());
+    return true;
+  }
+  AnnexBFileSource::Pointer source = AnnexBFileSource::New();
+  if (!source->Open(name))
+  {
+    return false;
+  }
+  sources.push_back(source.GetPointer());
+  return true;
+}
+
+double Decode(std::vector<EncodedUnitSource::Pointer>& sources, int workers, int chunkUnits, int window,
+              DecodedFrameSink* output)
+{
+  ParallelDecoder::Pointer decoder = ParallelDecoder::New();
+  for (unsigned int i = 0; i < sources.size(); i ++)
+  {
+    decoder->AddSource(sources[i]);
+  }
+  decoder->SetNumberOfWorkers(workers);
+  decoder->SetMinimumChunkUnits(chunkUnits);
+  decoder->SetWindow(window);
+  decoder->SetOutput(output);
+
+  igtlUint64 start = MonotonicTimeNs();
+  bool ok = decoder->Run();
+  double seconds = (MonotonicTimeNs() - start) / 1e9;
+  double fps = seconds > 0.0 ? decoder->GetNumberOfPictures() / seconds : 0.0;
+  fprintf(stderr, "%d threads: %llu pictures from %llu chunks in %.3f s, %.1f fps, %.3f s in the decoders%s\n",
+          workers, (unsigned long long) decoder->GetNumberOfPictures(), (unsigned long long) decoder->GetNumberOfChunks(),
+          seconds, fps, decoder->GetDecodeTime() / 1e6, ok ? "" : " (stopped at a read error)");
+  if (decoder->GetNumberOfChunks() < (size_t) workers)
+  {
+    fprintf(stderr, "Fewer chunks than threads; IDRs more often or a smaller --chunk-frames would decode in parallel\n");
+  }
+  return ok ? fps : 0.0;
+}
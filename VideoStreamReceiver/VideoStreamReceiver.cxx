@@ -26,53 +26,289 @@
 #include "igtlServerSocket.h"
 #include "igtlMultiThreader.h"
 
-#include "H264Decoder.h"
+#include "BitStreamLog.h"
+#include "FrameTiming.h"
+#include "KeyFrameRequest.h"
+#include "StreamError.h"
+#include "MetricsRegistry.h"
+#include "VideoDeviceNames.h"
+#include "ReceiverPipeline.h"
+#include "StreamDemux.h"
 
 
-int ReceiveVideoData(igtl::ClientSocket::Pointer& socket, igtl::MessageHeader::Pointer& header, ISVCDecoder* decoder_, const char* outputFileName);
+#define RECEIVER_DEFAULT_SHM_SLOTS  4
+#define RECEIVER_DEFAULT_SHM_WIDTH  1920
+#define RECEIVER_DEFAULT_SHM_HEIGHT 1080
+
+// One server to receive from. The main thread serves the first; every
+// further --connect gets a thread of its own.
+typedef struct {
+  std::string  hostname;
+  int          port;
+  int          id;
+  std::string  request;   // STT_VIDEO device name: "<profile>[/<layer>]"
+  int          interval;
+  int          frameNum;  // per stream
+  StreamDemux* demux;
+} ReceiverConnection;
+
+void* ConnectionThread(void* ptr);
+int ReceiveStreams(ReceiverConnection* connection);
+int ReceiveVideoData(igtl::ClientSocket::Pointer& socket, igtl::MessageHeader::Pointer& header, ReceiverPipeline* pipeline,
+                     bool endOfAccessUnit = true, FrameTiming* timing = NULL,
+                     BitStreamLog* log = NULL, const unsigned char* rawHeader = NULL);
+int ReceiveFrameTiming(igtl::ClientSocket::Pointer& socket, igtl::MessageHeader::Pointer& header, FrameTiming& timing);
 
 int main(int argc, char* argv[])
 {
   //------------------------------------------------------------
   // Parse Arguments
   
-  if (argc != 5) // check number of arguments
+  if (argc < 5) // check number of arguments
   {
     // If not correct, print usage
-    std::cerr << "Usage: " << argv[0] << " <hostname> <port> <fps>"    << std::endl;
+    std::cerr << "Usage: " << argv[0] << " <hostname> <port> <fps> <frameNum> [options]"    << std::endl;
     std::cerr << "    <hostname> : IP or host name"                    << std::endl;
     std::cerr << "    <port>     : Port # (18944 in default)"   << std::endl;
     std::cerr << "    <fps>      : Frequency (fps) to send frame" << std::endl;
-    std::cerr << "    <frameNum>      : Number of frame to be received" << std::endl;
+    std::cerr << "    <frameNum>      : Number of frame to be received (of every video device)" << std::endl;
+    std::cerr << "    --connect <host:port> : Also receive from this server; repeat for more" << std::endl;
+    std::cerr << "    --decoders <n>      : Decoder threads shared by all streams (one per core in default)" << std::endl;
+    std::cerr << "    --unit-queue <n>    : Received frames waiting for the decoder ("
+              << RECEIVER_PIPELINE_DEFAULT_UNIT_QUEUE_DEPTH << " in default)" << std::endl;
+    std::cerr << "    --picture-queue <n> : Decoded pictures waiting to be written ("
+              << RECEIVER_PIPELINE_DEFAULT_PICTURE_QUEUE_DEPTH << " in default)" << std::endl;
+    std::cerr << "    --drop-oldest       : Drop the oldest frame instead of waiting when a queue is full" << std::endl;
+    std::cerr << "    --profile <name>    : Encoder profile to ask the server for (low-latency, lossless-diagnostic,"
+              << " ultra-low-latency, bandwidth-saver, svc-3-layer)" << std::endl;
+    std::cerr << "    --layer <n|Nk>      : Spatial layer of a layered stream to receive, by index (0 is the smallest)"
+              << " or by bitrate in kbit/s, e.g. 800k" << std::endl;
+    std::cerr << "    --output <file>     : Decoded I420 output (outputDecodedVideo.yuv in default, - for none);"
+              << " streams other than " << VIDEO_DEVICE_NAME << " get _<device> added" << std::endl;
+    std::cerr << "    --direct-io         : Write the output file with O_DIRECT, bypassing the page cache" << std::endl;
+    std::cerr << "    --shm <name>        : Also publish decoded pictures in the shared memory ring <name>, e.g. /igtl-video;"
+              << " streams other than " << VIDEO_DEVICE_NAME << " get -<device> added" << std::endl;
+    std::cerr << "    --shm-slots <n>     : Pictures kept in the shared memory ring (" << RECEIVER_DEFAULT_SHM_SLOTS
+              << " in default)" << std::endl;
+    std::cerr << "    --shm-size <WxH>    : Largest picture the ring holds (" << RECEIVER_DEFAULT_SHM_WIDTH << "x"
+              << RECEIVER_DEFAULT_SHM_HEIGHT << " in default)" << std::endl;
+    std::cerr << "    --trace <file>      : Log the time stamps of every picture the server traces (--trace) to <file>"
+              << " and the latency histograms to <file>.hist" << std::endl;
+    std::cerr << "    --metrics <file>    : Write the live counters of every stream to <file> in the Prometheus text format"
+              << std::endl;
+    std::cerr << "    --metrics-interval <ms> : How often the counters file is rewritten (" << METRICS_DEFAULT_INTERVAL_MS
+              << " in default)" << std::endl;
+    std::cerr << "    --record <file>     : Also record the received bit stream, as <file> with _000000, _000001, ..."
+              << " added, each segment starting with an IDR; streams other than " << VIDEO_DEVICE_NAME
+              << " get _<device> added" << std::endl;
+    std::cerr << "    --segment-size <MB> : Size after which a new segment is begun at the next IDR ("
+              << (BIT_STREAM_LOG_DEFAULT_SEGMENT_SIZE >> 20) << " in default)" << std::endl;
     exit(0);
   }
   
-  char*  hostname = argv[1];
-  int    port     = atoi(argv[2]);
   double fps      = atof(argv[3]);
-  int frameNum      = atoi(argv[4]);
-  int    interval = (int) (1000.0 / fps);
+  ReceiverConnection first;
+  first.hostname = argv[1];
+  first.port     = atoi(argv[2]);
+  first.id       = 0;
+  first.frameNum = atoi(argv[4]);
+  // STT_VIDEO carries whole milliseconds. Round to the nearest one;
+  // truncating biased every rate upward (60 fps became 16 ms, 62.5 fps)
+  first.interval = (int) (1000.0 / fps + 0.5);
+  std::vector<ReceiverConnection> connections(1, first);
+  
+  // Socket reading stays on the connection threads; every video device
+  // gets a decoder of its own, run on a pool of decoder threads, and a
+  // thread that writes its output file.
+  // Created first, so that it outlives the streams that count into it
+  MetricsRegistry::Pointer metrics = MetricsRegistry::New();
+  StreamDemux::Pointer demux = StreamDemux::New();
+  demux->SetOutputFileName("outputDecodedVideo.yuv");
+  // The server reads a profile name and a layer request,
+  // "<profile>[/<layer>]", from the STT_VIDEO device name
+  std::string profile = "Video Client";
+  std::string layer;
+  std::string shmName;
+  int shmSlots = RECEIVER_DEFAULT_SHM_SLOTS;
+  int shmWidth = RECEIVER_DEFAULT_SHM_WIDTH;
+  int shmHeight = RECEIVER_DEFAULT_SHM_HEIGHT;
+  std::string traceName;
+  std::string recordName;
+  igtlUint64 segmentSize = BIT_STREAM_LOG_DEFAULT_SEGMENT_SIZE;
+  for (int i = 5; i < argc; i ++)
+  {
+    if (strcmp(argv[i], "--unit-queue") == 0 && i + 1 < argc)
+    {
+      demux->SetUnitQueueDepth(atoi(argv[++i]));
+    }
+    else if (strcmp(argv[i], "--picture-queue") == 0 && i + 1 < argc)
+    {
+      demux->SetPictureQueueDepth(atoi(argv[++i]));
+    }
+    else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+    {
+      profile = argv[++i];
+    }
+    else if (strcmp(argv[i], "--layer") == 0 && i + 1 < argc)
+    {
+      layer = argv[++i];
+    }
+    else if (strcmp(argv[i], "--drop-oldest") == 0)
+    {
+      demux->SetDropOldest(true);
+    }
+    else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+    {
+      ++ i;
+      demux->SetOutputFileName(strcmp(argv[i], "-") == 0 ? "" : argv[i]);
+    }
+    else if (strcmp(argv[i], "--direct-io") == 0)
+    {
+      demux->SetDirectIO(true);
+    }
+    else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc)
+    {
+      shmName = argv[++i];
+    }
+    else if (strcmp(argv[i], "--shm-slots") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+    {
+      shmSlots = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--shm-size") == 0 && i + 1 < argc &&
+             sscanf(argv[i + 1], "%dx%d", &shmWidth, &shmHeight) == 2 && shmWidth > 0 && shmHeight > 0)
+    {
+      ++ i;
+    }
+    else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+    {
+      traceName = argv[++i];
+    }
+    else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc)
+    {
+      metrics->SetFileName(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < argc)
+    {
+      metrics->SetInterval(atoi(argv[++i]));
+    }
+    else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+    {
+      recordName = argv[++i];
+    }
+    else if (strcmp(argv[i], "--segment-size") == 0 && i + 1 < argc)
+    {
+      segmentSize = (igtlUint64) atoi(argv[++i]) << 20;
+    }
+    else if (strcmp(argv[i], "--decoders") == 0 && i + 1 < argc)
+    {
+      demux->GetWorkerPool()->SetNumberOfWorkers(atoi(argv[++i]));
+    }
+    else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc && strrchr(argv[i + 1], ':'))
+    {
+      std::string address = argv[++i];
+      size_t colon = address.rfind(':');
+      ReceiverConnection connection = first;
+      connection.hostname = address.substr(0, colon);
+      connection.port = atoi(address.c_str() + colon + 1);
+      connection.id = (int) connections.size();
+      connections.push_back(connection);
+    }
+    else
+    {
+      std::cerr << "Unknown option: " << argv[i] << std::endl;
+      exit(0);
+    }
+  }
+  if (!shmName.empty())
+  {
+    demux->SetSharedMemory(shmName, shmSlots, shmWidth, shmHeight);
+  }
+  if (!recordName.empty())
+  {
+    demux->SetBitStreamLog(recordName, segmentSize);
+  }
+  if (!layer.empty())
+  {
+    profile += "/" + layer;
+  }
+  FILE* traceLog = NULL;
+  if (!traceName.empty())
+  {
+    traceLog = fopen(traceName.c_str(), "w");
+    if (traceLog == NULL)
+    {
+      std::cerr << "Can not open " << traceName << std::endl;
+      exit(0);
+    }
+    fprintf(traceLog, "stream,frame,capture_ns,encoded_ns,sent_ns,received_ns,decoded_ns,written_ns\n");
+    demux->SetTraceLog(traceLog);
+  }
+  if (!metrics->GetFileName().empty())
+  {
+    demux->SetMetrics(metrics);
+    metrics->Start();
+  }
+  std::cerr << "Decoder threads: " << demux->GetWorkerPool()->GetNumberOfWorkers() << std::endl;
+  demux->Start();
+  
+  igtl::MultiThreader::Pointer threader = igtl::MultiThreader::New();
+  std::vector<int> threadIDs;
+  for (unsigned int i = 0; i < connections.size(); i ++)
+  {
+    connections[i].request = profile;
+    connections[i].demux = demux;
+  }
+  for (unsigned int i = 1; i < connections.size(); i ++)
+  {
+    threadIDs.push_back(threader->SpawnThread((igtl::ThreadFunctionType) &ConnectionThread, &connections[i]));
+  }
+  ReceiveStreams(&connections[0]);
+  for (unsigned int i = 0; i < threadIDs.size(); i ++)
+  {
+    threader->TerminateThread(threadIDs[i]);
+  }
   
-  ISVCDecoder* decoder_;
-  WelsCreateDecoder (&decoder_);
-  SDecodingParam decParam;
-  memset (&decParam, 0, sizeof (SDecodingParam));
-  decParam.uiTargetDqLayer = UCHAR_MAX;
-  decParam.eEcActiveIdc = ERROR_CON_SLICE_COPY;
-  decParam.sVideoProperty.eVideoBsType = VIDEO_BITSTREAM_DEFAULT;
-  decoder_->Initialize (&decParam);
+  // Waits for the queued frames to be decoded and written
+  demux->Stop();
+  metrics->Stop();
+  if (traceLog)
+  {
+    fclose(traceLog);
+    FILE* histograms = fopen((traceName + ".hist").c_str(), "w");
+    if (histograms)
+    {
+      fprintf(histograms, "stream,stage,lower_us,upper_us,count\n");
+      demux->WriteLatencyHistograms(histograms);
+      fclose(histograms);
+    }
+  }
+}
+
+
+void* ConnectionThread(void* ptr)
+{
+  igtl::MultiThreader::ThreadInfo* info =
+    static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+  ReceiveStreams(static_cast<ReceiverConnection*>(info->UserData));
+  return NULL;
+}
+
 
+// Receives from one server until every video device on the connection
+// has sent frameNum access units or the connection closes
+int ReceiveStreams(ReceiverConnection* connection)
+{
   //------------------------------------------------------------
   // Establish Connection
   
   igtl::ClientSocket::Pointer socket;
   socket = igtl::ClientSocket::New();
-  int r = socket->ConnectToServer(hostname, port);
+  int r = socket->ConnectToServer(connection->hostname.c_str(), connection->port);
   
   if (r != 0)
   {
-    std::cerr << "Cannot connect to the server." << std::endl;
-    exit(0);
+    std::cerr << "Cannot connect to the server " << connection->hostname << ":" << connection->port << "." << std::endl;
+    return 0;
   }
   
   //------------------------------------------------------------
@@ -80,87 +316,175 @@ int main(int argc, char* argv[])
   std::cerr << "Sending STT_VIDEO message....." << std::endl;
   igtl::StartVideoDataMessage::Pointer startVideoMsg;
   startVideoMsg = igtl::StartVideoDataMessage::New();
-  startVideoMsg->SetDeviceName("Video Client");
-  startVideoMsg->SetTimeInterval(interval);
-  startVideoMsg->SetUseCompress(interval);
+  startVideoMsg->SetDeviceName(connection->request.c_str());
+  startVideoMsg->SetTimeInterval(connection->interval);
+  startVideoMsg->SetUseCompress(connection->interval);
   startVideoMsg->Pack();
   socket->Send(startVideoMsg->GetPackPointer(), startVideoMsg->GetPackSize());
   int loop = 0;
-  std::string outputFileName = "outputDecodedVideo.yuv";
-  while (1 && loop < frameNum)
+  std::vector<ReceiverStream*> streams;
+  igtl::MessageHeader::Pointer headerMsg;
+  headerMsg = igtl::MessageHeader::New();
+  while (1)
   {
     //------------------------------------------------------------
     // Wait for a reply
-    igtl::MessageHeader::Pointer headerMsg;
-    headerMsg = igtl::MessageHeader::New();
     headerMsg->InitPack();
     int rs = socket->Receive(headerMsg->GetPackPointer(), headerMsg->GetPackSize());
     if (rs == 0)
     {
       std::cerr << "Connection closed." << std::endl;
       socket->CloseSocket();
-      exit(0);
+      break;
     }
     if (rs != headerMsg->GetPackSize())
     {
       std::cerr << "Message size information and actual data size don't match." << std::endl;
       socket->CloseSocket();
-      exit(0);
+      break;
     }
     
+    // As received, for the recording; Unpack() converts the byte order
+    // in place
+    unsigned char rawHeader[IGTL_HEADER_SIZE];
+    memcpy(rawHeader, headerMsg->GetPackPointer(), IGTL_HEADER_SIZE);
     headerMsg->Unpack();
-    if (strcmp(headerMsg->GetDeviceName(), "Video") == 0)
-    {
-      ReceiveVideoData(socket, headerMsg, decoder_, outputFileName.c_str());
-      if (++loop >= frameNum) // if received user define frame number
-      {
-        //------------------------------------------------------------
-        // Ask the server to stop pushing tracking data
-        std::cerr << "Sending STP_VIDEO message....." << std::endl;
-        igtl::StopVideoMessage::Pointer stopVideoMsg;
-        stopVideoMsg = igtl::StopVideoMessage::New();
-        stopVideoMsg->SetDeviceName("TDataClient");
-        stopVideoMsg->Pack();
-        socket->Send(stopVideoMsg->GetPackPointer(), stopVideoMsg->GetPackSize());
-        break;
-      }
+    if (strcmp(headerMsg->GetDeviceType(), STREAM_ERROR_TYPE) == 0)
+    {
+      std::cerr << "The server refused " << headerMsg->GetDeviceName() << "." << std::endl;
+      socket->Skip(headerMsg->GetBodySizeToRead(), 0);
+      continue;
     }
-    else
+    bool endOfAccessUnit = true;
+    bool otherConnection = false;
+    ReceiverStream* stream = NULL;
+    bool video = strcmp(headerMsg->GetDeviceType(), "VIDEO") == 0;
+    if (video || strcmp(headerMsg->GetDeviceType(), FRAME_TIMING_DEVICE_TYPE) == 0)
     {
-      std::cerr << "Receiving : " << headerMsg->GetDeviceType() << std::endl;
+      stream = connection->demux->GetStream(headerMsg->GetDeviceName(), connection->id, endOfAccessUnit,
+                                            otherConnection);
+    }
+    // The stream's outputs are named after the device, so it can not be
+    // received from two servers; this one would never finish
+    if (otherConnection)
+    {
+      std::cerr << "Device " << headerMsg->GetDeviceName() << " from " << connection->hostname << ":"
+                << connection->port << " is already received from another server; closing the connection."
+                << std::endl;
+      socket->CloseSocket();
+      break;
+    }
+    if (stream == NULL)
+    {
+      std::cerr << "Receiving : " << headerMsg->GetDeviceType() << " " << headerMsg->GetDeviceName() << std::endl;
       socket->Skip(headerMsg->GetBodySizeToRead(), 0);
+      continue;
+    }
+    // Time stamps of the access unit that follows
+    if (!video)
+    {
+      ReceiveFrameTiming(socket, headerMsg, stream->m_Timing);
+      continue;
+    }
+    
+    // A slice: more of the same picture follows, decoding starts right away
+    ReceiveVideoData(socket, headerMsg, stream->m_Pipeline, endOfAccessUnit,
+                     stream->m_Timing.m_CaptureTime ? &stream->m_Timing : NULL, stream->m_Log, rawHeader);
+    if (!endOfAccessUnit)
+    {
+      continue;
+    }
+    stream->m_Timing.m_CaptureTime = 0;
+    // A frame was dropped; ask for a key frame rather than wait for the
+    // encoder's next one
+    if (stream->m_Pipeline->TakeKeyFrameRequest())
+    {
+      SendKeyFrameRequest(socket, stream->m_Name.c_str());
+    }
+    if (stream->m_Frames ++ == 0)
+    {
+      streams.push_back(stream);
+    }
+    ++ loop;
+    bool done = true;
+    for (unsigned int i = 0; i < streams.size(); i ++)
+    {
+      done = done && streams[i]->m_Frames >= connection->frameNum;
+    }
+    if (done) // if received user define frame number
+    {
+      //------------------------------------------------------------
+      // Ask the server to stop pushing tracking data
+      std::cerr << "Sending STP_VIDEO message....." << std::endl;
+      igtl::StopVideoMessage::Pointer stopVideoMsg;
+      stopVideoMsg = igtl::StopVideoMessage::New();
+      stopVideoMsg->SetDeviceName("TDataClient");
+      stopVideoMsg->Pack();
+      socket->Send(stopVideoMsg->GetPackPointer(), stopVideoMsg->GetPackSize());
+      break;
     }
   }
-  WelsDestroyDecoder(decoder_);
+  std::cerr << "Frames from " << connection->hostname << ":" << connection->port << ": " << loop << std::endl;
+  return loop;
 }
 
-
-int ReceiveVideoData(igtl::ClientSocket::Pointer& socket, igtl::MessageHeader::Pointer& header, ISVCDecoder* decoder_, const char* outputFileName)
+int ReceiveVideoData(igtl::ClientSocket::Pointer& socket, igtl::MessageHeader::Pointer& header, ReceiverPipeline* pipeline,
+                     bool endOfAccessUnit, FrameTiming* timing, BitStreamLog* log, const unsigned char* rawHeader)
 {
-  std::cerr << "Receiving Video data type." << std::endl;
-  
   //------------------------------------------------------------
-  // Allocate Video Message Class
+  // The body (video header and bit stream) is received straight into a
+  // recycled access unit, which is then queued for the decoder thread.
   
-  igtl::VideoMessage::Pointer videoMsg;
-  videoMsg = igtl::VideoMessage::New();
-  videoMsg->SetMessageHeader(header);
-  videoMsg->AllocatePack(header->GetBodySizeToRead());
+  int bodySize = header->GetBodySizeToRead();
+  if (bodySize <= IGTL_VIDEO_HEADER_SIZE)
+  {
+    socket->Skip(bodySize, 0);
+    return 0;
+  }
+  ReceivedAccessUnit* unit = pipeline->AcquireAccessUnit(bodySize);
   
   // Receive body from the socket
-  socket->Receive(videoMsg->GetPackBodyPointer(), videoMsg->GetPackBodySize());
-  
-  // Deserialize the transform data
-  // If you want to skip CRC check, call Unpack() without argument.
-  videoMsg->Unpack();
+  int r = socket->Receive(unit->m_Body, bodySize);
+  if (r != bodySize)
+  {
+    pipeline->ReleaseAccessUnit(unit);
+    return 0;
+  }
   
-  if (igtl::MessageHeader::UNPACK_BODY)
+  unit->m_EndOfAccessUnit = endOfAccessUnit;
+  igtlUint64 receivedTime = MonotonicTimeNs();
+  if (timing)
+  {
+    timing->m_ReceivedTime = receivedTime;
+    unit->m_Timing = *timing;
+  }
+  // Before the unit is handed to the decoder
+  if (log)
+  {
+    log->Write(rawHeader, unit->m_Body, bodySize, endOfAccessUnit, receivedTime);
+  }
+  pipeline->PushAccessUnit(unit);
+  return 1;
+}
+
+// Reads the body of a FRAME_TIMING message into 'timing'
+int ReceiveFrameTiming(igtl::ClientSocket::Pointer& socket, igtl::MessageHeader::Pointer& header, FrameTiming& timing)
+{
+  int bodySize = header->GetBodySizeToRead();
+  if (bodySize < FRAME_TIMING_BODY_SIZE)
+  {
+    socket->Skip(bodySize, 0);
+    return 0;
+  }
+  unsigned char body[FRAME_TIMING_BODY_SIZE];
+  if (socket->Receive(body, FRAME_TIMING_BODY_SIZE) != FRAME_TIMING_BODY_SIZE)
+  {
+    return 0;
+  }
+  if (bodySize > FRAME_TIMING_BODY_SIZE)
   {
-    unsigned char* data[3];
-    memset (data, 0, sizeof (data));
-    int32_t iWidth = videoMsg->GetWidth(), iHeight = videoMsg->GetHeight(), streamLength = videoMsg->GetPackBodySize()- IGTL_VIDEO_HEADER_SIZE;
-    H264DecodeInstance(decoder_, videoMsg->GetPackFragmentPointer(2), outputFileName, iWidth, iHeight, streamLength, NULL);
-    return 1;
+    socket->Skip(bodySize - FRAME_TIMING_BODY_SIZE, 0);
   }
-  return 0;
+  UnpackFrameTiming(body, timing);
+  return 1;
 }
@@ -0,0 +1,654 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __ClientSession_h
+#define __ClientSession_h
+
+#include <deque>
+#include <vector>
+
+#include "igtlObject.h"
+#include "igtlSocket.h"
+#include "igtlMutexLock.h"
+#include "igtlConditionVariable.h"
+#include "igtlMultiThreader.h"
+
+#include "EncodedFrame.h"
+#include "FrameTiming.h"
+#include "MonotonicClock.h"
+#include "ServerMetrics.h"
+#include "StreamError.h"
+#include "VectoredSend.h"
+
+#define CLIENT_SESSION_DEFAULT_QUEUE_DEPTH 8
+#define CLIENT_SESSION_BLOCKED_SEND_NS     2000000  // 2 ms
+
+class ClientSession;
+
+// Called from the encoder thread when a session that is sent by an event
+// loop has new frames queued
+typedef void (*ClientSessionWakeup)(ClientSession* session, void* userData);
+
+// A connected receiver. Frames pushed by the encoder thread are queued
+// and written to the socket by a sender thread owned by the session, so
+// a slow link only ever delays its own client.
+//
+// When the queue overflows, everything queued is discarded and the
+// session skips frames until the next IDR, since P frames that refer to
+// a dropped picture cannot be decoded anyway.
+//
+// From a layered stream the session sends one spatial layer, picked by
+// index or by the bitrate the client can take, and only the temporal
+// layers needed for the frame interval the client asked for.
+//
+// The sender thread also measures how the link keeps up: the bytes not
+// yet written, how long frames wait before their write completes and,
+// from writes that block, the rate at which the socket drains. The
+// encoder's rate controller reads these to back off before the queue
+// overflows.
+//
+// With tracing on, every access unit is preceded by a FRAME_TIMING
+// message stamped with the time its first write began.
+//
+// With a wakeup set, the session has no sender thread. An event loop
+// (EpollServer) is told when frames are queued and writes them with
+// SendQueued() on a non-blocking socket whenever it can take more.
+class ClientSession : public igtl::Object
+{
+public:
+  typedef ClientSession                  Self;
+  typedef igtl::Object                   Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(ClientSession, igtl::Object);
+  igtlNewMacro(ClientSession);
+
+  void SetSocket(igtl::Socket* socket)      { this->m_Socket = socket; };
+  igtl::Socket* GetSocket() const           { return this->m_Socket; };
+
+  void SetMaxQueueDepth(unsigned int depth) { this->m_MaxQueueDepth = depth > 0 ? depth : 1; };
+  unsigned int GetMaxQueueDepth() const     { return this->m_MaxQueueDepth; };
+
+  // Spatial layer to send: 'layer' if >= 0, else the largest one whose
+  // bitrate is at most 'bitrate' (bits per second) if that is > 0, else
+  // the full size one. Set before Start().
+  void SetLayerRequest(int layer, int bitrate)
+  {
+    this->m_RequestedLayer = layer;
+    this->m_RequestedBitrate = bitrate;
+  };
+  // Milliseconds between frames the client asked for; temporal layers
+  // beyond that rate are not sent. Set before Start().
+  void SetRequestedInterval(int interval)   { this->m_RequestedInterval = interval; };
+  int GetRequestedInterval() const          { return this->m_RequestedInterval; };
+  // Sends the FRAME_TIMING messages. Set before Start().
+  void SetTracing(bool tracing)             { this->m_Tracing = tracing; };
+  // Counters of the source to add this session's frames to, or NULL.
+  // Set before Start().
+  void SetMetrics(ServerMetrics* metrics)   { this->m_Metrics = metrics; };
+
+  // Hands the sending to an event loop instead of a thread of the
+  // session's own. Set before Start().
+  void SetWakeup(ClientSessionWakeup wakeup, void* userData)
+  {
+    this->m_Wakeup = wakeup;
+    this->m_WakeupData = userData;
+  };
+
+  // Starts the sender thread, unless an event loop sends.
+  void Start()
+  {
+    this->m_QueueLock.Lock();
+    this->m_Stop = 0;
+    this->m_QueueLock.Unlock();
+    if (this->m_ThreadID < 0 && this->m_Wakeup == NULL)
+      {
+      this->m_ThreadID = this->m_Threader->SpawnThread((igtl::ThreadFunctionType) &ClientSession::SendThread, this);
+      }
+  };
+
+  // Wakes the sender thread, waits for it to exit and drops whatever is
+  // still queued. Frames and errors pushed from now on are ignored, and
+  // an event loop is never woken for the session again, so it may free
+  // what it passed to SetWakeup(); such a session is not started again.
+  void Stop()
+  {
+    this->m_QueueLock.Lock();
+    this->m_Stop = 1;
+    this->m_Wakeup = NULL;
+    this->m_WakeupData = NULL;
+    this->m_QueueNotEmpty->Broadcast();
+    this->m_QueueLock.Unlock();
+    if (this->m_ThreadID >= 0)
+      {
+      this->m_Threader->TerminateThread(this->m_ThreadID);
+      this->m_ThreadID = -1;
+      }
+    this->m_QueueLock.Lock();
+    this->m_Queue.clear();
+    this->m_Sending = NULL;
+#if !defined(_WIN32)
+    this->m_SendingIOV.clear();
+    this->m_SendingFirst = 0;
+#endif
+    this->m_ErrorPending = false;
+    this->m_QueuedBytes = 0;
+    this->m_InFlightBytes = 0;
+    this->m_InFlightSince = 0;
+    this->m_QueueLock.Unlock();
+  };
+
+  // Called from the encoder thread. Never blocks on the network.
+  void Push(EncodedFrame* frame)
+  {
+    if (frame->GetTemporalId() > this->SelectTemporalLayer(frame))
+      {
+      return;
+      }
+    this->m_QueueLock.Lock();
+    if (this->m_Stop)
+      {
+      this->m_QueueLock.Unlock();
+      return;
+      }
+    if (this->m_WaitForIDR && !frame->IsIDR())
+      {
+      this->CountDropped(1);
+      }
+    else
+      {
+      if (this->m_Queue.size() >= this->m_MaxQueueDepth)
+        {
+        this->CountDropped(this->m_Queue.size());
+        this->m_Queue.clear();
+        this->m_QueuedBytes = this->m_InFlightBytes;
+        if (!frame->IsIDR())
+          {
+          this->m_WaitForIDR = true;
+          this->CountDropped(1);
+          this->m_QueueLock.Unlock();
+          return;
+          }
+        }
+      this->m_WaitForIDR = false;
+      this->m_Queue.push_back(frame);
+      this->m_QueuedBytes += frame->GetLayerWireSize(this->SelectLayer(frame));
+      this->m_QueueNotEmpty->Signal();
+      }
+    this->Wake();
+    this->m_QueueLock.Unlock();
+  };
+
+  // Called from the encoder thread when the session subscribes, with the
+  // frames of the current GOP from its IDR on. If they all fit in the
+  // queue the client starts right away from the IDR and stays in step;
+  // otherwise only the IDR is sent, so the client shows a picture at
+  // once, and the session waits for the next IDR to go on.
+  void Join(const std::vector<EncodedFrame::Pointer>& gop, bool complete)
+  {
+    this->m_QueueLock.Lock();
+    if (this->m_Stop)
+      {
+      this->m_QueueLock.Unlock();
+      return;
+      }
+    bool all = complete && gop.size() <= this->m_MaxQueueDepth;
+    for (unsigned int i = 0; i < gop.size() && (all || i == 0); i ++)
+      {
+      EncodedFrame* frame = gop[i];
+      if (frame->GetTemporalId() > this->SelectTemporalLayer(frame))
+        {
+        continue;
+        }
+      this->m_Queue.push_back(frame);
+      this->m_QueuedBytes += frame->GetLayerWireSize(this->SelectLayer(frame));
+      }
+    this->m_WaitForIDR = !all;
+    this->m_QueueNotEmpty->Signal();
+    this->Wake();
+    this->m_QueueLock.Unlock();
+  };
+
+  // Called from the encoder thread. Tells the client that its request
+  // 'deviceName' failed; the error goes out before the next frame.
+  void SendError(const char* deviceName)
+  {
+    this->m_QueueLock.Lock();
+    if (this->m_Stop)
+      {
+      this->m_QueueLock.Unlock();
+      return;
+      }
+    PackStreamError(this->m_ErrorMessage, deviceName);
+    this->m_ErrorPending = true;
+    this->m_QueueNotEmpty->Signal();
+    this->Wake();
+    this->m_QueueLock.Unlock();
+  };
+
+#if !defined(_WIN32)
+  // Event loop: writes queued frames to the non-blocking socket 'fd'
+  // until the queue is empty (returns 1) or the socket is full (returns
+  // 0; call again once it is writable). A frame written in part is
+  // continued where it stopped. Returns -1 when the connection failed.
+  int SendQueued(int fd)
+  {
+    for (;;)
+      {
+      if (this->m_SendingFirst >= this->m_SendingIOV.size() && !this->NextFrame())
+        {
+        return 1;
+        }
+      while (this->m_SendingFirst < this->m_SendingIOV.size())
+        {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov    = &this->m_SendingIOV[this->m_SendingFirst];
+        msg.msg_iovlen = this->m_SendingIOV.size() - this->m_SendingFirst;
+        if (msg.msg_iovlen > VECTORED_SEND_MAX_FRAGMENTS)
+          {
+          msg.msg_iovlen = VECTORED_SEND_MAX_FRAGMENTS;
+          }
+        int flags = MSG_DONTWAIT;
+#if defined(MSG_NOSIGNAL)
+        flags |= MSG_NOSIGNAL;
+#endif
+        ssize_t r = sendmsg(fd, &msg, flags);
+        if (r < 0)
+          {
+          if (errno == EINTR)
+            {
+            continue;
+            }
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+            return 0;
+            }
+          this->m_Connected = 0;
+          return -1;
+          }
+        while (this->m_SendingFirst < this->m_SendingIOV.size() &&
+               (size_t) r >= this->m_SendingIOV[this->m_SendingFirst].iov_len)
+          {
+          r -= this->m_SendingIOV[this->m_SendingFirst].iov_len;
+          ++ this->m_SendingFirst;
+          }
+        if (this->m_SendingFirst < this->m_SendingIOV.size())
+          {
+          struct iovec& partial = this->m_SendingIOV[this->m_SendingFirst];
+          partial.iov_base = static_cast<char*>(partial.iov_base) + r;
+          partial.iov_len -= r;
+          }
+        }
+      // NULL after an error message
+      if (this->m_Sending.IsNotNull())
+        {
+        this->FrameSent(this->m_Sending, this->m_SendingStart, MonotonicTimeNs());
+        }
+      this->m_Sending = NULL;
+      }
+  };
+#endif
+
+  // True while the session discards frames until an IDR arrives.
+  bool IsWaitingForIDR()
+  {
+    this->m_QueueLock.Lock();
+    bool wait = this->m_WaitForIDR;
+    this->m_QueueLock.Unlock();
+    return wait;
+  };
+
+  // How long the oldest unsent frame has waited, or how long the last
+  // frame took from the encoder to the socket if that was longer. 0 once
+  // the queue is empty: the last delay is history then, and the encoder
+  // must not hold back the frames that would replace it.
+  igtlUint64 GetSendDelayNs(igtlUint64 now)
+  {
+    this->m_QueueLock.Lock();
+    igtlUint64 oldest = this->m_InFlightSince;
+    if (oldest == 0 && !this->m_Queue.empty())
+      {
+      oldest = this->m_Queue.front()->GetReadyTime();
+      }
+    igtlUint64 delay = (oldest > 0 && now > oldest) ? now - oldest : 0;
+    if (oldest > 0 && this->m_LastSendDelay > delay)
+      {
+      delay = this->m_LastSendDelay;
+      }
+    this->m_QueueLock.Unlock();
+    return delay;
+  };
+
+  // Frames queued, not counting the one being written
+  unsigned int GetQueueDepth()
+  {
+    this->m_QueueLock.Lock();
+    unsigned int depth = this->m_Queue.size();
+    this->m_QueueLock.Unlock();
+    return depth;
+  };
+
+  // Bytes queued or being written
+  igtlUint64 GetQueuedBytes()
+  {
+    this->m_QueueLock.Lock();
+    igtlUint64 bytes = this->m_QueuedBytes;
+    this->m_QueueLock.Unlock();
+    return bytes;
+  };
+
+  // Smoothed rate of writes that had to wait for the link, in bytes per
+  // second; 0 until one has
+  double GetDrainRate()
+  {
+    this->m_QueueLock.Lock();
+    double rate = this->m_DrainRate;
+    this->m_QueueLock.Unlock();
+    return rate;
+  };
+
+  bool IsConnected() const                  { return this->m_Connected != 0; };
+  unsigned long GetNumberOfSentFrames() const    { return this->m_SentFrames; };
+  unsigned long GetNumberOfDroppedFrames() const { return this->m_DroppedFrames; };
+
+protected:
+  ClientSession()
+    : m_MaxQueueDepth(CLIENT_SESSION_DEFAULT_QUEUE_DEPTH),
+      m_RequestedLayer(-1), m_RequestedBitrate(0), m_RequestedInterval(0), m_Tracing(false), m_Metrics(NULL), m_ErrorPending(false),
+      m_WaitForIDR(true), m_Stop(0), m_Connected(1), m_ThreadID(-1),
+      m_SentFrames(0), m_DroppedFrames(0), m_QueuedBytes(0), m_InFlightBytes(0),
+      m_InFlightSince(0), m_LastSendDelay(0), m_DrainRate(0.0),
+      m_Wakeup(NULL), m_WakeupData(NULL), m_SendingFirst(0), m_SendingStart(0)
+  {
+    this->m_QueueNotEmpty = igtl::ConditionVariable::New();
+    this->m_Threader = igtl::MultiThreader::New();
+  };
+  ~ClientSession()
+  {
+    this->Stop();
+  };
+
+  int SelectLayer(const EncodedFrame* frame) const
+  {
+    int top = frame->GetNumberOfLayers() - 1;
+    if (this->m_RequestedLayer >= 0)
+      {
+      return this->m_RequestedLayer < top ? this->m_RequestedLayer : top;
+      }
+    if (this->m_RequestedBitrate > 0)
+      {
+      int layer = top;
+      while (layer > 0 && frame->GetLayerBitrate(layer) > this->m_RequestedBitrate)
+        {
+        -- layer;
+        }
+      return layer;
+      }
+    return top;
+  };
+
+  // Highest temporal layer that keeps the frame interval at or below
+  // the requested one
+  int SelectTemporalLayer(const EncodedFrame* frame) const
+  {
+    int top = frame->GetNumberOfTemporalLayers() - 1;
+    if (this->m_RequestedInterval <= 0 || frame->GetInterval() <= 0)
+      {
+      return top;
+      }
+    int id = 0;
+    while (id < top && (frame->GetInterval() << (top - id)) > this->m_RequestedInterval)
+      {
+      ++ id;
+      }
+    return id;
+  };
+
+  static void* SendThread(void* ptr)
+  {
+    igtl::MultiThreader::ThreadInfo* info =
+      static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+    ClientSession* session = static_cast<ClientSession*>(info->UserData);
+
+    for (;;)
+      {
+      session->m_QueueLock.Lock();
+      while (!session->m_Stop && session->m_Queue.empty() && !session->m_ErrorPending)
+        {
+        session->m_QueueNotEmpty->Wait(&session->m_QueueLock);
+        }
+      if (session->m_Stop)
+        {
+        session->m_QueueLock.Unlock();
+        break;
+        }
+      if (session->m_ErrorPending)
+        {
+        memcpy(session->m_ErrorSending, session->m_ErrorMessage, IGTL_HEADER_SIZE);
+        session->m_ErrorPending = false;
+        session->m_QueueLock.Unlock();
+        SendFragment error;
+        error.ptr  = session->m_ErrorSending;
+        error.size = IGTL_HEADER_SIZE;
+        if (SendFragments(session->m_Socket, &error, 1) == 0)
+          {
+          session->m_Connected = 0;
+          break;
+          }
+        continue;
+        }
+      EncodedFrame::Pointer frame = session->m_Queue.front();
+      session->m_Queue.pop_front();
+      int layer = session->SelectLayer(frame);
+      igtlUint64 bytes = frame->GetLayerWireSize(layer);
+      session->m_InFlightBytes = bytes;
+      session->m_InFlightSince = frame->GetReadyTime();
+      session->m_QueueLock.Unlock();
+      igtlUint64 start = MonotonicTimeNs();
+
+      // Headers and bit stream of each packet go out in gather writes,
+      // as many packets to a write as the fragment list takes
+      SendFragment fragments[VECTORED_SEND_MAX_FRAGMENTS];
+      int numberOfPackets = frame->GetNumberOfPackets(layer);
+      int n = 0;
+      if (session->m_Tracing && numberOfPackets > 0)
+        {
+        session->PackTiming(frame, layer, start);
+        fragments[n].ptr  = session->m_TimingMessage;
+        fragments[n].size = FRAME_TIMING_MESSAGE_SIZE;
+        ++ n;
+        }
+      int sent = 1;
+      for (int i = 0; sent && i < numberOfPackets; i ++)
+        {
+        fragments[n].ptr    = frame->GetPacketHeader(layer, i);
+        fragments[n].size   = VIDEO_FRAME_HEADER_SIZE;
+        fragments[n+1].ptr  = frame->GetPacketBitStream(layer, i);
+        fragments[n+1].size = frame->GetPacketSize(layer, i);
+        n += 2;
+        if (n + 2 > VECTORED_SEND_MAX_FRAGMENTS || i + 1 == numberOfPackets)
+          {
+          sent = SendFragments(session->m_Socket, fragments, n);
+          n = 0;
+          }
+        }
+      if (sent == 0)
+        {
+        session->m_Connected = 0;
+        break;
+        }
+      session->FrameSent(frame, start, MonotonicTimeNs());
+      // Hand the frame back to the pipeline for reuse
+      frame = NULL;
+      }
+    return NULL;
+  };
+
+  // Updates the link statistics once the last byte of a frame was
+  // written; 'start' is when its first write began
+  void FrameSent(EncodedFrame* frame, igtlUint64 start, igtlUint64 end)
+  {
+    this->m_QueueLock.Lock();
+    igtlUint64 bytes = this->m_InFlightBytes;
+    this->m_QueuedBytes -= this->m_InFlightBytes;
+    this->m_InFlightBytes = 0;
+    this->m_InFlightSince = 0;
+    this->m_LastSendDelay = end > frame->GetReadyTime() ? end - frame->GetReadyTime() : 0;
+    // A write that returns at once only filled the socket buffer and
+    // says nothing about the link
+    if (end - start > CLIENT_SESSION_BLOCKED_SEND_NS)
+      {
+      double rate = (double) bytes * 1e9 / (double) (end - start);
+      this->m_DrainRate = this->m_DrainRate > 0.0 ? 0.75 * this->m_DrainRate + 0.25 * rate : rate;
+      }
+    this->m_QueueLock.Unlock();
+    ++ this->m_SentFrames;
+    if (this->m_Metrics)
+      {
+      this->m_Metrics->m_FramesSent->Add();
+      this->m_Metrics->m_SentBytes->Add(bytes);
+      this->m_Metrics->m_SendTime->Record(end - start);
+      }
+  };
+
+  // Called with m_QueueLock held, so that Stop() can not return while
+  // the event loop is being woken
+  void Wake()
+  {
+    if (this->m_Wakeup)
+      {
+      this->m_Wakeup(this, this->m_WakeupData);
+      }
+  };
+
+  // Called with m_QueueLock held
+  void CountDropped(unsigned long n)
+  {
+    this->m_DroppedFrames += n;
+    if (this->m_Metrics)
+      {
+      this->m_Metrics->m_FramesDropped->Add(n);
+      }
+  };
+
+  // Fills m_TimingMessage for 'frame', which has packets in 'layer'
+  void PackTiming(EncodedFrame* frame, int layer, igtlUint64 sent)
+  {
+    FrameTiming timing;
+    timing.m_FrameIndex  = frame->GetFrameIndex();
+    timing.m_CaptureTime = frame->GetCaptureTime();
+    timing.m_EncodedTime = frame->GetEncodedTime();
+    timing.m_SentTime    = sent;
+    // The last packet is named after the stream, without the slice suffix
+    PackFrameTiming(this->m_TimingMessage, frame->GetPacketHeader(layer, frame->GetNumberOfPackets(layer) - 1), timing);
+  };
+
+#if !defined(_WIN32)
+  // Event loop: takes the next frame off the queue and lays out its
+  // packets for SendQueued(), or a pending error message, which goes
+  // first. False if there is neither.
+  bool NextFrame()
+  {
+    this->m_QueueLock.Lock();
+    if (!this->m_Stop && this->m_ErrorPending)
+      {
+      memcpy(this->m_ErrorSending, this->m_ErrorMessage, IGTL_HEADER_SIZE);
+      this->m_ErrorPending = false;
+      this->m_QueueLock.Unlock();
+      this->m_SendingIOV.resize(1);
+      this->m_SendingIOV[0].iov_base = this->m_ErrorSending;
+      this->m_SendingIOV[0].iov_len  = IGTL_HEADER_SIZE;
+      this->m_SendingFirst = 0;
+      return true;
+      }
+    if (this->m_Stop || this->m_Queue.empty())
+      {
+      this->m_QueueLock.Unlock();
+      return false;
+      }
+    this->m_Sending = this->m_Queue.front();
+    this->m_Queue.pop_front();
+    int layer = this->SelectLayer(this->m_Sending);
+    this->m_InFlightBytes = this->m_Sending->GetLayerWireSize(layer);
+    this->m_InFlightSince = this->m_Sending->GetReadyTime();
+    this->m_QueueLock.Unlock();
+
+    EncodedFrame* frame = this->m_Sending;
+    int numberOfPackets = frame->GetNumberOfPackets(layer);
+    this->m_SendingStart = MonotonicTimeNs();
+    this->m_SendingIOV.clear();
+    if (this->m_Tracing && numberOfPackets > 0)
+      {
+      this->PackTiming(frame, layer, this->m_SendingStart);
+      struct iovec timing;
+      timing.iov_base = this->m_TimingMessage;
+      timing.iov_len  = FRAME_TIMING_MESSAGE_SIZE;
+      this->m_SendingIOV.push_back(timing);
+      }
+    size_t first = this->m_SendingIOV.size();
+    this->m_SendingIOV.resize(first + 2 * numberOfPackets);
+    for (int i = 0; i < numberOfPackets; i ++)
+      {
+      struct iovec* iov = &this->m_SendingIOV[first + 2*i];
+      iov[0].iov_base = const_cast<unsigned char*>(frame->GetPacketHeader(layer, i));
+      iov[0].iov_len  = VIDEO_FRAME_HEADER_SIZE;
+      iov[1].iov_base = const_cast<unsigned char*>(frame->GetPacketBitStream(layer, i));
+      iov[1].iov_len  = frame->GetPacketSize(layer, i);
+      }
+    this->m_SendingFirst = 0;
+    return true;
+  };
+#endif
+
+  igtl::Socket::Pointer             m_Socket;
+  std::deque<EncodedFrame::Pointer> m_Queue;
+  igtl::SimpleMutexLock             m_QueueLock;
+  igtl::ConditionVariable::Pointer  m_QueueNotEmpty;
+  igtl::MultiThreader::Pointer      m_Threader;
+  unsigned int                      m_MaxQueueDepth;
+  int                               m_RequestedLayer;
+  int                               m_RequestedBitrate;
+  int                               m_RequestedInterval;
+  bool                              m_Tracing;
+  ServerMetrics*                    m_Metrics;
+  unsigned char                     m_TimingMessage[FRAME_TIMING_MESSAGE_SIZE];  // of the frame being sent
+  unsigned char                     m_ErrorMessage[IGTL_HEADER_SIZE];  // to send before the next frame
+  bool                              m_ErrorPending;
+  unsigned char                     m_ErrorSending[IGTL_HEADER_SIZE];  // being sent
+  bool                              m_WaitForIDR;
+  int                               m_Stop;
+  int                               m_Connected;
+  int                               m_ThreadID;
+  unsigned long                     m_SentFrames;
+  unsigned long                     m_DroppedFrames;
+  igtlUint64                        m_QueuedBytes;
+  igtlUint64                        m_InFlightBytes;
+  igtlUint64                        m_InFlightSince;
+  igtlUint64                        m_LastSendDelay;
+  double                            m_DrainRate;
+
+  // Sending by an event loop. The wakeup is cleared by Stop() under
+  // m_QueueLock; only the loop's thread touches the others.
+  ClientSessionWakeup               m_Wakeup;
+  void*                             m_WakeupData;
+  EncodedFrame::Pointer             m_Sending;       // frame being written
+#if !defined(_WIN32)
+  std::vector<struct iovec>         m_SendingIOV;    // what is left of it
+#endif
+  size_t                            m_SendingFirst;
+  igtlUint64                        m_SendingStart;
+};
+
+#endif // __ClientSession_h
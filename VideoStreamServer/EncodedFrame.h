@@ -0,0 +1,207 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __EncodedFrame_h
+#define __EncodedFrame_h
+
+#include <vector>
+
+#include "api/svc/codec_app_def.h"
+
+#include "igtlObject.h"
+
+#include "BufferPool.h"
+#include "VideoFramePacker.h"
+
+// One encoded access unit of a stream together with the IGTL and video
+// headers that precede it on the wire. The encoder thread builds it once
+// and hands the same instance to every subscriber; the senders only read
+// it. Once the slowest client has sent it, the pipeline reuses the frame
+// together with its bit stream buffer for a later access unit.
+//
+// With several spatial layers the bit stream holds one complete AVC
+// access unit per layer, lowest resolution first, and every layer has
+// its own headers, so a client is sent a single layer as a message of
+// its own.
+//
+// A layer goes out as one or more packets, each a VIDEO message with
+// headers of its own. Normally the packet is the whole access unit; when
+// slices are streamed every slice is a packet, so the receiver can start
+// decoding before the rest of the picture has arrived.
+//
+// A frame replayed from a recording refers to the bit stream in the
+// mapped file instead of a buffer of its own.
+class EncodedFrame : public igtl::Object
+{
+public:
+  typedef EncodedFrame                   Self;
+  typedef igtl::Object                   Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(EncodedFrame, igtl::Object);
+  igtlNewMacro(EncodedFrame);
+
+  // Spatial layers, 1 to MAX_SPATIAL_LAYER_NUM
+  void SetNumberOfLayers(int n)            { this->m_NumberOfLayers = n; };
+  int GetNumberOfLayers() const            { return this->m_NumberOfLayers; };
+
+  // Drops the packets of a layer, keeping their storage for reuse
+  void ClearPackets(int layer)
+  {
+    this->m_Layers[layer].m_Packets.clear();
+    this->m_Layers[layer].m_Size = 0;
+  };
+  // Appends a packet of 'size' bytes at 'offset' in the bit stream to a
+  // layer. Returns where its IGTL and video headers
+  // (VIDEO_FRAME_HEADER_SIZE bytes) go.
+  unsigned char* AddPacket(int layer, igtlUint64 offset, igtlUint64 size)
+  {
+    std::vector<Packet>& packets = this->m_Layers[layer].m_Packets;
+    packets.resize(packets.size() + 1);
+    packets.back().m_Offset = offset;
+    packets.back().m_Size = size;
+    this->m_Layers[layer].m_Size += VIDEO_FRAME_HEADER_SIZE + size;
+    return packets.back().m_Header;
+  };
+  int GetNumberOfPackets(int layer) const { return (int) this->m_Layers[layer].m_Packets.size(); };
+  const unsigned char* GetPacketHeader(int layer, int i) const
+  {
+    return this->m_Layers[layer].m_Packets[i].m_Header;
+  };
+  const unsigned char* GetPacketBitStream(int layer, int i) const
+  {
+    return this->GetBitStream() + this->m_Layers[layer].m_Packets[i].m_Offset;
+  };
+  igtlUint64 GetPacketSize(int layer, int i) const
+  {
+    return this->m_Layers[layer].m_Packets[i].m_Size;
+  };
+  // Bytes a layer takes on the wire, headers included
+  igtlUint64 GetLayerWireSize(int layer) const { return this->m_Layers[layer].m_Size; };
+
+  // Nominal bitrate of a spatial layer, in bits per second
+  void SetLayerBitrate(int layer, int bitrate)  { this->m_Layers[layer].m_Bitrate = bitrate; };
+  int GetLayerBitrate(int layer) const          { return this->m_Layers[layer].m_Bitrate; };
+
+  // Temporal layer of the access unit. Layer 0 runs at the stream rate
+  // divided by 2^(TemporalLayers - 1); frames of a layer only refer to
+  // frames of the same or lower layers.
+  void SetTemporalLayer(int id, int numberOfLayers)
+  {
+    this->m_TemporalId = id;
+    this->m_NumberOfTemporalLayers = numberOfLayers;
+  };
+  int GetTemporalId() const                { return this->m_TemporalId; };
+  int GetNumberOfTemporalLayers() const    { return this->m_NumberOfTemporalLayers; };
+
+  // Milliseconds between two frames of the stream, all temporal layers
+  // included; <= 0 if not paced by a client
+  void SetInterval(int interval)           { this->m_Interval = interval; };
+  int GetInterval() const                  { return this->m_Interval; };
+
+  // Annex-B bit stream of all layers, in encoder output order. The
+  // buffer comes from the pool and is only replaced when a frame needs
+  // more room than the current one has.
+  void SetBufferPool(BufferPool* pool)     { this->m_BufferPool = pool; };
+  bool Reserve(igtlUint64 size)
+  {
+    this->m_ExternalBitStream = NULL;
+    if (size > this->m_Capacity)
+      {
+      this->m_BufferPool->Release(this->m_BitStream, this->m_Capacity);
+      this->m_BitStream = this->m_BufferPool->Acquire(size, this->m_Capacity);
+      }
+    return this->m_BitStream != NULL;
+  };
+  unsigned char* GetBitStream()                 { return this->m_BitStream; };
+  const unsigned char* GetBitStream() const
+  {
+    return this->m_ExternalBitStream ? this->m_ExternalBitStream : this->m_BitStream;
+  };
+  // Packet offsets count from 'data' until the next Reserve(); the
+  // caller keeps 'data' valid while the frame is queued
+  void SetExternalBitStream(const unsigned char* data) { this->m_ExternalBitStream = data; };
+  void SetBitStreamSize(igtlUint64 size)        { this->m_BitStreamSize = size; };
+  igtlUint64 GetBitStreamSize() const           { return this->m_BitStreamSize; };
+
+  void SetFrameType(EVideoFrameType type)  { this->m_FrameType = type; };
+  EVideoFrameType GetFrameType() const     { return this->m_FrameType; };
+  bool IsIDR() const                       { return this->m_FrameType == videoFrameTypeIDR; };
+
+  void SetFrameIndex(unsigned int index)   { this->m_FrameIndex = index; };
+  unsigned int GetFrameIndex() const       { return this->m_FrameIndex; };
+
+  // MonotonicTimeNs() when the frame was handed to the senders
+  void SetReadyTime(igtlUint64 time)       { this->m_ReadyTime = time; };
+  igtlUint64 GetReadyTime() const          { return this->m_ReadyTime; };
+
+  // MonotonicTimeNs() when the raw picture was taken for encoding and
+  // when the encoder returned, for the FRAME_TIMING message
+  void SetCaptureTime(igtlUint64 time)     { this->m_CaptureTime = time; };
+  igtlUint64 GetCaptureTime() const        { return this->m_CaptureTime; };
+  void SetEncodedTime(igtlUint64 time)     { this->m_EncodedTime = time; };
+  igtlUint64 GetEncodedTime() const        { return this->m_EncodedTime; };
+
+protected:
+  EncodedFrame()
+    : m_BitStream(NULL), m_ExternalBitStream(NULL), m_BitStreamSize(0), m_Capacity(0),
+      m_FrameType(videoFrameTypeInvalid), m_FrameIndex(0), m_ReadyTime(0),
+      m_CaptureTime(0), m_EncodedTime(0),
+      m_NumberOfLayers(1), m_TemporalId(0), m_NumberOfTemporalLayers(1), m_Interval(0)
+  {
+    for (int i = 0; i < MAX_SPATIAL_LAYER_NUM; i ++)
+      {
+      this->m_Layers[i].m_Size = 0;
+      this->m_Layers[i].m_Bitrate = 0;
+      }
+  };
+  ~EncodedFrame()
+  {
+    if (this->m_BufferPool.IsNotNull())
+      {
+      this->m_BufferPool->Release(this->m_BitStream, this->m_Capacity);
+      }
+  };
+
+  BufferPool::Pointer         m_BufferPool;
+  unsigned char*              m_BitStream;
+  const unsigned char*        m_ExternalBitStream;
+  igtlUint64                  m_BitStreamSize;
+  igtlUint64                  m_Capacity;
+  EVideoFrameType             m_FrameType;
+  unsigned int                m_FrameIndex;
+  igtlUint64                  m_ReadyTime;
+  igtlUint64                  m_CaptureTime;
+  igtlUint64                  m_EncodedTime;
+
+  struct Packet
+  {
+    unsigned char m_Header[VIDEO_FRAME_HEADER_SIZE];
+    igtlUint64    m_Offset;
+    igtlUint64    m_Size;
+  };
+  struct Layer
+  {
+    std::vector<Packet> m_Packets;
+    igtlUint64          m_Size;
+    int                 m_Bitrate;
+  };
+  Layer                       m_Layers[MAX_SPATIAL_LAYER_NUM];
+  int                         m_NumberOfLayers;
+  int                         m_TemporalId;
+  int                         m_NumberOfTemporalLayers;
+  int                         m_Interval;
+};
+
+#endif // __EncodedFrame_h
@@ -0,0 +1,609 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __EncoderPipeline_h
+#define __EncoderPipeline_h
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "igtlObject.h"
+#include "igtlMutexLock.h"
+#include "igtlMultiThreader.h"
+
+#include "AccessUnitFile.h"
+#include "BufferPool.h"
+#include "ClientSession.h"
+#include "EncodedFrame.h"
+#include "EncoderProfiles.h"
+#include "FramePacer.h"
+#include "ServerMetrics.h"
+#include "VideoDeviceNames.h"
+
+#define ENCODER_PIPELINE_GOP_CACHE_SIZE         16
+#define ENCODER_PIPELINE_DEFAULT_IDR_INTERVAL   500  // ms
+
+// One encoder per video source. The encoder thread runs while at least
+// one client is subscribed and pushes every encoded access unit to all
+// subscribers, so N viewers cost a single encode.
+//
+// The frames since the latest IDR (parameter sets included) are kept,
+// so a client that joins mid-stream is sent them at once instead of
+// waiting for the encoder. Key frames that clients ask for are forced at
+// most once per MinIDRInterval; requests in between are merged into the
+// next one.
+//
+// Instead of encoding, the pipeline can replay a recording made with
+// Record(): the access units are handed to the subscribers straight from
+// the mapped file at their recorded pace, from the key frame at or before
+// the start frame, and the recording is played in a loop. Key frame
+// requests cannot be served then; a client that lost a frame waits for
+// the next recorded IDR.
+class EncoderPipeline : public igtl::Object
+{
+public:
+  typedef EncoderPipeline                Self;
+  typedef igtl::Object                   Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(EncoderPipeline, igtl::Object);
+  igtlNewMacro(EncoderPipeline);
+
+  void SetVideoFile(const std::string& file) { this->m_VideoFile = file; };
+  const std::string& GetVideoFile() const    { return this->m_VideoFile; };
+  void SetWidth(unsigned int width)          { this->m_Width = width; };
+  unsigned int GetWidth() const              { return this->m_Width; };
+  void SetHeight(unsigned int height)        { this->m_Height = height; };
+  unsigned int GetHeight() const             { return this->m_Height; };
+  // Pixel format of the video file, converted to I420 before encoding
+  void SetPixelFormat(EVideoFormatType format) { this->m_PixelFormat = format; };
+  EVideoFormatType GetPixelFormat() const    { return this->m_PixelFormat; };
+  void SetPacingPolicy(FramePacer::Policy policy) { this->m_PacingPolicy = policy; };
+  FramePacer::Policy GetPacingPolicy() const      { return this->m_PacingPolicy; };
+  // Selects the encoder settings. The encoder is shared, so the latest
+  // request applies to every subscriber; a running encoder is
+  // reinitialized before its next frame. If the encoder refuses the
+  // profile, 'requester' (if any) is sent an error.
+  void SetProfile(const EncoderProfile* profile, ClientSession* requester = NULL)
+  {
+    if (profile == NULL)
+      {
+      return;
+      }
+    this->m_Lock->Lock();
+    if (profile != this->m_Profile)
+      {
+      this->m_Profile = profile;
+      this->m_ProfileChanged = 1;
+      this->m_ProfileRequester = requester;
+      }
+    this->m_Lock->Unlock();
+  };
+  const EncoderProfile* GetProfile()
+  {
+    this->m_Lock->Lock();
+    const EncoderProfile* profile = this->m_Profile;
+    this->m_Lock->Unlock();
+    return profile;
+  };
+
+  // Upper bound on the time from encode to socket; the encoder lowers
+  // its bitrate and drops frames to stay under it. 0 disables this.
+  void SetMaxLatency(int ms)                      { this->m_MaxLatency = ms > 0 ? ms : 0; };
+  int GetMaxLatency() const                       { return this->m_MaxLatency; };
+
+  // Device name of the stream's VIDEO messages (VIDEO_DEVICE_NAME in
+  // default); the slice messages get VIDEO_SLICE_SUFFIX appended
+  void SetDeviceName(const std::string& name)     { this->m_DeviceName = name; };
+  const std::string& GetDeviceName() const        { return this->m_DeviceName; };
+  // Sends every slice NAL as a VIDEO message of its own rather than
+  // whole access units. Set before the first Subscribe().
+  void SetSliceStreaming(bool slices)             { this->m_SliceStreaming = slices; };
+  bool GetSliceStreaming() const                  { return this->m_SliceStreaming; };
+  // Sends a FRAME_TIMING message ahead of every access unit, with the
+  // times it was captured, encoded and sent. Set before the first
+  // Subscribe().
+  void SetTracing(bool tracing)                   { this->m_Tracing = tracing; };
+  bool GetTracing() const                         { return this->m_Tracing; };
+  // Registers the counters of this source, labeled with its device
+  // name, in 'registry'. Set after the device name and before the first
+  // Subscribe().
+  void SetMetrics(MetricsRegistry* registry)
+  {
+    this->m_HasMetrics = registry != NULL;
+    if (registry)
+      {
+      RegisterServerMetrics(registry, this->m_DeviceName, this->m_Metrics);
+      }
+  };
+  // NULL unless SetMetrics() was called
+  ServerMetrics* GetMetrics()                     { return this->m_HasMetrics ? &this->m_Metrics : NULL; };
+
+  // Encoder threads instead of the profile's, for every profile; 0 (the
+  // default) keeps the profile's. Set before the first Subscribe().
+  void SetEncoderThreads(int threads)             { this->m_EncoderThreads = threads > 0 ? threads : 0; };
+  int GetEncoderThreads() const                   { return this->m_EncoderThreads; };
+
+  // Shortest time between two forced IDRs, in milliseconds
+  void SetMinIDRInterval(int ms)                  { this->m_MinIDRInterval = ms > 0 ? ms : 0; };
+  int GetMinIDRInterval() const                   { return this->m_MinIDRInterval; };
+
+  // Asks for an IDR, e.g. for a client that lost a frame. Forced as soon
+  // as the rate limit allows.
+  void RequestKeyFrame()
+  {
+    this->m_Lock->Lock();
+    this->m_ForceIDR = 1;
+    this->m_Lock->Unlock();
+  };
+
+  // Frame of the video file the encoder starts from
+  void SetStartFrame(igtlUint64 index)            { this->m_StartFrame = index; };
+  igtlUint64 GetStartFrame() const                { return this->m_StartFrame; };
+
+  // Streams the access unit file 'file' instead of encoding the video
+  // file. False if it cannot be opened. Set before the first Subscribe().
+  bool SetReplayFile(const std::string& file)
+  {
+    this->m_Replay = AccessUnitFile::New();
+    if (!this->m_Replay->Open(file))
+      {
+      this->m_Replay = NULL;
+      return false;
+      }
+    return true;
+  };
+  bool IsReplaying() const                        { return this->m_Replay.IsNotNull(); };
+
+  // Encodes one pass over the video file, from the start frame to its
+  // end, as fast as the encoder goes and writes the access units with
+  // their headers to the access unit file 'file'. Call instead of
+  // serving clients; returns false if the file could not be written.
+  bool Record(const std::string& file)
+  {
+    this->m_Recorder = AccessUnitFileWriter::New();
+    if (!this->m_Recorder->Open(file, this->m_Width, this->m_Height))
+      {
+      this->m_Recorder = NULL;
+      return false;
+      }
+    this->m_Stop = 0;
+    int threadID = this->m_Threader->SpawnThread((igtl::ThreadFunctionType) &EncoderPipeline::EncodeThread, this);
+    this->m_Threader->TerminateThread(threadID);
+    igtlUint64 frames = this->m_Recorder->GetNumberOfFrames();
+    bool ok = this->m_Recorder->Close() && frames > 0;
+    std::cerr << "Recorded " << frames << " access units to " << file << std::endl;
+    this->m_Recorder = NULL;
+    return ok;
+  };
+
+  // Adds a client. The encoder thread is started with the first
+  // subscriber; the stream runs at the shortest interval requested by
+  // any subscriber. The client is handed the cached GOP; a key frame is
+  // requested if that alone does not let it follow the stream.
+  void Subscribe(ClientSession* session, int interval)
+  {
+    this->m_ControlLock->Lock();
+    this->m_Lock->Lock();
+    if (std::find(this->m_Subscribers.begin(), this->m_Subscribers.end(), session) == this->m_Subscribers.end())
+      {
+      this->m_Subscribers.push_back(session);
+      session->Join(this->m_GOPCache, this->m_GOPCacheComplete);
+      if (session->IsWaitingForIDR())
+        {
+        this->m_ForceIDR = 1;
+        }
+      }
+    if (this->m_Interval < 0 || interval < this->m_Interval)
+      {
+      this->m_Interval = interval;
+      }
+    if (this->m_ThreadID < 0)
+      {
+      this->m_Stop = 0;
+      this->m_ThreadID = this->m_Threader->SpawnThread(this->m_Replay.IsNotNull() ?
+        (igtl::ThreadFunctionType) &EncoderPipeline::ReplayThread : (igtl::ThreadFunctionType) &EncoderPipeline::EncodeThread, this);
+      }
+    if (this->m_HasMetrics)
+      {
+      this->m_Metrics.m_Clients->Set(this->m_Subscribers.size());
+      }
+    this->m_Lock->Unlock();
+    this->m_ControlLock->Unlock();
+  };
+
+  // Removes a client. The shortest interval of the clients that remain
+  // applies from the next frame on; the encoder thread is stopped with
+  // the last one.
+  void Unsubscribe(ClientSession* session)
+  {
+    int threadID = -1;
+    this->m_ControlLock->Lock();
+    this->m_Lock->Lock();
+    std::vector<ClientSession::Pointer>::iterator it =
+      std::find(this->m_Subscribers.begin(), this->m_Subscribers.end(), session);
+    if (it != this->m_Subscribers.end())
+      {
+      this->m_Subscribers.erase(it);
+      }
+    // Nobody to tell if the profile it asked for is refused
+    if (this->m_ProfileRequester.GetPointer() == session)
+      {
+      this->m_ProfileRequester = NULL;
+      }
+    this->m_Interval = -1;
+    for (unsigned int i = 0; i < this->m_Subscribers.size(); i ++)
+      {
+      int interval = this->m_Subscribers[i]->GetRequestedInterval();
+      if (this->m_Interval < 0 || interval < this->m_Interval)
+        {
+        this->m_Interval = interval;
+        }
+      }
+    if (this->m_HasMetrics)
+      {
+      this->m_Metrics.m_Clients->Set(this->m_Subscribers.size());
+      }
+    if (this->m_Subscribers.empty() && this->m_ThreadID >= 0)
+      {
+      this->m_Stop = 1;
+      threadID = this->m_ThreadID;
+      this->m_ThreadID = -1;
+      }
+    this->m_Lock->Unlock();
+
+    // Join outside m_Lock; the encoder thread takes it to broadcast.
+    // m_ControlLock keeps a concurrent Subscribe() from restarting the
+    // thread before the old one is gone.
+    if (threadID >= 0)
+      {
+      this->m_Threader->TerminateThread(threadID);
+      // The next encoder starts a new stream
+      this->m_Lock->Lock();
+      this->m_GOPCache.clear();
+      this->m_GOPCacheComplete = false;
+      this->m_LastIDRTime = 0;
+      this->m_Lock->Unlock();
+      }
+    this->m_ControlLock->Unlock();
+  };
+
+  BufferPool* GetBufferPool() const { return this->m_BufferPool; };
+
+  // Reports the backpressure of the slowest subscriber: how long its
+  // frames wait before they are written, and how fast its socket drains
+  // (0 if unknown). Subscribers that wait for an IDR have dropped their
+  // queue and do not count.
+  void GetCongestion(igtlUint64 now, igtlUint64& delayNs, double& drainBytesPerSec)
+  {
+    delayNs = 0;
+    drainBytesPerSec = 0.0;
+    this->m_Lock->Lock();
+    for (unsigned int i = 0; i < this->m_Subscribers.size(); i ++)
+      {
+      if (this->m_Subscribers[i]->IsWaitingForIDR())
+        {
+        continue;
+        }
+      igtlUint64 delay = this->m_Subscribers[i]->GetSendDelayNs(now);
+      if (delay >= delayNs)
+        {
+        delayNs = delay;
+        drainBytesPerSec = this->m_Subscribers[i]->GetDrainRate();
+        }
+      }
+    this->m_Lock->Unlock();
+  };
+
+  unsigned int GetNumberOfSubscribers()
+  {
+    this->m_Lock->Lock();
+    unsigned int n = this->m_Subscribers.size();
+    this->m_Lock->Unlock();
+    return n;
+  };
+
+protected:
+  EncoderPipeline()
+    : m_Width(0), m_Height(0), m_PixelFormat(videoFormatI420), m_PacingPolicy(FramePacer::CATCH_UP), m_StartFrame(0),
+      m_Profile(GetDefaultEncoderProfile()), m_ProfileChanged(0), m_MaxLatency(0), m_DeviceName(VIDEO_DEVICE_NAME), m_SliceStreaming(false), m_Tracing(false), m_HasMetrics(false),
+      m_EncoderThreads(0), m_MinIDRInterval(ENCODER_PIPELINE_DEFAULT_IDR_INTERVAL), m_LastIDRTime(0), m_GOPCacheComplete(false),
+      m_Interval(-1), m_Stop(0), m_ForceIDR(0), m_ThreadID(-1)
+  {
+    this->m_Lock = igtl::MutexLock::New();
+    this->m_ControlLock = igtl::MutexLock::New();
+    this->m_Threader = igtl::MultiThreader::New();
+    this->m_BufferPool = BufferPool::New();
+  };
+  ~EncoderPipeline() {};
+
+  // Hands a frame to every subscriber and adds it to the GOP cache. A
+  // subscriber that overflowed its queue needs a new IDR to resume, so
+  // one is requested.
+  void Broadcast(EncodedFrame* frame)
+  {
+    frame->SetReadyTime(MonotonicTimeNs());
+    this->m_Lock->Lock();
+    if (frame->IsIDR())
+      {
+      this->m_GOPCache.clear();
+      this->m_GOPCache.push_back(frame);
+      this->m_GOPCacheComplete = true;
+      this->m_LastIDRTime = frame->GetReadyTime();
+      }
+    else if (this->m_GOPCacheComplete)
+      {
+      if (this->m_GOPCache.size() < ENCODER_PIPELINE_GOP_CACHE_SIZE)
+        {
+        this->m_GOPCache.push_back(frame);
+        }
+      else
+        {
+        // Too long to replay; keep the IDR for a first picture
+        this->m_GOPCache.resize(1);
+        this->m_GOPCacheComplete = false;
+        }
+      }
+    unsigned int queued = 0;
+    for (unsigned int i = 0; i < this->m_Subscribers.size(); i ++)
+      {
+      this->m_Subscribers[i]->Push(frame);
+      if (this->m_Subscribers[i]->IsWaitingForIDR())
+        {
+        this->m_ForceIDR = 1;
+        }
+      queued += this->m_Subscribers[i]->GetQueueDepth();
+      }
+    if (this->m_HasMetrics)
+      {
+      this->m_Metrics.m_QueuedFrames->Set(queued);
+      }
+    this->m_Lock->Unlock();
+  };
+
+  // Returns a frame with room for 'size' bytes of bit stream, or without
+  // a buffer if 'size' is 0, for an external bit stream. Frames are
+  // recycled once no session queue references them any more; only the
+  // pool itself holds them then. Called from the encoder thread only.
+  EncodedFrame* AcquireFrame(igtlUint64 size)
+  {
+    EncodedFrame* frame = NULL;
+    for (unsigned int i = 0; i < this->m_Frames.size(); i ++)
+      {
+      if (this->m_Frames[i]->GetReferenceCount() == 1)
+        {
+        frame = this->m_Frames[i];
+        break;
+        }
+      }
+    if (frame == NULL)
+      {
+      EncodedFrame::Pointer newFrame = EncodedFrame::New();
+      newFrame->SetBufferPool(this->m_BufferPool);
+      this->m_Frames.push_back(newFrame);
+      this->m_BufferPool->CountAllocation();
+      frame = newFrame;
+      }
+    if (size > 0 && !frame->Reserve(size))
+      {
+      return NULL;
+      }
+    frame->SetBitStreamSize(0);
+    return frame;
+  };
+
+  // Returns the profile to switch to, and in 'requester' the session
+  // that asked for it, or NULL if it has not changed since the last call.
+  const EncoderProfile* TakeProfileChange(ClientSession::Pointer& requester)
+  {
+    this->m_Lock->Lock();
+    const EncoderProfile* profile = this->m_ProfileChanged ? this->m_Profile : NULL;
+    requester = this->m_ProfileRequester;
+    this->m_ProfileChanged = 0;
+    this->m_ProfileRequester = NULL;
+    this->m_Lock->Unlock();
+    return profile;
+  };
+
+  // The encoder refused the profile TakeProfileChange() returned and
+  // runs with 'profile' again, unless another one was asked for since.
+  void RevertProfile(const EncoderProfile* profile)
+  {
+    this->m_Lock->Lock();
+    if (!this->m_ProfileChanged)
+      {
+      this->m_Profile = profile;
+      }
+    this->m_Lock->Unlock();
+  };
+
+  // Returns and clears the pending key frame request once the last IDR
+  // is at least MinIDRInterval old; until then the request stays pending.
+  bool TakeForceIDR(igtlUint64 now)
+  {
+    this->m_Lock->Lock();
+    bool force = this->m_ForceIDR != 0 &&
+      (this->m_LastIDRTime == 0 || now - this->m_LastIDRTime >= (igtlUint64) this->m_MinIDRInterval * 1000000ULL);
+    if (force)
+      {
+      this->m_ForceIDR = 0;
+      }
+    this->m_Lock->Unlock();
+    return force;
+  };
+
+  int GetInterval()
+  {
+    this->m_Lock->Lock();
+    int interval = this->m_Interval;
+    this->m_Lock->Unlock();
+    return interval;
+  };
+
+  // Appends an encoded frame, every layer with its headers, to the
+  // recording. 'time' is its presentation time in ns.
+  void RecordFrame(EncodedFrame* frame, igtlUint64 time)
+  {
+    AccessUnitIndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.m_Time                   = time;
+    entry.m_FrameIndex             = frame->GetFrameIndex();
+    entry.m_FrameType              = (igtlUint8) frame->GetFrameType();
+    entry.m_IDR                    = frame->IsIDR() ? 1 : 0;
+    entry.m_TemporalId             = (igtlUint8) frame->GetTemporalId();
+    entry.m_NumberOfTemporalLayers = (igtlUint8) frame->GetNumberOfTemporalLayers();
+    entry.m_NumberOfLayers         = (igtlUint8) frame->GetNumberOfLayers();
+    entry.m_Interval               = frame->GetInterval() > 0 ? frame->GetInterval() : 0;
+    for (int s = 0; s < frame->GetNumberOfLayers(); s ++)
+      {
+      entry.m_LayerSize[s]    = (igtlUint32) frame->GetLayerWireSize(s);
+      entry.m_LayerBitrate[s] = (igtlUint32) frame->GetLayerBitrate(s);
+      }
+    this->m_Recorder->BeginFrame(entry);
+    for (int s = 0; s < frame->GetNumberOfLayers(); s ++)
+      {
+      for (int i = 0; i < frame->GetNumberOfPackets(s); i ++)
+        {
+        this->m_Recorder->Write(frame->GetPacketHeader(s, i), VIDEO_FRAME_HEADER_SIZE);
+        this->m_Recorder->Write(frame->GetPacketBitStream(s, i), frame->GetPacketSize(s, i));
+        }
+      }
+  };
+
+  // Fills 'frame' with access unit 'index' of the replayed file. The
+  // packets refer to the mapping; only their headers are copied, since
+  // the frame keeps them apart from the bit stream.
+  bool LoadReplayFrame(EncodedFrame* frame, igtlUint64 index)
+  {
+    const AccessUnitIndexEntry& entry = this->m_Replay->GetEntry(index);
+    const unsigned char* data = this->m_Replay->GetFrameData(index);
+    frame->SetExternalBitStream(data);
+    igtlUint64 offset = 0;
+    for (int s = 0; s < entry.m_NumberOfLayers; s ++)
+      {
+      frame->ClearPackets(s);
+      igtlUint64 end = offset + entry.m_LayerSize[s];
+      while (offset + VIDEO_FRAME_HEADER_SIZE <= end)
+        {
+        igtl_header h;
+        memcpy(&h, data + offset, IGTL_HEADER_SIZE);
+        igtl_header_convert_byte_order(&h);
+        if (h.body_size < IGTL_VIDEO_HEADER_SIZE || offset + IGTL_HEADER_SIZE + h.body_size > end)
+          {
+          return false;
+          }
+        igtlUint64 size = h.body_size - IGTL_VIDEO_HEADER_SIZE;
+        memcpy(frame->AddPacket(s, offset + VIDEO_FRAME_HEADER_SIZE, size), data + offset, VIDEO_FRAME_HEADER_SIZE);
+        offset += VIDEO_FRAME_HEADER_SIZE + size;
+        }
+      offset = end;
+      frame->SetLayerBitrate(s, entry.m_LayerBitrate[s]);
+      }
+    frame->SetNumberOfLayers(entry.m_NumberOfLayers);
+    frame->SetBitStreamSize(offset);
+    frame->SetTemporalLayer(entry.m_TemporalId, entry.m_NumberOfTemporalLayers > 0 ? entry.m_NumberOfTemporalLayers : 1);
+    frame->SetInterval(entry.m_Interval);
+    frame->SetFrameType((EVideoFrameType) entry.m_FrameType);
+    frame->SetFrameIndex(entry.m_FrameIndex);
+    return true;
+  };
+
+  static void* ReplayThread(void* ptr)
+  {
+    igtl::MultiThreader::ThreadInfo* info =
+      static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+    EncoderPipeline* pipeline = static_cast<EncoderPipeline*>(info->UserData);
+    AccessUnitFile* file = pipeline->m_Replay;
+
+    igtlUint64 numberOfFrames = file->GetNumberOfFrames();
+    // Receivers can only start decoding at an IDR
+    igtlUint64 index = file->FindKeyFrame(pipeline->m_StartFrame % numberOfFrames);
+    // A skipped access unit would break the references of the ones
+    // after it, so late frames always catch up
+    FramePacer pacer;
+    pacer.SetPolicy(FramePacer::CATCH_UP);
+    while (!pipeline->m_Stop)
+      {
+      const AccessUnitIndexEntry& entry = file->GetEntry(index);
+      igtlUint64 next = (index + 1) % numberOfFrames;
+      // Keep the recorded spacing; the interval where the file wraps
+      igtlUint64 period = (igtlUint64) entry.m_Interval * 1000000ULL;
+      if (next > index && file->GetEntry(next).m_Time > entry.m_Time)
+        {
+        period = file->GetEntry(next).m_Time - entry.m_Time;
+        }
+      pacer.SetPeriodNs(period > 0 ? period : 1000000000ULL / 30);
+      EncodedFrame::Pointer frame = pipeline->AcquireFrame(0);
+      if (frame.IsNotNull() && pipeline->LoadReplayFrame(frame, index))
+        {
+        igtlUint64 now = MonotonicTimeNs();
+        frame->SetCaptureTime(now);
+        frame->SetEncodedTime(now);
+        pacer.WaitForDeadline();
+        pipeline->Broadcast(frame);
+        }
+      else
+        {
+        // The frames up to the next IDR refer to this one, so the stream
+        // goes on there; its slot still passes, or a damaged file would
+        // spin
+        next = file->FindNextKeyFrame(next);
+        std::cerr << "Can not replay access unit " << index << "; going on at " << next << "." << std::endl;
+        pacer.WaitForDeadline();
+        }
+      file->Prefetch(next);
+      index = next;
+      }
+    return NULL;
+  };
+
+  // Defined in VideoStreamServer.cxx
+  static void* EncodeThread(void* ptr);
+
+  std::string                         m_VideoFile;
+  unsigned int                        m_Width;
+  unsigned int                        m_Height;
+  EVideoFormatType                    m_PixelFormat;
+  FramePacer::Policy                  m_PacingPolicy;
+  igtlUint64                          m_StartFrame;
+  const EncoderProfile*               m_Profile;
+  int                                 m_ProfileChanged;
+  ClientSession::Pointer              m_ProfileRequester;  // of the change not yet taken
+  int                                 m_MaxLatency;
+  std::string                         m_DeviceName;
+  bool                                m_SliceStreaming;
+  bool                                m_Tracing;
+  bool                                m_HasMetrics;
+  ServerMetrics                       m_Metrics;
+  int                                 m_EncoderThreads;
+  int                                 m_MinIDRInterval;
+  igtlUint64                          m_LastIDRTime;
+  std::vector<EncodedFrame::Pointer>  m_GOPCache;
+  bool                                m_GOPCacheComplete;
+  std::vector<ClientSession::Pointer> m_Subscribers;
+  igtl::MutexLock::Pointer            m_Lock;
+  igtl::MutexLock::Pointer            m_ControlLock;
+  igtl::MultiThreader::Pointer        m_Threader;
+  int                                 m_Interval;
+  int                                 m_Stop;
+  int                                 m_ForceIDR;
+  int                                 m_ThreadID;
+  BufferPool::Pointer                 m_BufferPool;
+  AccessUnitFile::Pointer             m_Replay;
+  AccessUnitFileWriter::Pointer       m_Recorder;
+  std::vector<EncodedFrame::Pointer>  m_Frames;
+};
+
+#endif // __EncoderPipeline_h
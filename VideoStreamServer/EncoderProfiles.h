@@ -0,0 +1,205 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __EncoderProfiles_h
+#define __EncoderProfiles_h
+
+#include <cstring>
+#include <thread>
+#include "api/svc/codec_api.h"
+#include "api/svc/codec_app_def.h"
+
+// iThreads of a profile that encodes on every hardware thread
+#define ENCODER_THREADS_PER_CORE (-1)
+// Most slices OpenH264 accepts in SM_FIXEDSLCNUM_SLICE mode
+#define ENCODER_MAX_FIXED_SLICES 35
+
+// A named set of encoder settings. Profiles are picked by name on the
+// server command line (--profile) or by a client, which puts the name in
+// the device name of its STT_VIDEO message.
+struct EncoderProfile {
+  const char*   pkcName;
+  const char*   pkcHashStr;        // SHA1 of the bit stream of the reference clip, or NULL
+  EUsageType    eUsageType;
+  float         fFrameRate;        // rate control frame rate; also the send rate when a client asks for none
+  SliceModeEnum eSliceMode;
+  unsigned int  uiSliceNum;        // SM_FIXEDSLCNUM_SLICE; 0 for one per thread
+  unsigned int  uiMaxNalSize;      // SM_SIZELIMITED_SLICE
+  int           iThreads;          // iMultipleThreadIdc; 0 lets the encoder pick, or ENCODER_THREADS_PER_CORE
+  bool          bDenoise;
+  int           iLayerNum;         // spatial layers, each half the size of the next; the last is full size
+  int           iTemporalLayerNum; // each temporal layer doubles the frame rate of the ones below
+  bool          bLossless;
+  bool          bEnableLtr;
+  bool          bCabac;
+  RC_MODES      eRCMode;
+  int           iTargetBitrate;    // bits per second of the full size layer; a quarter for each layer below
+  int           iMinQp;
+  int           iMaxQp;
+  bool          bEnableFrameSkip;
+};
+
+static const EncoderProfile kEncoderProfiles[] = {
+  // Bit-exact pictures for checking the pipeline; the former hard-coded
+  // settings, and still the default
+  {
+    "lossless-diagnostic", "dfd4666f9b90d5d77647454e2a06d546adac6a7c", CAMERA_VIDEO_REAL_TIME, 5.0f,
+    SM_SINGLE_SLICE, 5, 1500, 0, false, 1, 1, true, false, true, RC_OFF_MODE, 5000000, 0, 0, true
+  },
+  // Short frames in parallel slices, CAVLC and no frame skipping so that
+  // every frame leaves as soon as it is encoded
+  {
+    "low-latency", NULL, CAMERA_VIDEO_REAL_TIME, 30.0f,
+    SM_FIXEDSLCNUM_SLICE, 4, 1500, 4, false, 1, 1, false, false, false, RC_BITRATE_MODE, 4000000, 18, 36, false
+  },
+  // Slices of at most one network packet, for streaming them one by one
+  // (--slices) to decoders that start on a picture before it is complete
+  {
+    "ultra-low-latency", NULL, CAMERA_VIDEO_REAL_TIME, 30.0f,
+    SM_SIZELIMITED_SLICE, 0, 1500, 1, false, 1, 1, false, false, false, RC_BITRATE_MODE, 4000000, 18, 36, false
+  },
+  // Denoised, CABAC, long term references and a coarse QP range for thin
+  // links
+  {
+    "bandwidth-saver", NULL, CAMERA_VIDEO_REAL_TIME, 15.0f,
+    SM_SINGLE_SLICE, 1, 1500, 1, true, 1, 1, false, true, true, RC_BITRATE_MODE, 500000, 24, 45, true
+  },
+  // Quarter, half and full size pictures from one encode, in temporal
+  // layers of 7.5, 15 and 30 fps; each client receives only the layers
+  // it asks for
+  {
+    "svc-3-layer", NULL, CAMERA_VIDEO_REAL_TIME, 30.0f,
+    SM_SINGLE_SLICE, 1, 1500, 1, false, 3, 3, false, false, false, RC_BITRATE_MODE, 2000000, 18, 40, true
+  },
+  // 4K and multi-megapixel sources: a slice per hardware thread, all
+  // encoded in parallel, with the slice boundaries moved from frame to
+  // frame so that the threads finish together
+  {
+    "high-resolution", NULL, CAMERA_VIDEO_REAL_TIME, 30.0f,
+    SM_FIXEDSLCNUM_SLICE, 0, 1500, ENCODER_THREADS_PER_CORE, false, 1, 1, false, false, false, RC_BITRATE_MODE,
+    16000000, 18, 38, false
+  },
+};
+
+static const int kNumberOfEncoderProfiles = sizeof (kEncoderProfiles) / sizeof (kEncoderProfiles[0]);
+
+inline const EncoderProfile* GetDefaultEncoderProfile() {
+  return &kEncoderProfiles[0];
+}
+
+// Returns NULL when no profile has that name
+inline const EncoderProfile* FindEncoderProfile (const char* pkcName) {
+  if (pkcName == NULL)
+    return NULL;
+  for (int i = 0; i < kNumberOfEncoderProfiles; i++) {
+    if (strcmp (kEncoderProfiles[i].pkcName, pkcName) == 0)
+      return &kEncoderProfiles[i];
+  }
+  return NULL;
+}
+
+// Encoder threads for a profile; iThreads > 0 overrides the profile's
+inline int GetEncoderThreads (const EncoderProfile* pProfile, int iThreads = 0) {
+  if (iThreads <= 0)
+    iThreads = pProfile->iThreads;
+  if (iThreads == ENCODER_THREADS_PER_CORE) {
+    unsigned int uiCores = std::thread::hardware_concurrency();
+    iThreads = uiCores > 0 ? (int) uiCores : 1;
+  }
+  return iThreads;
+}
+
+// Fills everything but the picture sizes. iThreads > 0 overrides the
+// profile's thread count, and with it the number of slices of a profile
+// that has one per thread. The encoder caps the threads at its own
+// maximum.
+inline void EncoderProfileToParamExt (const EncoderProfile* pProfile, SEncParamExt* pEnxParamExt, int iThreads = 0) {
+  pEnxParamExt->iUsageType       = pProfile->eUsageType;
+  pEnxParamExt->fMaxFrameRate    = pProfile->fFrameRate;
+
+  pEnxParamExt->bEnableDenoise   = pProfile->bDenoise;
+  pEnxParamExt->iSpatialLayerNum = pProfile->iLayerNum;
+  pEnxParamExt->iTemporalLayerNum = pProfile->iTemporalLayerNum;
+  // Every spatial layer is a plain AVC stream of its own, so a client
+  // can be sent one layer without the ones below it
+  pEnxParamExt->bSimulcastAVC    = pProfile->iLayerNum > 1;
+
+  pEnxParamExt->iRCMode          = pProfile->eRCMode;
+  pEnxParamExt->iMinQp           = pProfile->iMinQp;
+  pEnxParamExt->iMaxQp           = pProfile->iMaxQp;
+  pEnxParamExt->bIsLosslessLink  = pProfile->bLossless;
+  if (pEnxParamExt->bIsLosslessLink)
+  {
+    pEnxParamExt->iMaxQp = 0;
+    pEnxParamExt->iMinQp = 0;
+    pEnxParamExt->iRCMode = RC_OFF_MODE;
+    pEnxParamExt->bEnableAdaptiveQuant = false;
+  }
+  pEnxParamExt->bEnableLongTermReference = pProfile->bEnableLtr;
+  pEnxParamExt->iEntropyCodingModeFlag   = pProfile->bCabac ? 1 : 0;
+  pEnxParamExt->iTargetBitrate = 0;
+  pEnxParamExt->uiMaxNalSize = pProfile->uiMaxNalSize;
+  pEnxParamExt->iNumRefFrame = AUTO_REF_PIC_COUNT;
+  pEnxParamExt->iMultipleThreadIdc = GetEncoderThreads (pProfile, iThreads);
+  if (pProfile->eSliceMode == SM_SIZELIMITED_SLICE) //SM_DYN_SLICE don't support multi-thread now
+    pEnxParamExt->iMultipleThreadIdc = 1;
+  unsigned int uiSliceNum = pProfile->uiSliceNum;
+  if (pProfile->eSliceMode == SM_FIXEDSLCNUM_SLICE) {
+    if (uiSliceNum == 0)
+      uiSliceNum = pEnxParamExt->iMultipleThreadIdc > 0 ? pEnxParamExt->iMultipleThreadIdc : 1;
+    if (uiSliceNum > ENCODER_MAX_FIXED_SLICES)
+      uiSliceNum = ENCODER_MAX_FIXED_SLICES;
+    // Lets the encoder move the slice boundaries after slices took
+    // unequal times; OpenH264's default, cleared by the memset in
+    // InitializeEncoder
+    pEnxParamExt->bUseLoadBalancing = true;
+  }
+
+  for (int i = 0; i < pEnxParamExt->iSpatialLayerNum; i++) {
+    pEnxParamExt->sSpatialLayers[i].bFullRange = 1;
+    pEnxParamExt->sSpatialLayers[i].fFrameRate      = pProfile->fFrameRate;
+    pEnxParamExt->sSpatialLayers[i].iSpatialBitrate = pProfile->iTargetBitrate >> (2 * (pEnxParamExt->iSpatialLayerNum - 1 - i));
+    pEnxParamExt->iTargetBitrate += pEnxParamExt->sSpatialLayers[i].iSpatialBitrate;
+    pEnxParamExt->sSpatialLayers[i].sSliceArgument.uiSliceMode = pProfile->eSliceMode;
+    pEnxParamExt->sSpatialLayers[i].sSliceArgument.uiSliceNum = uiSliceNum;
+    if (pProfile->eSliceMode == SM_SIZELIMITED_SLICE) {
+      pEnxParamExt->sSpatialLayers[i].sSliceArgument.uiSliceSizeConstraint = pProfile->uiMaxNalSize;
+      pEnxParamExt->bUseLoadBalancing = false;
+    }
+  }
+  pEnxParamExt->bEnableFrameSkip = pProfile->bEnableFrameSkip;
+}
+
+// (Re)initializes the encoder with a profile and the picture size. Each
+// spatial layer below the top one is half the width and height of the
+// next. threads > 0 overrides the profile's thread count. False if the
+// encoder refused the settings.
+inline bool InitializeEncoder (ISVCEncoder* encoder_, const EncoderProfile* profile,
+                               int width, int height, SEncParamExt& pEncParamExt, int threads = 0) {
+  memset (&pEncParamExt, 0, sizeof (SEncParamExt));
+  EncoderProfileToParamExt (profile, &pEncParamExt, threads);
+  pEncParamExt.iPicWidth = width;
+  pEncParamExt.iPicHeight = height;
+  for (int i = 0; i < pEncParamExt.iSpatialLayerNum; i++) {
+    int shift = pEncParamExt.iSpatialLayerNum - 1 - i;
+    pEncParamExt.sSpatialLayers[i].iVideoWidth     = (pEncParamExt.iPicWidth >> shift) & ~1;
+    pEncParamExt.sSpatialLayers[i].iVideoHeight    = (pEncParamExt.iPicHeight >> shift) & ~1;
+  }
+  if (encoder_->InitializeExt (&pEncParamExt) != cmResultSuccess)
+    return false;
+  int videoFormat = videoFormatI420;
+  encoder_->SetOption (ENCODER_OPTION_DATAFORMAT, &videoFormat);
+  return true;
+}
+
+#endif // __EncoderProfiles_h
@@ -0,0 +1,543 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __EpollServer_h
+#define __EpollServer_h
+
+#define EPOLL_SERVER_DEFAULT_LOOPS     2
+#define EPOLL_SERVER_MAX_EVENTS        64
+#define EPOLL_SERVER_READ_SIZE         4096
+#define EPOLL_SERVER_MAX_CONTROL_BODY  65536  // larger bodies are skipped
+
+#if defined(__linux__)
+
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <vector>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "igtlObject.h"
+#include "igtlMessageHeader.h"
+#include "igtlMultiThreader.h"
+#include "igtlMutexLock.h"
+#include "igtlVideoMessage.h"
+#include "igtl_header.h"
+
+#include "ClientSession.h"
+#include "EncoderPipeline.h"
+#include "KeyFrameRequest.h"
+#include "StreamRequest.h"
+
+// Event-driven network side of the server for Linux. A few threads, each
+// running an epoll loop over non-blocking sockets, accept clients, parse
+// their control messages and write their video, so hundreds of clients
+// need no thread of their own.
+//
+// Every connection stays on the loop that accepted it. The encoder
+// thread queues frames in the connection's ClientSession as before and
+// wakes the loop through an eventfd; the loop writes as much as the
+// socket takes and waits for EPOLLOUT to continue a frame written in
+// part. Control messages are assembled from whatever the socket delivers,
+// however it is split.
+//
+// Stop() wakes the loops, which unsubscribe and close their connections
+// and return; no thread is left blocked in a system call.
+class EpollServer : public igtl::Object
+{
+public:
+  typedef EpollServer                    Self;
+  typedef igtl::Object                   Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(EpollServer, igtl::Object);
+  igtlNewMacro(EpollServer);
+
+  // Configuration; takes effect in Start()
+  void SetPort(int port)                        { this->m_Port = port; };
+  void SetNumberOfLoops(int n)                  { this->m_NumberOfLoops = n > 0 ? n : 1; };
+  int  GetNumberOfLoops() const                 { return this->m_NumberOfLoops; };
+  void SetPipeline(EncoderPipeline* pipeline)   { this->m_Pipeline = pipeline; };
+
+  int GetNumberOfConnections() const            { return this->m_NumberOfConnections.load(); };
+
+  // Listens on the port and starts the loop threads. Returns false if
+  // the port can not be opened.
+  bool Start()
+  {
+    if (!this->m_Loops.empty())
+      {
+      return true;
+      }
+    this->m_ListenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (this->m_ListenFd < 0)
+      {
+      return false;
+      }
+    int on = 1;
+    setsockopt(this->m_ListenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family      = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port        = htons(this->m_Port);
+    if (bind(this->m_ListenFd, (struct sockaddr*) &address, sizeof(address)) != 0 ||
+        listen(this->m_ListenFd, SOMAXCONN) != 0)
+      {
+      close(this->m_ListenFd);
+      this->m_ListenFd = -1;
+      return false;
+      }
+
+    this->m_Stop = 0;
+    for (int i = 0; i < this->m_NumberOfLoops; i ++)
+      {
+      EventLoop* loop = new EventLoop();
+      loop->m_Server = this;
+      loop->m_EpollFd = epoll_create1(EPOLL_CLOEXEC);
+      loop->m_WakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      loop->m_ThreadID = -1;
+      struct epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      event.data.ptr = loop;
+      epoll_ctl(loop->m_EpollFd, EPOLL_CTL_ADD, loop->m_WakeFd, &event);
+      // Every loop accepts; EPOLLEXCLUSIVE wakes one of them per client
+      // instead of all
+      event.events = EPOLLIN;
+#if defined(EPOLLEXCLUSIVE)
+      event.events |= EPOLLEXCLUSIVE;
+#endif
+      event.data.ptr = this;
+      epoll_ctl(loop->m_EpollFd, EPOLL_CTL_ADD, this->m_ListenFd, &event);
+      this->m_Loops.push_back(loop);
+      }
+    for (unsigned int i = 0; i < this->m_Loops.size(); i ++)
+      {
+      this->m_Loops[i]->m_ThreadID =
+        this->m_Threader->SpawnThread((igtl::ThreadFunctionType) &EpollServer::LoopThread, this->m_Loops[i]);
+      }
+    return true;
+  };
+
+  // Closes every connection and joins the loop threads
+  void Stop()
+  {
+    if (this->m_Loops.empty())
+      {
+      return;
+      }
+    this->m_Stop = 1;
+    for (unsigned int i = 0; i < this->m_Loops.size(); i ++)
+      {
+      WakeLoop(this->m_Loops[i]);
+      }
+    for (unsigned int i = 0; i < this->m_Loops.size(); i ++)
+      {
+      EventLoop* loop = this->m_Loops[i];
+      this->m_Threader->TerminateThread(loop->m_ThreadID);
+      close(loop->m_WakeFd);
+      close(loop->m_EpollFd);
+      delete loop;
+      }
+    this->m_Loops.clear();
+    close(this->m_ListenFd);
+    this->m_ListenFd = -1;
+  };
+
+protected:
+  EpollServer()
+    : m_Port(18944), m_NumberOfLoops(EPOLL_SERVER_DEFAULT_LOOPS), m_ListenFd(-1),
+      m_Stop(0), m_NumberOfConnections(0)
+  {
+    this->m_Threader = igtl::MultiThreader::New();
+  };
+  ~EpollServer()
+  {
+    this->Stop();
+  };
+
+  struct EventLoop;
+
+  // One client. Everything but m_Queued belongs to the loop's thread.
+  struct Connection
+  {
+    int                          m_Fd;          // -1 once closed
+    EventLoop*                   m_Loop;
+    ClientSession::Pointer       m_Session;
+    bool                         m_Subscribed;
+    bool                         m_WantWrite;   // EPOLLOUT is armed
+    std::atomic<int>             m_Queued;      // on the loop's ready list
+
+    // Control message being assembled
+    igtl::MessageHeader::Pointer m_Header;
+    bool                         m_InBody;
+    igtlUint64                   m_Received;    // of the header or the body
+    igtlUint64                   m_BodySize;
+    bool                         m_KeepBody;
+    std::vector<unsigned char>   m_Body;
+  };
+
+  struct EventLoop
+  {
+    EpollServer*                 m_Server;
+    int                          m_EpollFd;
+    int                          m_WakeFd;
+    int                          m_ThreadID;
+    std::map<int, Connection*>   m_Connections;
+    igtl::SimpleMutexLock        m_ReadyLock;   // guards m_Ready
+    std::vector<Connection*>     m_Ready;       // have frames queued
+    std::vector<Connection*>     m_Closed;      // deleted after the current events
+  };
+
+  static void WakeLoop(EventLoop* loop)
+  {
+    uint64_t one = 1;
+    ssize_t r = write(loop->m_WakeFd, &one, sizeof(one));
+    (void) r;
+  };
+
+  // Encoder thread: frames were queued for the connection
+  static void Wakeup(ClientSession*, void* userData)
+  {
+    Connection* connection = static_cast<Connection*>(userData);
+    if (connection->m_Queued.exchange(1))
+      {
+      return;
+      }
+    EventLoop* loop = connection->m_Loop;
+    loop->m_ReadyLock.Lock();
+    loop->m_Ready.push_back(connection);
+    loop->m_ReadyLock.Unlock();
+    WakeLoop(loop);
+  };
+
+  static void* LoopThread(void* ptr)
+  {
+    igtl::MultiThreader::ThreadInfo* info =
+      static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+    EventLoop* loop = static_cast<EventLoop*>(info->UserData);
+    EpollServer* server = loop->m_Server;
+
+    struct epoll_event events[EPOLL_SERVER_MAX_EVENTS];
+    std::vector<Connection*> ready;
+    while (!server->m_Stop.load())
+      {
+      int n = epoll_wait(loop->m_EpollFd, events, EPOLL_SERVER_MAX_EVENTS, -1);
+      if (n < 0 && errno != EINTR)
+        {
+        break;
+        }
+      for (int i = 0; i < n; i ++)
+        {
+        void* source = events[i].data.ptr;
+        if (source == server)
+          {
+          server->Accept(loop);
+          }
+        else if (source == loop)
+          {
+          uint64_t count;
+          ssize_t r = read(loop->m_WakeFd, &count, sizeof(count));
+          (void) r;
+          loop->m_ReadyLock.Lock();
+          ready.swap(loop->m_Ready);
+          loop->m_ReadyLock.Unlock();
+          for (unsigned int j = 0; j < ready.size(); j ++)
+            {
+            // Frames pushed from here on wake the loop again
+            ready[j]->m_Queued = 0;
+            server->Flush(ready[j]);
+            }
+          ready.clear();
+          }
+        else
+          {
+          // May have been closed by an earlier event of this round
+          Connection* connection = static_cast<Connection*>(source);
+          if (connection->m_Fd < 0)
+            {
+            continue;
+            }
+          if ((events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && !server->Read(connection))
+            {
+            server->Close(connection);
+            continue;
+            }
+          if (events[i].events & EPOLLOUT)
+            {
+            server->Flush(connection);
+            }
+          }
+        }
+      server->DeleteClosed(loop);
+      }
+
+    while (!loop->m_Connections.empty())
+      {
+      server->Close(loop->m_Connections.begin()->second);
+      }
+    server->DeleteClosed(loop);
+    return NULL;
+  };
+
+  void Accept(EventLoop* loop)
+  {
+    for (;;)
+      {
+      int fd = accept4(this->m_ListenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0)
+        {
+        if (errno == EINTR)
+          {
+          continue;
+          }
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          {
+          std::cerr << "Cannot accept a client: " << strerror(errno) << std::endl;
+          }
+        return;
+        }
+      // Frames go out as soon as they are written
+      int on = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+      Connection* connection = new Connection();
+      connection->m_Fd = fd;
+      connection->m_Loop = loop;
+      connection->m_Session = ClientSession::New();
+      connection->m_Session->SetWakeup(&EpollServer::Wakeup, connection);
+      connection->m_Subscribed = false;
+      connection->m_WantWrite = false;
+      connection->m_Queued = 0;
+      connection->m_Header = igtl::MessageHeader::New();
+      connection->m_Header->InitPack();
+      connection->m_InBody = false;
+      connection->m_Received = 0;
+      connection->m_BodySize = 0;
+      connection->m_KeepBody = false;
+
+      struct epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      event.data.ptr = connection;
+      if (epoll_ctl(loop->m_EpollFd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+        close(fd);
+        delete connection;
+        continue;
+        }
+      loop->m_Connections[fd] = connection;
+      ++ this->m_NumberOfConnections;
+      std::cerr << "A client is connected." << std::endl;
+      }
+  };
+
+  // Reads what the socket has. Returns false when the connection ends.
+  bool Read(Connection* connection)
+  {
+    unsigned char buffer[EPOLL_SERVER_READ_SIZE];
+    for (;;)
+      {
+      ssize_t n = recv(connection->m_Fd, buffer, sizeof(buffer), 0);
+      if (n == 0)
+        {
+        std::cerr << "Disconnecting the client." << std::endl;
+        return false;
+        }
+      if (n < 0)
+        {
+        if (errno == EINTR)
+          {
+          continue;
+          }
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+      if (!this->Consume(connection, buffer, n))
+        {
+        return false;
+        }
+      }
+  };
+
+  // Feeds received bytes to the message being assembled and handles
+  // each message once it is complete
+  bool Consume(Connection* connection, const unsigned char* data, igtlUint64 size)
+  {
+    while (size > 0)
+      {
+      igtlUint64 n;
+      if (!connection->m_InBody)
+        {
+        n = std::min(size, (igtlUint64) IGTL_HEADER_SIZE - connection->m_Received);
+        memcpy(static_cast<unsigned char*>(connection->m_Header->GetPackPointer()) + connection->m_Received, data, n);
+        connection->m_Received += n;
+        if (connection->m_Received == IGTL_HEADER_SIZE)
+          {
+          connection->m_Header->Unpack();
+          connection->m_BodySize = connection->m_Header->GetBodySizeToRead();
+          connection->m_KeepBody = strcmp(connection->m_Header->GetDeviceType(), "STT_VIDEO") == 0 &&
+                                   connection->m_BodySize <= EPOLL_SERVER_MAX_CONTROL_BODY;
+          connection->m_Body.resize(connection->m_KeepBody ? connection->m_BodySize : 0);
+          connection->m_InBody = true;
+          connection->m_Received = 0;
+          }
+        }
+      else
+        {
+        n = std::min(size, connection->m_BodySize - connection->m_Received);
+        if (connection->m_KeepBody)
+          {
+          memcpy(&connection->m_Body[connection->m_Received], data, n);
+          }
+        connection->m_Received += n;
+        }
+      data += n;
+      size -= n;
+
+      if (connection->m_InBody && connection->m_Received == connection->m_BodySize)
+        {
+        connection->m_InBody = false;
+        connection->m_Received = 0;
+        bool keep = this->HandleMessage(connection);
+        connection->m_Header->InitPack();
+        if (!keep)
+          {
+          return false;
+          }
+        }
+      }
+    return true;
+  };
+
+  // Returns false when the client asks to stop
+  bool HandleMessage(Connection* connection)
+  {
+    igtl::MessageHeader* header = connection->m_Header;
+    if (strcmp(header->GetDeviceType(), "STT_VIDEO") == 0)
+      {
+      std::cerr << "Received a STT_VIDEO message." << std::endl;
+      igtl::StartVideoDataMessage::Pointer startVideoMsg;
+      startVideoMsg = igtl::StartVideoDataMessage::New();
+      startVideoMsg->SetMessageHeader(header);
+      startVideoMsg->AllocatePack();
+      if (!connection->m_KeepBody || connection->m_Body.size() != (size_t) startVideoMsg->GetPackBodySize())
+        {
+        return true;
+        }
+      if (!connection->m_Body.empty())
+        {
+        memcpy(startVideoMsg->GetPackBodyPointer(), &connection->m_Body[0], connection->m_Body.size());
+        }
+      int c = startVideoMsg->Unpack(1);
+      if ((c & igtl::MessageHeader::UNPACK_BODY) && !connection->m_Subscribed) // if CRC check is OK
+        {
+        SubscribeStreamRequest(this->m_Pipeline, connection->m_Session, startVideoMsg->GetDeviceName(),
+                               startVideoMsg->GetTimeInterval());
+        connection->m_Subscribed = true;
+        }
+      }
+    else if (strcmp(header->GetDeviceType(), KEY_FRAME_REQUEST_TYPE) == 0)
+      {
+      this->m_Pipeline->RequestKeyFrame();
+      }
+    else if (strcmp(header->GetDeviceType(), "STP_VIDEO") == 0)
+      {
+      std::cerr << "Received a STP_VIDEO message." << std::endl;
+      std::cerr << "Disconnecting the client." << std::endl;
+      return false;
+      }
+    else
+      {
+      std::cerr << "Receiving : " << header->GetDeviceType() << std::endl;
+      }
+    return true;
+  };
+
+  // Writes queued frames; arms EPOLLOUT while the socket is full
+  void Flush(Connection* connection)
+  {
+    if (connection->m_Fd < 0)
+      {
+      return;
+      }
+    int r = connection->m_Session->SendQueued(connection->m_Fd);
+    if (r < 0)
+      {
+      this->Close(connection);
+      return;
+      }
+    bool wantWrite = (r == 0);
+    if (wantWrite != connection->m_WantWrite)
+      {
+      struct epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = wantWrite ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+      event.data.ptr = connection;
+      epoll_ctl(connection->m_Loop->m_EpollFd, EPOLL_CTL_MOD, connection->m_Fd, &event);
+      connection->m_WantWrite = wantWrite;
+      }
+  };
+
+  void Close(Connection* connection)
+  {
+    EventLoop* loop = connection->m_Loop;
+    epoll_ctl(loop->m_EpollFd, EPOLL_CTL_DEL, connection->m_Fd, NULL);
+    // No frames, and so no wakeups, arrive after this
+    if (connection->m_Subscribed)
+      {
+      this->m_Pipeline->Unsubscribe(connection->m_Session);
+      }
+    connection->m_Session->Stop();
+    loop->m_ReadyLock.Lock();
+    loop->m_Ready.erase(std::remove(loop->m_Ready.begin(), loop->m_Ready.end(), connection), loop->m_Ready.end());
+    loop->m_ReadyLock.Unlock();
+    close(connection->m_Fd);
+    loop->m_Connections.erase(connection->m_Fd);
+    connection->m_Fd = -1;
+    loop->m_Closed.push_back(connection);
+    -- this->m_NumberOfConnections;
+  };
+
+  static void DeleteClosed(EventLoop* loop)
+  {
+    for (unsigned int i = 0; i < loop->m_Closed.size(); i ++)
+      {
+      delete loop->m_Closed[i];
+      }
+    loop->m_Closed.clear();
+  };
+
+  int                          m_Port;
+  int                          m_NumberOfLoops;
+  EncoderPipeline::Pointer     m_Pipeline;
+  igtl::MultiThreader::Pointer m_Threader;
+  int                          m_ListenFd;
+  std::vector<EventLoop*>      m_Loops;
+  std::atomic<int>             m_Stop;
+  std::atomic<int>             m_NumberOfConnections;
+};
+
+#endif // defined(__linux__)
+
+#endif // __EpollServer_h
@@ -0,0 +1,206 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __MappedYUVSource_h
+#define __MappedYUVSource_h
+
+#include <string>
+#include <iostream>
+
+#if defined(_WIN32)
+  #include <windows.h>
+#else
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+#include "igtlObject.h"
+#include "igtlTypes.h"
+
+#define MAPPED_YUV_SOURCE_PAGE_SIZE 4096
+
+// A raw video file mapped into memory, YUV420 (I420) unless Open() is
+// given the bits per pixel of another format. Frames are addressed by
+// index and handed out as pointers into the mapping, so the encoder reads
+// the planes where they are instead of through a read() copy, and any
+// frame can be the first one streamed. A trailing partial frame is
+// ignored.
+class MappedYUVSource : public igtl::Object
+{
+public:
+  typedef MappedYUVSource                Self;
+  typedef igtl::Object                   Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(MappedYUVSource, igtl::Object);
+  igtlNewMacro(MappedYUVSource);
+
+  bool Open(const std::string& fileName, int width, int height, int bitsPerPixel = 12)
+  {
+    this->Close();
+    this->m_FrameSize = (igtlUint64) width * height * bitsPerPixel / 8;
+    if (this->m_FrameSize == 0)
+      {
+      return false;
+      }
+#if defined(_WIN32)
+    this->m_File = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (this->m_File == INVALID_HANDLE_VALUE)
+      {
+      std::cerr << "Cannot open " << fileName << std::endl;
+      return false;
+      }
+    LARGE_INTEGER size;
+    GetFileSizeEx(this->m_File, &size);
+    this->m_MappedSize = (igtlUint64) size.QuadPart;
+    if (this->m_MappedSize >= this->m_FrameSize)
+      {
+      this->m_Mapping = CreateFileMappingA(this->m_File, NULL, PAGE_READONLY, 0, 0, NULL);
+      if (this->m_Mapping != NULL)
+        {
+        this->m_Data = (unsigned char*) MapViewOfFile(this->m_Mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+      }
+#else
+    this->m_File = open(fileName.c_str(), O_RDONLY);
+    if (this->m_File < 0)
+      {
+      std::cerr << "Cannot open " << fileName << std::endl;
+      return false;
+      }
+    struct stat st;
+    fstat(this->m_File, &st);
+    this->m_MappedSize = (igtlUint64) st.st_size;
+    if (this->m_MappedSize >= this->m_FrameSize)
+      {
+      void* data = mmap(NULL, this->m_MappedSize, PROT_READ, MAP_SHARED, this->m_File, 0);
+      if (data != MAP_FAILED)
+        {
+        this->m_Data = (unsigned char*) data;
+        // The encoder walks the file front to back
+        madvise(data, this->m_MappedSize, MADV_SEQUENTIAL);
+        }
+      }
+#endif
+    if (this->m_Data == NULL)
+      {
+      std::cerr << "No complete frame in " << fileName << std::endl;
+      this->Close();
+      return false;
+      }
+    this->m_NumberOfFrames = this->m_MappedSize / this->m_FrameSize;
+    return true;
+  };
+
+  void Close()
+  {
+#if defined(_WIN32)
+    if (this->m_Data)
+      {
+      UnmapViewOfFile(this->m_Data);
+      }
+    if (this->m_Mapping)
+      {
+      CloseHandle(this->m_Mapping);
+      this->m_Mapping = NULL;
+      }
+    if (this->m_File != INVALID_HANDLE_VALUE)
+      {
+      CloseHandle(this->m_File);
+      this->m_File = INVALID_HANDLE_VALUE;
+      }
+#else
+    if (this->m_Data)
+      {
+      munmap(this->m_Data, this->m_MappedSize);
+      }
+    if (this->m_File >= 0)
+      {
+      close(this->m_File);
+      this->m_File = -1;
+      }
+#endif
+    this->m_Data = NULL;
+    this->m_MappedSize = 0;
+    this->m_NumberOfFrames = 0;
+  };
+
+  igtlUint64 GetNumberOfFrames() const { return this->m_NumberOfFrames; };
+  igtlUint64 GetFrameSize() const      { return this->m_FrameSize; };
+
+  // First byte of frame 'index'; for I420 the Y plane, followed by U and
+  // V. Valid until Close().
+  const unsigned char* GetFrame(igtlUint64 index) const
+  {
+    if (index >= this->m_NumberOfFrames)
+      {
+      return NULL;
+      }
+    return this->m_Data + index * this->m_FrameSize;
+  };
+
+  // Asks the kernel to read frame 'index' ahead and faults its pages in
+  // on the calling thread, so the encoder does not stall on the disk.
+  void Prefetch(igtlUint64 index) const
+  {
+    const unsigned char* frame = this->GetFrame(index);
+    if (frame == NULL)
+      {
+      return;
+      }
+#if !defined(_WIN32)
+    igtlUint64 offset = (igtlUint64) (frame - this->m_Data);
+    igtlUint64 start = offset & ~((igtlUint64) MAPPED_YUV_SOURCE_PAGE_SIZE - 1);
+    madvise(this->m_Data + start, (size_t) (offset + this->m_FrameSize - start), MADV_WILLNEED);
+#endif
+    volatile unsigned char sink = 0;
+    for (igtlUint64 i = 0; i < this->m_FrameSize; i += MAPPED_YUV_SOURCE_PAGE_SIZE)
+      {
+      sink ^= frame[i];
+      }
+    sink ^= frame[this->m_FrameSize - 1];
+  };
+
+protected:
+  MappedYUVSource()
+    : m_Data(NULL), m_MappedSize(0), m_FrameSize(0), m_NumberOfFrames(0)
+  {
+#if defined(_WIN32)
+    this->m_File = INVALID_HANDLE_VALUE;
+    this->m_Mapping = NULL;
+#else
+    this->m_File = -1;
+#endif
+  };
+  ~MappedYUVSource()
+  {
+    this->Close();
+  };
+
+#if defined(_WIN32)
+  HANDLE         m_File;
+  HANDLE         m_Mapping;
+#else
+  int            m_File;
+#endif
+  unsigned char* m_Data;
+  igtlUint64     m_MappedSize;
+  igtlUint64     m_FrameSize;
+  igtlUint64     m_NumberOfFrames;
+};
+
+#endif // __MappedYUVSource_h
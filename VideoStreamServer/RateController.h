@@ -0,0 +1,145 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __RateController_h
+#define __RateController_h
+
+#include <cstdio>
+
+#include "igtlTypes.h"
+
+#define RATE_CONTROLLER_DECREASE_HOLD_NS 500000000ULL   // 500 ms
+#define RATE_CONTROLLER_INCREASE_HOLD_NS 1000000000ULL  // 1 s
+
+// Keeps the time from encode to socket under a latency bound by steering
+// the encoder from the backpressure the senders see.
+//
+// Update() is called before each frame is encoded with the current send
+// delay of the slowest client and the rate at which its socket drains:
+//  - above twice the bound the frame is dropped before encoding, so the
+//    queues drain without adding more work to them;
+//  - above the bound the bitrate is cut to 70 %, or to 85 % of the drain
+//    rate if that is lower, at most once per hold-off so the encoder can
+//    react in between;
+//  - below half the bound for a second the bitrate is raised again by a
+//    twentieth of the maximum.
+// A bound of 0 disables the controller.
+class RateController
+{
+public:
+  RateController()
+    : m_LatencyBoundNs(0), m_MinBitrate(0), m_MaxBitrate(0), m_Bitrate(0),
+      m_LastChange(0), m_CalmSince(0), m_Decreases(0), m_Increases(0), m_Dropped(0)
+  {
+  };
+
+  void SetLatencyBoundNs(igtlUint64 bound) { this->m_LatencyBoundNs = bound; };
+  igtlUint64 GetLatencyBoundNs() const     { return this->m_LatencyBoundNs; };
+
+  // Bits per second. Starts again from 'max'.
+  void SetBitrateRange(int min, int max)
+  {
+    this->m_MinBitrate = min < max ? min : max;
+    this->m_MaxBitrate = max;
+    this->m_Bitrate = max;
+    this->m_LastChange = 0;
+    this->m_CalmSince = 0;
+  };
+  int GetBitrate() const                   { return this->m_Bitrate; };
+
+  // Returns false when the frame should be dropped. 'bitrateChanged' is
+  // set when GetBitrate() should be passed on to the encoder.
+  bool Update(igtlUint64 now, igtlUint64 delayNs, double drainBytesPerSec, bool& bitrateChanged)
+  {
+    bitrateChanged = false;
+    if (this->m_LatencyBoundNs == 0)
+      {
+      return true;
+      }
+
+    if (delayNs > this->m_LatencyBoundNs)
+      {
+      this->m_CalmSince = 0;
+      if (this->m_Bitrate > this->m_MinBitrate &&
+          now - this->m_LastChange > RATE_CONTROLLER_DECREASE_HOLD_NS)
+        {
+        double target = this->m_Bitrate * 0.7;
+        if (drainBytesPerSec > 0.0 && drainBytesPerSec * 8.0 * 0.85 < target)
+          {
+          target = drainBytesPerSec * 8.0 * 0.85;
+          }
+        this->m_Bitrate = target > this->m_MinBitrate ? (int) target : this->m_MinBitrate;
+        this->m_LastChange = now;
+        ++ this->m_Decreases;
+        bitrateChanged = true;
+        }
+      if (delayNs > 2 * this->m_LatencyBoundNs)
+        {
+        ++ this->m_Dropped;
+        return false;
+        }
+      return true;
+      }
+
+    if (delayNs < this->m_LatencyBoundNs / 2)
+      {
+      if (this->m_CalmSince == 0)
+        {
+        this->m_CalmSince = now;
+        }
+      else if (this->m_Bitrate < this->m_MaxBitrate &&
+               now - this->m_CalmSince > RATE_CONTROLLER_INCREASE_HOLD_NS)
+        {
+        int step = this->m_MaxBitrate / 20;
+        this->m_Bitrate = this->m_Bitrate + step < this->m_MaxBitrate ? this->m_Bitrate + step : this->m_MaxBitrate;
+        this->m_CalmSince = now;
+        this->m_LastChange = now;
+        ++ this->m_Increases;
+        bitrateChanged = true;
+        }
+      }
+    else
+      {
+      this->m_CalmSince = 0;
+      }
+    return true;
+  };
+
+  // Prints the adjustments made since the last call and starts over
+  void Report(FILE* fp)
+  {
+    if (this->m_LatencyBoundNs == 0)
+      {
+      return;
+      }
+    fprintf(fp, "Rate control: bound %.0f ms, bitrate %d bps, %lu decreases, %lu increases, %lu dropped\n",
+            this->m_LatencyBoundNs / 1e6, this->m_Bitrate,
+            this->m_Decreases, this->m_Increases, this->m_Dropped);
+    this->m_Decreases = 0;
+    this->m_Increases = 0;
+    this->m_Dropped = 0;
+  };
+
+protected:
+  igtlUint64    m_LatencyBoundNs;
+  int           m_MinBitrate;
+  int           m_MaxBitrate;
+  int           m_Bitrate;
+  igtlUint64    m_LastChange;
+  igtlUint64    m_CalmSince;
+  unsigned long m_Decreases;
+  unsigned long m_Increases;
+  unsigned long m_Dropped;
+};
+
+#endif // __RateController_h
@@ -0,0 +1,209 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __RawFrameReader_h
+#define __RawFrameReader_h
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "igtlObject.h"
+#include "igtlMultiThreader.h"
+
+#include "SPSCRingBuffer.h"
+#include "MappedYUVSource.h"
+#include "PixelFormatConverter.h"
+
+#define RAW_FRAME_READER_DEFAULT_QUEUE_DEPTH 4
+
+// One uncompressed I420 picture of the source file
+struct RawFrame
+{
+  const unsigned char*       m_Data;         // points into the mapped file, or into m_Picture
+  igtlUint64                 m_Index;        // frame index in the file
+  bool                       m_FirstOfPass;  // first frame streamed, or first after wrapping around
+  std::vector<unsigned char> m_Picture;      // the converted picture of a file that is not I420
+};
+
+// Feeds the encoder the frames of a memory-mapped YUV file, starting at
+// any frame and wrapping around at the end without reopening anything.
+// Frames are not copied: each RawFrame points into the mapping. A thread
+// of its own stays QueueDepth frames ahead of the encoder and faults their
+// pages in, so disk reads overlap with encoding. Frames come back through
+// Release() and are reused; nothing is allocated after Start().
+//
+// A file in another pixel format (SetPixelFormat()) is converted to I420
+// on the reader's thread, straight from the mapping into the picture
+// buffer of the frame, which the encoder then reads.
+class RawFrameReader : public igtl::Object
+{
+public:
+  typedef RawFrameReader                 Self;
+  typedef igtl::Object                   Superclass;
+  typedef igtl::SmartPointer<Self>       Pointer;
+  typedef igtl::SmartPointer<const Self> ConstPointer;
+
+  igtlTypeMacro(RawFrameReader, igtl::Object);
+  igtlNewMacro(RawFrameReader);
+
+  void SetFileName(const std::string& name) { this->m_FileName = name; };
+  void SetFrameDimensions(int width, int height)
+  {
+    this->m_Width = width;
+    this->m_Height = height;
+  };
+  // One of kPixelFormats; I420 in default
+  void SetPixelFormat(EVideoFormatType format) { this->m_PixelFormat = format; };
+  EVideoFormatType GetPixelFormat() const   { return this->m_PixelFormat; };
+  void SetQueueDepth(int depth)             { this->m_QueueDepth = depth > 0 ? depth : 1; };
+  int  GetQueueDepth() const                { return this->m_QueueDepth; };
+  // Index of the first frame to stream; taken modulo the frame count
+  void SetStartFrame(igtlUint64 index)      { this->m_StartFrame = index; };
+
+  MappedYUVSource* GetSource() const        { return this->m_Source; };
+
+  // Maps the file and starts the prefetch thread. Returns false if the
+  // file cannot be mapped or holds no complete frame, or for a pixel
+  // format or picture size that cannot be converted.
+  bool Start()
+  {
+    const PixelFormat* format = ::GetPixelFormat(this->m_PixelFormat);
+    bool convert = this->m_PixelFormat != videoFormatI420;
+    if (this->m_ThreadID >= 0 || format == NULL ||
+        (convert && ((this->m_Width & 1) || (this->m_Height & 1))) ||
+        !this->m_Source->Open(this->m_FileName, this->m_Width, this->m_Height, format->iBitsPerPixel))
+      {
+      return false;
+      }
+    // Either ring can hold every frame, so a push never fails
+    this->m_Ready = new SPSCRingBuffer<RawFrame>(this->m_QueueDepth);
+    this->m_Free  = new SPSCRingBuffer<RawFrame>(this->m_QueueDepth);
+    for (int i = 0; i < this->m_QueueDepth; i ++)
+      {
+      RawFrame* frame = new RawFrame();
+      frame->m_Data = NULL;
+      frame->m_Index = 0;
+      frame->m_FirstOfPass = false;
+      if (convert)
+        {
+        frame->m_Picture.resize((size_t) this->m_Width * this->m_Height * 3 / 2);
+        }
+      this->m_Frames.push_back(frame);
+      this->m_Free->Push(frame);
+      }
+    this->m_Stop = 0;
+    this->m_ThreadID = this->m_Threader->SpawnThread((igtl::ThreadFunctionType) &RawFrameReader::ReadThread, this);
+    return true;
+  };
+
+  // Returns the next frame, or NULL if none is ready yet. The frame must
+  // be handed back with Release() once it has been encoded.
+  RawFrame* Pop()
+  {
+    return this->m_Ready->Pop();
+  };
+
+  void Release(RawFrame* frame)
+  {
+    this->m_Free->Push(frame);
+  };
+
+  void Stop()
+  {
+    if (this->m_ThreadID < 0)
+      {
+      return;
+      }
+    this->m_Stop = 1;
+    this->m_Threader->TerminateThread(this->m_ThreadID);
+    this->m_ThreadID = -1;
+  };
+
+protected:
+  RawFrameReader()
+    : m_Width(0), m_Height(0), m_PixelFormat(videoFormatI420), m_QueueDepth(RAW_FRAME_READER_DEFAULT_QUEUE_DEPTH), m_StartFrame(0),
+      m_Ready(NULL), m_Free(NULL), m_ThreadID(-1), m_Stop(0)
+  {
+    this->m_Threader = igtl::MultiThreader::New();
+    this->m_Source = MappedYUVSource::New();
+  };
+  ~RawFrameReader()
+  {
+    this->Stop();
+    for (unsigned int i = 0; i < this->m_Frames.size(); i ++)
+      {
+      delete this->m_Frames[i];
+      }
+    delete this->m_Ready;
+    delete this->m_Free;
+  };
+
+  static void* ReadThread(void* ptr)
+  {
+    igtl::MultiThreader::ThreadInfo* info =
+      static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+    RawFrameReader* reader = static_cast<RawFrameReader*>(info->UserData);
+
+    MappedYUVSource* source = reader->m_Source;
+    igtlUint64 numberOfFrames = source->GetNumberOfFrames();
+    igtlUint64 index = reader->m_StartFrame % numberOfFrames;
+    bool firstOfPass = true;
+    RingBufferBackoff backoff;
+    while (!reader->m_Stop)
+      {
+      RawFrame* frame = reader->m_Free->Pop();
+      if (frame == NULL)
+        {
+        backoff.Wait();
+        continue;
+        }
+      backoff.Reset();
+      if (frame->m_Picture.empty())
+        {
+        source->Prefetch(index);
+        frame->m_Data = source->GetFrame(index);
+        }
+      else
+        {
+        // Converting reads the whole frame, which faults its pages in
+        ConvertToI420(reader->m_PixelFormat, source->GetFrame(index), 0, reader->m_Width, reader->m_Height,
+                      &frame->m_Picture[0]);
+        frame->m_Data = &frame->m_Picture[0];
+        }
+      frame->m_Index = index;
+      frame->m_FirstOfPass = firstOfPass;
+      reader->m_Ready->Push(frame);
+      // Wrap around without reopening or remapping anything
+      index = (index + 1) % numberOfFrames;
+      firstOfPass = index == 0;
+      }
+    return NULL;
+  };
+
+  std::string                  m_FileName;
+  int                          m_Width;
+  int                          m_Height;
+  EVideoFormatType             m_PixelFormat;
+  int                          m_QueueDepth;
+  igtlUint64                   m_StartFrame;
+  MappedYUVSource::Pointer     m_Source;
+  std::vector<RawFrame*>       m_Frames;
+  SPSCRingBuffer<RawFrame>*    m_Ready;  // reader -> encoder
+  SPSCRingBuffer<RawFrame>*    m_Free;   // encoder -> reader
+  igtl::MultiThreader::Pointer m_Threader;
+  int                          m_ThreadID;
+  std::atomic<int>             m_Stop;
+};
+
+#endif // __RawFrameReader_h
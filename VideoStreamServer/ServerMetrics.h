@@ -0,0 +1,59 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __ServerMetrics_h
+#define __ServerMetrics_h
+
+#include <string>
+
+#include "MetricsRegistry.h"
+
+// Live counters of one video source: its encoder and the sessions it
+// feeds. Sessions of the same source share them, so they add up to the
+// totals of the device.
+struct ServerMetrics
+{
+  MetricsCounter*   m_FramesEncoded;
+  MetricsCounter*   m_FramesSkipped;   // dropped before encoding by the pacer
+  MetricsCounter*   m_RateDrops;       // dropped before encoding by the rate controller
+  MetricsCounter*   m_EncodedBytes;
+  LatencyHistogram* m_EncodeTime;
+  MetricsGauge*     m_EncoderQP;
+  MetricsGauge*     m_EncoderBitrate;  // target of the rate controller
+  MetricsGauge*     m_Clients;
+  MetricsGauge*     m_QueuedFrames;    // over every session queue
+  MetricsCounter*   m_FramesSent;
+  MetricsCounter*   m_FramesDropped;   // from session queues
+  MetricsCounter*   m_SentBytes;
+  LatencyHistogram* m_SendTime;        // first to last byte of a frame
+};
+
+inline void RegisterServerMetrics(MetricsRegistry* registry, const std::string& device, ServerMetrics& m)
+{
+  std::string labels = MetricsRegistry::Label("device", device);
+  m.m_FramesEncoded  = registry->AddCounter("igtl_video_frames_encoded_total", labels, "Access units put out by the encoder.");
+  m.m_FramesSkipped  = registry->AddCounter("igtl_video_frames_skipped_total", labels, "Frames dropped before encoding because their slot had passed.");
+  m.m_RateDrops      = registry->AddCounter("igtl_video_frames_congestion_dropped_total", labels, "Frames dropped before encoding to let congested send queues drain.");
+  m.m_EncodedBytes   = registry->AddCounter("igtl_video_encoded_bytes_total", labels, "Bit stream bytes put out by the encoder.");
+  m.m_EncodeTime     = registry->AddSummary("igtl_video_encode_seconds", labels, "Time spent in the encoder per frame.");
+  m.m_EncoderQP      = registry->AddGauge("igtl_video_encoder_qp", labels, "Average QP of the last encoded frame.");
+  m.m_EncoderBitrate = registry->AddGauge("igtl_video_encoder_bitrate_bps", labels, "Bitrate the encoder is set to, in bits per second.");
+  m.m_Clients        = registry->AddGauge("igtl_video_clients", labels, "Connected receivers.");
+  m.m_QueuedFrames   = registry->AddGauge("igtl_video_send_queue_frames", labels, "Frames waiting in the send queues of all receivers.");
+  m.m_FramesSent     = registry->AddCounter("igtl_video_frames_sent_total", labels, "Frames written to receivers.");
+  m.m_FramesDropped  = registry->AddCounter("igtl_video_frames_dropped_total", labels, "Frames dropped from the send queues of slow receivers.");
+  m.m_SentBytes      = registry->AddCounter("igtl_video_sent_bytes_total", labels, "Bytes written to receivers, headers included.");
+  m.m_SendTime       = registry->AddSummary("igtl_video_send_seconds", labels, "Time a frame takes to be written to a receiver's socket.");
+}
+
+#endif // __ServerMetrics_h
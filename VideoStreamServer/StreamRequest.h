@@ -0,0 +1,66 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __StreamRequest_h
+#define __StreamRequest_h
+
+#include <cstdlib>
+#include <string>
+
+#include "ClientSession.h"
+#include "EncoderPipeline.h"
+#include "EncoderProfiles.h"
+
+// Splits the device name of a STT_VIDEO message, "<profile>[/<layer>]",
+// where <layer> is a spatial layer index or a bitrate in kbit/s such as
+// "800k". Returns the profile, or NULL if the name holds none.
+inline const EncoderProfile* ParseStreamRequest(const char* deviceName, int& layer, int& bitrate)
+{
+  layer = -1;
+  bitrate = 0;
+  std::string name(deviceName);
+  std::string::size_type slash = name.find('/');
+  if (slash != std::string::npos)
+    {
+    std::string request = name.substr(slash + 1);
+    name.erase(slash);
+    if (!request.empty() && (request[request.size() - 1] == 'k' || request[request.size() - 1] == 'K'))
+      {
+      bitrate = atoi(request.c_str()) * 1000;
+      }
+    else if (!request.empty())
+      {
+      layer = atoi(request.c_str());
+      }
+    }
+  return FindEncoderProfile(name.c_str());
+}
+
+// Starts streaming to a client as its STT_VIDEO message asks: the device
+// name may name an encoder profile and a layer, 'interval' is the time
+// between frames in ms.
+inline void SubscribeStreamRequest(EncoderPipeline* pipeline, ClientSession* session,
+                                   const char* deviceName, int interval)
+{
+  int layer = -1;
+  int bitrate = 0;
+  pipeline->SetProfile(ParseStreamRequest(deviceName, layer, bitrate), session);
+  session->SetLayerRequest(layer, bitrate);
+  session->SetRequestedInterval(interval);
+  session->SetTracing(pipeline->GetTracing());
+  session->SetMetrics(pipeline->GetMetrics());
+  session->Start();
+  pipeline->Subscribe(session, interval);
+}
+
+#endif // __StreamRequest_h
@@ -0,0 +1,114 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __VectoredSend_h
+#define __VectoredSend_h
+
+#include <cstddef>
+#include <cstring>
+
+#if !defined(_WIN32)
+  #include <sys/types.h>
+  #include <sys/socket.h>
+  #include <sys/uio.h>
+  #include <errno.h>
+#endif
+
+#include "igtlSocket.h"
+
+#define VECTORED_SEND_MAX_FRAGMENTS 64
+
+typedef struct {
+  const void* ptr;
+  size_t      size;
+} SendFragment;
+
+// igtl::Socket keeps its descriptor protected. A pointer to the member
+// formed through a derived class may be applied to any igtl::Socket.
+class SocketDescriptor : public igtl::Socket
+{
+public:
+  static int Get(igtl::Socket* socket)
+  {
+    return socket->*(&SocketDescriptor::m_SocketDescriptor);
+  };
+};
+
+// Writes all fragments to the socket with as few system calls as the
+// kernel allows (sendmsg with a gather list), resuming after partial
+// writes. Returns 1 on success and 0 on failure, like igtl::Socket::Send().
+inline int SendFragments(igtl::Socket* socket, const SendFragment* fragments, int n)
+{
+  if (n > VECTORED_SEND_MAX_FRAGMENTS)
+    {
+    return 0;
+    }
+#if defined(_WIN32)
+  for (int i = 0; i < n; i ++)
+    {
+    if (fragments[i].size > 0 && socket->Send(fragments[i].ptr, fragments[i].size) == 0)
+      {
+      return 0;
+      }
+    }
+  return 1;
+#else
+  int fd = SocketDescriptor::Get(socket);
+  if (fd < 0)
+    {
+    return 0;
+    }
+  struct iovec iov[VECTORED_SEND_MAX_FRAGMENTS];
+  for (int i = 0; i < n; i ++)
+    {
+    iov[i].iov_base = const_cast<void*>(fragments[i].ptr);
+    iov[i].iov_len  = fragments[i].size;
+    }
+
+  int first = 0;
+  while (first < n)
+    {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = &iov[first];
+    msg.msg_iovlen = n - first;
+    int flags = 0;
+#if defined(MSG_NOSIGNAL)
+    flags |= MSG_NOSIGNAL;
+#endif
+    ssize_t r = sendmsg(fd, &msg, flags);
+    if (r < 0)
+      {
+      if (errno == EINTR)
+        {
+        continue;
+        }
+      return 0;
+      }
+    // Skip what has gone out and trim a partially sent fragment
+    while (first < n && (size_t) r >= iov[first].iov_len)
+      {
+      r -= iov[first].iov_len;
+      ++ first;
+      }
+    if (first < n)
+      {
+      iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + r;
+      iov[first].iov_len -= r;
+      }
+    }
+  return 1;
+#endif
+}
+
+#endif // __VectoredSend_h
@@ -0,0 +1,95 @@
+/*=========================================================================
+
+  Program:   OpenIGTLink
+  Language:  C++
+
+  Copyright (c) Insight Software Consortium. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef __VideoFramePacker_h
+#define __VideoFramePacker_h
+
+#include <cstring>
+
+#include "igtl_header.h"
+#include "igtl_video.h"
+#include "igtl_util.h"
+#include "igtlVideoMessage.h"
+
+#define VIDEO_FRAME_HEADER_SIZE (IGTL_HEADER_SIZE + IGTL_VIDEO_HEADER_SIZE)
+
+// Builds the IGTL header and video header of a VIDEO message for a bit
+// stream that lives in its own buffer, so the bit stream never has to be
+// copied into a VideoMessage body before it is sent.
+//
+// Only the body size and the CRC change between frames of a stream. Both
+// headers are taken once from a VideoMessage packed without a bit stream
+// and patched per frame.
+class VideoFramePacker
+{
+public:
+  VideoFramePacker() : m_Initialized(false)
+  {
+    memset(this->m_Template, 0, sizeof(this->m_Template));
+  };
+
+  void Initialize(const char* deviceName, unsigned int width, unsigned int height)
+  {
+    igtl::VideoMessage::Pointer videoMsg;
+    videoMsg = igtl::VideoMessage::New();
+    videoMsg->SetDeviceName(deviceName);
+    videoMsg->SetBitStreamSize(0);
+    videoMsg->AllocateScalars();
+    videoMsg->SetScalarType(videoMsg->TYPE_UINT32);
+    videoMsg->SetEndian(igtl_is_little_endian()==true?2:1); //little endian is 2 big endian is 1
+    videoMsg->SetWidth(width);
+    videoMsg->SetHeight(height);
+    videoMsg->Pack();
+    memcpy(this->m_Template, videoMsg->GetPackFragmentPointer(0), IGTL_HEADER_SIZE);
+    memcpy(this->m_Template + IGTL_HEADER_SIZE, videoMsg->GetPackFragmentPointer(1), IGTL_VIDEO_HEADER_SIZE);
+    this->m_Initialized = true;
+  };
+
+  bool IsInitialized() const { return this->m_Initialized; };
+
+  // Starts a frame: the CRC covers the video header and then every byte
+  // of the bit stream, which is fed with Update() in sending order.
+  void Begin()
+  {
+    this->m_BodySize = IGTL_VIDEO_HEADER_SIZE;
+    this->m_CRC = crc64(0, 0, 0LL);
+    this->m_CRC = crc64(this->m_Template + IGTL_HEADER_SIZE, IGTL_VIDEO_HEADER_SIZE, this->m_CRC);
+  };
+
+  void Update(const unsigned char* data, igtl_uint64 size)
+  {
+    this->m_CRC = crc64(const_cast<unsigned char*>(data), size, this->m_CRC);
+    this->m_BodySize += size;
+  };
+
+  // Writes both headers (VIDEO_FRAME_HEADER_SIZE bytes) to 'header'.
+  void End(unsigned char* header)
+  {
+    igtl_header h;
+    memcpy(&h, this->m_Template, IGTL_HEADER_SIZE);
+    igtl_header_convert_byte_order(&h);
+    h.body_size = this->m_BodySize;
+    h.crc       = this->m_CRC;
+    igtl_header_convert_byte_order(&h);
+    memcpy(header, &h, IGTL_HEADER_SIZE);
+    memcpy(header + IGTL_HEADER_SIZE, this->m_Template + IGTL_HEADER_SIZE, IGTL_VIDEO_HEADER_SIZE);
+  };
+
+protected:
+  unsigned char m_Template[VIDEO_FRAME_HEADER_SIZE];
+  igtl_uint64   m_BodySize;
+  igtl_uint64   m_CRC;
+  bool          m_Initialized;
+};
+
+#endif // __VideoFramePacker_h
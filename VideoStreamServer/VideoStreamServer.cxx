@@ -13,11 +13,12 @@
 
 #include <fstream>
 #include <cstring>
+#include <list>
+#include <signal.h>
 #include <stdlib.h>
 #include "api/svc/codec_api.h"
 #include "api/svc/codec_def.h"
 #include "api/svc/codec_app_def.h"
-#include "utils/FileInputStream.h"
 #include "api/sha1.c"
 #include "igtl_header.h"
 #include "igtl_video.h"
@@ -29,22 +30,38 @@
 #include "igtlServerSocket.h"
 #include "igtlMultiThreader.h"
 
+#include "ClientSession.h"
+#include "EncoderPipeline.h"
+#include "EpollServer.h"
+#include "FramePacer.h"
+#include "KeyFrameRequest.h"
+#include "VideoDeviceNames.h"
+#include "PixelFormatConverter.h"
+#include "RateController.h"
+#include "RawFrameReader.h"
+#include "StreamRequest.h"
+#include "VideoFramePacker.h"
+
 #define IGTL_IMAGE_HEADER_SIZE          72
+#define DEFAULT_MAX_LATENCY_MS          200
 
-void* ThreadFunction(void* ptr);
-int   SendVideoData(igtl::Socket::Pointer& socket, igtl::VideoMessage::Pointer& videoMsg);
+#if defined(__linux__)
+static volatile sig_atomic_t stopRequested = 0;
+static void OnStopSignal(int)
+{
+  stopRequested = 1;
+}
+#else
+void* ControlThread(void* ptr);
 
 typedef struct {
-  int   nloop;
-  igtl::MutexLock::Pointer glock;
   igtl::Socket::Pointer socket;
-  int   interval;
-  int   stop;
-  unsigned int width;
-  unsigned int height;
-} ThreadData;
-
-std::string     videoFile = "";
+  ClientSession::Pointer session;
+  EncoderPipeline::Pointer pipeline;
+  int   threadID;
+  int   finished;
+} ConnectionData;
+#endif
 
 int main(int argc, char* argv[])
 {
@@ -52,21 +69,206 @@ int main(int argc, char* argv[])
   //------------------------------------------------------------
   // Parse Arguments
 
-  if (argc != 5) // check number of arguments
+  if (argc < 5) // check number of arguments
     {
     // If not correct, print usage
-    std::cerr << "Usage: " << argv[0] << " <port>"    << std::endl;
+    std::cerr << "Usage: " << argv[0] << " <port> <VideoFile> <Width> <Height> [options]"    << std::endl;
     std::cerr << "    <port>     : Port # (18944 in default)"   << std::endl;
     std::cerr << "    <VideoFile>     : the name of the video with full directory "   << std::endl;
     std::cerr << "    <Width>     : Width of the frame"   << std::endl;
     std::cerr << "    <Height>    : Height of the frame"   << std::endl;
+    std::cerr << "    --pixel-format <name>    : Pixel format of <VideoFile>, converted to I420 for the encoder (i420 in"
+              << " default):" << std::endl;
+    for (int i = 0; i < kNumberOfPixelFormats; i ++)
+      {
+      std::cerr << "                               " << kPixelFormats[i].pkcName << " (" << kPixelFormats[i].pkcLayout << ")"
+                << std::endl;
+      }
+    std::cerr << "    --pacing <catch-up|skip> : What to do when encoding falls behind (catch-up in default)" << std::endl;
+    std::cerr << "    --start-frame <n>        : Index of the first frame to stream (0 in default)" << std::endl;
+    std::cerr << "    --slices                 : Send every slice as a message of its own, decoded as it arrives" << std::endl;
+    std::cerr << "    --io-threads <n>         : Threads serving all client sockets on Linux (" << EPOLL_SERVER_DEFAULT_LOOPS
+              << " in default)" << std::endl;
+    std::cerr << "    --device <name>          : Device name of the video messages (" << VIDEO_DEVICE_NAME
+              << " in default), to tell several sources apart" << std::endl;
+    std::cerr << "    --min-idr-interval <ms>  : Shortest time between two key frames forced for clients ("
+              << ENCODER_PIPELINE_DEFAULT_IDR_INTERVAL << " in default)" << std::endl;
+    std::cerr << "    --trace                  : Send the capture, encode and send times of every frame, for the receiver's"
+              << " latency trace" << std::endl;
+    std::cerr << "    --record <file>          : Encode the video file once into the access unit file <file> and exit" << std::endl;
+    std::cerr << "    --replay                 : <VideoFile> is an access unit file made with --record; stream it without"
+              << " encoding (<Width> and <Height> are not used)" << std::endl;
+    std::cerr << "    --metrics <file>         : Write the live counters to file in the Prometheus text format" << std::endl;
+    std::cerr << "    --metrics-interval <ms>  : How often the counters file is rewritten (" << METRICS_DEFAULT_INTERVAL_MS
+              << " in default)" << std::endl;
+    std::cerr << "    --max-latency <ms>       : Lower the bitrate and drop frames to keep the send delay under ms; 0 disables ("
+              << DEFAULT_MAX_LATENCY_MS << " in default)" << std::endl;
+    std::cerr << "    --threads <n>            : Encoder threads for every profile (the profile's in default;"
+              << " high-resolution uses one per core and a slice per thread)" << std::endl;
+    std::cerr << "    --profile <name>         : Encoder settings (" << GetDefaultEncoderProfile()->pkcName << " in default):" << std::endl;
+    for (int i = 0; i < kNumberOfEncoderProfiles; i ++)
+      {
+      std::cerr << "                               " << kEncoderProfiles[i].pkcName << std::endl;
+      }
     exit(0);
     }
 
   int    port     = atoi(argv[1]);
-  videoFile = argv[2];
+  std::string videoFile = argv[2];
   int width = atoi(argv[3]);
   int height = atoi(argv[4]);
+  FramePacer::Policy pacing = FramePacer::CATCH_UP;
+  igtlUint64 startFrame = 0;
+  int maxLatency = DEFAULT_MAX_LATENCY_MS;
+  int minIDRInterval = ENCODER_PIPELINE_DEFAULT_IDR_INTERVAL;
+  bool sliceStreaming = false;
+  bool tracing = false;
+  std::string metricsFile;
+  std::string recordFile;
+  bool replay = false;
+  int metricsInterval = METRICS_DEFAULT_INTERVAL_MS;
+  std::string deviceName = VIDEO_DEVICE_NAME;
+  int ioThreads = EPOLL_SERVER_DEFAULT_LOOPS;
+  int encoderThreads = 0;
+  const EncoderProfile* profile = GetDefaultEncoderProfile();
+  const PixelFormat* pixelFormat = FindPixelFormat("i420");
+  for (int i = 5; i < argc; i ++)
+    {
+    if (strcmp(argv[i], "--pacing") == 0 && i + 1 < argc && FramePacer::ParsePolicy(argv[i + 1], pacing))
+      {
+      ++ i;
+      }
+    else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc && FindEncoderProfile(argv[i + 1]))
+      {
+      profile = FindEncoderProfile(argv[++ i]);
+      }
+    else if (strcmp(argv[i], "--pixel-format") == 0 && i + 1 < argc && FindPixelFormat(argv[i + 1]))
+      {
+      pixelFormat = FindPixelFormat(argv[++ i]);
+      }
+    else if (strcmp(argv[i], "--max-latency") == 0 && i + 1 < argc)
+      {
+      maxLatency = atoi(argv[++ i]);
+      }
+    else if (strcmp(argv[i], "--slices") == 0)
+      {
+      sliceStreaming = true;
+      }
+    else if (strcmp(argv[i], "--trace") == 0)
+      {
+      tracing = true;
+      }
+    else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+      {
+      recordFile = argv[++ i];
+      }
+    else if (strcmp(argv[i], "--replay") == 0)
+      {
+      replay = true;
+      }
+    else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc)
+      {
+      metricsFile = argv[++ i];
+      }
+    else if (strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < argc)
+      {
+      metricsInterval = atoi(argv[++ i]);
+      }
+    else if (strcmp(argv[i], "--io-threads") == 0 && i + 1 < argc)
+      {
+      ioThreads = atoi(argv[++ i]);
+      }
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+      {
+      encoderThreads = atoi(argv[++ i]);
+      }
+    else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc)
+      {
+      deviceName = argv[++ i];
+      }
+    else if (strcmp(argv[i], "--min-idr-interval") == 0 && i + 1 < argc)
+      {
+      minIDRInterval = atoi(argv[++ i]);
+      }
+    else if (strcmp(argv[i], "--start-frame") == 0 && i + 1 < argc)
+      {
+      startFrame = strtoull(argv[++ i], NULL, 10);
+      }
+    else
+      {
+      std::cerr << "Unknown option: " << argv[i] << std::endl;
+      exit(0);
+      }
+    }
+  if (!IsValidVideoDeviceName(deviceName.c_str(), sliceStreaming))
+    {
+    std::cerr << "Invalid device name: " << deviceName << ". It must have 1 to "
+              << IGTL_HEADER_NAME_SIZE - (sliceStreaming ? sizeof(VIDEO_SLICE_SUFFIX) - 1 : 0)
+              << " characters and must not end in \"" << VIDEO_SLICE_SUFFIX << "\"." << std::endl;
+    exit(0);
+    }
+  if (pixelFormat->eFormat != videoFormatI420 && ((width & 1) || (height & 1)))
+    {
+    std::cerr << "Converting from " << pixelFormat->pkcName << " needs an even width and height." << std::endl;
+    exit(0);
+    }
+  // Every client watches the same source, so they all share one encoder.
+  EncoderPipeline::Pointer pipeline = EncoderPipeline::New();
+  pipeline->SetVideoFile(videoFile);
+  pipeline->SetWidth(width);
+  pipeline->SetHeight(height);
+  pipeline->SetPixelFormat(pixelFormat->eFormat);
+  pipeline->SetPacingPolicy(pacing);
+  pipeline->SetStartFrame(startFrame);
+  pipeline->SetMaxLatency(maxLatency);
+  pipeline->SetMinIDRInterval(minIDRInterval);
+  pipeline->SetSliceStreaming(sliceStreaming);
+  pipeline->SetTracing(tracing);
+  pipeline->SetDeviceName(deviceName);
+  pipeline->SetProfile(profile);
+  pipeline->SetEncoderThreads(encoderThreads);
+  if (!recordFile.empty())
+    {
+    return pipeline->Record(recordFile) ? 0 : 1;
+    }
+  if (replay && !pipeline->SetReplayFile(videoFile))
+    {
+    exit(0);
+    }
+  MetricsRegistry::Pointer metrics = MetricsRegistry::New();
+  if (!metricsFile.empty())
+    {
+    pipeline->SetMetrics(metrics);
+    metrics->SetFileName(metricsFile);
+    metrics->SetInterval(metricsInterval);
+    metrics->Start();
+    }
+
+#if defined(__linux__)
+  // A few epoll loops serve every client; the process runs until it is
+  // interrupted and then closes the connections in order.
+  EpollServer::Pointer server = EpollServer::New();
+  server->SetPort(port);
+  server->SetNumberOfLoops(ioThreads);
+  server->SetPipeline(pipeline);
+  if (!server->Start())
+    {
+    std::cerr << "Cannot create a server socket." << std::endl;
+    exit(0);
+    }
+  signal(SIGINT, &OnStopSignal);
+  signal(SIGTERM, &OnStopSignal);
+  signal(SIGPIPE, SIG_IGN);
+  while (!stopRequested)
+    {
+    igtl::Sleep(200);
+    }
+  std::cerr << "Shutting down." << std::endl;
+  server->Stop();
+  metrics->Stop();
+#else
+  // A thread per client here
+  (void) ioThreads;
   igtl::ServerSocket::Pointer serverSocket;
   serverSocket = igtl::ServerSocket::New();
   int r = serverSocket->CreateServer(port);
@@ -78,164 +280,154 @@ int main(int argc, char* argv[])
   }
 
   igtl::MultiThreader::Pointer threader = igtl::MultiThreader::New();
-  igtl::MutexLock::Pointer glock = igtl::MutexLock::New();
-  ThreadData td;
+  std::list<ConnectionData*> connections;
 
   while (1)
     {
+    //------------------------------------------------------------
+    // Reap the control threads of clients that have left
+    for (std::list<ConnectionData*>::iterator it = connections.begin(); it != connections.end();)
+      {
+      if ((*it)->finished)
+        {
+        threader->TerminateThread((*it)->threadID);
+        delete *it;
+        it = connections.erase(it);
+        }
+      else
+        {
+        ++ it;
+        }
+      }
+
     //------------------------------------------------------------
     // Waiting for Connection
-    int threadID = -1;
     igtl::Socket::Pointer socket;
     socket = serverSocket->WaitForConnection(1000);
     
     if (socket.IsNotNull()) // if client connected
       {
       std::cerr << "A client is connected." << std::endl;
-
-      // Create a message buffer to receive header
-      igtl::MessageHeader::Pointer headerMsg;
-      headerMsg = igtl::MessageHeader::New();
-      //------------------------------------------------------------
-      // loop
-      for (;;)
-        {
-        // Initialize receive buffer
-        headerMsg->InitPack();
-
-        // Receive generic header from the socket
-        int rs = socket->Receive(headerMsg->GetPackPointer(), headerMsg->GetPackSize());
-        if (rs == 0)
-          {
-          if (threadID >= 0)
-            {
-            td.stop = 1;
-            threader->TerminateThread(threadID);
-            threadID = -1;
-            }
-          std::cerr << "Disconnecting the client." << std::endl;
-          td.socket = NULL;  // VERY IMPORTANT. Completely remove the instance.
-          socket->CloseSocket();
-          break;
-          }
-        if (rs != headerMsg->GetPackSize())
-          {
-          continue;
-          }
-
-        // Deserialize the header
-        headerMsg->Unpack();
-
-        // Check data type and receive data body
-        if (strcmp(headerMsg->GetDeviceType(), "STT_VIDEO") == 0)
-          {
-          std::cerr << "Received a STT_VIDEO message." << std::endl;
-        
-          igtl::StartVideoDataMessage::Pointer startVideoMsg;
-          startVideoMsg = igtl::StartVideoDataMessage::New();
-          startVideoMsg->SetMessageHeader(headerMsg);
-          startVideoMsg->AllocatePack();
-        
-          socket->Receive(startVideoMsg->GetPackBodyPointer(), startVideoMsg->GetPackBodySize());
-          int c = startVideoMsg->Unpack(1);
-          if (c & igtl::MessageHeader::UNPACK_BODY) // if CRC check is OK
-            {
-              td.interval = startVideoMsg->GetTimeInterval();
-              td.glock    = glock;
-              td.socket   = socket;
-              td.stop     = 0;
-              td.width    = width;
-              td.height    = height;
-              threadID    = threader->SpawnThread((igtl::ThreadFunctionType) &ThreadFunction, &td);
-            }
-          }
-        else if (strcmp(headerMsg->GetDeviceType(), "STP_VIDEO") == 0)
-          {
-          socket->Skip(headerMsg->GetBodySizeToRead(), 0);
-          std::cerr << "Received a STP_VIDEO message." << std::endl;
-          if (threadID >= 0)
-            {
-              td.stop  = 1;
-              threader->TerminateThread(threadID);
-              threadID = -1;
-              std::cerr << "Disconnecting the client." << std::endl;
-              td.socket = NULL;  // VERY IMPORTANT. Completely remove the instance.
-              socket->CloseSocket();
-            }
-          break;
-          }
-        else
-          {
-          std::cerr << "Receiving : " << headerMsg->GetDeviceType() << std::endl;
-          socket->Skip(headerMsg->GetBodySizeToRead(), 0);
-          }
-        }
+      ConnectionData* cd = new ConnectionData;
+      cd->socket   = socket;
+      cd->session  = ClientSession::New();
+      cd->session->SetSocket(socket);
+      cd->pipeline = pipeline;
+      cd->finished = 0;
+      cd->threadID = threader->SpawnThread((igtl::ThreadFunctionType) &ControlThread, cd);
+      connections.push_back(cd);
       }
     }
     
   //------------------------------------------------------------
   // Close connection (The example code never reaches to this section ...)
   serverSocket->CloseSocket();
+#endif
 
 }
 
 
-struct EncodeFileParam {
-  const char* pkcHashStr;
-  EUsageType eUsageType;
-  float fFrameRate;
-  SliceModeEnum eSliceMode;
-  bool bDenoise;
-  int  iLayerNum;
-  bool bLossless;
-  bool bEnableLtr;
-  bool bCabac;
-  int iTargetBitrate;
-};
-
-void EncFileParamToParamExt (EncodeFileParam* pEncFileParam, SEncParamExt* pEnxParamExt) {
-  pEnxParamExt->iUsageType       = pEncFileParam->eUsageType;
-  pEnxParamExt->fMaxFrameRate    = pEncFileParam->fFrameRate;
-  
-  pEnxParamExt->bEnableDenoise   = pEncFileParam->bDenoise;
-  pEnxParamExt->iSpatialLayerNum = pEncFileParam->iLayerNum;
-
-  pEnxParamExt->bIsLosslessLink  = pEncFileParam->bLossless;
-  if (pEnxParamExt->bIsLosslessLink)
-  {
-    pEnxParamExt->iMaxQp = 0;
-    pEnxParamExt->iMinQp = 0;
-    pEnxParamExt->iRCMode = RC_OFF_MODE;
-    pEnxParamExt->bEnableAdaptiveQuant = false;
-  }
-  pEnxParamExt->bEnableLongTermReference = pEncFileParam->bEnableLtr;
-  pEnxParamExt->iEntropyCodingModeFlag   = pEncFileParam->bCabac ? 1 : 0;
-  pEnxParamExt->iTargetBitrate = pEncFileParam->iTargetBitrate;
-  pEnxParamExt->uiMaxNalSize = 1500;
-  pEnxParamExt->iNumRefFrame = AUTO_REF_PIC_COUNT;
-  if (pEncFileParam->eSliceMode != SM_SINGLE_SLICE && pEncFileParam->eSliceMode != SM_SIZELIMITED_SLICE) //SM_DYN_SLICE don't support multi-thread now
-    pEnxParamExt->iMultipleThreadIdc = 4;
-  
-  for (int i = 0; i < pEnxParamExt->iSpatialLayerNum; i++) {
-    pEnxParamExt->sSpatialLayers[i].bFullRange = 1;
-    pEnxParamExt->sSpatialLayers[i].fFrameRate      = pEncFileParam->fFrameRate;
-    pEnxParamExt->sSpatialLayers[i].iSpatialBitrate = pEncFileParam->iTargetBitrate;
-    pEnxParamExt->sSpatialLayers[i].sSliceArgument.uiSliceMode = pEncFileParam->eSliceMode;
-    pEnxParamExt->sSpatialLayers[i].sSliceArgument.uiSliceNum = 5;
-    if (pEncFileParam->eSliceMode == SM_SIZELIMITED_SLICE) {
-      pEnxParamExt->sSpatialLayers[i].sSliceArgument.uiSliceSizeConstraint = 1500;
-      pEnxParamExt->bUseLoadBalancing = false;
+#if !defined(__linux__)
+//------------------------------------------------------------
+// Handles the control messages of one client. The accept loop keeps
+// running while clients are connected.
+void* ControlThread(void* ptr)
+{
+  igtl::MultiThreader::ThreadInfo* info =
+    static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+  ConnectionData* cd = static_cast<ConnectionData*>(info->UserData);
+  igtl::Socket::Pointer& socket = cd->socket;
+  ClientSession::Pointer& session = cd->session;
+  bool subscribed = false;
+
+  // Create a message buffer to receive header
+  igtl::MessageHeader::Pointer headerMsg;
+  headerMsg = igtl::MessageHeader::New();
+  //------------------------------------------------------------
+  // loop
+  for (;;)
+    {
+    // Initialize receive buffer
+    headerMsg->InitPack();
+
+    // Receive generic header from the socket
+    int rs = socket->Receive(headerMsg->GetPackPointer(), headerMsg->GetPackSize());
+    if (rs == 0)
+      {
+      std::cerr << "Disconnecting the client." << std::endl;
+      break;
+      }
+    if (rs != headerMsg->GetPackSize())
+      {
+      continue;
+      }
+
+    // Deserialize the header
+    headerMsg->Unpack();
+
+    // Check data type and receive data body
+    if (strcmp(headerMsg->GetDeviceType(), "STT_VIDEO") == 0)
+      {
+      std::cerr << "Received a STT_VIDEO message." << std::endl;
+    
+      igtl::StartVideoDataMessage::Pointer startVideoMsg;
+      startVideoMsg = igtl::StartVideoDataMessage::New();
+      startVideoMsg->SetMessageHeader(headerMsg);
+      startVideoMsg->AllocatePack();
+    
+      socket->Receive(startVideoMsg->GetPackBodyPointer(), startVideoMsg->GetPackBodySize());
+      int c = startVideoMsg->Unpack(1);
+      if ((c & igtl::MessageHeader::UNPACK_BODY) && !subscribed) // if CRC check is OK
+        {
+        SubscribeStreamRequest(cd->pipeline, session, startVideoMsg->GetDeviceName(),
+                               startVideoMsg->GetTimeInterval());
+        subscribed = true;
+        }
+      }
+    else if (strcmp(headerMsg->GetDeviceType(), KEY_FRAME_REQUEST_TYPE) == 0)
+      {
+      socket->Skip(headerMsg->GetBodySizeToRead(), 0);
+      cd->pipeline->RequestKeyFrame();
+      }
+    else if (strcmp(headerMsg->GetDeviceType(), "STP_VIDEO") == 0)
+      {
+      socket->Skip(headerMsg->GetBodySizeToRead(), 0);
+      std::cerr << "Received a STP_VIDEO message." << std::endl;
+      std::cerr << "Disconnecting the client." << std::endl;
+      break;
+      }
+    else
+      {
+      std::cerr << "Receiving : " << headerMsg->GetDeviceType() << std::endl;
+      socket->Skip(headerMsg->GetBodySizeToRead(), 0);
+      }
+    }
+
+  if (subscribed)
+    {
+    cd->pipeline->Unsubscribe(session);
     }
+  session->Stop();
+  socket->CloseSocket();
+  cd->finished = 1;
+  return NULL;
+}
+#endif
+
+
+// Packers per spatial layer, since the picture size is in the headers:
+// one for whole access units and last slices, one for the other slices
+static void InitializePackers (VideoFramePacker* packers, VideoFramePacker* slicePackers,
+                               const SEncParamExt& pEncParamExt, const std::string& deviceName) {
+  std::string sliceDeviceName = deviceName + VIDEO_SLICE_SUFFIX;
+  for (int i = 0; i < pEncParamExt.iSpatialLayerNum; i++) {
+    packers[i].Initialize(deviceName.c_str(), pEncParamExt.sSpatialLayers[i].iVideoWidth,
+                          pEncParamExt.sSpatialLayers[i].iVideoHeight);
+    slicePackers[i].Initialize(sliceDeviceName.c_str(), pEncParamExt.sSpatialLayers[i].iVideoWidth,
+                               pEncParamExt.sSpatialLayers[i].iVideoHeight);
   }
-  pEnxParamExt->iTargetBitrate *= pEnxParamExt->iSpatialLayerNum;
-  pEnxParamExt->bEnableFrameSkip = true;
 }
 
-static EncodeFileParam kFileParamArray =
-{
-  "dfd4666f9b90d5d77647454e2a06d546adac6a7c", CAMERA_VIDEO_REAL_TIME, 5.0f, SM_SINGLE_SLICE, false, 1, true, false, true, 5000000
-};
-
 static bool CompareHash (const unsigned char* digest, const char* hashStr) {
   char hashStrCmp[SHA_DIGEST_LENGTH * 2 + 1];
   for (int i = 0; i < SHA_DIGEST_LENGTH; ++i) {
@@ -260,7 +452,7 @@ static void UpdateHashFromFrame (SFrameBSInfo& info, SHA1Context* ctx) {
   }
 }
 
-void* ThreadFunction(void* ptr)
+void* EncoderPipeline::EncodeThread(void* ptr)
 {
   //------------------------------------------------------------
   // Get thread information
@@ -269,15 +461,7 @@ void* ThreadFunction(void* ptr)
 
   //int id      = info->ThreadID;
   //int nThread = info->NumberOfThreads;
-  ThreadData* td = static_cast<ThreadData*>(info->UserData);
-
-  //------------------------------------------------------------
-  // Get user data
-  igtl::MutexLock::Pointer glock = td->glock;
-  long interval = td->interval;
-  std::cerr << "Interval = " << interval << " (ms)" << std::endl;
-
-  igtl::Socket::Pointer& socket = td->socket;
+  EncoderPipeline* pipeline = static_cast<EncoderPipeline*>(info->UserData);
 
   //------------------------------------------------------------
   // Allocate TrackingData Message Class
@@ -291,96 +475,294 @@ void* ThreadFunction(void* ptr)
   if (rv == 0 && encoder_ != NULL)
   {
     SEncParamExt pEncParamExt;
-    memset (&pEncParamExt, 0, sizeof (SEncParamExt));
-    EncFileParamToParamExt (&kFileParamArray, &pEncParamExt);
-    pEncParamExt.iPicWidth = td->width;
-    pEncParamExt.iPicHeight = td->height;
-    for (int i = 0; i < pEncParamExt.iSpatialLayerNum; i++) {
-      pEncParamExt.sSpatialLayers[i].iVideoWidth     = pEncParamExt.iPicWidth;
-      pEncParamExt.sSpatialLayers[i].iVideoHeight    = pEncParamExt.iPicWidth;
+    ClientSession::Pointer requester;
+    pipeline->TakeProfileChange(requester);
+    const EncoderProfile* profile = pipeline->GetProfile();
+    bool encoderReady = InitializeEncoder (encoder_, profile, pipeline->m_Width, pipeline->m_Height, pEncParamExt,
+                                           pipeline->m_EncoderThreads);
+    if (!encoderReady)
+    {
+      std::cerr << "The encoder refused profile " << profile->pkcName << "." << std::endl;
+      if (requester.IsNotNull())
+      {
+        requester->SendError(profile->pkcName);
+      }
     }
-    encoder_->InitializeExt(&pEncParamExt);
-    int videoFormat = videoFormatI420;
-    encoder_->SetOption (ENCODER_OPTION_DATAFORMAT, &videoFormat);
-    std::string fileName = videoFile;// + "/" + (std::string) kFileParamArray.pkcFileName;
-    while (!td->stop)
+    requester = NULL;
+    std::cerr << "Encoder profile: " << profile->pkcName << " (" << pEncParamExt.iMultipleThreadIdc << " threads)" << std::endl;
+    VideoFramePacker packers[MAX_SPATIAL_LAYER_NUM];
+    VideoFramePacker slicePackers[MAX_SPATIAL_LAYER_NUM];
+    InitializePackers (packers, slicePackers, pEncParamExt, pipeline->GetDeviceName());
+    bool sliceStreaming = pipeline->GetSliceStreaming();
+    std::vector<int> packetEnds;
+    unsigned int uiFrameCount = 0;
+
+    // Raw frames are prefetched on the reader's thread, and the client
+    // sessions send on theirs; this thread only encodes. Frame N+1 is
+    // encoded while frame N is on the wire, so the frame period is the
+    // interval rather than interval + read + encode + send.
+    RawFrameReader::Pointer reader = RawFrameReader::New();
+    reader->SetFileName(pipeline->m_VideoFile);
+    reader->SetFrameDimensions(pEncParamExt.iPicWidth, pEncParamExt.iPicHeight);
+    reader->SetPixelFormat(pipeline->m_PixelFormat);
+    reader->SetStartFrame(pipeline->m_StartFrame);
+    bool sourceReady = reader->Start();
+
+    SFrameBSInfo info;
+    memset (&info, 0, sizeof (SFrameBSInfo));
+    SSourcePicture pic;
+    memset (&pic, 0, sizeof (SSourcePicture));
+    pic.iPicWidth    = pEncParamExt.iPicWidth;
+    pic.iPicHeight   = pEncParamExt.iPicHeight;
+    pic.iColorFormat = videoFormatI420;
+    pic.iStride[0]   = pic.iPicWidth;
+    pic.iStride[1]   = pic.iStride[2] = pic.iPicWidth >> 1;
+    SHA1Context ctx;
+    memset (&ctx, 0, sizeof(SHA1Context));
+    FramePacer pacer;
+    pacer.SetPolicy(pipeline->GetPacingPolicy());
+    // The bitrate may fall to a tenth of the profile's target
+    RateController rate;
+    rate.SetLatencyBoundNs((igtlUint64) pipeline->GetMaxLatency() * 1000000ULL);
+    rate.SetBitrateRange(pEncParamExt.iTargetBitrate / 10, pEncParamExt.iTargetBitrate);
+    RingBufferBackoff backoff;
+    ServerMetrics* metrics = pipeline->GetMetrics();
+    // Recording runs one pass as fast as the encoder goes
+    bool recording = pipeline->m_Recorder.IsNotNull();
+    SEncoderStatistics statistics;
+    while (encoderReady && sourceReady && !pipeline->m_Stop)
     {
-      FileInputStream fileStream;
-      fileStream.Open(fileName.c_str());
-      int frameSize = pEncParamExt.iPicWidth * pEncParamExt.iPicHeight * 3 / 2;
-      
-      unsigned char*  buf = NULL;
-      buf = static_cast<unsigned char*> (realloc (buf, 2*frameSize));// Ensure the capacity
-      SFrameBSInfo info;
-      memset (&info, 0, sizeof (SFrameBSInfo));
-      SSourcePicture pic;
-      memset (&pic, 0, sizeof (SSourcePicture));
-      SHA1Context ctx;
-      memset (&ctx, 0, sizeof(SHA1Context));
-      pic.iPicWidth    = pEncParamExt.iPicWidth;
-      pic.iPicHeight   = pEncParamExt.iPicHeight;
-      pic.iColorFormat = videoFormatI420;
-      pic.iStride[0]   = pic.iPicWidth;
-      pic.iStride[1]   = pic.iStride[2] = pic.iPicWidth >> 1;
-      pic.pData[0]     = buf;
+      RawFrame* raw = reader->Pop();
+      if (raw == NULL)
+      {
+        backoff.Wait();
+        continue;
+      }
+      backoff.Reset();
+      // The picture is "captured" when the encoder takes it
+      igtlUint64 captureTime = MonotonicTimeNs();
+
+      if (raw->m_FirstOfPass && uiFrameCount > 0 && recording)
+      {
+        reader->Release(raw);
+        break;
+      }
+      if (raw->m_FirstOfPass && uiFrameCount > 0)
+      {
+        //------------------------------------------------------------
+        // Loop
+        unsigned char digest[SHA_DIGEST_LENGTH];
+        SHA1Result(&ctx, digest);
+        if (profile->pkcHashStr)
+        {
+          CompareHash (digest, profile->pkcHashStr);
+        }
+        memset (&ctx, 0, sizeof(SHA1Context));
+        // Stays constant once every frame size class has been seen
+        std::cerr << "Frames: " << uiFrameCount
+                  << "  pool allocations: " << pipeline->GetBufferPool()->GetNumberOfAllocations() << std::endl;
+        pacer.Report(stderr);
+        rate.Report(stderr);
+      }
+
+      // A client asked for other settings; the new sequence starts with
+      // an IDR, so every subscriber can switch over right away
+      const EncoderProfile* newProfile = pipeline->TakeProfileChange(requester);
+      if (newProfile)
+      {
+        encoder_->Uninitialize();
+        if (InitializeEncoder (encoder_, newProfile, pipeline->m_Width, pipeline->m_Height, pEncParamExt,
+                               pipeline->m_EncoderThreads))
+        {
+          profile = newProfile;
+        }
+        else
+        {
+          // Back to the settings that worked; the client that asked is
+          // told, the others never see the difference
+          std::cerr << "The encoder refused profile " << newProfile->pkcName << "; keeping " << profile->pkcName
+                    << "." << std::endl;
+          pipeline->RevertProfile(profile);
+          if (requester.IsNotNull())
+          {
+            requester->SendError(newProfile->pkcName);
+          }
+          encoder_->Uninitialize();
+          if (!InitializeEncoder (encoder_, profile, pipeline->m_Width, pipeline->m_Height, pEncParamExt,
+                                  pipeline->m_EncoderThreads))
+          {
+            std::cerr << "The encoder refused profile " << profile->pkcName << " too." << std::endl;
+            reader->Release(raw);
+            break;
+          }
+        }
+        requester = NULL;
+        InitializePackers (packers, slicePackers, pEncParamExt, pipeline->GetDeviceName());
+        memset (&ctx, 0, sizeof(SHA1Context));
+        rate.SetBitrateRange(pEncParamExt.iTargetBitrate / 10, pEncParamExt.iTargetBitrate);
+        std::cerr << "Encoder profile: " << profile->pkcName << " (" << pEncParamExt.iMultipleThreadIdc << " threads)" << std::endl;
+      }
+
+      // Clients set the send rate; the profile's frame rate applies
+      // when none asked for one. Under the skip policy a frame whose
+      // slot has passed is not encoded.
+      int interval = pipeline->GetInterval();
+      pacer.SetPeriodNs(interval > 0 ? (igtlUint64) interval * 1000000ULL
+                                     : (igtlUint64) (1e9 / profile->fFrameRate));
+      if (!recording && pacer.ShouldSkip())
+      {
+        reader->Release(raw);
+        if (metrics)
+        {
+          metrics->m_FramesSkipped->Add();
+        }
+        continue;
+      }
+
+      // Steer by the backpressure of the slowest client. A lower bitrate
+      // shortens the frames still to come; a frame dropped here is never
+      // encoded, so no reference is missing, and its slot passes idle to
+      // let the queues drain. Without rate control (lossless) frames can
+      // only be dropped.
+      igtlUint64 delayNs = 0;
+      double drainRate = 0.0;
+      bool bitrateChanged = false;
+      pipeline->GetCongestion(MonotonicTimeNs(), delayNs, drainRate);
+      if (!rate.Update(MonotonicTimeNs(), delayNs, drainRate, bitrateChanged))
+      {
+        reader->Release(raw);
+        if (metrics)
+        {
+          metrics->m_RateDrops->Add();
+        }
+        pacer.DropFrame();
+        continue;
+      }
+      if (bitrateChanged && pEncParamExt.iRCMode != RC_OFF_MODE)
+      {
+        SBitrateInfo bitrate;
+        bitrate.iLayer = SPATIAL_LAYER_ALL;
+        bitrate.iBitrate = rate.GetBitrate();
+        encoder_->SetOption (ENCODER_OPTION_BITRATE, &bitrate);
+      }
+
+      // Planes are read straight from the mapped file
+      pic.pData[0]     = const_cast<unsigned char*>(raw->m_Data);
       pic.pData[1]     = pic.pData[0] + pEncParamExt.iPicWidth * pEncParamExt.iPicHeight;
       pic.pData[2]     = pic.pData[1] + (pEncParamExt.iPicWidth * pEncParamExt.iPicHeight >> 2);
-      int iFrameIdx =0;
-      while (fileStream.read (buf, frameSize) == frameSize)
+      // Milliseconds on the same clock as the FRAME_TIMING stamps, so the
+      // rate control sees the real spacing of the pictures
+      pic.uiTimeStamp = (long long)(captureTime / 1000000ULL);
+      // A new or lagging subscriber can only start decoding at an IDR
+      if (pipeline->TakeForceIDR(MonotonicTimeNs()))
       {
-        pic.uiTimeStamp = (long long)(iFrameIdx * (1000 / pEncParamExt.fMaxFrameRate));
-        iFrameIdx++;
-        int rv = encoder_->EncodeFrame (&pic, &info);
-        if(rv == cmResultSuccess)
+        encoder_->ForceIntraFrame(true);
+      }
+      igtlUint64 encodeStart = MonotonicTimeNs();
+      int rv = encoder_->EncodeFrame (&pic, &info);
+      igtlUint64 encodedTime = MonotonicTimeNs();
+      // The encoder has its own copy of the picture now
+      reader->Release(raw);
+      if(rv == cmResultSuccess && info.eFrameType != videoFrameTypeSkip)
+      {
+        // 1. contain SHA encryption, could be removed, 2. contain the digest message could be as CRC
+        UpdateHashFromFrame (info, &ctx);
+        if (metrics)
+        {
+          metrics->m_FramesEncoded->Add();
+          metrics->m_EncodedBytes->Add(info.iFrameSizeInBytes);
+          metrics->m_EncodeTime->Record(encodedTime - encodeStart);
+          metrics->m_EncoderBitrate->Set(rate.GetBitrate());
+          if (encoder_->GetOption (ENCODER_OPTION_GET_STATISTICS, &statistics) == cmResultSuccess)
+          {
+            metrics->m_EncoderQP->Set(statistics.uiAverageFrameQP);
+          }
+        }
+        //---------------
+        // The layers are copied once into the shared frame, since the
+        // encoder reuses its output buffer before slow clients have
+        // sent it. The CRC is computed on the same pass and the
+        // headers are written in front without packing a VideoMessage.
+        // The encoder's output is regrouped by spatial layer, so that
+        // each layer's parameter sets and slices lie together. When
+        // slices are streamed, every slice NAL ends a packet; parameter
+        // sets travel with the slice after them.
+        EncodedFrame::Pointer frame = pipeline->AcquireFrame(info.iFrameSizeInBytes);
+        if (frame.IsNull())
         {
-          // 1. contain SHA encryption, could be removed, 2. contain the digest message could be as CRC
-          UpdateHashFromFrame (info, &ctx);
-          //---------------
-          igtl::VideoMessage::Pointer videoMsg;
-          videoMsg = igtl::VideoMessage::New();
-          videoMsg->SetDeviceName("Video");
-          videoMsg->SetBitStreamSize(info.iFrameSizeInBytes);
-          videoMsg->AllocateScalars();
-          videoMsg->SetScalarType(videoMsg->TYPE_UINT32);
-          videoMsg->SetEndian(igtl_is_little_endian()==true?2:1); //little endian is 2 big endian is 1
-          videoMsg->SetWidth(pic.iPicWidth);
-          videoMsg->SetHeight(pic.iPicHeight);
-          int frameSize = 0;
-          int layerSize = 0;
+          continue;
+        }
+        unsigned char* bitStream = frame->GetBitStream();
+        int frameSize = 0;
+        int temporalId = 0;
+        for (int s = 0; s < pEncParamExt.iSpatialLayerNum; ++s) {
+          packetEnds.clear();
+          int spatialOffset = frameSize;
           for (int i = 0; i < info.iLayerNum; ++i) {
             const SLayerBSInfo& layerInfo = info.sLayerInfo[i];
-            layerSize = 0;
+            if (layerInfo.uiSpatialId != s)
+            {
+              continue;
+            }
+            const unsigned char* pNal = layerInfo.pBsBuf;
             for (int j = 0; j < layerInfo.iNalCount; ++j)
             {
+              memcpy (bitStream + frameSize, pNal, layerInfo.pNalLengthInByte[j]);
+              pNal += layerInfo.pNalLengthInByte[j];
               frameSize += layerInfo.pNalLengthInByte[j];
-              layerSize += layerInfo.pNalLengthInByte[j];
+              if (sliceStreaming && layerInfo.uiLayerType == VIDEO_CODING_LAYER)
+              {
+                packetEnds.push_back(frameSize);
+              }
             }
-            for (int i = 0; i < layerSize ; i++)
+            if (layerInfo.uiLayerType == VIDEO_CODING_LAYER)
             {
-              videoMsg->GetPackFragmentPointer(2)[frameSize-layerSize+i] = layerInfo.pBsBuf[i];
+              temporalId = layerInfo.uiTemporalId;
             }
-            
           }
-          videoMsg->Pack();
-          glock->Lock();
-          
-          for (int i = 0; i < videoMsg->GetNumberOfPackFragments(); i ++)
+          if (frameSize > spatialOffset && (packetEnds.empty() || packetEnds.back() < frameSize))
           {
-            socket->Send(videoMsg->GetPackFragmentPointer(i), videoMsg->GetPackFragmentSize(i));
+            if (!packetEnds.empty())
+              packetEnds.pop_back();
+            packetEnds.push_back(frameSize);
           }
-          glock->Unlock();
-          igtl::Sleep(interval);
+          frame->ClearPackets(s);
+          int packetStart = spatialOffset;
+          for (size_t k = 0; k < packetEnds.size(); ++k)
+          {
+            // All but the last packet of an access unit are slices
+            VideoFramePacker& packer = k + 1 < packetEnds.size() ? slicePackers[s] : packers[s];
+            packer.Begin();
+            packer.Update (bitStream + packetStart, packetEnds[k] - packetStart);
+            packer.End(frame->AddPacket(s, packetStart, packetEnds[k] - packetStart));
+            packetStart = packetEnds[k];
+          }
+          frame->SetLayerBitrate(s, pEncParamExt.sSpatialLayers[s].iSpatialBitrate);
         }
+        frame->SetNumberOfLayers(pEncParamExt.iSpatialLayerNum);
+        frame->SetBitStreamSize(frameSize);
+        frame->SetTemporalLayer(temporalId, pEncParamExt.iTemporalLayerNum > 0 ? pEncParamExt.iTemporalLayerNum : 1);
+        frame->SetInterval(interval > 0 ? interval : (int) (1000 / profile->fFrameRate));
+        frame->SetFrameType(info.eFrameType);
+        frame->SetFrameIndex(uiFrameCount++);
+        frame->SetCaptureTime(captureTime);
+        frame->SetEncodedTime(encodedTime);
+
+        if (recording)
+        {
+          // Presentation times at the profile's frame rate
+          pipeline->RecordFrame(frame, (igtlUint64) (frame->GetFrameIndex() * 1e9 / profile->fFrameRate));
+          continue;
+        }
+        // Hold the encoded frame until its deadline, then hand it to the
+        // senders. Deadlines are absolute, so the time spent encoding is
+        // not added to the period.
+        pacer.WaitForDeadline();
+        pipeline->Broadcast(frame);
       }
-      free (buf);
-      unsigned char digest[SHA_DIGEST_LENGTH];
-      SHA1Result(&ctx, digest);
-      CompareHash (digest, kFileParamArray.pkcHashStr);
-      //------------------------------------------------------------
-      // Loop
     }
+    reader->Stop();
   }
   WelsDestroySVCEncoder(encoder_);
   return NULL;
 }
-